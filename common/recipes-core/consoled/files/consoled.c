@@ -29,7 +29,12 @@
 #include <poll.h>
 #include <termios.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <zlib.h>
 #include <openbmc/pal.h>
 
 #define BAUDRATE      B57600
@@ -37,6 +42,37 @@
 #define ASCII_ENTER   0x0D
 #define MAX_LOGFILE_LINES 1200 // Maximum lines based on carriage returns or new line
 #define MAX_LOGFILE_SIZE 102400 // 100KB size => 1200 lines of 80 characters each = ~108000B
+#define DEF_RETAIN_SEGMENTS 8   // Compressed segments kept of the rotated log
+
+// Console data is collected in a ring, and written to the log file once
+// FLUSH_SIZE bytes are pending or FLUSH_MS after the oldest pending byte.
+// Tail clients read straight from the ring.
+#define RING_SIZE     (64 * 1024)
+#define FLUSH_SIZE    (16 * 1024)
+#define FLUSH_MS      1000
+#define MAX_CLIENTS   4
+#define SOCK_PATH     "/var/run/consoled_%s.sock"
+
+typedef struct {
+  char buf[RING_SIZE];
+  uint64_t head;      // bytes ever written to the ring
+  uint64_t flushed;   // bytes written to the log file
+  int64_t pending_ms; // when the oldest unflushed byte came in
+} console_ring_t;
+
+typedef struct {
+  int fd;
+  uint64_t pos;       // next ring byte to send
+} tail_client_t;
+
+typedef struct {
+  char fname[64];     // live log file
+  int fd;
+  int lines;          // lines in the live log file
+  int size;           // bytes in the live log file
+  int retain;         // compressed segments kept
+} console_log_t;
+
 static sig_atomic_t sigexit = 0;
 
 static void
@@ -58,6 +94,160 @@ write_data(int file, char *buf, int len, char *fname) {
   }
 }
 
+static int64_t
+now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+ring_put(console_ring_t *ring, char *buf, int len) {
+  int off = ring->head % RING_SIZE;
+  int n = (len < RING_SIZE - off) ? len : RING_SIZE - off;
+
+  memcpy(&ring->buf[off], buf, n);
+  memcpy(ring->buf, buf + n, len - n);
+  if (ring->head == ring->flushed) {
+    ring->pending_ms = now_ms();
+  }
+  ring->head += len;
+}
+
+// Pointer to and length of the contiguous ring data starting at pos
+static int
+ring_span(console_ring_t *ring, uint64_t pos, char **data) {
+  int off = pos % RING_SIZE;
+  uint64_t len = ring->head - pos;
+
+  *data = &ring->buf[off];
+  return (len < RING_SIZE - off) ? len : RING_SIZE - off;
+}
+
+// Compress the log file in to segment 1, shifting the older segments up
+// and dropping the ones beyond the retention.
+static void
+rotate_log(console_log_t *log) {
+  char src[80], dst[80], seg[80];
+  char buf[4096];
+  gzFile gz;
+  int n, i;
+
+  snprintf(seg, sizeof(seg), "%s.%d.gz", log->fname, log->retain);
+  remove(seg);
+  for (i = log->retain - 1; i >= 1; i--) {
+    snprintf(src, sizeof(src), "%s.%d.gz", log->fname, i);
+    snprintf(dst, sizeof(dst), "%s.%d.gz", log->fname, i + 1);
+    rename(src, dst);
+  }
+
+  snprintf(seg, sizeof(seg), "%s.1.gz", log->fname);
+  gz = gzopen(seg, "wb");
+  if (gz == NULL) {
+    syslog(LOG_WARNING, "Cannot create the file %s", seg);
+  } else {
+    lseek(log->fd, 0, SEEK_SET);
+    while ((n = read(log->fd, buf, sizeof(buf))) > 0) {
+      gzwrite(gz, buf, n);
+    }
+    gzclose(gz);
+  }
+
+  if (ftruncate(log->fd, 0)) {
+    syslog(LOG_WARNING, "Cannot truncate the file %s", log->fname);
+  }
+  log->size = 0;
+  log->lines = 0;
+}
+
+// Write the pending ring data to the log file
+static void
+flush_log(console_ring_t *ring, console_log_t *log) {
+  char *data;
+  int len;
+
+  while (ring->flushed < ring->head) {
+    len = ring_span(ring, ring->flushed, &data);
+    write_data(log->fd, data, len, log->fname);
+    ring->flushed += len;
+    log->size += len;
+  }
+
+  /* Log Rotation based on max number of lines or max file size */
+  if (log->lines >= MAX_LOGFILE_LINES || log->size >= MAX_LOGFILE_SIZE) {
+    rotate_log(log);
+  }
+}
+
+// Send what a tail client has not seen yet. Returns -1 if the client
+// has to be dropped.
+static int
+tail_send(console_ring_t *ring, tail_client_t *cli) {
+  char *data;
+  int len, n;
+
+  // A client which fell behind by more than the ring skips ahead
+  if (ring->head - cli->pos > RING_SIZE) {
+    cli->pos = ring->head - RING_SIZE;
+  }
+  while (cli->pos < ring->head) {
+    len = ring_span(ring, cli->pos, &data);
+    n = send(cli->fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0) {
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    cli->pos += n;
+  }
+  return 0;
+}
+
+static int
+tail_listen(char *fru_name) {
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), SOCK_PATH, fru_name);
+  unlink(addr.sun_path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(fd, MAX_CLIENTS)) {
+    syslog(LOG_WARNING, "Cannot listen on %s", addr.sun_path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Print the console ring of a running consoled, then follow it
+static int
+run_tail(char *fru_name) {
+  struct sockaddr_un addr;
+  char buf[1024];
+  int fd, n;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), SOCK_PATH, fru_name);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    printf("consoled %s is not running\n", fru_name);
+    return -1;
+  }
+  while (!sigexit && (n = read(fd, buf, sizeof(buf))) > 0) {
+    write_data(STDOUT_FILENO, buf, n, "STDOUT_FILENO");
+  }
+  close(fd);
+  return 0;
+}
+
 static void
 exit_session(int sig)
 {
@@ -66,40 +256,41 @@ exit_session(int sig)
 
 static void
 print_usage() {
-  printf("Usage: consoled [ %s ]\n", pal_server_list);
+  printf("Usage: consoled [ %s ] [ --buffer | --term ] [ --retain <segments> ]\n",
+         pal_server_list);
+  printf("       consoled [ %s ] --tail\n", pal_server_list);
 }
 
 static void
-run_console(char* fru_name, int term) {
+run_console(char* fru_name, int term, int retain) {
 
   int i;
   int tty;    // serial port
-  int buf_fd;  // Buffer File
   int blen;   // len for
   int nfd = 0;      // For number of fd
   int nevents;      // For number of events in fd
-  int nline = 0;
-  //int pid_fd;
+  int timeout;
+  int lfd;          // For the tail socket
   int flags;
-  pid_t pid;        // For pid of the daemon
   uint8_t fru;
   char in;          // For stdin character
-  char data[32];
   char pid_file[64];
   char devtty[32];  // For tty dev path
-  char bfname[32];  // For buffer file path
-  char old_bfname[32];  // For old buffer file path
   char buf[256];    // For buffer data
   struct termios ottytio, nttytio;  // For the tty dev
+  static console_ring_t ring;
+  console_log_t log;
+  tail_client_t cli[MAX_CLIENTS];
+  int ncli = 0, cbase;
+  int quit = 0;
 
   int stdi;    // STDIN_FILENO
   int stdo; // STDOUT_FILENO
   struct termios ostditio, nstditio;  // For STDIN_FILENO
   struct termios ostdotio, nstdotio;  // For STDOUT_FILENO
 
-  struct stat buf_stat;
-
-  struct pollfd pfd[2];
+  // tty, stdin, tail socket and tail clients
+  struct pollfd pfd[3 + MAX_CLIENTS];
 
   /* Start Daemon for the console buffering */
   if (!term) {
@@ -145,12 +336,14 @@ run_console(char* fru_name, int term) {
   nfd++;
 
   /* Buffering the console data into a file */
-  sprintf(old_bfname, "/tmp/consoled_%s_log-old", fru_name);
-  sprintf(bfname, "/tmp/consoled_%s_log", fru_name);
-  if ((buf_fd = open(bfname, O_RDWR | O_APPEND | O_CREAT, 0666)) < 0) {
-    syslog(LOG_WARNING, "Cannot open the file %s", bfname);
+  memset(&log, 0, sizeof(log));
+  snprintf(log.fname, sizeof(log.fname), "/tmp/consoled_%s_log", fru_name);
+  log.retain = retain;
+  if ((log.fd = open(log.fname, O_RDWR | O_APPEND | O_CREAT, 0666)) < 0) {
+    syslog(LOG_WARNING, "Cannot open the file %s", log.fname);
     exit(-1);
   }
+  log.size = lseek(log.fd, 0, SEEK_END);
 
   if (term) {
     /* Changing the attributes of STDIN_FILENO */
@@ -168,70 +361,130 @@ run_console(char* fru_name, int term) {
     cfmakeraw(&nstdotio);
     tcflush(stdo, TCIFLUSH);
     tcsetattr(stdo, TCSANOW, &nstdotio);
-
-    /* Adding STDIN_FILENO to the poll fd set */
-    pfd[1].fd = stdi;
-    pfd[1].events = POLLIN;
-    nfd++;
   }
 
+  lfd = tail_listen(fru_name);
+
   /* Handling the input event from the  terminal and tty dev */
-  while (!sigexit && (nevents = poll(pfd, nfd, -1 /* Timeout */))) {
+  while (!sigexit && !quit) {
 
-    /* Input to the terminal from the user */
-    if (term && nevents && nfd > 1 && pfd[1].revents > 0) {
-      blen = read(stdi, &in, sizeof(in));
-      if (blen < 1) {
-        nfd--;
-      }
+    /* Poll set: tty, stdin while it is open, tail socket, tail clients */
+    nfd = 1;
+    if (term && stdi >= 0) {
+      pfd[nfd].fd = stdi;
+      pfd[nfd++].events = POLLIN;
+    }
+    if (lfd >= 0 && ncli < MAX_CLIENTS) {
+      pfd[nfd].fd = lfd;
+      pfd[nfd++].events = POLLIN;
+    }
+    cbase = nfd;
+    for (i = 0; i < ncli; i++) {
+      pfd[nfd].fd = cli[i].fd;
+      pfd[nfd++].events = (cli[i].pos < ring.head) ? POLLOUT : 0;
+    }
 
-      if (in == CTRL_X) {
-        break;
+    timeout = -1;
+    if (ring.flushed < ring.head) {
+      timeout = ring.pending_ms + FLUSH_MS - now_ms();
+      if (timeout < 0) {
+        timeout = 0;
       }
+    }
 
-      write_data(tty, &in, sizeof(in), "tty");
-
-      nevents--;
+    nevents = poll(pfd, nfd, timeout);
+    if (nevents < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
     }
 
     /* Input from the tty dev */
-    if (nevents && pfd[0].revents > 0) {
+    if (pfd[0].revents > 0) {
       blen = read(tty, buf, sizeof(buf));
       if (blen > 0) {
         for (i = 0; i < blen; i++) {
           if (buf[i] == 0xD || buf[i] == 0xA)
-            nline++;
+            log.lines++;
         }
-        write_data(buf_fd, buf, blen, bfname);
-        fsync(buf_fd);
+        ring_put(&ring, buf, blen);
         if (term) {
           write_data(stdo, buf, blen, "STDOUT_FILENO");
         }
       } else if (blen < 0) {
         raise(SIGHUP);
       }
+    }
+
+    /* Flush on size, or once the oldest pending data is old enough */
+    if (ring.head - ring.flushed >= FLUSH_SIZE ||
+        (ring.flushed < ring.head && now_ms() - ring.pending_ms >= FLUSH_MS)) {
+      flush_log(&ring, &log);
+    }
+
+    /* Drop the tail clients which hung up; these are reported even when
+       nothing was asked for, and would keep poll() from waiting. Going
+       backwards, the client moved in to a freed slot was seen already. */
+    for (i = ncli - 1; i >= 0; i--) {
+      if (pfd[cbase + i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+        close(cli[i].fd);
+        cli[i] = cli[--ncli];
+      }
+    }
 
-      // Get File stat information
-      memset(&buf_stat, 0, sizeof(struct stat));
-      fstat(buf_fd, &buf_stat);
-
-      /* Log Rotation based on max number of lines or max file size */
-      if (nline >= MAX_LOGFILE_LINES || buf_stat.st_size >= MAX_LOGFILE_SIZE) {
-        close(buf_fd);
-        remove(old_bfname);
-        rename(bfname, old_bfname);
-        if ((buf_fd = open(bfname, O_RDWR | O_APPEND | O_CREAT, 0666)) < 0) {
-          syslog(LOG_WARNING, "Cannot open the file %s", bfname);
-          exit(-1);
+    for (i = 1; i < cbase; i++) {
+      /* Input to the terminal from the user */
+      if (term && pfd[i].fd == stdi && pfd[i].revents > 0) {
+        blen = read(stdi, &in, sizeof(in));
+        if (blen < 1) {
+          stdi = -1;
+          continue;
+        }
+
+        if (in == CTRL_X) {
+          quit = 1;
+          break;
+        }
+
+        write_data(tty, &in, sizeof(in), "tty");
+      }
+
+      /* A new tail client gets the whole ring first */
+      if (pfd[i].fd == lfd && (pfd[i].revents & POLLIN)) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd >= 0) {
+          fcntl(fd, F_SETFL, O_NONBLOCK);
+          cli[ncli].fd = fd;
+          cli[ncli].pos = (ring.head > RING_SIZE) ? ring.head - RING_SIZE : 0;
+          ncli++;
         }
-        nline = 0;
       }
-      nevents--;
+    }
+
+    /* Feed the tail clients, dropping the ones that went away */
+    for (i = 0; i < ncli; ) {
+      if (tail_send(&ring, &cli[i])) {
+        close(cli[i].fd);
+        cli[i] = cli[--ncli];
+        continue;
+      }
+      i++;
     }
   }
 
   /* Close the console buffer file */
-  close(buf_fd);
+  flush_log(&ring, &log);
+  close(log.fd);
+
+  for (i = 0; i < ncli; i++) {
+    close(cli[i].fd);
+  }
+  if (lfd >= 0) {
+    snprintf(buf, sizeof(buf), SOCK_PATH, fru_name);
+    close(lfd);
+    unlink(buf);
+  }
 
   /* Revert the tty dev to old attributes */
   tcflush(tty, TCIFLUSH);
@@ -241,8 +494,8 @@ run_console(char* fru_name, int term) {
   if (term) {
     tcflush(stdo, TCIFLUSH);
     tcsetattr(stdo, TCSANOW, &ostdotio);
-    tcflush(stdi, TCIFLUSH);
-    tcsetattr(stdi, TCSANOW, &ostditio);
+    tcflush(STDIN_FILENO, TCIFLUSH);
+    tcsetattr(STDIN_FILENO, TCSANOW, &ostditio);
   }
 
   /* Delete the pid file */
@@ -255,9 +508,22 @@ main(int argc, void **argv) {
   int dev, rc, lock_file;
   char file[64];
   int term;
+  int retain = DEF_RETAIN_SEGMENTS;
   char *fru_name;
 
-  if (argc != 3) {
+  if (argc == 3 && !strcmp(argv[2], "--tail")) {
+    signal(SIGINT, exit_session);
+    signal(SIGTERM, exit_session);
+    return run_tail(argv[1]) ? 1 : 0;
+  }
+
+  if (argc == 5 && !strcmp(argv[3], "--retain")) {
+    retain = atoi(argv[4]);
+  } else if (argc != 3) {
+    print_usage();
+    exit(1);
+  }
+  if (retain < 1) {
     print_usage();
     exit(1);
   }
@@ -284,9 +550,8 @@ main(int argc, void **argv) {
       exit(-1);
     }
 
-    run_console(fru_name, term);
+    run_console(fru_name, term, retain);
   }
 
   return sigexit;
 }
-
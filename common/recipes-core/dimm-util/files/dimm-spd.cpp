@@ -0,0 +1,340 @@
+/*
+ *
+ * Copyright 2020-present Facebook. All Rights Reserved.
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <openbmc/kv.h>
+#include "dimm-util.h"
+
+// #define DEBUG_DIMM_UTIL
+
+#ifdef DEBUG_DIMM_UTIL
+  #define DBG_PRINT(fmt, args...) printf(fmt, ##args)
+#else
+  #define DBG_PRINT(fmt, args...)
+#endif
+
+// DIMM identity cache, one persistent key per DIMM, refreshed when the
+// presence or serial of a DIMM changes
+#define SPD_CACHE_KEY "dimm_spd/fru%d_dimm%d"
+
+// bytes asked of util_read_spd_block() at a time
+#define SPD_BLOCK_LEN 32
+
+// one SPD bus: its DIMMs are read in turn, as they share the EE page
+typedef struct {
+  uint8_t fru_id;
+  uint8_t cpu;
+  int bus;
+  uint8_t num;
+  uint8_t dimm[MAX_DIMM_PER_CPU];
+  // info reads
+  dimm_spd_t *spd[MAX_DIMM_PER_CPU];
+  bool check[MAX_DIMM_PER_CPU];   // cached, only confirm the serial
+  bool changed[MAX_DIMM_PER_CPU];
+  // raw reads
+  uint8_t (*raw[MAX_DIMM_PER_CPU])[SPD_PAGE_LEN];
+} spd_bus_t;
+
+// read several bytes off SPD bus in one transaction,
+// default: not supported, read byte by byte
+int __attribute__((weak))
+util_read_spd_block(uint8_t fru_id, uint8_t cpu, uint8_t dimm, uint8_t offset,
+                    uint8_t len, uint8_t *buf)
+{
+  return -1;
+}
+
+// default: a single SPD bus per CPU
+int __attribute__((weak))
+util_get_spd_bus(uint8_t cpu, uint8_t dimm)
+{
+  return 0;
+}
+
+// read multiple bytes of SPD (offset, len),  with retry on failure
+//
+// input
+//      fru_id, dimm, offset, len
+//      early_exit_cnt - value
+//            if more than early_exit_cnt  number of 0 are read,
+//                 do not read whole length and exit
+//            0 to disable this check
+//
+// output returned in buf
+// also returns a special flag  "present"
+//         1 - if buf contains non zero
+//         0 - if all data in buf are 0
+static int
+util_read_spd_with_retry(uint8_t fru_id, uint8_t cpu, uint8_t dimm, uint16_t offset, uint16_t len,
+                  uint16_t early_exit_cnt, uint8_t *buf, uint8_t *present) {
+  uint16_t j, fail_cnt = 0;
+  uint8_t retry = 0;
+  int value = 0;
+
+  *present = 0;
+  for (j = 0; j < len; ++j) {
+    // platforms with multi-byte reads take whole blocks at once
+    value = util_read_spd_block(fru_id, cpu, dimm, offset + j,
+                                len - j < SPD_BLOCK_LEN ? len - j : SPD_BLOCK_LEN,
+                                buf + j);
+    if (value > 0) {
+      *present = 1;
+      j += value - 1;
+      continue;
+    }
+    retry = 0;
+    while (retry < MAX_RETRY) {
+      value = util_read_spd_byte(fru_id, cpu, dimm, offset + j);
+      if (value >= 0)
+        break;
+      retry++;
+    }
+    if (value >= 0) {
+      buf[j] = value;
+      *present = 1;
+    } else {
+      // only consider early exit if it's non-0
+      if (early_exit_cnt) {
+        fail_cnt ++;
+        if (fail_cnt == early_exit_cnt) {
+          *present = 0;
+          return -1;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+// Page 1 is selected first so that the serial of the cached DIMMs can
+// be confirmed; the others are then read page by page, which saves an
+// EE page switch per DIMM.
+static void *
+spd_info_worker(void *arg) {
+  spd_bus_t *b = (spd_bus_t *)arg;
+  uint8_t serial[LEN_SERIAL];
+  uint8_t present;
+  bool check = false, changed = false, p1 = false;
+  int i;
+
+  for (i = 0; i < b->num; i++)
+    check |= b->check[i];
+  if (check)
+    util_set_EE_page(b->fru_id, b->cpu, b->dimm[0], 1);
+  for (i = 0; i < b->num; i++) {
+    if (!b->check[i])
+      continue;
+    memset(serial, 0, sizeof(serial));
+    util_read_spd_with_retry(b->fru_id, b->cpu, b->dimm[i], OFFSET_SERIAL,
+      LEN_SERIAL, MAX_FAIL_CNT, serial, &present);
+    if (present == b->spd[i]->present &&
+        (!present || !memcmp(serial, b->spd[i]->p1 + SPD_SERIAL_OFFSET, LEN_SERIAL)))
+      continue;
+    DBG_PRINT("cpu %d dimm %d changed\n", b->cpu, b->dimm[i]);
+    b->changed[i] = true;
+  }
+
+  for (i = 0; i < b->num; i++)
+    changed |= b->changed[i];
+  if (!changed)
+    return NULL;
+  util_set_EE_page(b->fru_id, b->cpu, b->dimm[0], 0);
+  for (i = 0; i < b->num; i++) {
+    if (!b->changed[i])
+      continue;
+    memset(b->spd[i], 0, sizeof(dimm_spd_t));
+    util_read_spd_with_retry(b->fru_id, b->cpu, b->dimm[i], SPD_P0_OFFSET,
+      SPD_P0_LEN, MAX_FAIL_CNT, b->spd[i]->p0, &b->spd[i]->present);
+    p1 |= b->spd[i]->present;
+  }
+
+  if (!p1)
+    return NULL;
+  util_set_EE_page(b->fru_id, b->cpu, b->dimm[0], 1);
+  for (i = 0; i < b->num; i++) {
+    if (!b->changed[i] || !b->spd[i]->present)
+      continue;
+    util_read_spd_with_retry(b->fru_id, b->cpu, b->dimm[i], SPD_P1_OFFSET,
+      SPD_P1_LEN, 0, b->spd[i]->p1, &b->spd[i]->present);
+  }
+  return NULL;
+}
+
+static void *
+spd_raw_worker(void *arg) {
+  spd_bus_t *b = (spd_bus_t *)arg;
+  uint8_t page, present;
+  int i;
+
+  for (page = 0; page < SPD_NUM_PAGES; page++) {
+    util_set_EE_page(b->fru_id, b->cpu, b->dimm[0], page);
+    for (i = 0; i < b->num; i++) {
+      util_read_spd_with_retry(b->fru_id, b->cpu, b->dimm[i], 0,
+        SPD_PAGE_LEN, 0, b->raw[i][page], &present);
+    }
+  }
+  return NULL;
+}
+
+// Split the selected DIMMs by SPD bus
+static int
+spd_group_buses(uint8_t fru_id, uint8_t dimm, spd_bus_t *buses) {
+  uint8_t cpu, i, startCPU, endCPU, startDimm, endDimm;
+  int n = 0, k;
+
+  set_dimm_loop(dimm, &startCPU, &endCPU, &startDimm, &endDimm);
+  for (cpu = startCPU; cpu < endCPU; cpu++) {
+    for (i = startDimm; i < endDimm; ++i) {
+      int bus = util_get_spd_bus(cpu, i);
+      for (k = 0; k < n; k++) {
+        if (buses[k].cpu == cpu && buses[k].bus == bus)
+          break;
+      }
+      if (k == n) {
+        memset(&buses[n], 0, sizeof(spd_bus_t));
+        buses[n].fru_id = fru_id;
+        buses[n].cpu = cpu;
+        buses[n].bus = bus;
+        n++;
+      }
+      buses[k].dimm[buses[k].num++] = i;
+    }
+  }
+  return n;
+}
+
+// Run worker on every bus, one thread per bus
+static void
+spd_run_buses(spd_bus_t **buses, int n, void *(*worker)(void *)) {
+  pthread_t tid[MAX_CPU_NUM * MAX_DIMM_PER_CPU];
+  bool started[MAX_CPU_NUM * MAX_DIMM_PER_CPU] = {false};
+  int k;
+
+  for (k = 0; k < n; k++) {
+    // the last bus runs on this thread
+    if (k == n - 1 || pthread_create(&tid[k], NULL, worker, buses[k]) != 0)
+      worker(buses[k]);
+    else
+      started[k] = true;
+  }
+  for (k = 0; k < n; k++) {
+    if (started[k])
+      pthread_join(tid[k], NULL);
+  }
+}
+
+static void
+spd_cache_key(char *key, uint8_t fru_id, uint8_t cpu, uint8_t dimm) {
+  snprintf(key, MAX_KEY_LEN, SPD_CACHE_KEY, fru_id, cpu * num_dimms_per_cpu + dimm);
+}
+
+// Identity bytes of the selected DIMMs. Only the serial of a cached
+// DIMM is read, the whole identity again if its presence or serial
+// changed (DIMM swapped while the host was off).
+int
+spd_get_info(uint8_t fru_id, uint8_t dimm,
+             dimm_spd_t spd[MAX_CPU_NUM][MAX_DIMM_PER_CPU]) {
+  spd_bus_t buses[MAX_CPU_NUM * MAX_DIMM_PER_CPU];
+  char keys[MAX_CPU_NUM * MAX_DIMM_PER_CPU][MAX_KEY_LEN];
+  char values[MAX_CPU_NUM * MAX_DIMM_PER_CPU][MAX_VALUE_LEN];
+  kv_pair_t pairs[MAX_CPU_NUM * MAX_DIMM_PER_CPU];
+  spd_bus_t *run[MAX_CPU_NUM * MAX_DIMM_PER_CPU];
+  int n, k, i, np = 0, nrun = 0;
+  bool any_present = false;
+
+  n = spd_group_buses(fru_id, dimm, buses);
+
+  // one pass over the cache for all DIMMs
+  for (k = 0; k < n; k++) {
+    for (i = 0; i < buses[k].num; i++) {
+      spd_cache_key(keys[np], fru_id, buses[k].cpu, buses[k].dimm[i]);
+      pairs[np].key = keys[np];
+      pairs[np].value = values[np];
+      np++;
+    }
+  }
+  kv_get_multi(pairs, np, KV_FPERSIST);
+
+  np = 0;
+  for (k = 0; k < n; k++) {
+    spd_bus_t *b = &buses[k];
+    bool busy = false;
+    for (i = 0; i < b->num; i++, np++) {
+      b->spd[i] = &spd[b->cpu][b->dimm[i]];
+      if (pairs[np].status == 0 && pairs[np].len == sizeof(dimm_spd_t)) {
+        memcpy(b->spd[i], values[np], sizeof(dimm_spd_t));
+        b->check[i] = true;
+      } else {
+        b->changed[i] = true;
+      }
+      busy |= b->check[i] || b->changed[i];
+    }
+    if (busy)
+      run[nrun++] = b;
+  }
+
+  spd_run_buses(run, nrun, spd_info_worker);
+
+  // Store what was read, in a single write. Absent DIMMs are only
+  // stored if some DIMM answered: with none, the SPD bus itself may
+  // have been unreachable.
+  for (k = 0; k < n; k++) {
+    for (i = 0; i < buses[k].num; i++)
+      any_present |= buses[k].spd[i]->present;
+  }
+  np = 0;
+  for (k = 0; k < n; k++) {
+    for (i = 0; i < buses[k].num; i++) {
+      if (!buses[k].changed[i] || !(buses[k].spd[i]->present || any_present))
+        continue;
+      spd_cache_key(keys[np], fru_id, buses[k].cpu, buses[k].dimm[i]);
+      pairs[np].key = keys[np];
+      pairs[np].value = (char *)buses[k].spd[i];
+      pairs[np].len = sizeof(dimm_spd_t);
+      np++;
+    }
+  }
+  if (np > 0 && kv_set_multi(pairs, np, KV_FPERSIST) != 0)
+    DBG_PRINT("failed to cache the SPD of fru %d\n", fru_id);
+
+  return 0;
+}
+
+// Both SPD pages of the selected DIMMs, always read from the DIMMs
+int
+spd_get_raw(uint8_t fru_id, uint8_t dimm,
+            uint8_t raw[MAX_CPU_NUM][MAX_DIMM_PER_CPU][SPD_NUM_PAGES][SPD_PAGE_LEN]) {
+  spd_bus_t buses[MAX_CPU_NUM * MAX_DIMM_PER_CPU];
+  spd_bus_t *run[MAX_CPU_NUM * MAX_DIMM_PER_CPU];
+  int n, k, i;
+
+  n = spd_group_buses(fru_id, dimm, buses);
+  for (k = 0; k < n; k++) {
+    for (i = 0; i < buses[k].num; i++)
+      buses[k].raw[i] = raw[buses[k].cpu][buses[k].dimm[i]];
+    run[k] = &buses[k];
+  }
+  spd_run_buses(run, n, spd_raw_worker);
+  return 0;
+}
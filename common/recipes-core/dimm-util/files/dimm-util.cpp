@@ -146,54 +146,6 @@ get_dimm_label(uint8_t cpu, uint8_t dimm)
   return "N/A";
 }
 
-// read multiple bytes of SPD (offset, len),  with retry on failure
-//
-// input
-//      fru_id, dimm, offset, len
-//      early_exit_cnt - value
-//            if more than early_exit_cnt  number of 0 are read,
-//                 do not read whole length and exit
-//            0 to disable this check
-//
-// output returned in buf
-// also returns a special flag  "present"
-//         1 - if buf contains non zero
-//         0 - if all data in buf are 0
-static int
-util_read_spd_with_retry(uint8_t fru_id, uint8_t cpu, uint8_t dimm, uint16_t offset, uint16_t len,
-                  uint16_t early_exit_cnt, uint8_t *buf, uint8_t *present) {
-  uint16_t j, fail_cnt = 0;
-  uint8_t retry = 0;
-  int value = 0;
-
-  *present = 0;
-  for (j = 0; j < len; ++j) {
-    retry = 0;
-    while (retry < MAX_RETRY) {
-      value = util_read_spd_byte(fru_id, cpu, dimm, offset + j);
-      if (value >= 0)
-        break;
-      retry++;
-    }
-    if (value >= 0) {
-      buf[j] = value;
-      *present = 1;
-    } else {
-      // only consider early exit if it's non-0
-      if (early_exit_cnt) {
-        fail_cnt ++;
-        if (fail_cnt == early_exit_cnt) {
-          *present = 0;
-          return -1;
-        }
-      }
-    }
-  }
-
-  return 0;
-}
-
-
 // convert system dimm number to  (cpu, dimm) pair
 //     eg.   on a 2-socket system with 24 dimms (0-23)
 //               dimms 0-11 would be on cpu 0
@@ -202,7 +154,7 @@ util_read_spd_with_retry(uint8_t fru_id, uint8_t cpu, uint8_t dimm, uint16_t off
 //
 //    Special case if user specify max dimm (e.g. 24),
 //       then loop through all CPUs and dimms
-static void
+void
 set_dimm_loop(uint8_t dimm, uint8_t *startCPU, uint8_t *endCPU,
               uint8_t *startDimm, uint8_t *endDimm) {
   if (dimm == total_dimms) {
@@ -225,7 +177,7 @@ set_dimm_loop(uint8_t dimm, uint8_t *startCPU, uint8_t *endCPU,
 static int
 util_get_serial(uint8_t fru_id, uint8_t dimm, bool json) {
   uint8_t i, j, cpu, startCPU, endCPU, startDimm, endDimm, dimm_present = 0;
-  uint8_t dimm_serial[MAX_CPU_NUM][MAX_DIMM_PER_CPU][LEN_SERIAL] = {0};
+  dimm_spd_t spd[MAX_CPU_NUM][MAX_DIMM_PER_CPU] = {0};
   json_t *config_arr = NULL;
   char   sn[LEN_SERIAL_STRING] = {0};
 
@@ -237,16 +189,15 @@ util_get_serial(uint8_t fru_id, uint8_t dimm, bool json) {
     printf("FRU: %s\n", fru_name[fru_id - 1]);
   }
 
+  spd_get_info(fru_id, dimm, spd);
   set_dimm_loop(dimm, &startCPU, &endCPU, &startDimm, &endDimm);
   for (cpu = startCPU; cpu < endCPU; cpu++) {
     for (i = startDimm; i < endDimm; ++i) {
-      util_set_EE_page(fru_id, cpu, i, 1);
-      util_read_spd_with_retry(fru_id, cpu, i, OFFSET_SERIAL, LEN_SERIAL, 0,
-        dimm_serial[cpu][i], &dimm_present);
-
+      dimm_present = spd[cpu][i].present;
       if (dimm_present)
           for (j = 0; j < LEN_SERIAL; ++j)
-            snprintf(sn + (2 * j), LEN_SERIAL_STRING - (2 * j), "%02X", dimm_serial[cpu][i][j]);
+            snprintf(sn + (2 * j), LEN_SERIAL_STRING - (2 * j), "%02X",
+              spd[cpu][i].p1[SPD_SERIAL_OFFSET + j]);
 
       if (json) {
         json_t *sn_obj = json_object();
@@ -290,7 +241,7 @@ err_exit:
 static int
 util_get_part(uint8_t fru_id, uint8_t dimm, bool json) {
   uint8_t i, j, cpu, startCPU, endCPU, startDimm, endDimm, dimm_present = 0;
-  uint8_t dimm_part[MAX_CPU_NUM][MAX_DIMM_PER_CPU][LEN_PART_NUMBER] = {0};
+  dimm_spd_t spd[MAX_CPU_NUM][MAX_DIMM_PER_CPU] = {0};
   json_t *config_arr = NULL;
   char   pn[LEN_PN_STRING] = {0};
 
@@ -302,16 +253,14 @@ util_get_part(uint8_t fru_id, uint8_t dimm, bool json) {
     printf("FRU: %s\n", fru_name[fru_id - 1]);
   }
 
+  spd_get_info(fru_id, dimm, spd);
   set_dimm_loop(dimm, &startCPU, &endCPU, &startDimm, &endDimm);
   for (cpu = startCPU; cpu < endCPU; cpu++) {
     for (i = startDimm; i < endDimm; ++i) {
-      util_set_EE_page(fru_id, cpu, i, 1);
-      util_read_spd_with_retry(fru_id, cpu, i, OFFSET_PART_NUMBER, LEN_PART_NUMBER,
-        MAX_FAIL_CNT, dimm_part[cpu][i], &dimm_present);
-
+      dimm_present = spd[cpu][i].present;
       if (dimm_present)
           for (j = 0; j < LEN_PART_NUMBER; ++j)
-            snprintf(pn + j, LEN_PN_STRING - j, "%c", dimm_part[cpu][i][j]);
+            snprintf(pn + j, LEN_PN_STRING - j, "%c", spd[cpu][i].p1[SPD_PN_OFFSET + j]);
 
       if (json) {
         json_t *part_obj = json_object();
@@ -354,21 +303,21 @@ err_exit:
 
 static int
 util_get_raw_dump(uint8_t fru_id, uint8_t dimm, bool json) {
-  uint8_t i, page, cpu, startCPU, endCPU, startDimm, endDimm, dimm_present = 0;
+  uint8_t i, page, cpu, startCPU, endCPU, startDimm, endDimm;
   uint16_t j = 0;
   uint16_t offset = DEFAULT_DUMP_OFFSET;
-  uint8_t buf[DEFAULT_DUMP_LEN] = {0};
+  uint8_t *buf;
+  static uint8_t raw[MAX_CPU_NUM][MAX_DIMM_PER_CPU][SPD_NUM_PAGES][SPD_PAGE_LEN];
 
   printf("Fru: %s\n", fru_name[fru_id - 1]);
+  memset(raw, 0, sizeof(raw));
+  spd_get_raw(fru_id, dimm, raw);
   set_dimm_loop(dimm, &startCPU, &endCPU, &startDimm, &endDimm);
   for (cpu = startCPU; cpu < endCPU; cpu++) {
     for (i = startDimm; i < endDimm; ++i) {
       printf("DIMM %s \n", get_dimm_label(cpu,i));
-      for (page = 0; page < 2; page++) {
-        memset(buf, 0, DEFAULT_DUMP_LEN);
-        util_set_EE_page(fru_id, cpu, i, page);
-        util_read_spd_with_retry(fru_id, cpu, i, DEFAULT_DUMP_OFFSET, DEFAULT_DUMP_LEN,
-          0, buf, &dimm_present);
+      for (page = 0; page < SPD_NUM_PAGES; page++) {
+        buf = raw[cpu][i][page];
         printf("%03x: ", offset + (page * 0x100));
         for (j = 0; j < DEFAULT_DUMP_LEN; ++j) {
           printf("%02x ", buf[j]);
@@ -473,21 +422,10 @@ util_get_size(char *size_str, uint8_t size_str_len, uint8_t *buf) {
 // PN, SN + vendor, manufacture_date, size, speed, clock speed.
 static int
 util_get_config(uint8_t fru_id, uint8_t dimm, bool json) {
-// page 0 constants
-#define P0_OFFSET   0
-#define P0_LEN      20
-#define TYPE_OFFSET 2
-#define MIN_CYCLE_TIME_OFFSET 18
-// page 1 constants
-#define P1_OFFSET 0x40
-#define P1_LEN    0x30
-#define MANUFACTURER_OFFSET 1
-#define DATE_OFFSET 3
-#define SERIAL_OFFSET 5
-#define PN_OFFSET 9
 #define BUF_SIZE 64
   uint8_t i, j, cpu, startCPU, endCPU, startDimm, endDimm, dimm_present = 0;
-  uint8_t buf[BUF_SIZE] = {0};
+  dimm_spd_t spd[MAX_CPU_NUM][MAX_DIMM_PER_CPU] = {0};
+  uint8_t *buf;
   json_t *config_arr = NULL;
   char   pn[LEN_PN_STRING] = {0};
   char   sn[LEN_SERIAL_STRING] = {0};
@@ -505,33 +443,29 @@ util_get_config(uint8_t fru_id, uint8_t dimm, bool json) {
     printf("FRU: %s\n", fru_name[fru_id - 1]);
   }
 
+  spd_get_info(fru_id, dimm, spd);
   set_dimm_loop(dimm, &startCPU, &endCPU, &startDimm, &endDimm);
   for (cpu = startCPU; cpu < endCPU; cpu++) {
     for (i = startDimm; i < endDimm; ++i) {
-      util_set_EE_page(fru_id, cpu, i, 0);
-      // read page 0 to get type, speed, capacity
-      memset(buf, 0, BUF_SIZE);
-      util_read_spd_with_retry(fru_id, cpu, i, P0_OFFSET, P0_LEN, 0, buf, &dimm_present);
+      dimm_present = spd[cpu][i].present;
       if (dimm_present) {
-        dimm_type = buf[TYPE_OFFSET];
-        mincycle  = buf[MIN_CYCLE_TIME_OFFSET];
+        // page 0: type, speed, capacity
+        buf = spd[cpu][i].p0;
+        dimm_type = buf[SPD_TYPE_OFFSET];
+        mincycle  = buf[SPD_MIN_CYCLE_TIME_OFFSET];
         util_get_size(size, BUF_SIZE, buf);
 
-        // read page 1 to get pn, sn, manufacturer, manufacturer week
-        util_set_EE_page(fru_id, cpu, i, 1);
-        memset(buf, 0, BUF_SIZE);
-        util_read_spd_with_retry(fru_id, cpu, i, P1_OFFSET, P1_LEN, 0, buf, &dimm_present);
-        if (dimm_present) {
-            for (j = 0; j < LEN_PART_NUMBER; ++j) {
-              snprintf(pn + j, LEN_PN_STRING - j, "%c", buf[PN_OFFSET + j]);
-            }
-            for (j = 0; j < LEN_SERIAL; ++j) {
-              snprintf(sn + (2 * j), LEN_SERIAL_STRING - (2 * j), "%02X", buf[SERIAL_OFFSET + j]);
-            }
-            snprintf(manu, BUF_SIZE, "%s", manu_string(buf[MANUFACTURER_OFFSET]));
-            snprintf(week, BUF_SIZE, "20%02x Week%02x",
-                      buf[DATE_OFFSET], buf[DATE_OFFSET + 1]);
+        // page 1: pn, sn, manufacturer, manufacturer week
+        buf = spd[cpu][i].p1;
+        for (j = 0; j < LEN_PART_NUMBER; ++j) {
+          snprintf(pn + j, LEN_PN_STRING - j, "%c", buf[SPD_PN_OFFSET + j]);
+        }
+        for (j = 0; j < LEN_SERIAL; ++j) {
+          snprintf(sn + (2 * j), LEN_SERIAL_STRING - (2 * j), "%02X", buf[SPD_SERIAL_OFFSET + j]);
         }
+        snprintf(manu, BUF_SIZE, "%s", manu_string(buf[SPD_MANUFACTURER_OFFSET]));
+        snprintf(week, BUF_SIZE, "20%02x Week%02x",
+                  buf[SPD_DATE_OFFSET], buf[SPD_DATE_OFFSET + 1]);
       }
 
      if (json) {
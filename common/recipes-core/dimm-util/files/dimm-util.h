@@ -38,6 +38,30 @@
 
 #define ERR_INVALID_SYNTAX -2
 
+// SPD pages
+#define SPD_PAGE_LEN 0x100
+#define SPD_NUM_PAGES 2
+
+// identity bytes of a DIMM, enough for serial/part/config queries
+// page 0: type, speed, capacity
+#define SPD_P0_OFFSET   0
+#define SPD_P0_LEN      20
+#define SPD_TYPE_OFFSET 2
+#define SPD_MIN_CYCLE_TIME_OFFSET 18
+// page 1: manufacturer, date, serial and part number
+#define SPD_P1_OFFSET 0x40
+#define SPD_P1_LEN    0x30
+#define SPD_MANUFACTURER_OFFSET 1
+#define SPD_DATE_OFFSET 3
+#define SPD_SERIAL_OFFSET (OFFSET_SERIAL - SPD_P1_OFFSET)
+#define SPD_PN_OFFSET (OFFSET_PART_NUMBER - SPD_P1_OFFSET)
+
+typedef struct {
+  uint8_t present;
+  uint8_t p0[SPD_P0_LEN];
+  uint8_t p1[SPD_P1_LEN];
+} dimm_spd_t;
+
 #define INTEL_ID_LEN  3
 #define MANU_INTEL_0  0x57
 #define MANU_INTEL_1  0x01
@@ -71,11 +95,26 @@ int get_bus_width_bits(uint8_t data);
 int get_device_width_bits(uint8_t data);
 int get_package_rank(uint8_t data);
 
+// SPD reads of a group of DIMMs, in parallel across SPD buses
+// and backed by a persistent cache (dimm-spd.cpp)
+int spd_get_info(uint8_t fru_id, uint8_t dimm,
+                 dimm_spd_t spd[MAX_CPU_NUM][MAX_DIMM_PER_CPU]);
+int spd_get_raw(uint8_t fru_id, uint8_t dimm,
+                uint8_t raw[MAX_CPU_NUM][MAX_DIMM_PER_CPU][SPD_NUM_PAGES][SPD_PAGE_LEN]);
+void set_dimm_loop(uint8_t dimm, uint8_t *startCPU, uint8_t *endCPU,
+                   uint8_t *startDimm, uint8_t *endDimm);
+
 
 // util functions to be provided by each platform
 int util_check_me_status(uint8_t fru_id);
 int util_set_EE_page(uint8_t fru_id, uint8_t cpu, uint8_t dimm, uint8_t page_num);
 int util_read_spd_byte(uint8_t fru_id, uint8_t cpu, uint8_t dimm, uint8_t offset);
+// read up to len bytes at once, returns the count read, -1 if unsupported
+int util_read_spd_block(uint8_t fru_id, uint8_t cpu, uint8_t dimm, uint8_t offset,
+                        uint8_t len, uint8_t *buf);
+// SPD bus of a DIMM behind its CPU; DIMMs on different buses of any CPU
+// can be read at the same time
+int util_get_spd_bus(uint8_t cpu, uint8_t dimm);
 int plat_init();
 const char * get_dimm_label(uint8_t cpu, uint8_t dimm);
 
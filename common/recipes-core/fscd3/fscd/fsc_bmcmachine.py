@@ -18,7 +18,11 @@
 import re
 from collections import namedtuple
 
-from fsc_sensor import FscSensorSourceSysfs, FscSensorSourceUtil
+from fsc_sensor import (
+    FscSensorSourceNativeUtil,
+    FscSensorSourceSysfs,
+    FscSensorSourceUtil,
+)
 from fsc_util import Logger
 
 
@@ -94,7 +98,9 @@ class BMCMachine(object):
         Logger.debug("Read all fan speeds")
         result = {}
         for key, value in list(fans.items()):
-            if isinstance(value.source, FscSensorSourceUtil):
+            if isinstance(value.source, FscSensorSourceNativeUtil):
+                result[fans[key]] = fans[key].source.read()
+            elif isinstance(value.source, FscSensorSourceUtil):
                 result[fans[key]] = parse_fan_util(fans[key].source.read())
             elif isinstance(fans[key].source, FscSensorSourceSysfs):
                 result[fans[key]] = parse_fan_sysfs(fans[key].source.read())
@@ -146,7 +152,12 @@ def get_sensor_tuples(fru_name, sensor_num, sensor_sources):
     """
     result = {}
     for key, value in list(sensor_sources.items()):
-        if isinstance(value.source, FscSensorSourceUtil):
+        if isinstance(value.source, FscSensorSourceNativeUtil):
+            result = parse_all_sensors_snapshot(
+                sensor_sources[key].source.read(fru=fru_name, num=sensor_num)
+            )
+            break  # Hack: util reads all sensors
+        elif isinstance(value.source, FscSensorSourceUtil):
             result = parse_all_sensors_util(
                 sensor_sources[key].source.read(fru=fru_name, num=sensor_num)
             )
@@ -238,6 +249,30 @@ def parse_all_sensors_util(sensor_data):
     return result
 
 
+def parse_all_sensors_snapshot(snapshot):
+    """
+    Builds the sensor tuples from the sensor cache snapshot of a native
+    source, the same way parse_all_sensors_util() does from the util output
+
+    Arguments:
+        snapshot: list of sensor dicts from sdr.sdr_get_fru_snapshot()
+
+    Returns:
+        SensorValue tuples
+    """
+    result = {}
+    for snr in snapshot:
+        value = snr["value"]
+        if isinstance(value, str):
+            # Discrete sensors are not used for fan control
+            continue
+        symname = symbolize_sensorname(snr["name"])
+        result[symname] = SensorValue(
+            snr["id"], snr["name"], value, snr["units"], snr["status"], 0, 0
+        )
+    return result
+
+
 def symbolize_sensorname(name):
     """
     Helper method to normalize the sensor name
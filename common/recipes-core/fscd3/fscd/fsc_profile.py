@@ -16,7 +16,12 @@
 # Boston, MA 02110-1301 USA
 #
 from fsc_control import PID, TTable, IncrementPID, TTable4Curve
-from fsc_sensor import FscSensorSourceSysfs, FscSensorSourceUtil
+from fsc_sensor import (
+    FscSensorSourceNativeSysfs,
+    FscSensorSourceNativeUtil,
+    FscSensorSourceSysfs,
+    FscSensorSourceUtil,
+)
 from fsc_util import Logger
 
 
@@ -24,12 +29,21 @@ class Sensor(object):
     def __init__(self, sensor_name, pTable):
         try:
             if "read_source" in pTable:
+                native = pTable["read_source"].get("native", False)
                 if "sysfs" in pTable["read_source"]:
-                    self.source = FscSensorSourceSysfs(
+                    if native:
+                        source_type = FscSensorSourceNativeSysfs
+                    else:
+                        source_type = FscSensorSourceSysfs
+                    self.source = source_type(
                         name=sensor_name, read_source=pTable["read_source"]["sysfs"]
                     )
                 if "util" in pTable["read_source"]:
-                    self.source = FscSensorSourceUtil(
+                    if native:
+                        source_type = FscSensorSourceNativeUtil
+                    else:
+                        source_type = FscSensorSourceUtil
+                    self.source = source_type(
                         name=sensor_name, read_source=pTable["read_source"]["util"]
                     )
                 self.offset = None
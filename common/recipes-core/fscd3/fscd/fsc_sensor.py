@@ -16,6 +16,7 @@
 # Boston, MA 02110-1301 USA
 #
 import abc
+import ctypes
 import os
 import re
 from subprocess import PIPE, Popen
@@ -220,3 +221,194 @@ class FscSensorSourceUtil(FscSensorBase):
             raise
         except Exception:
             Logger.crit("Exception with cmd=%s response=%s" % (cmd, response))
+
+
+_lpal_hndl = None
+
+
+def _pal():
+    # libpal is only loaded when a native source is configured, so configs
+    # that only use the util and sysfs sources keep working without it
+    global _lpal_hndl
+    if _lpal_hndl is None:
+        _lpal_hndl = ctypes.CDLL("libpal.so")
+        _lpal_hndl.pal_get_fru_id.argtypes = [
+            ctypes.c_char_p,
+            ctypes.POINTER(ctypes.c_uint8),
+        ]
+        _lpal_hndl.pal_get_fan_speed.argtypes = [
+            ctypes.c_uint8,
+            ctypes.POINTER(ctypes.c_int),
+        ]
+        _lpal_hndl.pal_set_fan_speed.argtypes = [ctypes.c_uint8, ctypes.c_uint8]
+    return _lpal_hndl
+
+
+class FscSensorSourceNativeSysfs(FscSensorSourceSysfs):
+    """
+    Class for FSC sensor source for sysfs, read and written in-process.
+    The files are kept open and re-read with pread(), so a control
+    cycle costs a syscall per sensor instead of a fork of cat/echo.
+    """
+
+    def __init__(self, **kwargs):
+        super(FscSensorSourceNativeSysfs, self).__init__(**kwargs)
+        self.read_fd = None
+        self.write_fd = None
+
+    def read(self, **kwargs):
+        """
+        Reads the sysfs source and returns the same blob cat would print
+        """
+        try:
+            if self.read_fd is None:
+                readsysfs = self.read_source
+                if "hwmon*" in self.read_source:
+                    readsysfs = self.get_hwmon_source()
+                self.read_fd = os.open(readsysfs, os.O_RDONLY)
+            data = os.pread(self.read_fd, 64, 0).decode()
+            self.read_source_fail_counter = 0
+            return data
+        except SystemExit:
+            Logger.debug("SystemExit from sensor read")
+            self.read_source_fail_counter += 1
+            raise
+        except Exception as e:
+            Logger.debug("Reading %s failed: %s" % (self.read_source, str(e)))
+            self.read_source_fail_counter += 1
+            # The device may have been rebound (hwmon index changed), so
+            # look it up again on the next read
+            self._close_read_fd()
+            self.hwmon_source = None
+            return ""
+
+    def write(self, value):
+        """
+        Writes value scaled by max_duty_register to write_source
+        """
+        if self.write_source is None:
+            return
+        data = str(int(value * self.max_duty_register / 100)) + "\n"
+        try:
+            if self.write_fd is None:
+                self.write_fd = os.open(self.write_source, os.O_WRONLY)
+            # Truncate like the shell redirection did, for plain files
+            os.ftruncate(self.write_fd, 0)
+            os.pwrite(self.write_fd, data.encode(), 0)
+            self.write_source_fail_counter = 0
+        except SystemExit:
+            Logger.debug("SystemExit from sensor write")
+            raise
+        except Exception as e:
+            Logger.crit(
+                "Writing %s to %s failed: %s" % (data, self.write_source, str(e))
+            )
+            self.write_source_fail_counter += 1
+            if self.write_fd is not None:
+                os.close(self.write_fd)
+                self.write_fd = None
+
+    def _close_read_fd(self):
+        if self.read_fd is not None:
+            try:
+                os.close(self.read_fd)
+            except OSError:
+                pass
+            self.read_fd = None
+
+
+class FscSensorSourceNativeUtil(FscSensorSourceUtil):
+    """
+    Class for FSC sensor source for BMC sensors and fans, read in-process.
+    Sensors come from the sensor cache through libsdr in one call per FRU,
+    fans are read and set through libpal. Nothing is forked, and sensors
+    sensord does not poll read as NA.
+    """
+
+    def __init__(self, **kwargs):
+        super(FscSensorSourceNativeUtil, self).__init__(**kwargs)
+        self.fru_ids = {}
+        self.uncached = set()
+        # The pwm output driven by this fan, when it differs from the
+        # tach index
+        self.pwm = kwargs.get("pwm")
+
+    def get_fru_id(self, fru_name):
+        if fru_name not in self.fru_ids:
+            fru = ctypes.c_uint8(0)
+            if _pal().pal_get_fru_id(fru_name.encode(), ctypes.byref(fru)):
+                raise ValueError("Unknown FRU %s" % fru_name)
+            self.fru_ids[fru_name] = fru.value
+        return self.fru_ids[fru_name]
+
+    def read(self, **kwargs):
+        """
+        With fru, returns the sensors of the FRU (or only sensors num) as a
+        list of dicts from sdr.sdr_get_fru_snapshot().
+        Without fru, returns the fan speed in RPM, -1 on failure.
+        """
+        if "fru" not in kwargs:
+            return self.read_speed()
+
+        import sdr
+
+        try:
+            fru = self.get_fru_id(kwargs["fru"])
+            nums = [int(num, 0) for num in kwargs.get("num", [])]
+            if nums:
+                snrs = sdr.sdr_get_snr_snapshot(fru, nums)
+            else:
+                snrs = sdr.sdr_get_fru_snapshot(fru)
+            for snr in snrs:
+                if not snr["cached"] and snr["name"] not in self.uncached:
+                    self.uncached.add(snr["name"])
+                    Logger.warn(
+                        "%s of %s is not polled by sensord"
+                        % (snr["name"], kwargs["fru"])
+                    )
+            return snrs
+        except SystemExit:
+            Logger.debug("SystemExit from sensor read")
+            raise
+        except sdr.SnapshotFailure as e:
+            # Left out like sensor-util leaves out the sensors of the FRU
+            if e.ret == sdr.SDR_ERR_NOT_PRESENT:
+                Logger.debug("%s is not present" % kwargs["fru"])
+            elif e.ret == sdr.SDR_ERR_NOT_READY:
+                Logger.debug("%s is unavailable" % kwargs["fru"])
+            else:
+                Logger.crit(
+                    "Reading sensors of %s failed: %d" % (kwargs["fru"], e.ret)
+                )
+        except Exception as e:
+            Logger.crit("Reading sensors of %s failed: %s" % (kwargs["fru"], str(e)))
+        return []
+
+    def read_speed(self):
+        rpm = ctypes.c_int(0)
+        try:
+            if _pal().pal_get_fan_speed(int(self.name), ctypes.byref(rpm)) == 0:
+                return rpm.value
+        except SystemExit:
+            Logger.debug("SystemExit from fan read")
+            raise
+        except Exception as e:
+            Logger.crit("Reading fan %s failed: %s" % (self.name, str(e)))
+        return -1
+
+    def write(self, value):
+        """
+        Sets the pwm of the fan through libpal
+        """
+        if self.write_source is None:
+            return
+        pwm = int(self.name) if self.pwm is None else int(self.pwm)
+        duty = int(value * self.max_duty_register / 100)
+        try:
+            if _pal().pal_set_fan_speed(pwm, duty):
+                raise Exception("pal_set_fan_speed failed")
+        except SystemExit:
+            Logger.debug("SystemExit from sensor write")
+            raise
+        except Exception as e:
+            Logger.crit("Setting pwm %d to %d failed: %s" % (pwm, duty, str(e)))
@@ -20,7 +20,12 @@ import re
 import sys
 
 import fsc_board
-from fsc_sensor import FscSensorSourceSysfs, FscSensorSourceUtil
+from fsc_sensor import (
+    FscSensorSourceNativeSysfs,
+    FscSensorSourceNativeUtil,
+    FscSensorSourceSysfs,
+    FscSensorSourceUtil,
+)
 from fsc_util import Logger, clamp
 
 
@@ -39,36 +44,46 @@ class Fan(object):
             else:
                 self.label = "Fan %d" % (self.fan_num)
 
+            native = pTable["read_source"].get("native", False)
             if "sysfs" in pTable["read_source"]:
+                if native:
+                    source_type = FscSensorSourceNativeSysfs
+                else:
+                    source_type = FscSensorSourceSysfs
                 if "write_source" in pTable:
                     if "max_duty_register" in pTable["write_source"]:
                         max_duty_register = pTable["write_source"]["max_duty_register"]
                     else:
                         max_duty_register = 100
-                    self.source = FscSensorSourceSysfs(
+                    self.source = source_type(
                         name=fan_name,
                         read_source=pTable["read_source"]["sysfs"],
                         write_source=pTable["write_source"]["sysfs"],
                         max_duty_register=max_duty_register,
                     )
                 else:
-                    self.source = FscSensorSourceSysfs(
+                    self.source = source_type(
                         name=fan_name, read_source=pTable["read_source"]["sysfs"]
                     )
             if "util" in pTable["read_source"]:
+                if native:
+                    source_type = FscSensorSourceNativeUtil
+                else:
+                    source_type = FscSensorSourceUtil
                 if "write_source" in pTable:
                     if "max_duty_register" in pTable["write_source"]:
                         max_duty_register = pTable["write_source"]["max_duty_register"]
                     else:
                         max_duty_register = 100
-                    self.source = FscSensorSourceUtil(
+                    self.source = source_type(
                         name=fan_name,
                         read_source=pTable["read_source"]["util"],
                         write_source=pTable["write_source"]["util"],
                         max_duty_register=max_duty_register,
+                        pwm=pTable["write_source"].get("pwm"),
                     )
                 else:
-                    self.source = FscSensorSourceUtil(
+                    self.source = source_type(
                         name=fan_name, read_source=pTable["read_source"]["util"]
                     )
         except Exception:
@@ -17,6 +17,7 @@
 # 51 Franklin Street, Fifth Floor,
 # Boston, MA 02110-1301 USA
 #
+import ctypes
 import json
 import os.path
 import signal
@@ -47,10 +48,35 @@ DEFAULT_INIT_BOOST = 100
 DEFAULT_INIT_TRANSITIONAL = 70
 WDTCLI_CMD = "/usr/local/bin/wdtcli"
 
+try:
+    lwdt_hndl = ctypes.CDLL("libwatchdog.so")
+except OSError:
+    lwdt_hndl = None
+
+
+def watchdog_call(func):
+    """Run func on the watchdog device through libwatchdog, the way wdtcli
+    does it but without forking it. The device is released right away as
+    it may only be opened once at a time.
+    Returns None if libwatchdog is not available.
+    """
+    if lwdt_hndl is None:
+        return None
+    if lwdt_hndl.open_watchdog(0, 0) != 0:
+        return -1
+    ret = func()
+    lwdt_hndl.release_watchdog()
+    return ret
+
 
 def kick_watchdog():
     """kick the watchdog device.
     """
+    ret = watchdog_call(lambda: lwdt_hndl.kick_watchdog())
+    if ret is not None:
+        if ret != 0:
+            Logger.error("failed to kick watchdog device")
+        return
     f = subprocess.Popen(
         WDTCLI_CMD + " kick", shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE
     )
@@ -60,14 +86,19 @@ def kick_watchdog():
 
 
 def stop_watchdog():
-    """kick the watchdog device.
+    """stop the watchdog device.
     """
+    ret = watchdog_call(lambda: lwdt_hndl.stop_watchdog())
+    if ret is not None:
+        if ret != 0:
+            Logger.error("failed to stop watchdog")
+        return
     f = subprocess.Popen(
         WDTCLI_CMD + " stop", shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE
     )
     info, err = f.communicate()
     if len(err) != 0:
-        Logger.error("failed to kick watchdog device")
+        Logger.error("failed to stop watchdog")
 
 
 class Fscd(object):
@@ -4,9 +4,11 @@ import logging
 from subprocess import PIPE, Popen
 
 from fsc_base_tester import BaseFscdUnitTest
+from fsc_sensor import FscSensorSourceNativeSysfs
 
 
 TEST_CONFIG = "./test-data/config-example-test-sysfs.json"
+TEST_NATIVE_CONFIG = "./test-data/config-example-test-sysfs-native.json"
 
 
 class FscdSysfsTester(BaseFscdUnitTest):
@@ -146,3 +148,19 @@ class FscdSysfsOperationalTester(BaseFscdUnitTest):
         cmd3 = "echo 15000 > ./test-data/test-sysfs-data/3-0048/temp1_input"
         cmd = cmd1 + ";" + cmd2 + ";" + cmd3
         Popen(cmd, shell=True, stdout=PIPE).stdout.read()
+
+
+class FscdNativeSysfsOperationalTester(FscdSysfsOperationalTester):
+    """
+    Same operation as FscdSysfsOperationalTester, with the sysfs sources
+    read and written in-process
+    """
+
+    def define_fscd(self):
+        BaseFscdUnitTest.define_fscd(self, config=TEST_NATIVE_CONFIG)
+
+    def test_native_sources(self):
+        for sensor in self.fscd_tester.sensors.values():
+            self.assertIsInstance(sensor.source, FscSensorSourceNativeSysfs)
+        for fan in self.fscd_tester.fans.values():
+            self.assertIsInstance(fan.source, FscSensorSourceNativeSysfs)
@@ -6,7 +6,11 @@ from fsc_base_tester import Result
 from fsc_bmc_machine_tester import FscdBmcMachineUnitTest, FscdBmcMachineUnitTest2
 from fsc_config_tester import FscdConfigUnitTest
 from fsc_operational_tester import FscdOperationalTest
-from fsc_sysfs_tester import FscdSysfsOperationalTester, FscdSysfsTester
+from fsc_sysfs_tester import (
+    FscdNativeSysfsOperationalTester,
+    FscdSysfsOperationalTester,
+    FscdSysfsTester,
+)
 
 
 def config_suite():
@@ -52,6 +56,8 @@ def operational_sysfs_suite():
     """
     test_suite = unittest.TestSuite()
     test_suite.addTest(FscdSysfsOperationalTester("test_fscd_operation"))
+    test_suite.addTest(FscdNativeSysfsOperationalTester("test_native_sources"))
+    test_suite.addTest(FscdNativeSysfsOperationalTester("test_fscd_operation"))
     return test_suite
 
 
@@ -32,21 +32,6 @@ class SystemMock : public System {
   MOCK_METHOD1(get_fru_id, uint8_t(string &name));
   MOCK_METHOD2(set_update_ongoing, void(uint8_t fruid, int timeo));
   MOCK_METHOD1(lock_file, string(string name));
-
-  int copy_file(string cmd) {
-    size_t pos = cmd.find("flashcp -v ");
-    if (pos == string::npos) {
-      return -1;
-    }
-    string params = cmd.substr(pos + strlen("flashcp -v "));
-    pos = params.find(" ");
-    string filesrc = params.substr(0, pos);
-    string filedst = params.substr(pos + 1);
-    ofstream dst(filedst);
-    dst << file_contents(filesrc);
-    dst.close();
-    return 0;
-  }
 };
 
 // TEST1: Verify that if the BMC component is created without a version flash
@@ -125,8 +110,8 @@ class BmcComponentMock : public BmcComponent {
 
 // TEST1: Check if image validation fails, update will fail with the correct error message.
 // TEST2: Check if the above test succeeds, but get_mtd_name fails, update will fail with the correct error message.
-// TEST3: Check if the above tests succeeds, but runcmd fails update will fail.
-// TEST4: Check if the above tests succeeds, bmc is flashed to the correct MTD device (Correct call to flashcp)
+// TEST3: Check if the above tests succeeds, but the image cannot be read, update will fail.
+// TEST4: Check if the above tests succeeds, bmc is written to the correct MTD device.
 TEST(BmcComponentTest, MTDFlash) {
   stringstream out, err;
   SystemMock mock(out, err);
@@ -134,8 +119,8 @@ TEST(BmcComponentTest, MTDFlash) {
   string dummy_image("blahimage");
   string name("fbtp");
   string version = name + "-4.9";
-  TmpFile mtd("U-Boot 2016.07 fbtp-v11.0");
-  string exp_flashcp_call("flashcp -v " + dummy_image + " " + mtd.name);
+  TmpFile mtd("oldimage");
+  TmpFile image("newimage1");
 
   EXPECT_CALL(mock, version())
     .Times(1)
@@ -147,18 +132,13 @@ TEST(BmcComponentTest, MTDFlash) {
     .WillOnce(DoAll(SetArgReferee<1>(mtd.name), Return(true)))
     .WillOnce(DoAll(SetArgReferee<1>(mtd.name), Return(true)));
 
-  EXPECT_CALL(mock, runcmd(string(exp_flashcp_call)))
-    .Times(2)
-    .WillOnce(Return(-1))
-    .WillOnce(Return(0));
-
   BmcComponentMock b("bmc_test", "bmc_test", mock, dummy_mtd);
 
-  EXPECT_CALL(b, update(dummy_image))
+  EXPECT_CALL(b, update(_))
     .Times(4)
     .WillRepeatedly(Invoke(&b, &BmcComponentMock::real_update));
 
-  EXPECT_CALL(b, is_valid(dummy_image))
+  EXPECT_CALL(b, is_valid(_))
     .Times(4)
     .WillOnce(Return(false))
     .WillOnce(Return(true))
@@ -177,30 +157,26 @@ TEST(BmcComponentTest, MTDFlash) {
   err.str("");
 
   EXPECT_EQ(FW_STATUS_FAILURE, b.update(dummy_image));
+  EXPECT_EQ(err.str(), "Cannot open " + dummy_image + "\n");
 
-  // Both succeeds. Check if we are calling flashcp correctly.
-  EXPECT_EQ(0, b.update(dummy_image));
+  // Both succeeds. Check if the image landed on the device.
+  EXPECT_EQ(0, b.update(image.name));
+  EXPECT_EQ("newimage1", mtd.read());
 }
 
 // Test1: Test offseted flash used for verified boot works as expected.
 TEST(BmcComponentTest, MTDOffsetFlash) {
   TmpFile image("1234567890"); // 10 byte image.
   TmpFile mtd_dev("abcdef"); // 6 byte mtd
-  string exp_image_name = image.name + "-tmp";
 
   stringstream out;
   SystemMock mock(out, cerr);
   string dummy_mtd("flash123");
-  string exp_flashcp_call("flashcp -v " + exp_image_name + " " + mtd_dev.name);
 
   EXPECT_CALL(mock, get_mtd_name(dummy_mtd, _))
     .Times(1)
     .WillRepeatedly(DoAll(SetArgReferee<1>(mtd_dev.name), Return(true)));
 
-  EXPECT_CALL(mock, runcmd(string(exp_flashcp_call)))
-    .Times(1)
-    .WillRepeatedly(Invoke(&mock, &SystemMock::copy_file));
-
   // We are skipping the first 4 bytes. Copying the next 4 from mtd
   // and replacing our own.
   BmcComponentMock b("bmc_test", "bmc_test", mock, dummy_mtd, "", 4, 8);
@@ -9,6 +9,7 @@
 #include <sys/mman.h>
 #include <syslog.h>
 #include "bmc.h"
+#include "flash.h"
 
 using namespace std;
 
@@ -19,8 +20,6 @@ int BmcComponent::update(string image_path)
 {
   string dev;
   int ret;
-  string flash_image = image_path;
-  stringstream cmd_str;
 
   if (_mtd_name == "") {
     // Upgrade not supported
@@ -40,80 +39,24 @@ int BmcComponent::update(string image_path)
   syslog(LOG_CRIT, "BMC fw upgrade initiated");
 
   system.output << "Flashing to device: " << dev << endl;
-  if (_skip_offset > 0 || _writable_offset > 0) {
-    flash_image = image_path + "-tmp";
-    // Ensure that we are not overwriting an existing file.
-    while (access( flash_image.c_str(), F_OK  ) != -1) {
-      flash_image.append("_");
-    }
-    // Open input image and seek skipping to the writable offset.
-    int fd_r = open(image_path.c_str(), O_RDONLY);
-    if (fd_r < 0) {
-      system.error << "Cannot open " << image_path << " for reading" << endl;
-      return FW_STATUS_FAILURE;
-    }
-    if (lseek(fd_r, _skip_offset, SEEK_SET) != (off_t)_skip_offset) {
-      close(fd_r);
-      system.error << "Cannot seek " << image_path << endl;
-      return FW_STATUS_FAILURE;
-    }
-    // create tmp file for writing.
-    int fd_w = open(flash_image.c_str(), O_WRONLY | O_CREAT, 0666);
-    if (fd_w < 0) {
-      system.error << "Cannot write to " << flash_image << endl;
-      close(fd_r);
+  // The image is streamed from its mapping straight into the device.
+  // Everything before _skip_offset is dropped, and when that lies past
+  // the writable offset, the device keeps its own data up to there.
+  size_t offset = _skip_offset > _writable_offset ? _skip_offset - _writable_offset : 0;
+  try {
+    MappedImage image(image_path);
+    if (image.size() <= _skip_offset) {
+      system.error << image_path << " is too small" << endl;
       return FW_STATUS_FAILURE;
     }
-    uint8_t buf[1024];
-    size_t r_b;
-
-    if (_skip_offset > _writable_offset) {
-      size_t copy = _skip_offset - _writable_offset;
-      int fd_d = open(dev.c_str(), O_RDONLY);
-      if (fd_d < 0) {
-        close(fd_r);
-        close(fd_w);
-        return FW_STATUS_FAILURE;
-      }
-      while (copy > 0) {
-        size_t to_copy = copy > sizeof(buf) ? sizeof(buf) : copy;
-        r_b = read(fd_d, buf, to_copy);
-        if (r_b != to_copy) {
-          close(fd_r);
-          close(fd_w);
-          close(fd_d);
-          return FW_STATUS_FAILURE;
-        }
-        if (write(fd_w, buf, to_copy) != (int)to_copy) {
-          close(fd_r);
-          close(fd_w);
-          close(fd_d);
-          return FW_STATUS_FAILURE;
-        }
-        copy -= to_copy;
-      }
-      close(fd_d);
-    }
-
-    // Copy from r to w.
-    while ((r_b = read(fd_r, buf, 1024)) > 0) {
-      if (write(fd_w, buf, r_b) != (int)r_b) {
-        close(fd_r);
-        close(fd_w);
-        return -1;
-      }
-    }
-    close(fd_r);
-    close(fd_w);
-  }
-  cmd_str << "flashcp -v " << flash_image << " " << dev;
-  ret = system.runcmd(cmd_str.str());
-  if (_writable_offset > 0) {
-    // this is a temp. file, remove it.
-    remove(flash_image.c_str());
+    FlashWriter writer(system, dev);
+    ret = writer.write(image.data() + _skip_offset, image.size() - _skip_offset, offset);
+  } catch (string &ex) {
+    system.error << ex << endl;
+    return FW_STATUS_FAILURE;
   }
 
-  // If flashcp cmd was successful, keep historical info that BMC fw was upgraded
+  // If the update was successful, keep historical info that BMC fw was upgraded
   if (ret == 0) {
     syslog(LOG_CRIT, "BMC fw upgrade completed. Version: %s", get_bmc_version(dev).c_str());
   }
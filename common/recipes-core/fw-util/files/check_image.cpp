@@ -10,6 +10,7 @@ extern "C" {
 #include <openssl/sha.h>
 #include <zlib.h>
 #include "bmc.h"
+#include "flash.h"
 
 int __attribute__((weak)) fdt_first_subnode(const void *fdt, int offset)
 {
@@ -39,8 +40,6 @@ int __attribute__((weak)) fdt_next_subnode(const void *fdt, int offset)
        node = fdt_next_subnode(fdt, node))
 #endif
 
-#define FLASH_SIZE (32 * 1024 * 1024)
-
 using namespace std;
 
 class Checker {
@@ -50,7 +49,7 @@ class Checker {
   off_t size;
   public:
   Checker(string n, off_t of, off_t sz) : name(n), offset(of), size(sz) {}
-  virtual bool is_valid(const unsigned char *image) {
+  virtual bool is_valid(const unsigned char *image, size_t image_size) {
     return true;
   }
 };
@@ -74,12 +73,12 @@ class LegacyChecker : public Checker {
   public:
     LegacyChecker(string n, off_t of, off_t sz) : Checker(n, of, sz) {}
 
-  virtual bool is_valid(const unsigned char *image) {
+  virtual bool is_valid(const unsigned char *image, size_t image_size) {
     uint32_t hcrc, dcrc, hcrc_c, dcrc_c;
     unsigned char hdr[HEADER_SIZE];
     const unsigned char *data;
 
-    if (size <= HEADER_SIZE) {
+    if (size <= HEADER_SIZE || (off_t)image_size < offset + HEADER_SIZE) {
       return false;
     }
     image = image + offset;
@@ -97,7 +96,7 @@ class LegacyChecker : public Checker {
     dcrc = get_word(hdr, DATA_CRC_OFFSET);
     off_t len  = (off_t)get_word(hdr, SIZE_OFFSET);
     data = image + HEADER_SIZE;
-    if (len + HEADER_SIZE > size) {
+    if (len + HEADER_SIZE > size || offset + HEADER_SIZE + len > (off_t)image_size) {
       return false;
     }
     dcrc_c = crc32(0, data, len);
@@ -113,7 +112,7 @@ class FITChecker : public Checker {
   public:
   FITChecker(string n, off_t of, off_t sz, int nodes) : Checker(n, of, sz), num_nodes(nodes) {}
 
-  virtual bool is_valid(const unsigned char *image) {
+  virtual bool is_valid(const unsigned char *image, size_t image_size) {
       const void *fdt = (const void *)(image + offset);
       int nodep, node, hashnode;
       size_t data_size;
@@ -123,7 +122,10 @@ class FITChecker : public Checker {
       int len = 0;
       int valid_nodes = 0;
 
-      if (size < (off_t)FDT_V17_SIZE || fdt_check_header(fdt) != 0) {
+      // The image is mapped, nothing past its end may be touched.
+      image_size -= offset;
+      if (size < (off_t)FDT_V17_SIZE || image_size < FDT_V17_SIZE ||
+          fdt_check_header(fdt) != 0 || fdt_totalsize(fdt) > image_size) {
         return false;
       }
 
@@ -154,6 +156,9 @@ class FITChecker : public Checker {
             return false;
           }
           data_pos = ntohl(*(uint32_t *)data);
+          if ((size_t)data_pos + data_size > image_size) {
+            return false;
+          }
           data = (const unsigned char *)fdt + data_pos;
         } else {
           data_size = (size_t)len;
@@ -246,7 +251,7 @@ class PartitionDescriptor
         return false;
       // A valid image might not take up the whole partition.
       // So image_size < offset + size is possible.
-      return checker->is_valid(image);
+      return checker->is_valid(image, image_size);
     }
 };
 
@@ -289,9 +294,9 @@ class ImageDescriptor {
 class ImageDescriptorList;
 
 class Image {
+  MappedImage          map;
   const unsigned char *image;
   size_t               fsize;
-  int                  fd;
   friend class         ImageDescriptorList;
   bool match(const char *s, const char *p)
   {
@@ -321,31 +326,7 @@ class Image {
     return true;
   }
   public:
-  Image(string &file) : image(NULL) {
-    fd = open(file.c_str(), O_RDONLY);
-    if (fd < 0) {
-      throw "Cannot open " + string(file);
-    }
-    fsize = lseek(fd, 0, SEEK_END);
-    if (fsize == 0) {
-      throw "Zero size image file " + string(file);
-    }
-    lseek(fd, 0, SEEK_SET);
-    unsigned char *img = (unsigned char *)calloc(FLASH_SIZE, 1);
-    for (int bread = 0; bread < (int)fsize;) {
-      int rc = read(fd, img + bread, fsize - bread);
-      if (rc > 0) {
-        bread += rc;
-      }
-    }
-    image = (const unsigned char *)img;
-  }
-  ~Image() {
-    if (image)
-      free((void *)image);
-    if (fd >= 0)
-      close(fd);
-  }
+  Image(string &file) : map(file), image(map.data()), fsize(map.size()) {}
   bool supports_machine(string &machine) {
     // Just dont check in the last 256 bytes of the image. Technically we
     // need to find this in the uboot section so it should be pretty early on.
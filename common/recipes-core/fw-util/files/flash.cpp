@@ -0,0 +1,145 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mtd/mtd-user.h>
+#include "flash.h"
+
+#define DEFAULT_ERASE_SIZE (64 * 1024)
+
+using namespace std;
+
+MappedImage::MappedImage(const string &file) : _data(NULL), _size(0)
+{
+  struct stat st;
+  void *p;
+
+  _fd = open(file.c_str(), O_RDONLY);
+  if (_fd < 0) {
+    throw "Cannot open " + file;
+  }
+  if (fstat(_fd, &st) != 0 || st.st_size == 0) {
+    close(_fd);
+    throw "Zero size image file " + file;
+  }
+  _size = st.st_size;
+  p = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+  if (p == MAP_FAILED) {
+    close(_fd);
+    throw "Cannot map " + file;
+  }
+  // Validation and writing both walk the image front to back.
+  madvise(p, _size, MADV_SEQUENTIAL);
+  _data = (const unsigned char *)p;
+}
+
+MappedImage::~MappedImage()
+{
+  munmap((void *)_data, _size);
+  close(_fd);
+}
+
+FlashWriter::~FlashWriter()
+{
+  if (_fd >= 0)
+    close(_fd);
+}
+
+int FlashWriter::write_block(size_t pos, const unsigned char *blk,
+                             unsigned char *cur, size_t len)
+{
+  if (_is_mtd) {
+    struct erase_info_user erase;
+    erase.start = pos;
+    erase.length = _erase_size;
+    if (ioctl(_fd, MEMERASE, &erase) < 0) {
+      system.error << "Erase failed at 0x" << hex << pos << dec
+                   << " of " << _dev << endl;
+      return FW_STATUS_FAILURE;
+    }
+  }
+  if (pwrite(_fd, blk, len, pos) != (ssize_t)len) {
+    system.error << "Write failed at 0x" << hex << pos << dec
+                 << " of " << _dev << endl;
+    return FW_STATUS_FAILURE;
+  }
+  if (pread(_fd, cur, len, pos) != (ssize_t)len || memcmp(cur, blk, len)) {
+    system.error << "Verify failed at 0x" << hex << pos << dec
+                 << " of " << _dev << endl;
+    return FW_STATUS_FAILURE;
+  }
+  return FW_STATUS_SUCCESS;
+}
+
+int FlashWriter::write(const unsigned char *data, size_t len, size_t offset)
+{
+  struct mtd_info_user info;
+  size_t pos, end = offset + len;
+  int written = 0, unchanged = 0;
+
+  _fd = open(_dev.c_str(), O_RDWR | O_SYNC);
+  if (_fd < 0) {
+    system.error << "Cannot open " << _dev << " for writing" << endl;
+    return FW_STATUS_FAILURE;
+  }
+  if (ioctl(_fd, MEMGETINFO, &info) == 0) {
+    _is_mtd = true;
+    _dev_size = info.size;
+    _erase_size = info.erasesize;
+    if (end > _dev_size) {
+      system.error << "Image does not fit in " << _dev << endl;
+      return FW_STATUS_FAILURE;
+    }
+  } else {
+    _is_mtd = false;
+    _erase_size = DEFAULT_ERASE_SIZE;
+  }
+
+  pos = offset - offset % _erase_size;
+
+  vector<unsigned char> blk(_erase_size), cur(_erase_size);
+  for (; pos < end; pos += _erase_size) {
+    size_t blk_end = pos + _erase_size;
+    size_t data_start = pos < offset ? offset : pos;
+    size_t data_end = blk_end < end ? blk_end : end;
+    // An MTD is always written in whole erase blocks, a plain file only
+    // where the image goes.
+    size_t wr_start = _is_mtd ? pos : data_start;
+    size_t wr_end = _is_mtd ? blk_end : data_end;
+    size_t wr_len = wr_end - wr_start;
+    ssize_t rc;
+
+    rc = pread(_fd, &cur[0], wr_len, wr_start);
+    if (rc < 0 || (_is_mtd && rc != (ssize_t)wr_len)) {
+      system.error << "Read failed at 0x" << hex << wr_start << dec
+                   << " of " << _dev << endl;
+      return FW_STATUS_FAILURE;
+    }
+    // Keep what precedes the image in its first block, and leave the
+    // rest of the last block erased like flashcp does.
+    memcpy(&blk[0], &cur[0], data_start - wr_start);
+    memcpy(&blk[data_start - wr_start], data + (data_start - offset),
+           data_end - data_start);
+    memset(&blk[data_end - wr_start], 0xff, wr_end - data_end);
+
+    if (rc == (ssize_t)wr_len && !memcmp(&blk[0], &cur[0], wr_len)) {
+      unchanged++;
+    } else {
+      if (write_block(wr_start, &blk[0], &cur[0], wr_len)) {
+        return FW_STATUS_FAILURE;
+      }
+      written++;
+    }
+  }
+
+  system.output << "Wrote " << written << " blocks, " << unchanged
+                << " already up to date" << endl;
+  return FW_STATUS_SUCCESS;
+}
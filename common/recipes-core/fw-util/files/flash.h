@@ -0,0 +1,42 @@
+#ifndef _FLASH_H_
+#define _FLASH_H_
+#include <string>
+#include "fw-util.h"
+
+// Read-only mapping of an image file. Nothing is copied, pages come
+// straight from the page cache as the checkers and the writer touch them.
+class MappedImage {
+  int _fd;
+  const unsigned char *_data;
+  size_t _size;
+  public:
+    MappedImage(const std::string &file);
+    ~MappedImage();
+    const unsigned char *data() { return _data; }
+    size_t size() { return _size; }
+};
+
+// Writes an image to an MTD device one erase block at a time. Blocks
+// whose contents already match are left alone, every written block is
+// read back and compared. When the device is not an MTD (tests), it is
+// written as a plain file without erasing.
+class FlashWriter {
+  System &system;
+  std::string _dev;
+  int _fd;
+  bool _is_mtd;
+  size_t _dev_size;
+  size_t _erase_size;
+  int write_block(size_t pos, const unsigned char *blk, unsigned char *cur,
+                  size_t len);
+  public:
+    FlashWriter(System &sys, const std::string &dev)
+      : system(sys), _dev(dev), _fd(-1), _is_mtd(false),
+        _dev_size(0), _erase_size(0) {}
+    ~FlashWriter();
+    // Write len bytes of data at offset of the device. Bytes of the
+    // first erase block before offset are preserved.
+    int write(const unsigned char *data, size_t len, size_t offset);
+};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2020-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Query the statistics ipmbd keeps about one IPMB bus.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <openbmc/ipc.h>
+
+#include "ipmbd.h"
+
+#define CTL_TIMEOUT 2
+
+static void
+print_usage(const char *prog)
+{
+  printf("Usage: %s <bus-id> stats|reset\n", prog);
+  printf("    stats  - print request counters and latency\n");
+  printf("    reset  - print and clear the counters\n");
+}
+
+static uint64_t
+percentile(const ipmbd_stats_t *st, int pct)
+{
+  uint64_t total = 0, target, seen = 0;
+  int i;
+
+  for (i = 0; i < IPMBD_LAT_BUCKETS; i++) {
+    total += st->lat_hist[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  target = (total * pct + 99) / 100;
+  for (i = 0; i < IPMBD_LAT_BUCKETS; i++) {
+    seen += st->lat_hist[i];
+    if (seen >= target) {
+      break;
+    }
+  }
+  // upper bound of the bucket, or the real maximum if lower
+  return (2ULL << i) < st->lat_max_us ? (2ULL << i) : st->lat_max_us;
+}
+
+static void
+print_stats(const ipmbd_stats_t *st)
+{
+  uint32_t elapsed = st->elapsed_s ? st->elapsed_s : 1;
+  uint32_t i;
+
+  printf("Bus %u, %u s of statistics, window %u per responder\n",
+         st->bus, st->elapsed_s, st->window);
+  printf("Requests:         %llu (%.1f/s)\n",
+         (unsigned long long)st->requests, (double)st->requests / elapsed);
+  printf("Responses:        %llu\n", (unsigned long long)st->responses);
+  printf("Timeouts:         %llu\n", (unsigned long long)st->timeouts);
+  printf("Bus errors:       %llu\n", (unsigned long long)st->errors);
+  printf("Throttled:        %llu\n", (unsigned long long)st->throttled);
+  printf("Late responses:   %llu\n", (unsigned long long)st->late);
+  printf("In flight:        %u (max %u)\n", st->inflight, st->inflight_max);
+  printf("Bytes:            tx %llu (%.1f/s), rx %llu (%.1f/s)\n",
+         (unsigned long long)st->tx_bytes, (double)st->tx_bytes / elapsed,
+         (unsigned long long)st->rx_bytes, (double)st->rx_bytes / elapsed);
+  if (st->responses) {
+    printf("Latency:          avg %llu us, p50 %llu us, p99 %llu us, max %llu us\n",
+           (unsigned long long)(st->lat_total_us / st->responses),
+           (unsigned long long)percentile(st, 50),
+           (unsigned long long)percentile(st, 99),
+           (unsigned long long)st->lat_max_us);
+  }
+  printf("Bus requests:     %llu\n", (unsigned long long)st->rx_requests);
+
+  if (st->num_dests == 0) {
+    return;
+  }
+  printf("\n%-9s %9s %10s %10s %9s %10s %10s %11s\n", "Responder",
+         "In-flight", "Requests", "Responses", "Timeouts", "SRTT(us)",
+         "Max(us)", "Timeout(ms)");
+  for (i = 0; i < st->num_dests && i < IPMBD_STATS_MAX_DEST; i++) {
+    const ipmbd_dest_stats_t *d = &st->dests[i];
+    printf("0x%02x      %9u %10llu %10llu %9llu %10u %10u %11u\n",
+           d->addr, d->inflight, (unsigned long long)d->requests,
+           (unsigned long long)d->responses, (unsigned long long)d->timeouts,
+           d->srtt_us, d->lat_max_us, d->rto_ms);
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  char endpoint[64];
+  ipmbd_stats_t st;
+  size_t len = sizeof(st);
+  uint8_t cmd;
+  int bus;
+
+  if (argc != 3) {
+    print_usage(argv[0]);
+    return -1;
+  }
+  bus = (int)strtoul(argv[1], NULL, 0);
+  if (!strcmp(argv[2], "stats")) {
+    cmd = IPMBD_CTL_GET_STATS;
+  } else if (!strcmp(argv[2], "reset")) {
+    cmd = IPMBD_CTL_RESET_STATS;
+  } else {
+    print_usage(argv[0]);
+    return -1;
+  }
+
+  snprintf(endpoint, sizeof(endpoint), "%s_%d", IPMBD_CTL_ENDPOINT, bus);
+  memset(&st, 0, sizeof(st));
+  if (ipc_send_req(endpoint, &cmd, sizeof(cmd), (uint8_t *)&st, &len,
+                   CTL_TIMEOUT) != 0 || len != sizeof(st)) {
+    printf("ipmbd on bus %d is not responding\n", bus);
+    return -1;
+  }
+  if (st.version != IPMBD_STATS_VERSION) {
+    printf("Unsupported ipmbd statistics version %u\n", st.version);
+    return -1;
+  }
+  print_stats(&st);
+  return 0;
+}
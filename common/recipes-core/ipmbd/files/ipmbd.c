@@ -74,6 +74,8 @@
 #include <openbmc/ipmb.h>
 #include <openbmc/misc-utils.h>
 
+#include "ipmbd.h"
+
 /*
  * IPMB packet sizes.
  */
@@ -102,7 +104,31 @@
   .mq_curmsgs = 0,                 \
 }
 
+/*
+ * rqSeq is 6 bits wide. A response is matched on the responder address
+ * and the sequence number, so every responder gets its own window.
+ */
 #define SEQ_NUM_MAX 64
+#define IPMB_DEST_MAX 128 /* 7-bit slave addresses */
+
+/*
+ * Requests in flight allowed per responder by default, more wait for
+ * one to complete.
+ */
+#define IPMB_DEST_WINDOW 16
+
+/*
+ * Requests served concurrently for BMC applications, summed over all
+ * responders. Workers are started as requests need them.
+ */
+#define IPMB_SVC_WORKERS 128
+
+/*
+ * Responders which stopped answering get a shorter timeout, halved on
+ * every further timeout down to this; any response restores the full
+ * TIMEOUT_IPMB, including one arriving after its request timed out.
+ */
+#define IPMB_RTO_MIN_MS 500
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(_a) (sizeof(_a) / sizeof((_a)[0]))
@@ -123,23 +149,49 @@
 #define RES_VERBOSE(fmt, args...) __VERBOSE(IPMBD_RES_THREAD ": " fmt, ##args)
 #define SVC_VERBOSE(fmt, args...) __VERBOSE(IPMBD_SVC_THREAD ": " fmt, ##args)
 
+enum {
+  SEQ_FREE = 0,
+  SEQ_WAITING,  // request sent, requester waits for the response
+  SEQ_FILLING,  // response being copied in
+  SEQ_DONE,
+};
+
 // Structure for sequence number and buffer
 typedef struct {
-  bool in_use; // seq# is being used
+  int state; // SEQ_*, changed atomically
   uint8_t len; // buffer size
-  uint8_t *p_buf; // pointer to buffer
+  uint8_t buf[IPMB_PKT_MAX_SIZE]; // response
   sem_t seq_sem; // semaphore for thread sync.
 } seq_buf_t;
 
-// Structure for holding currently used sequence number and
-// array of all possible sequence number
-static struct {
-  pthread_mutex_t seq_mutex;
+// Outstanding requests and statistics of one responder
+typedef struct {
+  uint8_t addr; // 8-bit slave address
+  uint64_t seq_map; // seq# in use, allocated with CAS
+  unsigned int curr_seq; // next seq# to try, keeps seq# rotating
+  sem_t window; // credits for requests in flight
+
+  // protected by ipmb_stats.mutex
+  uint32_t rto_ms;
+  uint32_t srtt_us;
+  uint32_t lat_max_us;
+  uint32_t consec_timeouts;
+  uint64_t requests;
+  uint64_t responses;
+  uint64_t timeouts;
+
+  seq_buf_t seq[SEQ_NUM_MAX]; // array of all possible seq# struct.
+} ipmb_dest_t;
+
+// Responders, allocated on first use and never freed
+static ipmb_dest_t *ipmb_dests[IPMB_DEST_MAX];
 
-  uint8_t curr_seq; // currently used seq#
-  seq_buf_t seq[SEQ_NUM_MAX]; //array of all possible seq# struct.
-} ipmb_seq_buf = {
-  .seq_mutex = PTHREAD_MUTEX_INITIALIZER,
+static struct {
+  pthread_mutex_t mutex;
+  struct timespec since;
+  ipmbd_stats_t s;
+} ipmb_stats = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
 };
 
 static pthread_mutex_t i2c_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -147,6 +199,8 @@ static pthread_mutex_t i2c_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct {
   int bus_id;
   int payload_id;
+  int dest_window;
+  uint16_t bmc_addr;
 
   /* global flags */
   unsigned int bic_update_enabled:1;
@@ -154,6 +208,7 @@ static struct {
 } ipmbd_config = {
   .bus_id = -1,
   .payload_id = -1,
+  .dest_window = IPMB_DEST_WINDOW,
 };
 
 /*
@@ -176,8 +231,8 @@ ipc_name_gen(char *buf, size_t size, const char *prefix, int bus_num)
 
 // Calculate checksum
 static inline uint8_t
-calc_cksum(uint8_t *buf, uint8_t len) {
-  uint8_t i = 0;
+calc_cksum(uint8_t *buf, size_t len) {
+  size_t i = 0;
   uint8_t cksum = 0;
 
   for (i = 0; i < len; i++) {
@@ -187,76 +242,247 @@ calc_cksum(uint8_t *buf, uint8_t len) {
   return (ZERO_CKSUM_CONST - cksum);
 }
 
-static void ipmb_seq_buf_init(void) {
+static uint64_t
+now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Absolute CLOCK_REALTIME time <ms> from now, as sem_timedwait wants
+static void
+deadline_ms(struct timespec *ts, uint32_t ms)
+{
+  clock_gettime(CLOCK_REALTIME, ts);
+  ts->tv_sec += ms / 1000;
+  ts->tv_nsec += (long)(ms % 1000) * 1000000;
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
+static int
+sem_wait_until(sem_t *sem, const struct timespec *ts)
+{
+  int ret;
+
+  while ((ret = sem_timedwait(sem, ts)) == -1 && errno == EINTR)
+    ;
+  return ret;
+}
+
+static ipmb_dest_t *
+dest_find(uint8_t addr)
+{
+  return __atomic_load_n(&ipmb_dests[(addr >> 1) % IPMB_DEST_MAX],
+                         __ATOMIC_ACQUIRE);
+}
+
+// Returns the responder at <addr>, creating it on first use
+static ipmb_dest_t *
+dest_get(uint8_t addr)
+{
+  ipmb_dest_t *dest, *exp = NULL;
   int i;
-  for (i = 0; i < ARRAY_SIZE(ipmb_seq_buf.seq); i++) {
-    ipmb_seq_buf.seq[i].in_use = false;
-    assert(sem_init(&ipmb_seq_buf.seq[i].seq_sem, 0, 0) == 0);
-    ipmb_seq_buf.seq[i].len = 0;
-    ipmb_seq_buf.seq[i].p_buf = NULL;
+
+  if ((dest = dest_find(addr)) != NULL) {
+    return dest;
+  }
+
+  dest = calloc(1, sizeof(*dest));
+  if (dest == NULL) {
+    return NULL;
   }
+  dest->addr = addr & 0xFE;
+  dest->rto_ms = TIMEOUT_IPMB * 1000;
+  sem_init(&dest->window, 0, ipmbd_config.dest_window);
+  for (i = 0; i < ARRAY_SIZE(dest->seq); i++) {
+    sem_init(&dest->seq[i].seq_sem, 0, 0);
+  }
+
+  if (!__atomic_compare_exchange_n(&ipmb_dests[(addr >> 1) % IPMB_DEST_MAX],
+                                   &exp, dest, false, __ATOMIC_ACQ_REL,
+                                   __ATOMIC_ACQUIRE)) {
+    // Somebody else was first
+    free(dest);
+    dest = exp;
+  }
+  return dest;
 }
 
-static int seq_put(uint8_t seq, uint8_t *buf, uint8_t len)
+// Returns an unused seq# of the responder, or -1 if all are in use
+static int
+seq_get_new(ipmb_dest_t *dest)
 {
-  seq_buf_t *s;
-  int rc = -1;
+  uint64_t map, avail;
+  unsigned int start;
+  int index;
+
+  map = __atomic_load_n(&dest->seq_map, __ATOMIC_ACQUIRE);
+  do {
+    if (map == ~0ULL) {
+      return -1;
+    }
+    // Search for unused sequence number, beginning after the last one
+    // handed out so a late response is unlikely to meet a reused seq#
+    start = __atomic_load_n(&dest->curr_seq, __ATOMIC_RELAXED) % SEQ_NUM_MAX;
+    avail = ~map;
+    if (start) {
+      avail = (avail >> start) | (avail << (SEQ_NUM_MAX - start));
+    }
+    index = (start + __builtin_ctzll(avail)) % SEQ_NUM_MAX;
+  } while (!__atomic_compare_exchange_n(&dest->seq_map, &map,
+                                        map | (1ULL << index), true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  __atomic_store_n(&dest->curr_seq, index + 1, __ATOMIC_RELAXED);
+  dest->seq[index].len = 0;
+  __atomic_store_n(&dest->seq[index].state, SEQ_WAITING, __ATOMIC_RELEASE);
+  return index;
+}
+
+static void
+seq_release(ipmb_dest_t *dest, int index)
+{
+  __atomic_store_n(&dest->seq[index].state, SEQ_FREE, __ATOMIC_RELEASE);
+  __atomic_fetch_and(&dest->seq_map, ~(1ULL << index), __ATOMIC_RELEASE);
+  sem_post(&dest->window);
+}
 
-  if (seq >= ARRAY_SIZE(ipmb_seq_buf.seq)) {
+static int
+seq_put_dest(ipmb_dest_t *dest, uint8_t seq, uint8_t *buf, uint8_t len)
+{
+  seq_buf_t *s = &dest->seq[seq];
+  int exp = SEQ_WAITING;
+
+  // Check if the response is being waited for
+  if (!__atomic_compare_exchange_n(&s->state, &exp, SEQ_FILLING, false,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
     return -1;
   }
-  // Check if the response is being waited for
-  pthread_mutex_lock(&ipmb_seq_buf.seq_mutex);
-  s = &ipmb_seq_buf.seq[seq];
-  if (s->in_use && s->p_buf) {
-    // Copy the response to the requester's buffer
-    memcpy(s->p_buf, buf, len);
-    s->len = len;
-
-    // Wake up the worker thread to receive the response
-    sem_post(&s->seq_sem);
-    rc = 0;
-  }
-  pthread_mutex_unlock(&ipmb_seq_buf.seq_mutex);
-  return rc;
+  // Copy the response to the requester's slot
+  memcpy(s->buf, buf, len);
+  s->len = len;
+  __atomic_store_n(&s->state, SEQ_DONE, __ATOMIC_RELEASE);
+
+  // Wake up the worker thread to receive the response
+  sem_post(&s->seq_sem);
+  return 0;
 }
 
-// Returns an unused seq# from all possible seq#
-static int8_t
-seq_get_new(unsigned char *resp) {
-  int8_t ret = -1;
-  uint8_t index;
+// Called with ipmb_stats.mutex held
+static void
+dest_alive(ipmb_dest_t *dest)
+{
+  dest->consec_timeouts = 0;
+  dest->rto_ms = TIMEOUT_IPMB * 1000;
+}
 
-  pthread_mutex_lock(&ipmb_seq_buf.seq_mutex);
+static int
+seq_put(uint8_t addr, uint8_t seq, uint8_t *buf, uint8_t len)
+{
+  ipmb_dest_t *dest;
 
-  // Search for unused sequence number
-  index = ipmb_seq_buf.curr_seq;
-  do {
-    if (!ipmb_seq_buf.seq[index].in_use) {
-      // Found it!
-      ret = index;
-      ipmb_seq_buf.seq[index].in_use = true;
-      ipmb_seq_buf.seq[index].len = 0;
-      ipmb_seq_buf.seq[index].p_buf = resp;
-      break;
-    }
+  if (seq >= SEQ_NUM_MAX) {
+    return -1;
+  }
+  // Only the requester of this seq# at this responder gets the response
+  dest = dest_find(addr);
+  if (!dest) {
+    return -1;
+  }
+  if (seq_put_dest(dest, seq, buf, len)) {
+    // Nobody waits for it any more: the responder is alive but slower
+    // than the timeout it was given, give it the full one again
+    pthread_mutex_lock(&ipmb_stats.mutex);
+    dest_alive(dest);
+    pthread_mutex_unlock(&ipmb_stats.mutex);
+    return -1;
+  }
+  return 0;
+}
 
-    if (++index == ARRAY_SIZE(ipmb_seq_buf.seq)) {
-      index = 0;
-    }
-  } while (index != ipmb_seq_buf.curr_seq);
+static uint32_t
+dest_rto(ipmb_dest_t *dest)
+{
+  uint32_t rto;
 
-  // Update the current seq num
-  if (ret >= 0) {
-    if (++index == ARRAY_SIZE(ipmb_seq_buf.seq)) {
-      index = 0;
-    }
-    ipmb_seq_buf.curr_seq = index;
+  if (ipmbd_config.bic_update_enabled) {
+    return TIMEOUT_IPMB * 1000;
   }
+  pthread_mutex_lock(&ipmb_stats.mutex);
+  rto = dest->rto_ms;
+  pthread_mutex_unlock(&ipmb_stats.mutex);
+  return rto;
+}
 
-  pthread_mutex_unlock(&ipmb_seq_buf.seq_mutex);
+static void
+stats_sent(ipmb_dest_t *dest, uint8_t len)
+{
+  uint32_t inflight;
+
+  pthread_mutex_lock(&ipmb_stats.mutex);
+  dest->requests++;
+  ipmb_stats.s.requests++;
+  ipmb_stats.s.tx_bytes += len;
+  inflight = ++ipmb_stats.s.inflight;
+  if (inflight > ipmb_stats.s.inflight_max) {
+    ipmb_stats.s.inflight_max = inflight;
+  }
+  pthread_mutex_unlock(&ipmb_stats.mutex);
+}
 
-  return ret;
+static void
+stats_done(ipmb_dest_t *dest, uint64_t lat_us, uint8_t len)
+{
+  ipmbd_stats_t *st = &ipmb_stats.s;
+  int32_t err;
+  int b = 0;
+
+  while (b < IPMBD_LAT_BUCKETS - 1 && lat_us >= (2ULL << b)) {
+    b++;
+  }
+
+  pthread_mutex_lock(&ipmb_stats.mutex);
+  st->inflight--;
+  if (len == 0) {
+    st->timeouts++;
+    dest->timeouts++;
+    // Stop waiting the full time for a responder which is gone
+    if (++dest->consec_timeouts >= 2) {
+      dest->rto_ms /= 2;
+      if (dest->rto_ms < IPMB_RTO_MIN_MS) {
+        dest->rto_ms = IPMB_RTO_MIN_MS;
+      }
+    }
+  } else {
+    st->responses++;
+    st->rx_bytes += len;
+    st->lat_hist[b]++;
+    st->lat_total_us += lat_us;
+    if (lat_us > st->lat_max_us) {
+      st->lat_max_us = lat_us;
+    }
+    dest->responses++;
+    dest_alive(dest);
+    if (lat_us > dest->lat_max_us) {
+      dest->lat_max_us = lat_us;
+    }
+    // srtt += (sample - srtt) / 8
+    err = (int32_t)(lat_us - dest->srtt_us);
+    dest->srtt_us = dest->srtt_us ? dest->srtt_us + err / 8 : lat_us;
+  }
+  pthread_mutex_unlock(&ipmb_stats.mutex);
+}
+
+static void
+stats_inc(uint64_t *counter, uint64_t val)
+{
+  pthread_mutex_lock(&ipmb_stats.mutex);
+  *counter += val;
+  pthread_mutex_unlock(&ipmb_stats.mutex);
 }
 
 static int
@@ -276,16 +502,21 @@ ipmb_write_satellite(int fd, uint8_t *buf, uint16_t len) {
   data.msgs = &msg;
   data.nmsgs = 1;
 
-  pthread_mutex_lock(&i2c_mutex);
-  while ((rc = ioctl(fd, I2C_RDWR, &data)) < 0 &&
-         ++i < I2C_RETRIES_MAX) {
+  // Don't hold the bus while backing off, a responder which NAKs
+  // must not delay requests to the others
+  while (1) {
+    pthread_mutex_lock(&i2c_mutex);
+    rc = ioctl(fd, I2C_RDWR, &data);
+    pthread_mutex_unlock(&i2c_mutex);
+    if (rc >= 0 || ++i >= I2C_RETRIES_MAX) {
+      break;
+    }
     msleep(I2C_RETRY_DELAY);
   }
   if (rc < 0) {
     OBMC_ERROR(errno, "Failed to send %u bytes to device @%#x",
                len, msg.addr);
   }
-  pthread_mutex_unlock(&i2c_mutex);
 
   return (rc < 0 ? -1 : 0);
 }
@@ -295,12 +526,14 @@ static void*
 ipmb_req_handler(void *args) {
   int bus_num = *((int*)args);
   mqd_t mq;
-  int i, fd;
+  int fd;
+#ifdef DEBUG
+  int i;
+#endif
   uint8_t rlen = 0;
   uint16_t tlen = 0;
   char mq_name_req[NAME_MAX];
-  uint16_t addr=0;
-  int ret=0;
+  uint16_t addr = ipmbd_config.bmc_addr;
 
   //Buffers for IPMB transport
   uint8_t rxbuf[IPMB_PKT_MAX_SIZE] = {0};
@@ -323,10 +556,6 @@ ipmb_req_handler(void *args) {
     return NULL;
   }
 
-  ret = pal_get_bmc_ipmb_slave_addr(&addr, bus_num);
-  if(ret < 0) {
-    return NULL;
-  }
 #ifdef DEBUG
   syslog(LOG_WARNING, "%s ADDR=%x BUS_ID=%x\n", __func__, addr, bus_num);
 #endif
@@ -350,6 +579,7 @@ ipmb_req_handler(void *args) {
     if (ipmbd_config.bic_update_enabled) {
       continue;
     }
+    stats_inc(&ipmb_stats.s.rx_requests, 1);
 
     pal_ipmb_processing(bus_num, rxbuf, rlen);
 
@@ -402,21 +632,12 @@ ipmb_req_handler(void *args) {
     }
 
     // Calculate Header Checksum
-    p_ipmb_res->hdr_cksum = p_ipmb_res->req_slave_addr +
-                           p_ipmb_res->netfn_lun;
-    p_ipmb_res->hdr_cksum = ZERO_CKSUM_CONST - p_ipmb_res->hdr_cksum;
+    p_ipmb_res->hdr_cksum = calc_cksum(txbuf, IPMB_DATA_OFFSET - 1);
 
     // Calculate Data Checksum
-    uint8_t data_chk_sum = p_ipmb_res->res_slave_addr +
-                            p_ipmb_res->seq_lun +
-                            p_ipmb_res->cmd +
-                            p_ipmb_res->cc;
-
-    for (i = 0; i < res_data_len; i++) {
-      data_chk_sum += p_ipmb_res->data[i];
-    }
-
-    p_ipmb_res->data[res_data_len] = ZERO_CKSUM_CONST - data_chk_sum;
+    p_ipmb_res->data[res_data_len] =
+      calc_cksum(&txbuf[IPMB_DATA_OFFSET],
+                 offsetof(ipmb_res_t, data) - IPMB_DATA_OFFSET + res_data_len);
     // include data-checksum +1
     size_t txlen = offsetof(ipmb_res_t, data) + res_data_len + 1;
 
@@ -466,10 +687,11 @@ ipmb_res_handler(void *args) {
     // Check the seq# of response
     index = p_res->seq_lun >> LUN_OFFSET;
 
-    if (seq_put(index, buf, len)) {
+    if (seq_put(p_res->res_slave_addr, index, buf, len)) {
       // Either the IPMB packet is corrupted or arrived late after client exits
-      OBMC_WARN("%s: WRONG packet received with seq #%d\n",
-                IPMBD_RES_THREAD, index);
+      stats_inc(&ipmb_stats.s.late, 1);
+      OBMC_WARN("%s: WRONG packet received with seq #%d from %#x\n",
+                IPMBD_RES_THREAD, index, p_res->res_slave_addr);
     }
 
 #ifdef DEBUG
@@ -522,17 +744,11 @@ ipmb_rx_handler(void *args) {
   };
   char mq_name_req[NAME_MAX], mq_name_res[NAME_MAX];
   int bus_num = *((int*)args);
-  uint16_t addr=0;
-  int ret=0;
+  uint16_t addr = ipmbd_config.bmc_addr;
   int poll_timeout = determine_poll_timeout();
 
   RX_VERBOSE("thread starts execution");
 
-  ret = pal_get_bmc_ipmb_slave_addr(&addr, bus_num);
-  if (ret < 0) {
-    return NULL;
-  }
-
 #ifdef DEBUG
   syslog(LOG_WARNING, "%s ADDR=%x BUS_ID=%x\n", __func__, addr, ipmbd_config.bus_id);
 #endif
@@ -674,76 +890,154 @@ ipmb_handle (int fd, unsigned char *request, unsigned short req_len,
        unsigned char *response, unsigned char *res_len)
 {
   ipmb_req_t *req = (ipmb_req_t *) request;
-  int i, ret;
-  int8_t index;
+  ipmb_dest_t *dest;
+  seq_buf_t *s;
   struct timespec ts;
-  uint16_t addr=0;
+  uint64_t start;
+  uint32_t rto;
+  int index;
+  int exp = SEQ_WAITING;
+
+  *res_len = 0;
+  if (req_len < MIN_IPMB_REQ_LEN || req_len > IPMB_PKT_MAX_SIZE) {
+    return;
+  }
 
-  // Allocate right sequence Number
-  index = seq_get_new(response);
-  if (index < 0) {
-    *res_len = 0;
-    return ;
+  dest = dest_get(req->res_slave_addr);
+  if (dest == NULL) {
+    return;
+  }
+  rto = dest_rto(dest);
+
+  // Per responder flow control, wait for a request in flight to finish
+  if (sem_trywait(&dest->window)) {
+    stats_inc(&ipmb_stats.s.throttled, 1);
+    deadline_ms(&ts, rto);
+    if (sem_wait_until(&dest->window, &ts)) {
+      IPMBD_VERBOSE("Too many requests in flight to %#x\n", dest->addr);
+      return;
+    }
   }
 
-  ret = pal_get_bmc_ipmb_slave_addr(&addr, ipmbd_config.bus_id);
-  if (ret < 0) {
-    return ;
+  // Allocate right sequence Number; holding a window credit there is
+  // always one free
+  index = seq_get_new(dest);
+  if (index < 0) {
+    sem_post(&dest->window);
+    return;
   }
+  s = &dest->seq[index];
+
 #ifdef DEBUG
-  syslog(LOG_WARNING, "%s ADDR=%x BUS_ID=%x\n", __func__, addr, ipmbd_config.bus_id);
+  syslog(LOG_WARNING, "%s ADDR=%x BUS_ID=%x\n", __func__, ipmbd_config.bmc_addr, ipmbd_config.bus_id);
 #endif
   req->seq_lun = index << LUN_OFFSET;
-  req->req_slave_addr = addr << 1;
+  req->req_slave_addr = ipmbd_config.bmc_addr << 1;
 
   // Calculate/update header Cksum
-  req->hdr_cksum = req->res_slave_addr +
-                   req->netfn_lun;
-  req->hdr_cksum = ZERO_CKSUM_CONST - req->hdr_cksum;
+  req->hdr_cksum = calc_cksum(request, IPMB_DATA_OFFSET - 1);
 
   // Calculate/update dataCksum
   // Note: dataCkSum byte is last byte
-  request[req_len-1] = 0;
-  for (i = IPMB_DATA_OFFSET; i < req_len-1; i++) {
-    request[req_len-1] += request[i];
-  }
-
-  request[req_len-1] = ZERO_CKSUM_CONST - request[req_len-1];
+  request[req_len-1] = calc_cksum(&request[IPMB_DATA_OFFSET],
+                                  req_len - IPMB_DATA_OFFSET - 1);
 
   if (pal_ipmb_processing(ipmbd_config.bus_id, request, req_len)) {
     goto ipmb_handle_out;
   }
 
   // Send request over i2c bus
+  start = now_us();
   if (ipmb_write_satellite(fd, request, req_len)) {
+    stats_inc(&ipmb_stats.s.errors, 1);
     goto ipmb_handle_out;
   }
+  stats_sent(dest, req_len);
 
   // Wait on semaphore for that sequence Number
-  clock_gettime(CLOCK_REALTIME, &ts);
-
-  ts.tv_sec += TIMEOUT_IPMB;
-
-  ret = sem_timedwait(&ipmb_seq_buf.seq[index].seq_sem, &ts);
-  if (ret == -1) {
-    IPMBD_VERBOSE("No response for sequence number: %d\n", index);
-    *res_len = 0;
+  deadline_ms(&ts, rto);
+  if (sem_wait_until(&s->seq_sem, &ts) == -1) {
+    if (__atomic_compare_exchange_n(&s->state, &exp, SEQ_FREE, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      IPMBD_VERBOSE("No response for sequence number: %d from %#x (%u ms)\n",
+                    index, dest->addr, rto);
+      stats_done(dest, now_us() - start, 0);
+      goto ipmb_handle_out;
+    }
+    // The response is being stored right now
+    sem_wait(&s->seq_sem);
   }
 
-ipmb_handle_out:
   // Reply to user with data
-  pthread_mutex_lock(&ipmb_seq_buf.seq_mutex);
-  *res_len = ipmb_seq_buf.seq[index].len;
+  memcpy(response, s->buf, s->len);
+  *res_len = s->len;
+  stats_done(dest, now_us() - start, s->len);
 
-  ipmb_seq_buf.seq[index].in_use = false;
-  ipmb_seq_buf.seq[index].p_buf = NULL;
-  pthread_mutex_unlock(&ipmb_seq_buf.seq_mutex);
+ipmb_handle_out:
+  seq_release(dest, index);
 
   pal_ipmb_finished(ipmbd_config.bus_id, request, *res_len);
 
   return;
 }
 
+static int
+ctl_handler(client_t *cli) {
+  uint8_t cmd;
+  size_t len = sizeof(cmd);
+  ipmbd_stats_t st;
+  struct timespec now;
+  int i;
+
+  if (ipc_recv_req(cli, &cmd, &len, TIMEOUT_IPMB) || len < 1) {
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  pthread_mutex_lock(&ipmb_stats.mutex);
+  st = ipmb_stats.s;
+  st.version = IPMBD_STATS_VERSION;
+  st.bus = ipmbd_config.bus_id;
+  st.window = ipmbd_config.dest_window;
+  st.elapsed_s = now.tv_sec - ipmb_stats.since.tv_sec;
+  for (i = 0; i < IPMB_DEST_MAX && st.num_dests < IPMBD_STATS_MAX_DEST; i++) {
+    ipmb_dest_t *d = dest_find(i << 1);
+    ipmbd_dest_stats_t *ds = &st.dests[st.num_dests];
+    if (d == NULL) {
+      continue;
+    }
+    ds->addr = d->addr;
+    ds->inflight = __builtin_popcountll(
+        __atomic_load_n(&d->seq_map, __ATOMIC_RELAXED));
+    ds->rto_ms = d->rto_ms;
+    ds->srtt_us = d->srtt_us;
+    ds->lat_max_us = d->lat_max_us;
+    ds->requests = d->requests;
+    ds->responses = d->responses;
+    ds->timeouts = d->timeouts;
+    st.num_dests++;
+  }
+
+  // Reset after taking the snapshot, the caller still sees the totals
+  if (cmd == IPMBD_CTL_RESET_STATS) {
+    memset(&ipmb_stats.s, 0, sizeof(ipmb_stats.s));
+    ipmb_stats.s.inflight = st.inflight;
+    ipmb_stats.since = now;
+    for (i = 0; i < IPMB_DEST_MAX; i++) {
+      ipmb_dest_t *d = dest_find(i << 1);
+      if (d) {
+        d->requests = d->responses = d->timeouts = 0;
+        d->lat_max_us = 0;
+      }
+    }
+  }
+  pthread_mutex_unlock(&ipmb_stats.mutex);
+
+  if (cmd != IPMBD_CTL_GET_STATS && cmd != IPMBD_CTL_RESET_STATS) {
+    return -1;
+  }
+  return ipc_send_resp(cli, (uint8_t *)&st, sizeof(st));
+}
 
 struct ipmb_svc_cookie {
   int i2c_fd;
@@ -800,12 +1094,19 @@ start_ipmb_lib_handler(int bus_num) {
   IPMBD_VERBOSE("bic opened successfully, fd=%d", svc->i2c_fd);
 
   ipc_name_gen(sock_path, sizeof(sock_path), SOCK_PATH_IPMB, bus_num);
-  if (ipc_start_svc(sock_path, conn_handler, SEQ_NUM_MAX, svc, NULL)) {
+  if (ipc_start_svc_ex(sock_path, conn_handler, IPMB_SVC_WORKERS,
+                       IPMB_SVC_WORKERS, svc, NULL)) {
     OBMC_ERROR(errno, "failed to start svc thread");
     free(svc);
     return -1;
   }
 
+  // Statistics for ipmbd-util, not fatal
+  ipc_name_gen(sock_path, sizeof(sock_path), IPMBD_CTL_ENDPOINT, bus_num);
+  if (ipc_start_svc(sock_path, ctl_handler, 1, NULL, NULL)) {
+    OBMC_ERROR(errno, "failed to start control svc thread");
+  }
+
   return 0;
 }
 
@@ -820,6 +1121,7 @@ dump_usage(const char *prog_name)
     {"-h|--help", "print this help message"},
     {"-v|--verbose", "enable verbose logging"},
     {"-u|--enable-bic-update", "enable/allow bic update"},
+    {"-w|--window <n>", "requests in flight per responder (1-64)"},
     {NULL, NULL},
   };
 
@@ -836,12 +1138,13 @@ parse_cmdline_args(int argc, char* const argv[])
     {"help",              no_argument, NULL, 'h'},
     {"verbose",           no_argument, NULL, 'v'},
     {"enable-bic-update", no_argument, NULL, 'u'},
+    {"window",      required_argument, NULL, 'w'},
     {NULL,               0,           NULL, 0},
   };
 
   while (1) {
     int opt_index = 0;
-    int ret = getopt_long(argc, argv, "hvu", long_opts, &opt_index);
+    int ret = getopt_long(argc, argv, "hvuw:", long_opts, &opt_index);
     if (ret == -1)
       break; /* end of arguments */
 
@@ -858,6 +1161,15 @@ parse_cmdline_args(int argc, char* const argv[])
       ipmbd_config.bic_update_enabled = true;
       break;
 
+    case 'w':
+      ipmbd_config.dest_window = (int)strtoul(optarg, NULL, 0);
+      if (ipmbd_config.dest_window < 1 ||
+          ipmbd_config.dest_window > SEQ_NUM_MAX) {
+        fprintf(stderr, "Error: window must be 1-%d\n", SEQ_NUM_MAX);
+        return -1;
+      }
+      break;
+
     default:
       return -1;
     }
@@ -960,8 +1272,14 @@ main(int argc, char * const argv[]) {
   }
   IPMBD_VERBOSE("message queue %s created", mq_name_res);
 
-  ipmb_seq_buf_init();
-  IPMBD_VERBOSE("sequence buffer initialized");
+  if (pal_get_bmc_ipmb_slave_addr(&ipmbd_config.bmc_addr,
+                                  ipmbd_config.bus_id) < 0) {
+    rc = -1;
+    OBMC_WARN("failed to get bmc slave address on bus %d",
+              ipmbd_config.bus_id);
+    goto cleanup;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ipmb_stats.since);
 
   for (i = 0; i < ARRAY_SIZE(ipmb_threads); i++) {
     IPMBD_VERBOSE("creating thread %s", ipmb_threads[i].name);
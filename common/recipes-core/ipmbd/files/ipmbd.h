@@ -0,0 +1,75 @@
+/*
+ * Copyright 2020-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __IPMBD_H__
+#define __IPMBD_H__
+
+#include <stdint.h>
+
+/*
+ * Control endpoint of ipmbd, used by ipmbd-util. A request is a single
+ * command byte, GET_STATS answers with ipmbd_stats_t.
+ */
+#define IPMBD_CTL_ENDPOINT "ipmbd_ctl"
+
+#define IPMBD_CTL_GET_STATS   0x01
+#define IPMBD_CTL_RESET_STATS 0x02
+
+#define IPMBD_STATS_VERSION   1
+#define IPMBD_LAT_BUCKETS     24 /* bucket i: latency < 2^(i+1) us */
+#define IPMBD_STATS_MAX_DEST  32
+
+typedef struct {
+  uint8_t  addr;       /* responder slave address, 8-bit form */
+  uint8_t  inflight;
+  uint16_t reserved;
+  uint32_t rto_ms;     /* current response timeout */
+  uint32_t srtt_us;    /* smoothed response time */
+  uint32_t lat_max_us;
+  uint64_t requests;
+  uint64_t responses;
+  uint64_t timeouts;
+} ipmbd_dest_stats_t;
+
+typedef struct {
+  uint32_t version;
+  uint32_t bus;
+  uint32_t elapsed_s;  /* since start or last reset */
+  uint32_t window;     /* requests in flight allowed per responder */
+  uint32_t inflight;
+  uint32_t inflight_max;
+  /* requests from BMC applications to responders on the bus */
+  uint64_t requests;
+  uint64_t responses;
+  uint64_t timeouts;
+  uint64_t errors;     /* bus write failures */
+  uint64_t throttled;  /* had to wait for the responder window */
+  uint64_t late;       /* responses nobody was waiting for */
+  uint64_t tx_bytes;
+  uint64_t rx_bytes;
+  uint64_t lat_total_us;
+  uint64_t lat_max_us;
+  uint64_t lat_hist[IPMBD_LAT_BUCKETS];
+  /* requests received from the bus and served by ipmid */
+  uint64_t rx_requests;
+  uint32_t num_dests;
+  uint32_t reserved;
+  ipmbd_dest_stats_t dests[IPMBD_STATS_MAX_DEST];
+} ipmbd_stats_t;
+
+#endif /* __IPMBD_H__ */
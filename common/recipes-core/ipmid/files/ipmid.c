@@ -20,6 +20,7 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#define _GNU_SOURCE     /* To get pthread_rwlockattr_setkind_np */
 #include "sdr.h"
 #include "sel.h"
 #include "fruid.h"
@@ -30,6 +31,8 @@
 #include <syslog.h>
 #include <string.h>
 #include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -148,20 +151,6 @@ static char *drive_info_key[] =
   "wwn"
 };
 
-// TODO: Based on performance testing results, might need fine grained locks
-// Since the global data is specific to a NetFunction, adding locs at NetFn level
-static pthread_mutex_t m_chassis;
-static pthread_mutex_t m_sensor;
-static pthread_mutex_t m_app;
-static pthread_mutex_t m_storage;
-static pthread_mutex_t m_transport;
-static pthread_mutex_t m_oem;
-static pthread_mutex_t m_oem_storage;
-static pthread_mutex_t m_oem_1s;
-static pthread_mutex_t m_oem_usb_dbg;
-static pthread_mutex_t m_oem_q;
-static pthread_mutex_t m_oem_zion;
-
 extern int plat_udbg_get_frame_info(uint8_t *num);
 extern int plat_udbg_get_updated_frames(uint8_t *count, uint8_t *buffer);
 extern int plat_udbg_get_post_desc(uint8_t index, uint8_t *next, uint8_t phase,  uint8_t *end, uint8_t *length, uint8_t *buffer);
@@ -381,7 +370,6 @@ ipmi_handle_chassis (unsigned char *request, unsigned char req_len,
   ipmi_res_t *res = (ipmi_res_t *) response;
   unsigned char cmd = req->cmd;
 
-  pthread_mutex_lock(&m_chassis);
   switch (cmd)
   {
     case CMD_CHASSIS_GET_STATUS:
@@ -413,7 +401,6 @@ ipmi_handle_chassis (unsigned char *request, unsigned char req_len,
       res->cc = CC_INVALID_CMD;
       break;
   }
-  pthread_mutex_unlock(&m_chassis);
 }
 
 /*
@@ -522,7 +509,6 @@ ipmi_handle_sensor(unsigned char *request, unsigned char req_len,
   ipmi_res_t *res = (ipmi_res_t *) response;
   unsigned char cmd = req->cmd;
 
-  pthread_mutex_lock(&m_sensor);
   switch (cmd)
   {
     case CMD_SENSOR_PLAT_EVENT_MSG:
@@ -538,7 +524,6 @@ ipmi_handle_sensor(unsigned char *request, unsigned char req_len,
       res->cc = CC_INVALID_CMD;
       break;
   }
-  pthread_mutex_unlock(&m_sensor);
 }
 
 /*
@@ -1153,7 +1138,6 @@ ipmi_handle_app (unsigned char *request, unsigned char req_len,
   ipmi_res_t *res = (ipmi_res_t *) response;
   unsigned char cmd = req->cmd;
 
-  pthread_mutex_lock(&m_app);
   switch (cmd)
   {
     case CMD_APP_GET_DEVICE_ID:
@@ -1214,7 +1198,6 @@ ipmi_handle_app (unsigned char *request, unsigned char req_len,
       res->cc = CC_INVALID_CMD;
       break;
   }
-  pthread_mutex_unlock(&m_app);
 }
 
 /*
@@ -1635,7 +1618,6 @@ ipmi_handle_storage (unsigned char *request, unsigned char req_len,
   res->cc = CC_SUCCESS;
   *res_len = 0;
 
-  pthread_mutex_lock(&m_storage);
   switch (cmd)
   {
     case CMD_STORAGE_GET_FRUID_INFO:
@@ -1688,7 +1670,6 @@ ipmi_handle_storage (unsigned char *request, unsigned char req_len,
       break;
   }
 
-  pthread_mutex_unlock(&m_storage);
   return;
 }
 
@@ -1791,6 +1772,9 @@ transport_get_lan_config (unsigned char *request, unsigned char *response,
   ipmi_res_t *res = (ipmi_res_t *) response;
   unsigned char *data = &res->data[0];
   unsigned char param = req->data[1];
+  // Runs under the shared transport lock, the addresses refreshed by
+  // plat_lan_init() go to a private copy
+  lan_config_t lan = g_lan_config;
 
   // Fill the response with default values
   res->cc = CC_SUCCESS;
@@ -1809,16 +1793,16 @@ transport_get_lan_config (unsigned char *request, unsigned char *response,
       data += SIZE_AUTH_ENABLES;
       break;
     case LAN_PARAM_IP_ADDR:
-      plat_lan_init(&g_lan_config);
-      memcpy(data, g_lan_config.ip_addr, SIZE_IP_ADDR);
+      plat_lan_init(&lan);
+      memcpy(data, lan.ip_addr, SIZE_IP_ADDR);
       data += SIZE_IP_ADDR;
       break;
     case LAN_PARAM_IP_SRC:
       *data++ = g_lan_config.ip_src;
       break;
     case LAN_PARAM_MAC_ADDR:
-      plat_lan_init(&g_lan_config);
-      memcpy(data, g_lan_config.mac_addr, SIZE_MAC_ADDR);
+      plat_lan_init(&lan);
+      memcpy(data, lan.mac_addr, SIZE_MAC_ADDR);
       data += SIZE_MAC_ADDR;
       break;
     case LAN_PARAM_NET_MASK:
@@ -1875,16 +1859,16 @@ transport_get_lan_config (unsigned char *request, unsigned char *response,
       data += SIZE_DEST_ADDR;
       break;
     case LAN_PARAM_IP6_ADDR:
-      plat_lan_init(&g_lan_config);
-      memcpy(data, g_lan_config.ip6_addr, SIZE_IP6_ADDR);
+      plat_lan_init(&lan);
+      memcpy(data, lan.ip6_addr, SIZE_IP6_ADDR);
       data += SIZE_IP6_ADDR;
       break;
    case LAN_PARAM_IP6_DYNAMIC_ADDR:
-      plat_lan_init(&g_lan_config);
+      plat_lan_init(&lan);
       data[0] = 0; // Selector
       data[1] = 0x02; // DHCPv6
-      memcpy(&data[2], g_lan_config.ip6_addr, SIZE_IP6_ADDR);
-      data[18] = g_lan_config.ip6_prefix;
+      memcpy(&data[2], lan.ip6_addr, SIZE_IP6_ADDR);
+      data[18] = lan.ip6_prefix;
       data[19] = 0x00; // Active
       data += SIZE_IP6_ADDR + 4;
       break;
@@ -1959,7 +1943,6 @@ ipmi_handle_transport (unsigned char *request, unsigned char req_len,
   ipmi_res_t *res = (ipmi_res_t *) response;
   unsigned char cmd = req->cmd;
 
-  pthread_mutex_lock(&m_transport);
   switch (cmd)
   {
     case CMD_TRANSPORT_SET_LAN_CONFIG:
@@ -1975,7 +1958,6 @@ ipmi_handle_transport (unsigned char *request, unsigned char req_len,
       res->cc = CC_INVALID_CMD;
       break;
   }
-  pthread_mutex_unlock(&m_transport);
 }
 
 /*
@@ -3337,7 +3319,6 @@ ipmi_handle_oem (unsigned char *request, unsigned char req_len,
 
   unsigned char cmd = req->cmd;
 
-  pthread_mutex_lock(&m_oem);
   switch (cmd)
   {
     case CMD_OEM_ADD_RAS_SEL:
@@ -3461,7 +3442,6 @@ ipmi_handle_oem (unsigned char *request, unsigned char req_len,
       res->cc = CC_INVALID_CMD;
       break;
   }
-  pthread_mutex_unlock(&m_oem);
 }
 
 static void
@@ -3473,7 +3453,6 @@ ipmi_handle_oem_storage (unsigned char *request, unsigned char req_len,
 
   unsigned char cmd = req->cmd;
 
-  pthread_mutex_lock(&m_oem_storage);
   switch (cmd)
   {
     case CMD_OEM_STOR_ADD_STRING_SEL:
@@ -3483,7 +3462,6 @@ ipmi_handle_oem_storage (unsigned char *request, unsigned char req_len,
       res->cc = CC_INVALID_CMD;
       break;
   }
-  pthread_mutex_unlock(&m_oem_storage);
 }
 
 static void
@@ -3494,7 +3472,6 @@ ipmi_handle_oem_q (unsigned char *request, unsigned char req_len,
   ipmi_res_t *res = (ipmi_res_t *) response;
 
   unsigned char cmd = req->cmd;
-  pthread_mutex_lock(&m_oem_q);
   switch (cmd)
   {
     case CMD_OEM_Q_SET_PROC_INFO:
@@ -3525,7 +3502,6 @@ ipmi_handle_oem_q (unsigned char *request, unsigned char req_len,
       res->cc = CC_INVALID_CMD;
       break;
   }
-  pthread_mutex_unlock(&m_oem_q);
 }
 
 static void
@@ -3614,17 +3590,14 @@ ipmi_handle_oem_1s(unsigned char *request, unsigned char req_len,
 
   unsigned char cmd = req->cmd;
 
-  pthread_mutex_lock(&m_oem_1s);
   switch (cmd)
   {
     case CMD_OEM_1S_MSG_IN:
       // As all bridge in messages are IPMI request
       // all IPMI request will be process by ipmi_handle
       // which will "properly" serialize the processing according to netfn
-      // Thus it is not necessary to serialize processing of MSG-IN.
-      pthread_mutex_unlock(&m_oem_1s);
+      // Thus MSG-IN itself takes no lock (see g_ipmi_cmds).
       oem_1s_handle_ipmb_req(request, req_len, response, res_len);
-      pthread_mutex_lock(&m_oem_1s);
       break;
     case CMD_OEM_1S_INTR:
 #ifdef DEBUG
@@ -3731,7 +3704,6 @@ ipmi_handle_oem_1s(unsigned char *request, unsigned char req_len,
       *res_len = 3;
       break;
   }
-  pthread_mutex_unlock(&m_oem_1s);
 }
 
 static void
@@ -3923,7 +3895,6 @@ ipmi_handle_oem_usb_dbg(unsigned char *request, unsigned char req_len,
 
   unsigned char cmd = req->cmd;
 
-  pthread_mutex_lock(&m_oem_usb_dbg);
   switch (cmd)
   {
     case CMD_OEM_USB_DBG_GET_FRAME_INFO:
@@ -3950,7 +3921,6 @@ ipmi_handle_oem_usb_dbg(unsigned char *request, unsigned char req_len,
       *res_len = 3;
       break;
   }
-  pthread_mutex_unlock(&m_oem_usb_dbg);
 }
 
 static void
@@ -3974,7 +3944,6 @@ ipmi_handle_oem_zion(unsigned char *request, unsigned char req_len,
 
   unsigned char cmd = req->cmd;
 
-  pthread_mutex_lock(&m_oem_zion);
   switch (cmd)
   {
     case CMD_OEM_ZION_SET_USB_PATH:
@@ -3986,7 +3955,313 @@ ipmi_handle_oem_zion(unsigned char *request, unsigned char req_len,
       *res_len = 3;
       break;
   }
-  pthread_mutex_unlock(&m_oem_zion);
+}
+
+/*
+ * Command locking
+ *
+ * Every command declares in g_ipmi_cmds which state it touches (a lock
+ * domain) and how (mode). Commands of different domains never wait on
+ * each other, readers of a domain run in parallel, and per-slot commands
+ * only wait for commands of the same payload_id, so a slow OEM command
+ * from one slot does not hold up the other slots. A command missing from
+ * the table takes the CMD_ANY entry of its NetFn.
+ */
+enum {
+  LOCK_DOM_CHASSIS,
+  LOCK_DOM_SENSOR,
+  LOCK_DOM_APP,
+  LOCK_DOM_STORAGE,
+  LOCK_DOM_SEL,
+  LOCK_DOM_TRANSPORT,
+  LOCK_DOM_DCMI,
+  LOCK_DOM_OEM,
+  LOCK_DOM_OEM_STORAGE,
+  LOCK_DOM_OEM_Q,
+  LOCK_DOM_OEM_1S,
+  LOCK_DOM_OEM_USB_DBG,
+  LOCK_DOM_OEM_ZION,
+  LOCK_DOM_MAX,
+};
+
+enum {
+  LOCK_NONE,         // touches no state of ipmid, or locks it itself
+  LOCK_SHARED,       // reads the state of the domain
+  LOCK_EXCL,         // writes the state of the domain
+  LOCK_SLOT_SHARED,  // reads the state of its payload_id
+  LOCK_SLOT_EXCL,    // writes the state of its payload_id
+};
+
+#define CMD_ANY 0x100
+
+// Latency histogram: bucket i counts commands which took less than
+// 2^(i+1) us, the last bucket all the slower ones.
+#define LAT_BUCKETS 20
+#define IPMID_STATS_FILE "/tmp/ipmid_stats"
+
+typedef struct {
+  uint32_t count;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint64_t wait_us;
+  uint32_t hist[LAT_BUCKETS];
+} cmd_stats_t;
+
+typedef struct {
+  uint8_t netfn;
+  uint16_t cmd;
+  uint8_t domain;
+  uint8_t mode;
+  cmd_stats_t stats;
+} ipmi_cmd_t;
+
+static ipmi_cmd_t g_ipmi_cmds[] = {
+  {NETFN_CHASSIS_REQ, CMD_ANY, LOCK_DOM_CHASSIS, LOCK_EXCL},
+  {NETFN_CHASSIS_REQ, CMD_CHASSIS_GET_STATUS, LOCK_DOM_CHASSIS, LOCK_SLOT_SHARED},
+  {NETFN_CHASSIS_REQ, CMD_CHASSIS_CONTROL, LOCK_DOM_CHASSIS, LOCK_SLOT_EXCL},
+  {NETFN_CHASSIS_REQ, CMD_CHASSIS_IDENTIFY, LOCK_DOM_CHASSIS, LOCK_SLOT_EXCL},
+  {NETFN_CHASSIS_REQ, CMD_CHASSIS_SET_POWER_RESTORE_POLICY, LOCK_DOM_CHASSIS, LOCK_SLOT_EXCL},
+  {NETFN_CHASSIS_REQ, CMD_CHASSIS_GET_SYSTEM_RESTART_CAUSE, LOCK_DOM_CHASSIS, LOCK_SLOT_SHARED},
+
+  // Platform events go to the SEL, same as Add SEL Entry
+  {NETFN_SENSOR_REQ, CMD_ANY, LOCK_DOM_SENSOR, LOCK_EXCL},
+  {NETFN_SENSOR_REQ, CMD_SENSOR_PLAT_EVENT_MSG, LOCK_DOM_SEL, LOCK_SLOT_EXCL},
+  {NETFN_SENSOR_REQ, CMD_SENSOR_ALERT_IMMEDIATE_MSG, LOCK_DOM_SEL, LOCK_SLOT_EXCL},
+  {NETFN_SENSOR_REQ, CMD_SENSOR_SET_SENSOR_READING, LOCK_DOM_SENSOR, LOCK_SLOT_EXCL},
+
+  // g_sys_info_params is shared by all slots, and also written by Get
+  {NETFN_APP_REQ, CMD_ANY, LOCK_DOM_APP, LOCK_EXCL},
+  {NETFN_APP_REQ, CMD_APP_GET_DEVICE_ID, LOCK_DOM_APP, LOCK_SHARED},
+  {NETFN_APP_REQ, CMD_APP_GET_SELFTEST_RESULTS, LOCK_DOM_APP, LOCK_SHARED},
+  {NETFN_APP_REQ, CMD_APP_GET_DEVICE_GUID, LOCK_DOM_APP, LOCK_SLOT_SHARED},
+  {NETFN_APP_REQ, CMD_APP_GET_SYSTEM_GUID, LOCK_DOM_APP, LOCK_SLOT_SHARED},
+  {NETFN_APP_REQ, CMD_APP_RESET_WDT, LOCK_DOM_APP, LOCK_NONE},
+  {NETFN_APP_REQ, CMD_APP_SET_WDT, LOCK_DOM_APP, LOCK_NONE},
+  {NETFN_APP_REQ, CMD_APP_GET_WDT, LOCK_DOM_APP, LOCK_NONE},
+  {NETFN_APP_REQ, CMD_APP_SET_GLOBAL_ENABLES, LOCK_DOM_APP, LOCK_SLOT_EXCL},
+  {NETFN_APP_REQ, CMD_APP_GET_GLOBAL_ENABLES, LOCK_DOM_APP, LOCK_SLOT_SHARED},
+  {NETFN_APP_REQ, CMD_APP_CLEAR_MESSAGE_FLAGS, LOCK_DOM_APP, LOCK_NONE},
+  {NETFN_APP_REQ, CMD_APP_GET_SYS_INTF_CAPS, LOCK_DOM_APP, LOCK_SHARED},
+
+  {NETFN_STORAGE_REQ, CMD_ANY, LOCK_DOM_STORAGE, LOCK_EXCL},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_GET_FRUID_INFO, LOCK_DOM_STORAGE, LOCK_SHARED},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_READ_FRUID_DATA, LOCK_DOM_STORAGE, LOCK_SHARED},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_GET_SEL_INFO, LOCK_DOM_SEL, LOCK_SLOT_SHARED},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_RSV_SEL, LOCK_DOM_SEL, LOCK_SLOT_EXCL},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_ADD_SEL, LOCK_DOM_SEL, LOCK_SLOT_EXCL},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_GET_SEL, LOCK_DOM_SEL, LOCK_SLOT_SHARED},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_CLR_SEL, LOCK_DOM_SEL, LOCK_SLOT_EXCL},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_GET_SEL_TIME, LOCK_DOM_STORAGE, LOCK_NONE},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_GET_SEL_UTC, LOCK_DOM_STORAGE, LOCK_NONE},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_GET_SDR_INFO, LOCK_DOM_STORAGE, LOCK_SHARED},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_RSV_SDR, LOCK_DOM_STORAGE, LOCK_SLOT_EXCL},
+  {NETFN_STORAGE_REQ, CMD_STORAGE_GET_SDR, LOCK_DOM_STORAGE, LOCK_SLOT_SHARED},
+
+  {NETFN_TRANSPORT_REQ, CMD_ANY, LOCK_DOM_TRANSPORT, LOCK_EXCL},
+  {NETFN_TRANSPORT_REQ, CMD_TRANSPORT_GET_LAN_CONFIG, LOCK_DOM_TRANSPORT, LOCK_SHARED},
+  {NETFN_TRANSPORT_REQ, CMD_TRANSPORT_GET_SOL_CONFIG, LOCK_DOM_TRANSPORT, LOCK_SHARED},
+
+  {NETFN_DCMI_REQ, CMD_ANY, LOCK_DOM_DCMI, LOCK_NONE},
+
+  // Almost all OEM commands only deal with their own slot
+  {NETFN_OEM_REQ, CMD_ANY, LOCK_DOM_OEM, LOCK_SLOT_EXCL},
+  {NETFN_OEM_REQ, CMD_OEM_GET_PROC_INFO, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_DIMM_INFO, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_BOOT_ORDER, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_TPM_PRESENCE, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_PLAT_INFO, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_PCIE_CONFIG, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_BOARD_ID, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_80PORT_RECORD, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_FW_INFO, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_BIOS_FLASH_INFO, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_PCIE_PORT_CONFIG, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_GET_80_PORT_DWORD_BUFFER, LOCK_DOM_OEM, LOCK_SLOT_SHARED},
+  {NETFN_OEM_REQ, CMD_OEM_SLED_AC_CYCLE, LOCK_DOM_OEM, LOCK_EXCL},
+  {NETFN_OEM_REQ, CMD_OEM_BBV_POWER_CYCLE, LOCK_DOM_OEM, LOCK_EXCL},
+
+  {NETFN_OEM_STORAGE_REQ, CMD_ANY, LOCK_DOM_OEM_STORAGE, LOCK_EXCL},
+
+  {NETFN_OEM_Q_REQ, CMD_ANY, LOCK_DOM_OEM_Q, LOCK_SLOT_EXCL},
+  {NETFN_OEM_Q_REQ, CMD_OEM_Q_GET_PROC_INFO, LOCK_DOM_OEM_Q, LOCK_SLOT_SHARED},
+  {NETFN_OEM_Q_REQ, CMD_OEM_Q_GET_DIMM_INFO, LOCK_DOM_OEM_Q, LOCK_SLOT_SHARED},
+  {NETFN_OEM_Q_REQ, CMD_OEM_Q_GET_DRIVE_INFO, LOCK_DOM_OEM_Q, LOCK_SLOT_SHARED},
+  {NETFN_OEM_Q_REQ, CMD_OEM_Q_GET_SMU_PSP_VER, LOCK_DOM_OEM_Q, LOCK_SLOT_SHARED},
+
+  // MSG-IN carries a request which is locked on its own by ipmi_handle
+  {NETFN_OEM_1S_REQ, CMD_ANY, LOCK_DOM_OEM_1S, LOCK_SLOT_EXCL},
+  {NETFN_OEM_1S_REQ, CMD_OEM_1S_MSG_IN, LOCK_DOM_OEM_1S, LOCK_NONE},
+
+  {NETFN_OEM_USB_DBG_REQ, CMD_ANY, LOCK_DOM_OEM_USB_DBG, LOCK_EXCL},
+
+  {NETFN_OEM_ZION_REQ, CMD_ANY, LOCK_DOM_OEM_ZION, LOCK_EXCL},
+};
+
+// Bulk SEL reads, which are not IPMI commands
+static ipmi_cmd_t g_sel_range_cmd = {0, CMD_ANY, LOCK_DOM_SEL, LOCK_SLOT_SHARED};
+
+// Index + 1 in g_ipmi_cmds of each NetFn/Cmd, 0 if the NetFn is unknown
+static uint8_t g_cmd_idx[64][256];
+
+static pthread_rwlock_t g_dom_lock[LOCK_DOM_MAX];
+static pthread_rwlock_t g_slot_lock[LOCK_DOM_MAX][MAX_NODES+1];
+static pthread_mutex_t m_stats = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+ipmi_cmd_init(void)
+{
+  pthread_rwlockattr_t attr;
+  int i, j;
+
+  // Writers must not be starved by a steady flow of Get commands
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr,
+      PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  for (i = 0; i < LOCK_DOM_MAX; i++) {
+    pthread_rwlock_init(&g_dom_lock[i], &attr);
+    for (j = 0; j <= MAX_NODES; j++) {
+      pthread_rwlock_init(&g_slot_lock[i][j], &attr);
+    }
+  }
+  pthread_rwlockattr_destroy(&attr);
+
+  for (i = 0; i < sizeof(g_ipmi_cmds)/sizeof(g_ipmi_cmds[0]); i++) {
+    if (g_ipmi_cmds[i].cmd == CMD_ANY) {
+      memset(g_cmd_idx[g_ipmi_cmds[i].netfn], i + 1, 256);
+    }
+  }
+  for (i = 0; i < sizeof(g_ipmi_cmds)/sizeof(g_ipmi_cmds[0]); i++) {
+    if (g_ipmi_cmds[i].cmd != CMD_ANY) {
+      g_cmd_idx[g_ipmi_cmds[i].netfn][g_ipmi_cmds[i].cmd] = i + 1;
+    }
+  }
+}
+
+static void
+ipmi_cmd_lock(ipmi_cmd_t *c, int slot)
+{
+  switch (c->mode) {
+    case LOCK_SHARED:
+      pthread_rwlock_rdlock(&g_dom_lock[c->domain]);
+      break;
+    case LOCK_EXCL:
+      pthread_rwlock_wrlock(&g_dom_lock[c->domain]);
+      break;
+    case LOCK_SLOT_SHARED:
+      pthread_rwlock_rdlock(&g_dom_lock[c->domain]);
+      pthread_rwlock_rdlock(&g_slot_lock[c->domain][slot]);
+      break;
+    case LOCK_SLOT_EXCL:
+      pthread_rwlock_rdlock(&g_dom_lock[c->domain]);
+      pthread_rwlock_wrlock(&g_slot_lock[c->domain][slot]);
+      break;
+    default:
+      break;
+  }
+}
+
+static void
+ipmi_cmd_unlock(ipmi_cmd_t *c, int slot)
+{
+  switch (c->mode) {
+    case LOCK_SLOT_SHARED:
+    case LOCK_SLOT_EXCL:
+      pthread_rwlock_unlock(&g_slot_lock[c->domain][slot]);
+      pthread_rwlock_unlock(&g_dom_lock[c->domain]);
+      break;
+    case LOCK_SHARED:
+    case LOCK_EXCL:
+      pthread_rwlock_unlock(&g_dom_lock[c->domain]);
+      break;
+    default:
+      break;
+  }
+}
+
+static uint64_t
+ipmi_time_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+ipmi_cmd_account(ipmi_cmd_t *c, uint64_t wait_us, uint64_t lat_us)
+{
+  cmd_stats_t *st = &c->stats;
+  int b = 0;
+
+  while (b < LAT_BUCKETS - 1 && lat_us >= (2ULL << b)) {
+    b++;
+  }
+
+  pthread_mutex_lock(&m_stats);
+  st->count++;
+  st->total_us += lat_us;
+  st->wait_us += wait_us;
+  if (lat_us > st->max_us) {
+    st->max_us = lat_us;
+  }
+  st->hist[b]++;
+  pthread_mutex_unlock(&m_stats);
+}
+
+// Write the statistics of every command seen so far to IPMID_STATS_FILE
+static void
+ipmi_stats_dump(void)
+{
+  char tmp[] = IPMID_STATS_FILE ".tmp";
+  cmd_stats_t st;
+  FILE *fp;
+  int i, b;
+
+  fp = fopen(tmp, "w");
+  if (fp == NULL) {
+    syslog(LOG_WARNING, "ipmid: cannot create %s", tmp);
+    return;
+  }
+  fprintf(fp, "# netfn cmd count avg_us max_us avg_wait_us"
+              " hist(<2us <4us ... >=%uus)\n", 1U << (LAT_BUCKETS - 1));
+  for (i = 0; i < sizeof(g_ipmi_cmds)/sizeof(g_ipmi_cmds[0]); i++) {
+    pthread_mutex_lock(&m_stats);
+    st = g_ipmi_cmds[i].stats;
+    pthread_mutex_unlock(&m_stats);
+    if (st.count == 0) {
+      continue;
+    }
+    if (g_ipmi_cmds[i].cmd == CMD_ANY) {
+      fprintf(fp, "0x%02x *", g_ipmi_cmds[i].netfn);
+    } else {
+      fprintf(fp, "0x%02x 0x%02x", g_ipmi_cmds[i].netfn, g_ipmi_cmds[i].cmd);
+    }
+    fprintf(fp, " %u %llu %u %llu", st.count,
+            (unsigned long long)(st.total_us / st.count), st.max_us,
+            (unsigned long long)(st.wait_us / st.count));
+    for (b = 0; b < LAT_BUCKETS; b++) {
+      fprintf(fp, " %u", st.hist[b]);
+    }
+    fprintf(fp, "\n");
+  }
+  fclose(fp);
+  rename(tmp, IPMID_STATS_FILE);
+}
+
+// Dumps the statistics whenever ipmid gets SIGUSR1
+static void *
+stats_handler(void *arg)
+{
+  sigset_t *set = (sigset_t *)arg;
+  int sig;
+
+  while (1) {
+    if (sigwait(set, &sig) == 0 && sig == SIGUSR1) {
+      ipmi_stats_dump();
+    }
+  }
+
+  pthread_exit(NULL);
 }
 
 /*
@@ -3999,7 +4274,10 @@ ipmi_handle (unsigned char *request, unsigned char req_len,
 
   ipmi_mn_req_t *req = (ipmi_mn_req_t *) request;
   ipmi_res_t *res = (ipmi_res_t *) response;
+  ipmi_cmd_t *c = NULL;
   unsigned char netfn;
+  uint64_t start, locked;
+  int slot;
   netfn = req->netfn_lun >> 2;
 
   // Provide default values in the response message
@@ -4008,6 +4286,16 @@ ipmi_handle (unsigned char *request, unsigned char req_len,
   printf("ipmi_handle netfn %x cmd %x len %d\n", netfn, req->cmd, req_len);
   *(unsigned short*)res_len = 0;
 
+  if (g_cmd_idx[netfn][req->cmd]) {
+    c = &g_ipmi_cmds[g_cmd_idx[netfn][req->cmd] - 1];
+  }
+  slot = (req->payload_id <= MAX_NODES) ? req->payload_id : 0;
+  start = ipmi_time_us();
+  if (c) {
+    ipmi_cmd_lock(c, slot);
+  }
+  locked = ipmi_time_us();
+
   switch (netfn)
   {
     case NETFN_CHASSIS_REQ:
@@ -4063,6 +4351,11 @@ ipmi_handle (unsigned char *request, unsigned char req_len,
       break;
   }
 
+  if (c) {
+    ipmi_cmd_unlock(c, slot);
+    ipmi_cmd_account(c, locked - start, ipmi_time_us() - start);
+  }
+
   // This header includes NetFunction, Command, and Completion Code
   *(unsigned short*)res_len += IPMI_RESP_HDR_SIZE;
 
@@ -4096,6 +4389,41 @@ conn_handler(client_t *cli) {
   return 0;
 }
 
+// Bulk SEL reads for local tools (lib_ipmi_get_sel_range)
+static int
+sel_range_handler(client_t *cli) {
+  ipmi_sel_range_req_t req;
+  uint8_t buf[sizeof(ipmi_sel_range_res_t) +
+              IPMI_SEL_RANGE_MAX * sizeof(ipmi_sel_range_rec_t)];
+  ipmi_sel_range_res_t *res = (ipmi_sel_range_res_t *)buf;
+  size_t req_len = sizeof(req);
+  int max, next_rec_id = 0xFFFF;
+  int count = -1;
+
+  if (ipc_recv_req(cli, (uint8_t *)&req, &req_len, TIMEOUT_IPMI) ||
+      req_len != sizeof(req)) {
+    syslog(LOG_WARNING, "ipmid: sel range recv() failed\n");
+    return -1;
+  }
+
+  if (req.node >= 1 && req.node <= MAX_NODES) {
+    max = (req.max > IPMI_SEL_RANGE_MAX) ? IPMI_SEL_RANGE_MAX : req.max;
+    ipmi_cmd_lock(&g_sel_range_cmd, req.node);
+    count = sel_get_range(req.node, req.rec_id, req.since, res->recs, max,
+                          &next_rec_id);
+    ipmi_cmd_unlock(&g_sel_range_cmd, req.node);
+  }
+
+  res->count = (count < 0) ? -1 : count;
+  res->next_id = next_rec_id;
+  if (ipc_send_resp(cli, buf, sizeof(ipmi_sel_range_res_t) +
+                    ((count > 0) ? count : 0) * sizeof(ipmi_sel_range_rec_t))) {
+    syslog(LOG_WARNING, "ipmid: sel range send() failed\n");
+    return -1;
+  }
+  return 0;
+}
+
 void *
 wdt_timer (void *arg) {
   int ret;
@@ -4189,27 +4517,28 @@ main (void)
   int fru;
   pthread_t tid;
   uint8_t max_slot_num = 0;
+  static sigset_t stats_sig;
 
   //daemon(1, 1);
   //openlog("ipmid", LOG_CONS, LOG_DAEMON);
 
+  // Only the stats thread takes SIGUSR1, every other thread inherits
+  // the mask from here.
+  sigemptyset(&stats_sig);
+  sigaddset(&stats_sig, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &stats_sig, NULL);
+
   plat_fruid_init();
   plat_sensor_init();
   plat_lan_init(&g_lan_config);
 
   sdr_init();
   sel_init();
+  ipmi_cmd_init();
 
-  pthread_mutex_init(&m_chassis, NULL);
-  pthread_mutex_init(&m_sensor, NULL);
-  pthread_mutex_init(&m_app, NULL);
-  pthread_mutex_init(&m_storage, NULL);
-  pthread_mutex_init(&m_transport, NULL);
-  pthread_mutex_init(&m_oem, NULL);
-  pthread_mutex_init(&m_oem_1s, NULL);
-  pthread_mutex_init(&m_oem_usb_dbg, NULL);
-  pthread_mutex_init(&m_oem_q, NULL);
-  pthread_mutex_init(&m_oem_zion, NULL);
+  if (pthread_create(&tid, NULL, stats_handler, &stats_sig) == 0) {
+    pthread_detach(tid);
+  }
 
   pal_get_num_slots(&max_slot_num);
   fru = 1;
@@ -4234,20 +4563,13 @@ main (void)
     fru++;
   }
 
+  if (ipc_start_svc(SOCK_PATH_IPMI_SEL, sel_range_handler, 2, NULL, NULL)) {
+    syslog(LOG_WARNING, "ipmid: cannot serve %s\n", SOCK_PATH_IPMI_SEL);
+  }
+
   if (ipc_start_svc(SOCK_PATH_IPMI, conn_handler, MAX_REQUESTS, NULL, &tid) == 0) {
     pthread_join(tid, NULL);
   }
 
-
-  pthread_mutex_destroy(&m_chassis);
-  pthread_mutex_destroy(&m_sensor);
-  pthread_mutex_destroy(&m_app);
-  pthread_mutex_destroy(&m_storage);
-  pthread_mutex_destroy(&m_transport);
-  pthread_mutex_destroy(&m_oem);
-  pthread_mutex_destroy(&m_oem_1s);
-  pthread_mutex_destroy(&m_oem_usb_dbg);
-  pthread_mutex_destroy(&m_oem_q);
-
   return 0;
 }
@@ -5,8 +5,11 @@
  * This file represents platform specific implementation for storing
  * SEL logs and acts as back-end for IPMI stack
  *
- * TODO: Optimize the file handling to keep file open always instead of
- * current open/seek/close
+ * Each node's SEL is an append-only journal of CRC protected records
+ * (additions and erasures). The last SEL_RECORDS_MAX records are kept in
+ * memory in order of addition, which makes the record ids consecutive
+ * and both lookup by record id and by time cheap. The journal is
+ * compacted once it holds a quarter more records than the SEL keeps.
  *
  *
  * This program is free software; you can redistribute it and/or modify
@@ -23,22 +26,26 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
-#define _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
 #include "sel.h"
 #include "timestamp.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <syslog.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <time.h>
 #include <openbmc/pal.h>
 
-// SEL File.
+// SEL journal, and the file of the former fixed size SEL
+#define SEL_JRNL_FILE "/mnt/data/sel%d.jrnl"
 #define SEL_LOG_FILE  "/mnt/data/sel%d.bin"
 #define SIZE_PATH_MAX 32
 
@@ -51,29 +58,46 @@
 // SEL Data offset from file beginning
 #define SEL_DATA_OFFSET 0x100
 
+// Journal magic number and version
+#define SEL_JRNL_MAGIC 0x4C455346 // "FSEL"
+#define SEL_JRNL_VERSION 0x01
+
 // SEL reservation IDs can not be 0x00 or 0xFFFF
 #define SEL_RSVID_MIN  0x01
 #define SEL_RSVID_MAX  0xFFFE
 
-// Number of SEL records before wrap
-#define SEL_RECORDS_MAX 128 // TODO: Based on need we can make it bigger
-#define SEL_ELEMS_MAX (SEL_RECORDS_MAX+1)
+// Number of SEL records before the oldest ones are dropped
+#ifndef SEL_RECORDS_MAX
+#define SEL_RECORDS_MAX 16384
+#endif
 
-// Index for circular array
-#define SEL_INDEX_MIN 0x00
-#define SEL_INDEX_MAX SEL_RECORDS_MAX
+// Records in the former fixed size SEL
+#define SEL_BIN_RECORDS 128
+#define SEL_BIN_ELEMS (SEL_BIN_RECORDS+1)
 
 // Record ID can not be 0x0 (IPMI/Section 31)
-#define SEL_RECID_MIN (SEL_INDEX_MIN+1)
-#define SEL_RECID_MAX (SEL_INDEX_MAX+1)
+#define SEL_RECID_MIN 0x0001
+#define SEL_RECID_MAX 0xFFFE
+
+#if SEL_RECORDS_MAX > SEL_RECID_MAX
+#error "SEL_RECORDS_MAX does not fit in the record IDs"
+#endif
 
 // Special RecID value for first and last (IPMI/Section 31)
 #define SEL_RECID_FIRST 0x0000
 #define SEL_RECID_LAST 0xFFFF
 
+// The journal is fsync'ed every SEL_SYNC_BATCH additions, or on the
+// first addition SEL_SYNC_SEC after the last sync.
+#define SEL_SYNC_BATCH 32
+#define SEL_SYNC_SEC 2
+
+// Compact the journal when it holds that many more records than the SEL
+#define SEL_JRNL_SLACK (SEL_RECORDS_MAX / 4 + 16)
+
 #define RAS_SEL_LENGTH 1024
 
-// SEL header struct to keep track of SEL Log entries
+// Header of the former fixed size SEL file
 typedef struct {
   int magic; // Magic number to check validity
   int version; // version number of this header
@@ -83,130 +107,306 @@ typedef struct {
   time_stamp_t ts_erase; // last erase time stamp
 } sel_hdr_t;
 
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+} sel_jhdr_t;
+
+enum {
+  SEL_JREC_ADD = 0x01,
+  SEL_JREC_ERASE = 0x02,
+};
+
+// Journal record. An erasure only carries its time.
+typedef struct {
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t rec_id;
+  uint32_t time;
+  sel_msg_t msg;
+  uint32_t crc;
+} sel_jrec_t;
+
+typedef struct {
+  uint32_t time;  // BMC time the record was added
+  sel_msg_t msg;
+} sel_rec_t;
+
+typedef struct {
+  int fd;             // journal, open for appending
+  sel_rec_t *recs;    // ring of the records in order of addition
+  int begin;          // ring index of the oldest record
+  int count;
+  int first_id;       // record id of the oldest record
+  int next_id;        // record id of the next addition
+  int jrnl_recs;      // records in the journal
+  int unsynced;       // additions since the last fsync
+  time_t synced;
+  uint32_t ts_add;    // last addition time
+  uint32_t ts_erase;  // last erase time
+} sel_node_t;
+
 // Keep track of last Reservation ID
 static int g_rsv_id[MAX_NODES+1];
 
-// Cached version of SEL Header and data
-static sel_hdr_t g_sel_hdr[MAX_NODES+1];
-static sel_msg_t g_sel_data[MAX_NODES+1][SEL_ELEMS_MAX];
+static sel_node_t g_sel[MAX_NODES+1];
+
+static uint32_t
+crc32_update(uint32_t crc, const void *data, size_t len) {
+  const uint8_t *p = data;
+  int i;
+
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
 
-// Local helper functions to interact with file system
 static int
-file_get_sel_hdr(int node) {
-  FILE *fp;
-  char fpath[SIZE_PATH_MAX] = {0};
+rec_id_add(int rec_id, int n) {
+  return (rec_id - SEL_RECID_MIN + n) % SEL_RECID_MAX + SEL_RECID_MIN;
+}
 
-  sprintf(fpath, SEL_LOG_FILE, node);
+// Position from the oldest record of a record id, -1 if not in the SEL
+static int
+rec_id_pos(sel_node_t *sel, int rec_id) {
+  int pos;
 
-  fp = fopen(fpath, "r");
-  if (fp == NULL) {
+  if (rec_id < SEL_RECID_MIN || rec_id > SEL_RECID_MAX) {
     return -1;
   }
+  pos = (rec_id - sel->first_id + SEL_RECID_MAX) % SEL_RECID_MAX;
+  return (pos < sel->count) ? pos : -1;
+}
 
-  if (fread(&g_sel_hdr[node], sizeof(sel_hdr_t), 1, fp) <= 0) {
-    syslog(LOG_WARNING, "file_get_sel_hdr: fread\n");
-    fclose (fp);
-    return -1;
-  }
+static sel_rec_t *
+rec_at(sel_node_t *sel, int pos) {
+  return &sel->recs[(sel->begin + pos) % SEL_RECORDS_MAX];
+}
 
-  fclose(fp);
-  return 0;
+static void
+ts_from_time(time_stamp_t *ts, uint32_t time) {
+  ts->ts[0] = time & 0xFF;
+  ts->ts[1] = (time >> 8) & 0xFF;
+  ts->ts[2] = (time >> 16) & 0xFF;
+  ts->ts[3] = (time >> 24) & 0xFF;
 }
 
-static int
-file_get_sel_data(int node) {
-  FILE *fp;
-  int i, j;
-  char fpath[SIZE_PATH_MAX] = {0};
+static uint32_t
+time_from_ts(const unsigned char *ts) {
+  return ts[0] | (ts[1] << 8) | (ts[2] << 16) | ((uint32_t)ts[3] << 24);
+}
 
-  sprintf(fpath, SEL_LOG_FILE, node);
+// Apply a journal record to the in-memory SEL
+static void
+sel_apply(sel_node_t *sel, sel_jrec_t *jrec) {
+  if (jrec->type == SEL_JREC_ERASE) {
+    sel->begin = 0;
+    sel->count = 0;
+    sel->first_id = sel->next_id;
+    sel->ts_erase = jrec->time;
+    return;
+  }
+
+  if (sel->count == SEL_RECORDS_MAX) {
+    sel->begin = (sel->begin + 1) % SEL_RECORDS_MAX;
+    sel->count--;
+    sel->first_id = rec_id_add(sel->first_id, 1);
+  }
+  if (sel->count == 0) {
+    sel->first_id = jrec->rec_id;
+  }
+  rec_at(sel, sel->count)->time = jrec->time;
+  memcpy(&rec_at(sel, sel->count)->msg, &jrec->msg, sizeof(sel_msg_t));
+  sel->count++;
+  sel->next_id = rec_id_add(jrec->rec_id, 1);
+  sel->ts_add = jrec->time;
+}
 
-  fp = fopen(fpath, "r");
-  if (fp == NULL) {
-    syslog(LOG_WARNING, "file_get_sel_data: fopen\n");
+static int
+file_append_jrec(sel_node_t *sel, sel_jrec_t *jrec) {
+  jrec->crc = crc32_update(0, jrec, offsetof(sel_jrec_t, crc));
+  if (write(sel->fd, jrec, sizeof(sel_jrec_t)) != sizeof(sel_jrec_t)) {
+    syslog(LOG_WARNING, "file_append_jrec: write: %s\n", strerror(errno));
     return -1;
   }
+  sel->jrnl_recs++;
+  return 0;
+}
 
-  if (fseek(fp, SEL_DATA_OFFSET, SEEK_SET)) {
-    syslog(LOG_WARNING, "file_get_sel_data: fseek\n");
-    fclose(fp);
-    return -1;
+static void
+file_sync(sel_node_t *sel) {
+  if (fsync(sel->fd)) {
+    syslog(LOG_WARNING, "file_sync: fsync: %s\n", strerror(errno));
   }
+  sel->unsynced = 0;
+  sel->synced = time(NULL);
+}
 
-  unsigned char buf[SEL_ELEMS_MAX * 16];
-  if (fread(buf, 1, SEL_ELEMS_MAX * sizeof(sel_msg_t), fp) <= 0) {
-    syslog(LOG_WARNING, "file_get_sel_data: fread\n");
-    fclose(fp);
-    return -1;
-  }
+// Rewrite the journal with just the last erasure and the records in
+// the SEL, replacing the old one atomically.
+static int
+file_compact(int node) {
+  sel_node_t *sel = &g_sel[node];
+  char fpath[SIZE_PATH_MAX] = {0};
+  char tmp[SIZE_PATH_MAX + 4] = {0};
+  sel_jhdr_t hdr = {SEL_JRNL_MAGIC, SEL_JRNL_VERSION};
+  sel_jrec_t jrec;
+  int fd, old_fd, old_recs, i;
 
-  fclose(fp);
+  sprintf(fpath, SEL_JRNL_FILE, node);
+  sprintf(tmp, "%s.tmp", fpath);
 
-  for (i = 0; i < SEL_ELEMS_MAX; i++) {
-    for (j = 0; j < sizeof(sel_msg_t);j++) {
-      g_sel_data[node][i].msg[j] = buf[i*16 + j];
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (fd < 0) {
+    syslog(LOG_WARNING, "file_compact: open %s\n", tmp);
+    return -1;
+  }
+  if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+    goto error;
+  }
+
+  old_fd = sel->fd;
+  old_recs = sel->jrnl_recs;
+  sel->fd = fd;
+  sel->jrnl_recs = 0;
+
+  memset(&jrec, 0, sizeof(jrec));
+  jrec.type = SEL_JREC_ERASE;
+  jrec.rec_id = sel->first_id;
+  jrec.time = sel->ts_erase;
+  if (file_append_jrec(sel, &jrec)) {
+    goto restore;
+  }
+  for (i = 0; i < sel->count; i++) {
+    jrec.type = SEL_JREC_ADD;
+    jrec.rec_id = rec_id_add(sel->first_id, i);
+    jrec.time = rec_at(sel, i)->time;
+    memcpy(&jrec.msg, &rec_at(sel, i)->msg, sizeof(sel_msg_t));
+    if (file_append_jrec(sel, &jrec)) {
+      goto restore;
     }
   }
+  if (fsync(fd) || rename(tmp, fpath)) {
+    goto restore;
+  }
 
+  close(old_fd);
+  sel->unsynced = 0;
+  sel->synced = time(NULL);
   return 0;
+
+restore:
+  sel->fd = old_fd;
+  sel->jrnl_recs = old_recs;
+error:
+  syslog(LOG_WARNING, "file_compact: %s: %s\n", tmp, strerror(errno));
+  close(fd);
+  unlink(tmp);
+  return -1;
 }
 
+// Replay the journal in to memory. A torn record at the end, left by a
+// power loss in the middle of a write, is cut off.
 static int
-file_store_sel_hdr(int node) {
-  FILE *fp;
-  char fpath[SIZE_PATH_MAX] = {0};
-
-  sprintf(fpath, SEL_LOG_FILE, node);
-
-  fp = fopen(fpath, "r+");
-  if (fp == NULL) {
-    syslog(LOG_WARNING, "file_store_sel_hdr: fopen\n");
+file_replay(int node) {
+  sel_node_t *sel = &g_sel[node];
+  sel_jhdr_t hdr;
+  sel_jrec_t jrec;
+  off_t off = sizeof(hdr);
+  ssize_t len;
+
+  if (read(sel->fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+      hdr.magic != SEL_JRNL_MAGIC || hdr.version != SEL_JRNL_VERSION) {
+    syslog(LOG_WARNING, "file_replay: sel%d: bad journal header\n", node);
     return -1;
   }
 
-  if (fwrite(&g_sel_hdr[node], sizeof(sel_hdr_t), 1, fp) <= 0) {
-    syslog(LOG_WARNING, "file_store_sel_hdr: fwrite\n");
-    fclose(fp);
-    return -1;
+  while ((len = read(sel->fd, &jrec, sizeof(jrec))) == sizeof(jrec)) {
+    if (crc32_update(0, &jrec, offsetof(sel_jrec_t, crc)) != jrec.crc ||
+        (jrec.type != SEL_JREC_ADD && jrec.type != SEL_JREC_ERASE) ||
+        jrec.rec_id < SEL_RECID_MIN || jrec.rec_id > SEL_RECID_MAX) {
+      break;
+    }
+    if (jrec.type == SEL_JREC_ERASE) {
+      sel->next_id = jrec.rec_id;
+    }
+    sel_apply(sel, &jrec);
+    sel->jrnl_recs++;
+    off += sizeof(jrec);
   }
 
-  fclose(fp);
-
+  if (len != 0) {
+    syslog(LOG_WARNING, "file_replay: sel%d: dropping journal after offset %ld\n",
+           node, (long)off);
+    if (ftruncate(sel->fd, off)) {
+      return -1;
+    }
+  }
   return 0;
 }
 
-static int
-file_store_sel_data(int node, int recId, sel_msg_t *data) {
-  FILE *fp;
-  int index;
+// Add the records of the former fixed size SEL file to the journal
+static void
+file_import_sel_bin(int node) {
+  sel_node_t *sel = &g_sel[node];
   char fpath[SIZE_PATH_MAX] = {0};
+  sel_msg_t data[SEL_BIN_ELEMS];
+  sel_hdr_t hdr;
+  sel_jrec_t jrec;
+  FILE *fp;
+  int i;
 
   sprintf(fpath, SEL_LOG_FILE, node);
 
-  fp = fopen(fpath, "r+");
+  fp = fopen(fpath, "r");
   if (fp == NULL) {
-    syslog(LOG_WARNING, "file_store_sel_data: fopen\n");
-    return -1;
-  }
-
-  // Records are stored using zero-based index
-  index = (recId-1) * sizeof(sel_msg_t);
-
-  if (fseek(fp, SEL_DATA_OFFSET+index, SEEK_SET)) {
-    syslog(LOG_WARNING, "file_store_sel_data: fseek\n");
+    return;
+  }
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != SEL_HDR_MAGIC ||
+      hdr.begin < 0 || hdr.begin >= SEL_BIN_ELEMS ||
+      hdr.end < 0 || hdr.end >= SEL_BIN_ELEMS ||
+      fseek(fp, SEL_DATA_OFFSET, SEEK_SET) ||
+      fread(data, sizeof(sel_msg_t), SEL_BIN_ELEMS, fp) != SEL_BIN_ELEMS) {
+    syslog(LOG_WARNING, "file_import_sel_bin: %s is not valid\n", fpath);
     fclose(fp);
-    return -1;
+    return;
   }
+  fclose(fp);
 
-  if (fwrite(data->msg, sizeof(sel_msg_t), 1, fp) <= 0) {
-    syslog(LOG_WARNING, "file_store_sel_data: fwrite\n");
-    fclose(fp);
-    return -1;
+  memset(&jrec, 0, sizeof(jrec));
+  jrec.type = SEL_JREC_ERASE;
+  jrec.rec_id = sel->next_id;
+  jrec.time = time_from_ts(hdr.ts_erase.ts);
+  if (file_append_jrec(sel, &jrec)) {
+    return;
+  }
+  sel_apply(sel, &jrec);
+
+  for (i = hdr.begin; i != hdr.end; i = (i + 1) % SEL_BIN_ELEMS) {
+    jrec.type = SEL_JREC_ADD;
+    jrec.rec_id = sel->next_id;
+    // Only timestamped records tell when they were added
+    if (data[i].msg[2] < 0xE0) {
+      jrec.time = time_from_ts(&data[i].msg[3]);
+    } else {
+      jrec.time = time_from_ts(hdr.ts_add.ts);
+    }
+    memcpy(&jrec.msg, &data[i], sizeof(sel_msg_t));
+    jrec.msg.msg[0] = jrec.rec_id & 0xFF;
+    jrec.msg.msg[1] = (jrec.rec_id >> 8) & 0xFF;
+    if (file_append_jrec(sel, &jrec)) {
+      return;
+    }
+    sel_apply(sel, &jrec);
   }
+  file_sync(sel);
 
-  fclose(fp);
-
-  return 0;
+  syslog(LOG_INFO, "SEL: imported %d records of %s\n", sel->count, fpath);
+  unlink(fpath);
 }
 
 static void
@@ -400,35 +600,29 @@ parse_sel(uint8_t fru, sel_msg_t *data) {
 // Retrieve time stamp for recent add operation
 void
 sel_ts_recent_add(int node, time_stamp_t *ts) {
-  memcpy(ts->ts, g_sel_hdr[node].ts_add.ts, 0x04);
+  ts_from_time(ts, g_sel[node].ts_add);
 }
 
 // Retrieve time stamp for recent erase operation
 void
 sel_ts_recent_erase(int node, time_stamp_t *ts) {
-  memcpy(ts->ts, g_sel_hdr[node].ts_erase.ts, 0x04);
+  ts_from_time(ts, g_sel[node].ts_erase);
 }
 
 // Retrieve total number of entries in SEL log
 int
 sel_num_entries(int node) {
-  if (g_sel_hdr[node].begin <= g_sel_hdr[node].end) {
-      return (g_sel_hdr[node].end - g_sel_hdr[node].begin);
-  } else {
-    return (g_sel_hdr[node].end + (SEL_INDEX_MAX - g_sel_hdr[node].begin + 1));
-  }
+  return g_sel[node].count;
 }
 
 // Retrieve total free space available in SEL log
+// FFFFh means 65535 bytes or more (IPMI/Section 31.2)
 int
 sel_free_space(int node) {
-  int total_space;
-  int used_space;
-
-  total_space = SEL_RECORDS_MAX * sizeof(sel_msg_t);
-  used_space = sel_num_entries(node) * sizeof(sel_msg_t);
+  int free_space;
 
-  return (total_space - used_space);
+  free_space = (SEL_RECORDS_MAX - sel_num_entries(node)) * sizeof(sel_msg_t);
+  return (free_space > 0xFFFF) ? 0xFFFF : free_space;
 }
 
 // Reserve an ID that will be used in later operations
@@ -447,64 +641,84 @@ sel_rsv_id(int node) {
 // IPMI/Section 31.5
 int
 sel_get_entry(int node, int read_rec_id, sel_msg_t *msg, int *next_rec_id) {
+  sel_node_t *sel = &g_sel[node];
+  int pos;
 
-  int index;
+  // If the log is empty return error
+  if (sel->count == 0) {
+    syslog(LOG_WARNING, "sel_get_entry: No entries\n");
+    return -1;
+  }
 
-  // Find the index in to array based on given index
   if (read_rec_id == SEL_RECID_FIRST) {
-    index = g_sel_hdr[node].begin;
+    pos = 0;
   } else if (read_rec_id == SEL_RECID_LAST) {
-    if (g_sel_hdr[node].end) {
-      index = g_sel_hdr[node].end - 1;
-    } else {
-      index = SEL_INDEX_MAX;
-    }
+    pos = sel->count - 1;
   } else {
-    index = read_rec_id;
+    pos = rec_id_pos(sel, read_rec_id);
+    if (pos < 0) {
+      syslog(LOG_WARNING, "sel_get_entry: Wrong Record ID %d\n", read_rec_id);
+      return -1;
+    }
   }
 
-  // If the log is empty return error
-  if (sel_num_entries(node) == 0) {
-    syslog(LOG_WARNING, "sel_get_entry: No entries\n");
-    return -1;
-  }
+  memcpy(msg->msg, rec_at(sel, pos)->msg.msg, sizeof(sel_msg_t));
 
-  // Check for boundary conditions
-  if ((index < SEL_INDEX_MIN) || (index > SEL_INDEX_MAX)) {
-    syslog(LOG_WARNING, "sel_get_entry: Invalid Record ID %d\n", read_rec_id);
-    return -1;
+  // Return the next record ID in the log, 0xFFFF after the last entry
+  if (pos == sel->count - 1) {
+    *next_rec_id = SEL_RECID_LAST;
+  } else {
+    *next_rec_id = rec_id_add(sel->first_id, pos + 1);
   }
 
-  // If begin < end, check to make sure the given id falls between
-  if (g_sel_hdr[node].begin < g_sel_hdr[node].end) {
-    if (index < g_sel_hdr[node].begin || index >= g_sel_hdr[node].end) {
-      syslog(LOG_WARNING, "sel_get_entry: Wrong Record ID %d\n", read_rec_id);
-      return -1;
+  return 0;
+}
+
+// Get up to max entries starting at rec_id (SEL_RECID_FIRST for the
+// oldest one), skipping those added before the time since. Returns the
+// number of entries, next_rec_id is SEL_RECID_LAST after the last one.
+int
+sel_get_range(int node, int rec_id, uint32_t since, ipmi_sel_range_rec_t *recs,
+              int max, int *next_rec_id) {
+  sel_node_t *sel = &g_sel[node];
+  int pos, lo, hi, mid, n;
+
+  *next_rec_id = SEL_RECID_LAST;
+  if (rec_id == SEL_RECID_FIRST) {
+    pos = 0;
+  } else {
+    pos = rec_id_pos(sel, rec_id);
+    if (pos < 0) {
+      return (sel->count == 0) ? 0 : -1;
     }
   }
 
-  // If end < begin, check to make sure the given id is valid
-  if (g_sel_hdr[node].begin > g_sel_hdr[node].end) {
-    if (index >= g_sel_hdr[node].end && index < g_sel_hdr[node].begin) {
-      syslog(LOG_WARNING, "sel_get_entry: Wrong Record ID2 %d\n", read_rec_id);
-      return -1;
+  // Records are in order of addition, so their times only go backwards
+  // if the clock was set back. Find the first one at or after since.
+  if (since) {
+    lo = pos;
+    hi = sel->count;
+    while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (rec_at(sel, mid)->time < since) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
     }
+    pos = lo;
   }
 
-  memcpy(msg->msg, g_sel_data[node][index].msg, sizeof(sel_msg_t));
-
-  // Return the next record ID in the log
-  *next_rec_id = ++read_rec_id;
-  if (*next_rec_id > SEL_INDEX_MAX) {
-    *next_rec_id = SEL_INDEX_MIN;
+  for (n = 0; n < max && pos < sel->count; n++, pos++) {
+    recs[n].rec_id = rec_id_add(sel->first_id, pos);
+    recs[n].time = rec_at(sel, pos)->time;
+    memcpy(recs[n].msg, rec_at(sel, pos)->msg.msg, sizeof(sel_msg_t));
   }
-
-  // If this is the last entry in the log, return 0xFFFF
-  if (*next_rec_id == g_sel_hdr[node].end) {
-    *next_rec_id = SEL_RECID_LAST;
+  if (pos < sel->count) {
+    *next_rec_id = rec_id_add(sel->first_id, pos);
   }
 
-  return 0;
+  return n;
 }
 
 // Add a new entry in to SEL log for RAS SEL
@@ -524,24 +738,25 @@ ras_sel_add_entry(int node, ras_sel_msg_t *msg) {
 // IPMI/Section 31.6
 int
 sel_add_entry(int node, sel_msg_t *msg, int *rec_id) {
-  // If the SEL if full, roll over. To keep track of empty condition, use
-  // one empty location less than the max records.
-  if (sel_num_entries(node) == SEL_RECORDS_MAX) {
-      syslog(LOG_WARNING, "sel_add_entry: SEL rollover\n");
-    if (++g_sel_hdr[node].begin > SEL_INDEX_MAX) {
-      g_sel_hdr[node].begin = SEL_INDEX_MIN;
-    }
+  sel_node_t *sel = &g_sel[node];
+  sel_jrec_t jrec;
+
+  if (sel->fd < 0) {
+    return -1;
+  }
+
+  if (sel->count == SEL_RECORDS_MAX) {
+    syslog(LOG_WARNING, "sel_add_entry: SEL rollover\n");
   }
 
   // Update message's time stamp starting at byte 4
   if (msg->msg[2] < 0xE0)
     time_stamp_fill(&msg->msg[3]);
 
-  // Add the enry at end
-  memcpy(g_sel_data[node][g_sel_hdr[node].end].msg, msg->msg, sizeof(sel_msg_t));
-
   // Return the newly added record ID
-  *rec_id = g_sel_hdr[node].end+1;
+  *rec_id = sel->next_id;
+  msg->msg[0] = *rec_id & 0xFF;
+  msg->msg[1] = (*rec_id >> 8) & 0xFF;
 
   // Print the data in syslog
   dump_sel_syslog(node, msg);
@@ -549,23 +764,22 @@ sel_add_entry(int node, sel_msg_t *msg, int *rec_id) {
   // Parse the SEL message
   parse_sel((uint8_t) node, msg);
 
-  if (file_store_sel_data(node, *rec_id, msg)) {
-    syslog(LOG_WARNING, "sel_add_entry: file_store_sel_data\n");
+  memset(&jrec, 0, sizeof(jrec));
+  jrec.type = SEL_JREC_ADD;
+  jrec.rec_id = *rec_id;
+  jrec.time = time(NULL);
+  memcpy(&jrec.msg, msg, sizeof(sel_msg_t));
+  if (file_append_jrec(sel, &jrec)) {
+    syslog(LOG_WARNING, "sel_add_entry: file_append_jrec\n");
     return -1;
   }
+  sel_apply(sel, &jrec);
 
-  // Increment the end pointer
-  if (++g_sel_hdr[node].end > SEL_INDEX_MAX) {
-    g_sel_hdr[node].end = SEL_INDEX_MIN;
-  }
-
-  // Update timestamp for add in header
-  time_stamp_fill(g_sel_hdr[node].ts_add.ts);
-
-  // Store the structure persistently
-  if (file_store_sel_hdr(node)) {
-    syslog(LOG_WARNING, "sel_add_entry: file_store_sel_hdr\n");
-    return -1;
+  if (sel->jrnl_recs > SEL_RECORDS_MAX + SEL_JRNL_SLACK) {
+    file_compact(node);
+  } else if (++sel->unsynced >= SEL_SYNC_BATCH ||
+             time(NULL) - sel->synced >= SEL_SYNC_SEC) {
+    file_sync(sel);
   }
 
   return 0;
@@ -573,25 +787,30 @@ sel_add_entry(int node, sel_msg_t *msg, int *rec_id) {
 
 // Erase the SEL completely
 // IPMI/Section 31.9
-// Note: To reduce wear/tear, instead of erasing, manipulating the metadata
+// Note: the erasure is logged in the journal, which gets compacted
 int
 sel_erase(int node, int rsv_id) {
-  if (rsv_id != g_rsv_id[node]) {
+  sel_node_t *sel = &g_sel[node];
+  sel_jrec_t jrec;
+
+  if (rsv_id != g_rsv_id[node] || sel->fd < 0) {
     return -1;
   }
 
-  // Erase SEL Logs
-  g_sel_hdr[node].begin = SEL_INDEX_MIN;
-  g_sel_hdr[node].end = SEL_INDEX_MIN;
-
-  // Update timestamp for erase in header
-  time_stamp_fill(g_sel_hdr[node].ts_erase.ts);
-
-  // Store the structure persistently
-  if (file_store_sel_hdr(node)) {
-    syslog(LOG_WARNING, "sel_erase: file_store_sel_hdr\n");
+  memset(&jrec, 0, sizeof(jrec));
+  jrec.type = SEL_JREC_ERASE;
+  jrec.rec_id = sel->next_id;
+  jrec.time = time(NULL);
+  if (file_append_jrec(sel, &jrec)) {
+    syslog(LOG_WARNING, "sel_erase: file_append_jrec\n");
     return -1;
   }
+  sel_apply(sel, &jrec);
+
+  // Drop the erased records from the journal
+  if (file_compact(node)) {
+    file_sync(sel);
+  }
 
   return 0;
 }
@@ -611,79 +830,103 @@ sel_erase_status(int node, int rsv_id, sel_erase_stat_t *status) {
   return 0;
 }
 
-// Initialize SEL log file
+// Forget what a failed replay put in to memory
+static void
+sel_node_reset(sel_node_t *sel) {
+  memset(sel->recs, 0, SEL_RECORDS_MAX * sizeof(sel_rec_t));
+  sel->begin = 0;
+  sel->count = 0;
+  sel->first_id = SEL_RECID_MIN;
+  sel->next_id = SEL_RECID_MIN;
+  sel->jrnl_recs = 0;
+  sel->unsynced = 0;
+  sel->ts_add = 0;
+  sel->ts_erase = 0;
+}
+
+// Initialize SEL journal
 static int
 sel_node_init(int node) {
-  FILE *fp;
-  int i;
+  sel_node_t *sel = &g_sel[node];
+  sel_jhdr_t hdr = {SEL_JRNL_MAGIC, SEL_JRNL_VERSION};
   char fpath[SIZE_PATH_MAX] = {0};
+  char bad[SIZE_PATH_MAX + 8] = {0};
+  int exists;
 
-  sprintf(fpath, SEL_LOG_FILE, node);
-
-  // Check if the file exists or not
-  if (access(fpath, F_OK) == 0) {
-    // Since file is present, fetch all the contents to cache
-    if (file_get_sel_hdr(node)) {
-      syslog(LOG_WARNING, "init_sel: file_get_sel_hdr\n");
-      return -1;
-    }
-
-    if (file_get_sel_data(node)) {
-      syslog(LOG_WARNING, "init_sel: file_get_sel_data\n");
-      return -1;
-    }
-
-    return 0;
-  }
+  sprintf(fpath, SEL_JRNL_FILE, node);
 
-  // File not present, so create the file
-  fp = fopen(fpath, "w+");
-  if (fp == NULL) {
-    syslog(LOG_WARNING, "init_sel: fopen\n");
+  g_rsv_id[node] = 0x01;
+  sel->fd = -1;
+  sel->first_id = SEL_RECID_MIN;
+  sel->next_id = SEL_RECID_MIN;
+  sel->synced = time(NULL);
+  sel->recs = calloc(SEL_RECORDS_MAX, sizeof(sel_rec_t));
+  if (sel->recs == NULL) {
+    syslog(LOG_WARNING, "init_sel: calloc\n");
     return -1;
   }
 
-  fclose (fp);
-
-  // Populate SEL Header in to the file
-  g_sel_hdr[node].magic = SEL_HDR_MAGIC;
-  g_sel_hdr[node].version = SEL_HDR_VERSION;
-  g_sel_hdr[node].begin = SEL_INDEX_MIN;
-  g_sel_hdr[node].end = SEL_INDEX_MIN;
-  memset(g_sel_hdr[node].ts_add.ts, 0x0, 4);
-  memset(g_sel_hdr[node].ts_erase.ts, 0x0, 4);
-
-  if (file_store_sel_hdr(node)) {
-    syslog(LOG_WARNING, "init_sel: file_store_sel_hdr\n");
+  exists = (access(fpath, F_OK) == 0);
+  sel->fd = open(fpath, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (sel->fd < 0) {
+    syslog(LOG_WARNING, "init_sel: open %s\n", fpath);
     return -1;
   }
 
-  // Populate SEL Data in to the file
-  for (i = 1;  i <= SEL_RECORDS_MAX; i++) {
-    sel_msg_t msg = {0};
-    if (file_store_sel_data(node, i, &msg)) {
-      syslog(LOG_WARNING, "init_sel: file_store_sel_data\n");
+  if (exists) {
+    // Since the journal is present, replay it in to memory
+    if (file_replay(node) == 0) {
+      return 0;
+    }
+    // Keep the unreadable journal for analysis and start a new one,
+    // rather than leaving the node without a SEL until it is removed
+    close(sel->fd);
+    sel->fd = -1;
+    sel_node_reset(sel);
+    snprintf(bad, sizeof(bad), "%s.bad", fpath);
+    if (rename(fpath, bad)) {
+      syslog(LOG_WARNING, "init_sel: rename %s\n", fpath);
+      return -1;
+    }
+    syslog(LOG_CRIT, "SEL: sel%d journal is corrupt, moved to %s, "
+           "starting a new one\n", node, bad);
+    sel->fd = open(fpath, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (sel->fd < 0) {
+      syslog(LOG_WARNING, "init_sel: open %s\n", fpath);
       return -1;
     }
   }
 
-  g_rsv_id[node] = 0x01;
+  if (write(sel->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+    syslog(LOG_WARNING, "init_sel: write %s\n", fpath);
+    close(sel->fd);
+    sel->fd = -1;
+    unlink(fpath);
+    return -1;
+  }
+
+  // Carry over the records of the former SEL file
+  file_import_sel_bin(node);
+  file_sync(sel);
 
   return 0;
 }
 
 int
 sel_init(void) {
-  int ret;
+  int ret = 0;
   int i;
 
+  for (i = 0; i < MAX_NODES+1; i++) {
+    g_sel[i].fd = -1;
+  }
+
+  // A node whose SEL cannot be set up rejects additions, the others work
   for (i = 1; i < MAX_NODES+1; i++) {
-    ret = sel_node_init(i);
-    if (ret) {
-      return ret;
+    if (sel_node_init(i)) {
+      ret = -1;
     }
   }
 
   return ret;
 }
-
@@ -21,6 +21,8 @@
 #ifndef __SEL_H__
 #define __SEL_H__
 
+#include <stdint.h>
+#include <openbmc/ipmi.h>
 #include "timestamp.h"
 
 enum {
@@ -47,6 +49,8 @@ int sel_num_entries(int node);
 int sel_free_space(int node);
 int sel_rsv_id(int node);
 int sel_get_entry(int node, int read_rec_id, sel_msg_t *msg, int *next_rec_id);
+int sel_get_range(int node, int rec_id, uint32_t since, ipmi_sel_range_rec_t *recs,
+                  int max, int *next_rec_id);
 int sel_add_entry(int node, sel_msg_t *msg, int *rec_id);
 int sel_erase(int node, int rsv_id);
 int sel_erase_status(int node, int rsv_id, sel_erase_stat_t *status);
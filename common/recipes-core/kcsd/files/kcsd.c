@@ -47,11 +47,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <syslog.h>
 #include <pthread.h>
 #include <sys/un.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -59,6 +61,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <signal.h>
+#include <poll.h>
 #include <openbmc/libgpio.h>
 #include "openbmc/ipmi.h"
 #include <time.h>
@@ -69,12 +72,7 @@ uint8_t req_buf[256];
 uint8_t res_buf[300];
 gpio_desc_t *bmc_ready_n = NULL;
 int kcs_fd;
-
-#define TOUCH(path) \
-{\
-  int fd = creat(path, 0644);\
-  if (fd) close(fd);\
-}
+kcs_stats_t *kcs_stats = NULL;
 
 #define FRU_SERVER 0x1  //payload id for FRU_SERVER
 
@@ -150,6 +148,109 @@ bool is_add_sel_req(uint8_t *buff)
   return (buff[0] == (NETFN_STORAGE_REQ << 2)) && (buff[1] == CMD_STORAGE_ADD_SEL);
 }
 
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void kcs_stats_init(void)
+{
+  void *map;
+  int fd;
+
+  fd = shm_open(SHM_PATH_KCS, O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    syslog(LOG_WARNING, "kcsd: shm_open %s failed: %s", SHM_PATH_KCS, strerror(errno));
+    return;
+  }
+  if (ftruncate(fd, sizeof(kcs_stats_t)) < 0) {
+    syslog(LOG_WARNING, "kcsd: ftruncate %s failed: %s", SHM_PATH_KCS, strerror(errno));
+    close(fd);
+    return;
+  }
+  map = mmap(NULL, sizeof(kcs_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    syslog(LOG_WARNING, "kcsd: mmap %s failed: %s", SHM_PATH_KCS, strerror(errno));
+    return;
+  }
+
+  // Readers keep their mapping across kcsd restarts, so reset in place.
+  // A new object is zero filled; an existing one keeps the time of the
+  // last request, which is not kcsd's but the host's state.
+  kcs_stats = map;
+  memset(&kcs_stats->requests, 0, sizeof(kcs_stats_t) - offsetof(kcs_stats_t, requests));
+}
+
+void kcs_stats_record(uint8_t netfn, uint8_t cmd, uint64_t us)
+{
+  kcs_cmd_stats_t *c = NULL;
+  uint32_t i, n;
+  int b = 0;
+
+  if (!kcs_stats)
+    return;
+
+  n = kcs_stats->num_cmds;
+  for (i = 0; i < n; i++) {
+    if (kcs_stats->cmds[i].netfn == netfn && kcs_stats->cmds[i].cmd == cmd) {
+      c = &kcs_stats->cmds[i];
+      break;
+    }
+  }
+  if (!c) {
+    if (n >= KCS_STATS_CMDS) {
+      kcs_stats->dropped++;
+      return;
+    }
+    c = &kcs_stats->cmds[n];
+    c->netfn = netfn;
+    c->cmd = cmd;
+    __atomic_store_n(&kcs_stats->num_cmds, n + 1, __ATOMIC_RELEASE);
+  }
+
+  while (b < KCS_LAT_BUCKETS - 1 && us >= (2ULL << b))
+    b++;
+  c->lat_hist[b]++;
+  c->count++;
+  c->total_us += us;
+  if (us > c->max_us)
+    c->max_us = us;
+}
+
+int kcs_stats_dump(void)
+{
+  kcs_stats_t st;
+  uint32_t i;
+  int b;
+
+  if (lib_ipmi_get_kcs_stats(&st)) {
+    printf("kcsd statistics are not available\n");
+    return -1;
+  }
+
+  printf("last_req: %u\nrequests: %llu\ndropped: %u\n",
+      st.last_req, (unsigned long long)st.requests, st.dropped);
+  for (i = 0; i < st.num_cmds && i < KCS_STATS_CMDS; i++) {
+    kcs_cmd_stats_t *c = &st.cmds[i];
+
+    if (!c->count)
+      continue;
+    printf("netfn 0x%02X cmd 0x%02X: count %u avg %lluus max %lluus\n",
+        c->netfn, c->cmd, c->count,
+        (unsigned long long)(c->total_us / c->count),
+        (unsigned long long)c->max_us);
+    for (b = 0; b < KCS_LAT_BUCKETS; b++) {
+      if (c->lat_hist[b])
+        printf("  lt_%lluus: %u\n", 2ULL << b, c->lat_hist[b]);
+    }
+  }
+  return 0;
+}
+
 void set_bmc_ready(bool ready)
 {
   /* Active low */
@@ -214,8 +315,12 @@ void *handle_add_sel(void *unused)
 void *kcs_thread(void *unused) {
   struct timespec req;
   struct timespec rem;
+  struct pollfd pfd;
+  ssize_t len;
   unsigned char req_len;
   unsigned short res_len;
+  uint64_t start_us;
+  uint8_t netfn, cmd;
 
 #ifdef DEBUG
   struct timespec req_tv;
@@ -231,9 +336,25 @@ void *kcs_thread(void *unused) {
   req.tv_sec = 0;
   req.tv_nsec = 10000000;//10mSec
 
+  pfd.fd = kcs_fd;
+  pfd.events = POLLIN;
+
   while(1) {
-    req_len = read(kcs_fd, req_buf, sizeof(req_buf));
-    if (req_len > 0) {
+    if (poll(&pfd, 1, -1) < 0) {
+      if (errno != EINTR) {
+        syslog(LOG_WARNING, "kcsd: poll failed: %s", strerror(errno));
+        nanosleep(&req, &rem);
+      }
+      continue;
+    }
+
+    // Leave a byte for the payload id prepended below
+    len = read(kcs_fd, req_buf, sizeof(req_buf) - 1);
+    if (len > 0) {
+      req_len = (unsigned char)len;
+      start_us = now_us();
+      netfn = req_buf[0] >> 2;
+      cmd = (req_len > 1) ? req_buf[1] : 0;
 
 #ifdef DEBUG
       //dump read data
@@ -245,7 +366,10 @@ void *kcs_thread(void *unused) {
       syslog(LOG_WARNING, "[ %ld.%ld ] KCS Req: %s, len=%d", req_tv.tv_sec, req_tv.tv_nsec, cmd, req_len);
 #endif
 
-      TOUCH("/tmp/kcs_touch");
+      if (kcs_stats) {
+        __atomic_store_n(&kcs_stats->last_req, (uint32_t)time(NULL), __ATOMIC_RELAXED);
+        kcs_stats->requests++;
+      }
 
       if ( true == is_add_sel_req(req_buf) )
       {
@@ -268,17 +392,19 @@ void *kcs_thread(void *unused) {
         memmove(&req_buf[1], req_buf, req_len);
         req_buf[0] = FRU_SERVER;
 
-        // Send to IPMI stack and get response
+        // Send to IPMI stack and get response, over this thread's
+        // persistent connection to ipmid (kept by libipc)
         // Additional byte as we are adding and passing payload ID for MN support
         lib_ipmi_handle(req_buf, req_len + 1, res_buf, &res_len);
       }
     } else {
-      //sleep(0);
+      // Drivers without poll support always report the fd readable
       nanosleep(&req, &rem);
       continue;
     }
 
     res_len = write(kcs_fd, res_buf, res_len);
+    kcs_stats_record(netfn, cmd, now_us() - start_us);
 
 #ifdef DEBUG
     memset(cmd, 0, 200);
@@ -302,6 +428,10 @@ main(int argc, char * const argv[]) {
   uint8_t kcs_channel_num = 2;
   const char *bmc_ready_n_shadow;
 
+  if (argc > 1 && !strcmp(argv[1], "--stats")) {
+    return kcs_stats_dump() ? -1 : 0;
+  }
+
   if (daemon(1, 0) != 0) {
     return -1;
   }
@@ -335,6 +465,8 @@ main(int argc, char * const argv[]) {
   }
   syslog(LOG_INFO, "opened %s", device);
 
+  kcs_stats_init();
+
   sleep(1);
 
   if (pthread_create(&thread, NULL, kcs_thread, NULL) < 0) {
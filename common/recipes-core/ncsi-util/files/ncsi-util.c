@@ -188,18 +188,39 @@ int sendPldmCmdAndCheckResp(NCSI_NL_MSG_T *nl_msg)
   return ret;
 }
 
+// prints transfer progress of the current component, once per percent
+static void pldm_fw_progress(const pldm_fw_progress_t *progress, void *arg)
+{
+  int *lastPct = (int *)arg;
+  int pct = progress->size ?
+            (int)((uint64_t)progress->offset * 100 / progress->size) : 100;
+
+  if (progress->done) {
+    printf("\rComponent[%d/%d]: %u of %u bytes sent, CRC32=0x%08x, result=%d\n",
+           progress->compIdx + 1, progress->compCnt, progress->offset,
+           progress->size, progress->crc32, progress->result);
+    *lastPct = -1;
+  } else if (pct != *lastPct) {
+    printf("\rComponent[%d/%d]: %3d%%", progress->compIdx + 1,
+           progress->compCnt, pct);
+    fflush(stdout);
+    *lastPct = pct;
+  }
+}
+
 int pldm_update_fw(char *path, int pldm_bufsize)
 {
 #define PLDM_STATE_CHANGE_TIMEOUT_S 180  // state change timeout in seconds
 #define SLEEP_TIME_MS               200  // wait time per loop in ms
   NCSI_NL_MSG_T *nl_msg = NULL;
   NCSI_NL_RSP_T *nl_resp = NULL;
-  pldm_fw_pkg_hdr_t *pkgHdr;
+  pldm_fw_pkg_hdr_t *pkgHdr = NULL;
   pldm_cmd_req pldmReq = {0};
   pldm_response *pldmRes = NULL;
   int i = 0;
   int ret = 0;
   int waitcycle = 0;
+  int lastPct = -1;
 #define MAX_WAIT_CYCLE 1000
 
   nl_msg = calloc(1, sizeof(NCSI_NL_MSG_T));
@@ -215,10 +236,17 @@ int pldm_update_fw(char *path, int pldm_bufsize)
   if (!pldmRes) {
     printf("%s, Error: failed pldmRes buffer allocation(%d)\n",
            __FUNCTION__, sizeof(pldm_response));
+    ret = -1;
+    goto free_exit;
   }
 
 
   pkgHdr = pldm_parse_fw_pkg(path);
+  if (!pkgHdr) {
+    ret = -1;
+    goto free_exit;
+  }
+  pldm_set_fw_progress_cb(pkgHdr, pldm_fw_progress, &lastPct);
 
 
   pldmCreateReqUpdateCmd(pkgHdr, &pldmReq, pldm_bufsize);
@@ -226,11 +254,11 @@ int pldm_update_fw(char *path, int pldm_bufsize)
   ret = create_ncsi_ctrl_pkt(nl_msg, 0, NCSI_PLDM_REQUEST, pldmReq.payload_size,
                        &(pldmReq.common[0]));
   if (ret) {
-    goto free_exit;
+    goto cancel_exit;
   }
 
   if (sendPldmCmdAndCheckResp(nl_msg) != CC_SUCCESS) {
-    goto free_exit;
+    goto cancel_exit;
   }
 
   for (i=0; i<pkgHdr->componentImageCnt; ++i) {
@@ -241,15 +269,17 @@ int pldm_update_fw(char *path, int pldm_bufsize)
     ret = create_ncsi_ctrl_pkt(nl_msg, 0, NCSI_PLDM_REQUEST, pldmReq.payload_size,
                          &(pldmReq.common[0]));
     if (ret) {
-      goto free_exit;
+      goto cancel_exit;
     }
     if (sendPldmCmdAndCheckResp(nl_msg) != CC_SUCCESS) {
-      goto free_exit;
+      goto cancel_exit;
     }
   }
 
 
 
+  // Components are updated one after another, each one is offered with
+  // UpdateComponent and then pulled by the device until ApplyComplete
   for (i=0; i<pkgHdr->componentImageCnt; ++i) {
     memset(&pldmReq, 0, sizeof(pldm_cmd_req));
     pldmCreateUpdateComponentCmd(pkgHdr, i, &pldmReq);
@@ -258,69 +288,78 @@ int pldm_update_fw(char *path, int pldm_bufsize)
     ret = create_ncsi_ctrl_pkt(nl_msg, 0, NCSI_PLDM_REQUEST, pldmReq.payload_size,
                          &(pldmReq.common[0]));
     if (ret) {
-      goto free_exit;
+      goto cancel_exit;
     }
     if (sendPldmCmdAndCheckResp(nl_msg) != CC_SUCCESS) {
-      goto free_exit;
-    }
-  }
-
-  // FW data transfer
-  int loopCount = 0;
-  int idleCnt = 0;
-  int pldmCmd = 0;
-  while (idleCnt < (PLDM_STATE_CHANGE_TIMEOUT_S * 1000 /SLEEP_TIME_MS) ) {
-//    printf("\n04 QueryPendingNcPldmRequestOp, loop=%d\n", loopCount);
-    ret = create_ncsi_ctrl_pkt(nl_msg, 0, NCSI_QUERY_PENDING_NC_PLDM_REQ, 0, NULL);
-    if (ret) {
-      goto free_exit;
-    }
-    nl_resp = send_nl_msg(nl_msg);
-    if (!nl_resp) {
-      goto free_exit;
-    }
-    print_pldm_cmd_status(nl_resp);
-
-    pldmCmd = ncsiGetPldmCmd(nl_resp, &pldmReq);
-    free(nl_resp);
-
-    if (pldmCmd == -1) {
-  //    printf("No pending command, loop %d\n", idleCnt);
-      msleep(SLEEP_TIME_MS); // wait some time and try again
-      idleCnt++;
-      continue;
-    } else {
-      idleCnt = 0;
+      goto cancel_exit;
     }
 
-    if ( (pldmCmd == CMD_REQUEST_FIRMWARE_DATA) ||
-         (pldmCmd == CMD_TRANSFER_COMPLETE) ||
-         (pldmCmd == CMD_VERIFY_COMPLETE) ||
-         (pldmCmd == CMD_APPLY_COMPLETE)) {
-      loopCount++;
-      waitcycle = 0;
-      int cmdStatus = 0;
-      cmdStatus = pldmFwUpdateCmdHandler(pkgHdr, &pldmReq, pldmRes);
-      ret = create_ncsi_ctrl_pkt(nl_msg, 0, NCSI_SEND_NC_PLDM_REPLY,
-                                 pldmRes->resp_size, pldmRes->common);
+    // FW data transfer
+    int idleCnt = 0;
+    int pldmCmd = 0;
+    int applied = 0;
+    waitcycle = 0;
+    while (idleCnt < (PLDM_STATE_CHANGE_TIMEOUT_S * 1000 /SLEEP_TIME_MS) ) {
+      ret = create_ncsi_ctrl_pkt(nl_msg, 0, NCSI_QUERY_PENDING_NC_PLDM_REQ, 0, NULL);
       if (ret) {
-        goto free_exit;
+        goto cancel_exit;
       }
       nl_resp = send_nl_msg(nl_msg);
       if (!nl_resp) {
-        goto free_exit;
+        goto cancel_exit;
       }
-      //print_ncsi_resp(nl_resp);
+
+      pldmCmd = ncsiGetPldmCmd(nl_resp, &pldmReq);
       free(nl_resp);
-      if ((pldmCmd == CMD_APPLY_COMPLETE) || (cmdStatus == -1))
-        break;
-    } else {
-      printf("unknown PLDM cmd 0x%x\n", pldmCmd);
-      waitcycle++;
-      if (waitcycle >= MAX_WAIT_CYCLE) {
-        printf("max wait cycle exceeded, exit\n");
-        break;
+      nl_resp = NULL;
+
+      if (pldmCmd == -1) {
+        msleep(SLEEP_TIME_MS); // wait some time and try again
+        idleCnt++;
+        continue;
+      } else {
+        idleCnt = 0;
       }
+
+      if ( (pldmCmd == CMD_REQUEST_FIRMWARE_DATA) ||
+           (pldmCmd == CMD_TRANSFER_COMPLETE) ||
+           (pldmCmd == CMD_VERIFY_COMPLETE) ||
+           (pldmCmd == CMD_APPLY_COMPLETE)) {
+        waitcycle = 0;
+        int cmdStatus = 0;
+        cmdStatus = pldmFwUpdateCmdHandler(pkgHdr, &pldmReq, pldmRes);
+        ret = create_ncsi_ctrl_pkt(nl_msg, 0, NCSI_SEND_NC_PLDM_REPLY,
+                                   pldmRes->resp_size, pldmRes->common);
+        if (ret) {
+          goto cancel_exit;
+        }
+        nl_resp = send_nl_msg(nl_msg);
+        if (!nl_resp) {
+          goto cancel_exit;
+        }
+        free(nl_resp);
+        nl_resp = NULL;
+        if (cmdStatus == -1) {
+          goto cancel_exit;
+        }
+        if (pldmCmd == CMD_APPLY_COMPLETE) {
+          applied = 1;
+          break;
+        }
+      } else {
+        printf("unknown PLDM cmd 0x%x\n", pldmCmd);
+        waitcycle++;
+        if (waitcycle >= MAX_WAIT_CYCLE) {
+          printf("max wait cycle exceeded, exit\n");
+          break;
+        }
+      }
+    }
+
+    // a stalled component must not be activated, drop the whole update
+    if (!applied) {
+      printf("\nComponent[%d] was not applied, cancel update\n", i);
+      goto cancel_exit;
     }
   }
 
@@ -331,11 +370,24 @@ int pldm_update_fw(char *path, int pldm_bufsize)
   ret = create_ncsi_ctrl_pkt(nl_msg, 0, NCSI_PLDM_REQUEST, pldmReq.payload_size,
                        &(pldmReq.common[0]));
   if (ret) {
-    goto free_exit;
+    goto cancel_exit;
   }
   if (sendPldmCmdAndCheckResp(nl_msg) != CC_SUCCESS) {
-    goto free_exit;
+    goto cancel_exit;
+  }
+  goto free_exit;
+
+// every abort after RequestUpdate cancels, the device may already be in
+// update mode (e.g. left there by an earlier failed run)
+cancel_exit:
+  memset(&pldmReq, 0, sizeof(pldm_cmd_req));
+  pldmCreateCancelUpdateCmd(&pldmReq);
+  printf("\nPldmCancelUpdateOp\n");
+  if (!create_ncsi_ctrl_pkt(nl_msg, 0, NCSI_PLDM_REQUEST, pldmReq.payload_size,
+                            &(pldmReq.common[0]))) {
+    sendPldmCmdAndCheckResp(nl_msg);
   }
+  ret = -1;
 
 free_exit:
   if (pkgHdr)
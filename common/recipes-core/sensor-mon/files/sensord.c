@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
 #include <pthread.h>
 #include <sys/file.h>
 #include <sys/stat.h>
@@ -41,9 +42,69 @@
 #define MAX_SENSOR_CHECK_RETRY 3
 #define MAX_ASSERT_CHECK_RETRY 1
 
+#define RECHECK_DELAY_MS    50    // between threshold confirmation samples
+#define MIN_POLL_MS         100   // floor for pal_get_sensor_poll_interval_ms()
+#define DEADLINE_SLACK_MS   100   // a poll starting later than this is "missed"
+#define SNR_STATS_FILE      "/tmp/sensord.stats"
+#define SNR_STATS_PERIOD    30    // seconds
+
 static thresh_sensor_t g_snr[MAX_NUM_FRUS][MAX_SENSOR_NUM] = {0};
 static thresh_sensor_t g_aggregate_snr[MAX_SENSOR_NUM] = {0};
 
+/*
+ * Sensors are polled by deadline driven workers. Each FRU (and the
+ * aggregate sensors) is a scheduling domain with its own min-heap of
+ * events and its own worker, so pal calls for one FRU stay serialized
+ * as before, while a FRU behind a slow or hung bus only delays its own
+ * sensors.
+ */
+enum {
+  EV_POLL = 0,    // periodic threshold sensor read
+  EV_RECHECK,     // confirmation re-read of a threshold crossing
+  EV_TICK,        // per-FRU housekeeping and discrete sensors
+};
+
+typedef struct {
+  uint64_t deadline;  // CLOCK_MONOTONIC, ms
+  int idx;            // position in the domain heap, -1 if not queued
+  uint8_t type;
+  uint8_t snr_num;
+} snr_event_t;
+
+typedef struct {
+  snr_event_t poll;
+  snr_event_t recheck;
+  bool want_recheck;
+  uint32_t interval_ms;
+  // consecutive samples seen beyond (or back within) each threshold
+  uint8_t assert_cnt[LNR_THRESH + 1];
+  uint8_t deassert_cnt[LNR_THRESH + 1];
+  // statistics, updated under g_sched_lock
+  uint64_t polls;
+  uint64_t missed;
+  uint32_t win_polls;
+  uint32_t late_max_ms;
+} snr_sched_t;
+
+typedef struct {
+  uint8_t fru;
+  bool paused;        // FW update or failed SDR update in progress
+  uint8_t *sensor_list;
+  int sensor_cnt;
+  uint8_t *discrete_list;
+  int discrete_cnt;
+  snr_sched_t sched[256];
+  snr_event_t tick;
+  snr_event_t **heap;
+  int heap_len;
+  uint32_t pass;      // bumped each time the worker wakes up for due events
+  uint64_t rechecks;
+} snr_domain_t;
+
+// index 0 is the aggregate sensor domain, FRU n is at index n
+static snr_domain_t *g_domain[MAX_NUM_FRUS + 1] = {0};
+static pthread_mutex_t g_sched_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void
 print_usage() {
     printf("Usage: sensord <options>\n");
@@ -120,13 +181,44 @@ init_fru_snr_thresh(uint8_t fru) {
   return 0;
 }
 
+/*
+ * The aggregate sensors share most of their sources, so they are all
+ * evaluated in one pass, reading each source once. Sensors run in the
+ * same scheduler pass (one wakeup of the aggregate worker) share its
+ * result; a new pass, or a sensor read again within the same pass,
+ * evaluates them again. Only the worker serving the aggregate domain
+ * gets here, so no locking is needed.
+ */
+static int
+aggregate_read(uint8_t snr_num, float *val)
+{
+  static float values[MAX_SENSOR_NUM];
+  static int status[MAX_SENSOR_NUM];
+  static bool used[256];
+  static int count = 0;
+  static uint32_t pass = 0;
+  uint32_t cur = g_domain[0]->pass;
+
+  if (count == 0 || pass != cur || used[snr_num]) {
+    count = aggregate_sensor_read_all(values, status, MAX_SENSOR_NUM);
+    memset(used, 0, sizeof(used));
+    pass = cur;
+  }
+  used[snr_num] = true;
+  if (snr_num >= count || status[snr_num]) {
+    return -1;
+  }
+  *val = values[snr_num];
+  return 0;
+}
+
 static int
 sensor_raw_read_helper(uint8_t fru, uint8_t snr_num, float *val)
 {
   int ret = 0;
 
   if (fru == AGGREGATE_SENSOR_FRU_ID) {
-    ret = aggregate_sensor_read(snr_num, val);
+    ret = aggregate_read(snr_num, val);
     if (ret == 0) {
       sensor_cache_write(fru, snr_num, true, *val);
     } else {
@@ -176,9 +268,21 @@ get_snr_thresh_val(uint8_t fru, uint8_t snr_num, uint8_t thresh) {
   return val;
 }
 
+static snr_sched_t *
+get_snr_sched(uint8_t fru, uint8_t snr_num) {
+  snr_domain_t *d;
+
+  d = g_domain[fru == AGGREGATE_SENSOR_FRU_ID ? 0 : fru];
+  return &d->sched[snr_num];
+}
+
 /*
  * Check the curr sensor values against the threshold and
  * if the curr val has deasserted, log it.
+ *
+ * A deassertion has to be seen on MAX_SENSOR_CHECK_RETRY further
+ * samples before it is logged; returns 1 while that confirmation is
+ * pending, so the caller schedules a re-read.
  */
 static int
 check_thresh_deassert(uint8_t fru, uint8_t snr_num, uint8_t thresh,
@@ -187,42 +291,44 @@ check_thresh_deassert(uint8_t fru, uint8_t snr_num, uint8_t thresh,
   float thresh_val;
   char thresh_name[100];
   thresh_sensor_t *snr;
-  uint8_t retry = 0;
-  int ret;
+  uint8_t *confirm;
 
   snr = get_struct_thresh_sensor(fru);
+  confirm = &get_snr_sched(fru, snr_num)->deassert_cnt[thresh];
 
   if (!GETBIT(snr[snr_num].flag, thresh) ||
-      !GETBIT(snr[snr_num].curr_state, thresh))
+      !GETBIT(snr[snr_num].curr_state, thresh)) {
+    *confirm = 0;
     return 0;
+  }
 
   thresh_val = get_snr_thresh_val(fru, snr_num, thresh);
 
-  while (retry <= MAX_SENSOR_CHECK_RETRY) {
-    switch (thresh) {
-
-      case UNR_THRESH:
-      case UCR_THRESH:
-      case UNC_THRESH:
-        if (FORMAT_CONV(*curr_val) >= FORMAT_CONV((thresh_val - snr[snr_num].neg_hyst)))
-          return 0;
-        break;
-
-      case LNR_THRESH:
-      case LCR_THRESH:
-      case LNC_THRESH:
-        if (FORMAT_CONV(*curr_val) <= FORMAT_CONV((thresh_val + snr[snr_num].pos_hyst)))
-          return 0;
-    }
+  switch (thresh) {
 
-    if (retry < MAX_SENSOR_CHECK_RETRY) {
-      msleep(50);
-      ret = sensor_raw_read_helper(fru, snr_num, curr_val);
-      if (ret < 0)
-        return -1;
-    }
-    retry++;
+    case UNR_THRESH:
+    case UCR_THRESH:
+    case UNC_THRESH:
+      if (FORMAT_CONV(*curr_val) >= FORMAT_CONV((thresh_val - snr[snr_num].neg_hyst))) {
+        *confirm = 0;
+        return 0;
+      }
+      break;
+
+    case LNR_THRESH:
+    case LCR_THRESH:
+    case LNC_THRESH:
+      if (FORMAT_CONV(*curr_val) <= FORMAT_CONV((thresh_val + snr[snr_num].pos_hyst))) {
+        *confirm = 0;
+        return 0;
+      }
+  }
+
+  if (*confirm < MAX_SENSOR_CHECK_RETRY) {
+    (*confirm)++;
+    return 1;
   }
+  *confirm = 0;
 
   switch (thresh) {
     case UNC_THRESH:
@@ -283,6 +389,9 @@ check_thresh_deassert(uint8_t fru, uint8_t snr_num, uint8_t thresh,
 /*
  * Check the curr sensor values against the threshold and
  * if the curr val has asserted, log it.
+ *
+ * Like deassertion, an assertion is confirmed on MAX_ASSERT_CHECK_RETRY
+ * further samples; returns 1 while that is pending.
  */
 static int
 check_thresh_assert(uint8_t fru, uint8_t snr_num, uint8_t thresh,
@@ -291,46 +400,48 @@ check_thresh_assert(uint8_t fru, uint8_t snr_num, uint8_t thresh,
   float thresh_val;
   char thresh_name[100];
   thresh_sensor_t *snr;
-  uint8_t retry = 0;
-  int ret;
+  uint8_t *confirm;
 
   snr = get_struct_thresh_sensor(fru);
+  confirm = &get_snr_sched(fru, snr_num)->assert_cnt[thresh];
 
-  if (pal_ignore_thresh(fru,snr_num,thresh))
+  if (pal_ignore_thresh(fru,snr_num,thresh)) {
+    *confirm = 0;
     return 0;
+  }
 
   if (!GETBIT(snr[snr_num].flag, thresh) ||
-      GETBIT(snr[snr_num].curr_state, thresh))
+      GETBIT(snr[snr_num].curr_state, thresh)) {
+    *confirm = 0;
     return 0;
+  }
 
   thresh_val = get_snr_thresh_val(fru, snr_num, thresh);
 
-  while (retry <= MAX_ASSERT_CHECK_RETRY) {
-    switch (thresh) {
-      case UNR_THRESH:
-      case UCR_THRESH:
-      case UNC_THRESH:
-        if (FORMAT_CONV(*curr_val) < FORMAT_CONV(thresh_val)) {
-          return 0;
-        }
-        break;
-      case LNR_THRESH:
-      case LCR_THRESH:
-      case LNC_THRESH:
-        if (FORMAT_CONV(*curr_val) > FORMAT_CONV(thresh_val)) {
-          return 0;
-        }
-        break;
-    }
+  switch (thresh) {
+    case UNR_THRESH:
+    case UCR_THRESH:
+    case UNC_THRESH:
+      if (FORMAT_CONV(*curr_val) < FORMAT_CONV(thresh_val)) {
+        *confirm = 0;
+        return 0;
+      }
+      break;
+    case LNR_THRESH:
+    case LCR_THRESH:
+    case LNC_THRESH:
+      if (FORMAT_CONV(*curr_val) > FORMAT_CONV(thresh_val)) {
+        *confirm = 0;
+        return 0;
+      }
+      break;
+  }
 
-    if (retry < MAX_ASSERT_CHECK_RETRY) {
-      msleep(50);
-      ret = sensor_raw_read_helper(fru, snr_num, curr_val);
-      if (ret < 0)
-        return -1;
-    }
-    retry++;
+  if (*confirm < MAX_ASSERT_CHECK_RETRY) {
+    (*confirm)++;
+    return 1;
   }
+  *confirm = 0;
 
   switch (thresh) {
     case UNR_THRESH:
@@ -439,123 +550,407 @@ thresh_reinit_chk(uint8_t fru) {
   return ret;
 }
 
+static uint64_t
+mono_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+heap_swap(snr_domain_t *d, int a, int b) {
+  snr_event_t *ev = d->heap[a];
+
+  d->heap[a] = d->heap[b];
+  d->heap[b] = ev;
+  d->heap[a]->idx = a;
+  d->heap[b]->idx = b;
+}
+
+static void
+heap_push(snr_domain_t *d, snr_event_t *ev) {
+  int i = d->heap_len++;
+
+  d->heap[i] = ev;
+  ev->idx = i;
+  while (i > 0 && d->heap[(i - 1) / 2]->deadline > d->heap[i]->deadline) {
+    heap_swap(d, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static snr_event_t *
+heap_pop(snr_domain_t *d) {
+  snr_event_t *top = d->heap[0];
+  int i = 0, c;
+
+  heap_swap(d, 0, --d->heap_len);
+  while ((c = 2 * i + 1) < d->heap_len) {
+    if (c + 1 < d->heap_len && d->heap[c + 1]->deadline < d->heap[c]->deadline)
+      c++;
+    if (d->heap[i]->deadline <= d->heap[c]->deadline)
+      break;
+    heap_swap(d, i, c);
+    i = c;
+  }
+  top->idx = -1;
+  return top;
+}
+
 /*
- * Starts monitoring all the sensors on a fru for all the threshold/discrete values.
- * Each pthread runs this monitoring for a different fru.
+ * Poll interval of a threshold sensor in ms. Platforms wanting
+ * sub-second polling implement pal_get_sensor_poll_interval_ms(),
+ * otherwise the SDR/pal interval in seconds is used as before.
  */
-static void *
-snr_monitor(void *arg) {
+static uint32_t
+get_snr_interval_ms(uint8_t fru, uint8_t snr_num) {
+  thresh_sensor_t *snr = get_struct_thresh_sensor(fru);
+  uint32_t ms;
+
+  if (fru != AGGREGATE_SENSOR_FRU_ID &&
+      pal_get_sensor_poll_interval_ms(fru, snr_num, &ms) == 0) {
+    return ms < MIN_POLL_MS ? MIN_POLL_MS : ms;
+  }
+  if (snr[snr_num].poll_interval < MIN_POLL_INTERVAL)
+    return MIN_POLL_INTERVAL * 1000;
+  return snr[snr_num].poll_interval * 1000;
+}
 
-  uint8_t fru = (uint8_t)(uintptr_t)arg;
-  int i, ret, snr_num, sensor_cnt, discrete_cnt;
-  float curr_val;
-  uint8_t *sensor_list, *discrete_list;
-  thresh_sensor_t *snr;
-  uint32_t snr_poll_interval[MAX_SENSOR_NUM] = {0};
+/*
+ * Read a threshold sensor and run the assert/deassert checks on the
+ * sample. Returns true if a crossing still waits for confirmation.
+ */
+static bool
+poll_thresh_sensor(uint8_t fru, uint8_t snr_num) {
+#ifdef DEBUG
+  thresh_sensor_t *snr = get_struct_thresh_sensor(fru);
+#endif /* DEBUG */
+  snr_sched_t *s = get_snr_sched(fru, snr_num);
+  float curr_val = 0;
+  int pending = 0;
 
-  ret = pal_get_fru_sensor_list(fru, &sensor_list, &sensor_cnt);
-  if (ret < 0) {
-    pthread_detach(pthread_self());
-    pthread_exit(NULL);
+  if (sensor_raw_read_helper(fru, snr_num, &curr_val)) {
+#ifdef DEBUG
+    syslog(LOG_ERR, "FRU: %d, num: 0x%X, snr:%-16s, read failed",
+        fru, snr_num, snr[snr_num].name);
+#endif /* DEBUG */
+    memset(s->assert_cnt, 0, sizeof(s->assert_cnt));
+    memset(s->deassert_cnt, 0, sizeof(s->deassert_cnt));
+    return false;
   }
 
-  ret = pal_get_fru_discrete_list(fru, &discrete_list, &discrete_cnt);
-  if (ret < 0) {
-    pthread_detach(pthread_self());
-    pthread_exit(NULL);
+  pending |= check_thresh_assert(fru, snr_num, UNC_THRESH, &curr_val);
+  pending |= check_thresh_assert(fru, snr_num, UCR_THRESH, &curr_val);
+  pending |= check_thresh_assert(fru, snr_num, UNR_THRESH, &curr_val);
+  pending |= check_thresh_assert(fru, snr_num, LNC_THRESH, &curr_val);
+  pending |= check_thresh_assert(fru, snr_num, LCR_THRESH, &curr_val);
+  pending |= check_thresh_assert(fru, snr_num, LNR_THRESH, &curr_val);
+
+  pending |= check_thresh_deassert(fru, snr_num, UNR_THRESH, &curr_val);
+  pending |= check_thresh_deassert(fru, snr_num, UCR_THRESH, &curr_val);
+  pending |= check_thresh_deassert(fru, snr_num, UNC_THRESH, &curr_val);
+  pending |= check_thresh_deassert(fru, snr_num, LNR_THRESH, &curr_val);
+  pending |= check_thresh_deassert(fru, snr_num, LCR_THRESH, &curr_val);
+  pending |= check_thresh_deassert(fru, snr_num, LNC_THRESH, &curr_val);
+
+  return pending != 0;
+}
+
+/*
+ * Per-FRU housekeeping that used to run at the top of every monitor
+ * loop, plus the discrete sensors. Returns the delay to the next tick.
+ */
+static uint32_t
+fru_tick(snr_domain_t *d) {
+  uint8_t fru = d->fru;
+  int i, ret, snr_num;
+  float curr_val;
+  thresh_sensor_t *snr = get_struct_thresh_sensor(fru);
+
+  if (pal_is_fw_update_ongoing(fru)) {
+    d->paused = true;
+    return STOP_PERIOD * 1000;
   }
 
-  if ((sensor_cnt == 0) && (discrete_cnt == 0)) {
-    pthread_detach(pthread_self());
-    pthread_exit(NULL);
+  if (pal_get_sdr_update_flag(fru)) {
+    sdr_cache_invalidate(fru);
+    if (init_fru_snr_thresh(fru) < 0 || pal_update_sensor_reading_sdr(fru) < 0) {
+      syslog(LOG_DEBUG, "%s : slot%u SDR update fail", __func__, fru);
+      d->paused = true;
+      return STOP_PERIOD * 1000;
+    } else {
+      syslog(LOG_DEBUG, "%s : slot%u SDR update successfully", __func__, fru);
+      pal_set_sdr_update_flag(fru,0);
+    }
+  }
+  d->paused = false;
+
+  ret = thresh_reinit_chk(fru);
+  if (ret < 0)
+    syslog(LOG_ERR, "%s: Fail to reinit sensor threshold for fru%d",__func__,fru);
+
+  for (i = 0; i < d->discrete_cnt; i++) {
+    snr_num = d->discrete_list[i];
+    ret = sensor_raw_read_helper(fru, snr_num, &curr_val);
+    if (!ret && (snr[snr_num].curr_state != (int) curr_val)) {
+      pal_sensor_discrete_check(fru, snr_num, snr[snr_num].name,
+          snr[snr_num].curr_state, (int) curr_val);
+      snr[snr_num].curr_state = (int) curr_val;
+    }
   }
 
-  snr = get_struct_thresh_sensor(fru);
-  if (snr == NULL) {
-    syslog(LOG_WARNING, "snr_monitor: get_struct_thresh_sensor failed");
-    exit(-1);
+#ifdef DYN_THRESH_FRU1
+  // Handle dynamic threshold changes for FRU1
+  if (fru == 1) {
+    init_fru_snr_thresh(1);
   }
+#endif
 
-  for (i = 0; i < discrete_cnt; i++) {
-    snr_num = discrete_list[i];
-    pal_get_sensor_name(fru, snr_num, snr[snr_num].name);
+  return MIN_POLL_INTERVAL * 1000;
+}
+
+/*
+ * Runs one event of a domain the caller owns. Returns the deadline to
+ * requeue the event at, or 0 if it is done; *polled tells whether the
+ * sensor was read on schedule.
+ */
+static uint64_t
+run_event(snr_domain_t *d, snr_event_t *ev, uint64_t now, bool *polled) {
+  thresh_sensor_t *snr = get_struct_thresh_sensor(d->fru);
+  snr_sched_t *s = &d->sched[ev->snr_num];
+  uint64_t next;
+
+  *polled = false;
+  switch (ev->type) {
+    case EV_TICK:
+      return mono_ms() + fru_tick(d);
+
+    case EV_RECHECK:
+      if (!d->paused && snr[ev->snr_num].flag)
+        s->want_recheck = poll_thresh_sensor(d->fru, ev->snr_num);
+      return 0;
+
+    case EV_POLL:
+    default:
+      if (!d->paused && snr[ev->snr_num].flag) {
+        s->want_recheck = poll_thresh_sensor(d->fru, ev->snr_num);
+        *polled = true;
+      }
+      // keep the phase of the sensor instead of drifting by the read
+      // time; if a whole period was lost, start over from now
+      s->interval_ms = get_snr_interval_ms(d->fru, ev->snr_num);
+      next = ev->deadline + s->interval_ms;
+      if (next <= now)
+        next = now + s->interval_ms;
+      return next;
   }
+}
 
-  while(1) {
-    if (pal_is_fw_update_ongoing(fru)) {
-      sleep(STOP_PERIOD);
+/*
+ * Worker of one domain. Only it touches the heap once the domain is
+ * set up; g_sched_lock guards the statistics read by snr_dump_stats().
+ */
+static void *
+snr_worker(void *arg) {
+  snr_domain_t *d = (snr_domain_t *)arg;
+  snr_event_t *ev;
+  snr_sched_t *s;
+  uint64_t now, next, late;
+  struct timespec ts;
+  bool polled;
+
+  while (d->heap_len > 0) {
+    next = d->heap[0]->deadline;
+    now = mono_ms();
+    if (next > now) {
+      ts.tv_sec = next / 1000;
+      ts.tv_nsec = (next % 1000) * 1000000;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      d->pass++;
       continue;
     }
 
-    if (pal_get_sdr_update_flag(fru)) {
-      if (init_fru_snr_thresh(fru) < 0 || pal_update_sensor_reading_sdr(fru) < 0) {
-        syslog(LOG_DEBUG, "%s : slot%u SDR update fail", __func__, fru);
-        sleep(STOP_PERIOD);
-        continue;
-      } else {
-        syslog(LOG_DEBUG, "%s : slot%u SDR update successfully", __func__, fru);
-        pal_set_sdr_update_flag(fru,0);
+    pthread_mutex_lock(&g_sched_lock);
+    ev = heap_pop(d);
+    pthread_mutex_unlock(&g_sched_lock);
+
+    next = run_event(d, ev, now, &polled);
+
+    pthread_mutex_lock(&g_sched_lock);
+    s = &d->sched[ev->snr_num];
+    if (polled) {
+      late = now - ev->deadline;
+      s->polls++;
+      s->win_polls++;
+      if (late > DEADLINE_SLACK_MS)
+        s->missed++;
+      if (late > s->late_max_ms)
+        s->late_max_ms = late;
+    }
+    if (ev->type == EV_RECHECK)
+      d->rechecks++;
+    if (next) {
+      ev->deadline = next;
+      heap_push(d, ev);
+    }
+    if (ev->type != EV_TICK && s->want_recheck) {
+      s->want_recheck = false;
+      if (s->recheck.idx < 0) {
+        s->recheck.deadline = mono_ms() + RECHECK_DELAY_MS;
+        heap_push(d, &s->recheck);
       }
     }
+    pthread_mutex_unlock(&g_sched_lock);
+  }
+  return NULL;
+}
 
-    ret = thresh_reinit_chk(fru);
-    if (ret < 0)
-      syslog(LOG_ERR, "%s: Fail to reinit sensor threshold for fru%d",__func__,fru);
-
-    for (i = 0; i < sensor_cnt; i++) {
-      snr_num = sensor_list[i];
-      curr_val = 0;
-      if (snr[snr_num].flag) {
-        // granular the sensor via assigning the poll_interval
-        if (snr_poll_interval[snr_num] > MIN_POLL_INTERVAL) {
-          snr_poll_interval[snr_num] -= MIN_POLL_INTERVAL;
-          continue;
-        }
-        snr_poll_interval[snr_num] = snr[snr_num].poll_interval;
-        if (!(ret = sensor_raw_read_helper(fru, snr_num, &curr_val))) {
-
-          check_thresh_assert(fru, snr_num, UNC_THRESH, &curr_val);
-          check_thresh_assert(fru, snr_num, UCR_THRESH, &curr_val);
-          check_thresh_assert(fru, snr_num, UNR_THRESH, &curr_val);
-          check_thresh_assert(fru, snr_num, LNC_THRESH, &curr_val);
-          check_thresh_assert(fru, snr_num, LCR_THRESH, &curr_val);
-          check_thresh_assert(fru, snr_num, LNR_THRESH, &curr_val);
-
-          check_thresh_deassert(fru, snr_num, UNR_THRESH, &curr_val);
-          check_thresh_deassert(fru, snr_num, UCR_THRESH, &curr_val);
-          check_thresh_deassert(fru, snr_num, UNC_THRESH, &curr_val);
-          check_thresh_deassert(fru, snr_num, LNR_THRESH, &curr_val);
-          check_thresh_deassert(fru, snr_num, LCR_THRESH, &curr_val);
-          check_thresh_deassert(fru, snr_num, LNC_THRESH, &curr_val);
-#ifdef DEBUG
-        } else {
-          syslog(LOG_ERR, "FRU: %d, num: 0x%X, snr:%-16s, read failed",
-              fru, snr_num, snr[snr_num].name);
-#endif /* DEBUG */
-        } /* pal_sensor_read return check */
-      } /* flag check */
-    } /* loop for all sensors */
-
-    for (i = 0; i < discrete_cnt; i++) {
-      snr_num = discrete_list[i];
-      ret = sensor_raw_read_helper(fru, snr_num, &curr_val);
-      if (!ret && (snr[snr_num].curr_state != (int) curr_val)) {
-        pal_sensor_discrete_check(fru, snr_num, snr[snr_num].name,
-            snr[snr_num].curr_state, (int) curr_val);
-        snr[snr_num].curr_state = (int) curr_val;
+/*
+ * Set up the scheduling domain of a FRU, or of the aggregate sensors.
+ * The first poll of each sensor is spread over its interval so reads
+ * do not all land on the same tick, and each domain starts 'offset' ms
+ * after the previous one.
+ */
+static snr_domain_t *
+snr_domain_init(uint8_t fru, uint8_t *sensor_list, int sensor_cnt,
+    uint8_t *discrete_list, int discrete_cnt, uint64_t start) {
+  snr_domain_t *d;
+  snr_sched_t *s;
+  thresh_sensor_t *snr;
+  int i;
+
+  d = calloc(1, sizeof(snr_domain_t));
+  if (d == NULL)
+    return NULL;
+  d->heap = calloc(2 * sensor_cnt + 1, sizeof(snr_event_t *));
+  if (d->heap == NULL) {
+    free(d);
+    return NULL;
+  }
+  d->fru = fru;
+  d->sensor_list = sensor_list;
+  d->sensor_cnt = sensor_cnt;
+  d->discrete_list = discrete_list;
+  d->discrete_cnt = discrete_cnt;
+
+  snr = get_struct_thresh_sensor(fru);
+  for (i = 0; i < discrete_cnt; i++) {
+    pal_get_sensor_name(fru, discrete_list[i], snr[discrete_list[i]].name);
+  }
+
+  for (i = 0; i < (int)(sizeof(d->sched) / sizeof(d->sched[0])); i++) {
+    d->sched[i].poll.idx = -1;
+    d->sched[i].recheck.idx = -1;
+  }
+  for (i = 0; i < sensor_cnt; i++) {
+    s = &d->sched[sensor_list[i]];
+    if (s->poll.idx >= 0)
+      continue;
+    s->interval_ms = get_snr_interval_ms(fru, sensor_list[i]);
+    s->poll.type = EV_POLL;
+    s->poll.snr_num = sensor_list[i];
+    // aggregate sensors are read in one pass, so they are due together
+    if (fru == AGGREGATE_SENSOR_FRU_ID)
+      s->poll.deadline = start;
+    else
+      s->poll.deadline = start + (uint64_t)s->interval_ms * i / sensor_cnt;
+    s->recheck.type = EV_RECHECK;
+    s->recheck.snr_num = sensor_list[i];
+    heap_push(d, &s->poll);
+  }
+  if (fru != AGGREGATE_SENSOR_FRU_ID) {
+    d->tick.type = EV_TICK;
+    d->tick.deadline = start;
+    heap_push(d, &d->tick);
+  }
+  return d;
+}
+
+/*
+ * Dump the scheduler statistics: per domain the configured and the
+ * achieved poll rate, deadlines missed and the worst lateness; sensors
+ * polled noticeably slower than configured are listed separately.
+ */
+static void
+snr_dump_stats(uint32_t window) {
+  FILE *fp;
+  snr_domain_t *d;
+  snr_sched_t *s;
+  thresh_sensor_t *snr;
+  char name[32];
+  char tmp[] = SNR_STATS_FILE ".tmp";
+  double cfg_rate, act_rate;
+  uint64_t polls, missed;
+  uint32_t late_max;
+  int i, j;
+
+  if (window == 0)
+    return;
+  fp = fopen(tmp, "w");
+  if (fp == NULL)
+    return;
+
+  pthread_mutex_lock(&g_sched_lock);
+  fprintf(fp, "%-16s %7s %9s %9s %10s %8s %8s %8s\n", "FRU", "sensors",
+      "cfg(/s)", "act(/s)", "polls", "missed", "late(ms)", "rechecks");
+  for (i = 0; i <= MAX_NUM_FRUS; i++) {
+    if ((d = g_domain[i]) == NULL)
+      continue;
+    if (d->fru == AGGREGATE_SENSOR_FRU_ID || pal_get_fru_name(d->fru, name))
+      snprintf(name, sizeof(name), "%s", i ? "unknown" : "aggregate");
+    cfg_rate = act_rate = 0;
+    polls = missed = 0;
+    late_max = 0;
+    snr = get_struct_thresh_sensor(d->fru);
+    for (j = 0; j < d->sensor_cnt; j++) {
+      s = &d->sched[d->sensor_list[j]];
+      if (snr[d->sensor_list[j]].flag && !d->paused)
+        cfg_rate += 1000.0 / s->interval_ms;
+      act_rate += (double)s->win_polls / window;
+      polls += s->polls;
+      missed += s->missed;
+      if (s->late_max_ms > late_max)
+        late_max = s->late_max_ms;
+    }
+    fprintf(fp, "%-16s %7d %9.2f %9.2f %10llu %8llu %8u %8llu%s\n", name,
+        d->sensor_cnt, cfg_rate, act_rate, (unsigned long long)polls,
+        (unsigned long long)missed, late_max,
+        (unsigned long long)d->rechecks, d->paused ? " (paused)" : "");
+  }
+
+  fprintf(fp, "\nSensors below 90%% of their configured rate:\n");
+  for (i = 0; i <= MAX_NUM_FRUS; i++) {
+    if ((d = g_domain[i]) == NULL || d->paused)
+      continue;
+    snr = get_struct_thresh_sensor(d->fru);
+    for (j = 0; j < d->sensor_cnt; j++) {
+      s = &d->sched[d->sensor_list[j]];
+      if (!snr[d->sensor_list[j]].flag || s->polls == 0)
+        continue;
+      cfg_rate = 1000.0 / s->interval_ms;
+      act_rate = (double)s->win_polls / window;
+      if (act_rate < cfg_rate * 0.9) {
+        fprintf(fp, "  FRU %u num 0x%02X %-24s interval %u ms, %.2f/s, "
+            "missed %llu, late max %u ms\n", d->fru, d->sensor_list[j],
+            snr[d->sensor_list[j]].name, s->interval_ms, act_rate,
+            (unsigned long long)s->missed, s->late_max_ms);
       }
     }
+  }
 
-#ifdef DYN_THRESH_FRU1
-    // Handle dynamic threshold changes for FRU1
-    if (fru == 1) {
-      init_fru_snr_thresh(1);
+  for (i = 0; i <= MAX_NUM_FRUS; i++) {
+    if ((d = g_domain[i]) == NULL)
+      continue;
+    for (j = 0; j < d->sensor_cnt; j++) {
+      d->sched[d->sensor_list[j]].win_polls = 0;
     }
-#endif
+  }
+  pthread_mutex_unlock(&g_sched_lock);
 
-    sleep(MIN_POLL_INTERVAL);
-  } /* while loop*/
-} /* function definition */
+  fclose(fp);
+  rename(tmp, SNR_STATS_FILE);
+}
 
 static void *
 snr_health_monitor() {
@@ -567,6 +962,7 @@ snr_health_monitor() {
   int ret = 0;
   uint8_t fru_health_last_state[MAX_NUM_FRUS+1] = {0};
   uint8_t fru_health_kv_state[MAX_NUM_FRUS+1] = {0};
+  uint64_t now, last_dump = mono_ms();
 
   // Initial fru health, default value is good.
   for (num = 0; num<=MAX_NUM_FRUS; num++){
@@ -614,19 +1010,22 @@ snr_health_monitor() {
       pal_set_sensor_health(fru, value);
 
     } /* for loop for frus */
+
+    now = mono_ms();
+    if (now - last_dump >= SNR_STATS_PERIOD * 1000) {
+      snr_dump_stats((now - last_dump) / 1000);
+      last_dump = now;
+    }
     sleep(MIN_POLL_INTERVAL);
   } /* while loop */
 }
 
-static void *
-aggregate_snr_monitor(void *unused)
+/* Scheduling domain of the aggregate sensors */
+static int
+init_aggregate_snr(uint64_t start)
 {
+  static uint8_t agg_list[MAX_SENSOR_NUM];
   size_t cnt = 0, i;
-  int ret;
-  float curr_val;
-  uint8_t fru = AGGREGATE_SENSOR_FRU_ID;
-  uint8_t snr_num;
-  thresh_sensor_t *snr;
 
   if(aggregate_sensor_init(NULL)) {
     syslog(LOG_WARNING, "Initializing aggregate sensors failed!");
@@ -634,62 +1033,42 @@ aggregate_snr_monitor(void *unused)
 
   aggregate_sensor_count(&cnt);
   if (cnt == 0) {
-    pthread_exit(NULL);
-    return NULL;
+    return 0;
+  }
+  if (cnt > MAX_SENSOR_NUM) {
+    cnt = MAX_SENSOR_NUM;
   }
-  for(i = 0; i < (int)cnt; i++) {
+  for(i = 0; i < cnt; i++) {
     aggregate_sensor_threshold(i, &g_aggregate_snr[i]);
+    agg_list[i] = (uint8_t)i;
   }
-  snr = get_struct_thresh_sensor(fru);
-  if (snr == NULL) {
-    syslog(LOG_WARNING, "agg_snr_monitor: get_struct_thresh_sensor failed");
-    pthread_exit(NULL);
-  }
-
-  while(1) {
-    for (i = 0; i < cnt; i++) {
-      snr_num = (uint8_t)i;
-      curr_val = 0;
-      if (snr[snr_num].flag) {
-        if (!(ret = sensor_raw_read_helper(fru, snr_num, &curr_val))) {
-
-          check_thresh_assert(fru, snr_num, UNC_THRESH, &curr_val);
-          check_thresh_assert(fru, snr_num, UCR_THRESH, &curr_val);
-          check_thresh_assert(fru, snr_num, UNR_THRESH, &curr_val);
-          check_thresh_assert(fru, snr_num, LNC_THRESH, &curr_val);
-          check_thresh_assert(fru, snr_num, LCR_THRESH, &curr_val);
-          check_thresh_assert(fru, snr_num, LNR_THRESH, &curr_val);
-
-          check_thresh_deassert(fru, snr_num, UNR_THRESH, &curr_val);
-          check_thresh_deassert(fru, snr_num, UCR_THRESH, &curr_val);
-          check_thresh_deassert(fru, snr_num, UNC_THRESH, &curr_val);
-          check_thresh_deassert(fru, snr_num, LNR_THRESH, &curr_val);
-          check_thresh_deassert(fru, snr_num, LCR_THRESH, &curr_val);
-          check_thresh_deassert(fru, snr_num, LNC_THRESH, &curr_val);
-#ifdef DEBUG
-        } else {
-          syslog(LOG_ERR, "FRU: %d, num: 0x%X, snr:%-16s, read failed",
-              fru, snr_num, snr[snr_num].name);
-#endif /* DEBUG */
-        } /* pal_sensor_read return check */
-      } /* flag check */
-    } /* loop for all sensors */
-    sleep(MIN_POLL_INTERVAL);
+
+  g_domain[0] = snr_domain_init(AGGREGATE_SENSOR_FRU_ID, agg_list, (int)cnt,
+      NULL, 0, start);
+  if (g_domain[0] == NULL) {
+    syslog(LOG_WARNING, "agg_snr_monitor: scheduler init failed");
+    return -1;
   }
-  pthread_exit(NULL);
-  return NULL;
+  return 1;
 }
 
-/* Spawns a pthread for each fru to monitor all the sensors on it */
+/*
+ * Sets up a scheduling domain for each fru and starts the worker
+ * threads polling the sensors on them.
+ */
 static int
 run_sensord(int argc, char **argv) {
 
-  int ret, arg;
+  int ret, arg, i;
   uint8_t fru;
   int fru_flag = 0;
-  pthread_t thread_snr[MAX_NUM_FRUS];
+  int num_domains = 0;
+  int sensor_cnt, discrete_cnt;
+  uint8_t *sensor_list, *discrete_list;
+  uint64_t start;
+  pthread_t workers[MAX_NUM_FRUS + 1];
+  bool started[MAX_NUM_FRUS + 1] = {false};
   pthread_t sensor_health;
-  pthread_t agg_sensor_mon;
 
   arg = 1;
   while(arg < argc) {
@@ -702,6 +1081,7 @@ run_sensord(int argc, char **argv) {
     arg++;
   }
 
+  start = mono_ms();
   for (fru = 1; fru <= MAX_NUM_FRUS; fru++) {
 
     if (GETBIT(fru_flag, fru)) {
@@ -709,17 +1089,35 @@ run_sensord(int argc, char **argv) {
       if (init_fru_snr_thresh(fru) < 0)
         continue;
 
-      /* Threshold Sensors */
-      if (pthread_create(&thread_snr[fru-1], NULL, snr_monitor,
-          (void*)(uintptr_t)fru) < 0) {
-        syslog(LOG_WARNING, "pthread_create for Threshold Sensors for FRU %d failed\n", fru);
-#ifdef DEBUG
-      } else {
-        syslog(LOG_WARNING, "pthread_create for Threshold Sensors for FRU %d succeed\n", fru);
-#endif /* DEBUG */
+      if (pal_get_fru_sensor_list(fru, &sensor_list, &sensor_cnt) < 0 ||
+          pal_get_fru_discrete_list(fru, &discrete_list, &discrete_cnt) < 0)
+        continue;
+      if ((sensor_cnt == 0) && (discrete_cnt == 0))
+        continue;
+
+      // stagger the FRUs by a second, as the per-FRU threads used to be
+      g_domain[fru] = snr_domain_init(fru, sensor_list, sensor_cnt,
+          discrete_list, discrete_cnt, start + num_domains * 1000);
+      if (g_domain[fru] == NULL) {
+        syslog(LOG_WARNING, "Scheduler init for Threshold Sensors for FRU %d failed\n", fru);
+        continue;
       }
-      sleep(1);
+      num_domains++;
+    }
+  }
+
+  if (init_aggregate_snr(start) > 0)
+    num_domains++;
+
+  // one worker per domain, a stuck FRU cannot hold up the others
+  for (i = 0; i <= MAX_NUM_FRUS; i++) {
+    if (g_domain[i] == NULL)
+      continue;
+    if (pthread_create(&workers[i], NULL, snr_worker, g_domain[i]) != 0) {
+      syslog(LOG_WARNING, "pthread_create for sensor worker of FRU %d failed\n", i);
+      continue;
     }
+    started[i] = true;
   }
 
   /* Sensor Health */
@@ -727,19 +1125,11 @@ run_sensord(int argc, char **argv) {
     syslog(LOG_WARNING, "pthread_create for sensor health failed\n");
   }
 
-  /* Aggregate sensor monitor */
-  if (pthread_create(&agg_sensor_mon, NULL, aggregate_snr_monitor, NULL) < 0) {
-    syslog(LOG_WARNING, "pthread_create for aggregate sensor failed!\n");
-  }
-
-  pthread_join(agg_sensor_mon, NULL);
-
   pthread_join(sensor_health, NULL);
 
-  for (fru = 1; fru <= MAX_NUM_FRUS; fru++) {
-
-    if (GETBIT(fru_flag, fru))
-      pthread_join(thread_snr[fru-1], NULL);
+  for (i = 0; i <= MAX_NUM_FRUS; i++) {
+    if (started[i])
+      pthread_join(workers[i], NULL);
   }
   return 0;
 }
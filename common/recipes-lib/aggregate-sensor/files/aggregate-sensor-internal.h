@@ -35,9 +35,16 @@
 #define MAX_CONDITIONALS 16
 #define MAX_STRING_SIZE 128
 
+/* A physical sensor used as a source. A sensor used by several
+ * aggregate sensors has a single entry, and it is read at most once
+ * per evaluation pass. */
 struct sensor_src {
   uint8_t fru;
   uint8_t id;
+  int ret;
+  float value;
+  unsigned int pass;
+  struct sensor_src *next;
 };
 
 typedef struct {
@@ -51,6 +58,17 @@ typedef enum{
   KEY_PATH
 } cond_key_type;
 
+/* Value of a condition key, shared by the sensors using the key. It
+ * is re-read only once the kv watch of the key reports it stale. */
+typedef struct cond_cache_s {
+  cond_key_type type;
+  char key[MAX_KEY_LEN];
+  kv_watch_t *watch;
+  int ret;
+  char value[MAX_VALUE_LEN];
+  struct cond_cache_s *next;
+} cond_cache_t;
+
 typedef struct {
   thresh_sensor_t sensor;
   size_t idx;
@@ -59,6 +77,7 @@ typedef struct {
   bool conditional;
   char cond_key[MAX_KEY_LEN];
   cond_key_type cond_type;
+  cond_cache_t *cond;
   size_t value_map_size;
   value_map_element_type value_map[MAX_CONDITIONALS];
   int default_expression_idx; /* -1 == invalid */
@@ -69,5 +88,8 @@ extern aggregate_sensor_t *g_sensors;
 
 int load_aggregate_conf(const char *conf_path);
 int get_sensor_value(void *state, float *value);
+struct sensor_src *aggregate_source_get(uint8_t fru, uint8_t id);
+cond_cache_t *aggregate_cond_get(cond_key_type type, const char *key);
+void aggregate_cache_reset(void);
 
 #endif
@@ -44,7 +44,8 @@ static void cleanup_vars(variable_type *vars, size_t count)
   size_t i;
 
   for(i = 0; i < count; i++) {
-    if (vars[i].state) {
+    /* Sources are shared, and owned by the source list */
+    if (vars[i].state && vars[i].value != get_sensor_value) {
       free(vars[i].state);
     }
   }
@@ -61,7 +62,6 @@ static int logical_expression_parse(void *state, float *value)
 static int load_variable(const char *name, json_t *obj, variable_type *var)
 {
   json_t *fru_o, *id_o, *exp_o;
-  struct sensor_src *s;
 
   if (!obj) {
     return -1;
@@ -89,17 +89,13 @@ static int load_variable(const char *name, json_t *obj, variable_type *var)
      * when the value of this variable is required */
     var->value = get_sensor_value;
 
-    /* Allocate the state which will be passed to
-     * get_sensor_value (fru, id) */
-    s = calloc(1, sizeof(struct sensor_src));
-    if (!s) {
+    /* The state passed to get_sensor_value is the (fru, id)
+     * source, shared with the other sensors using it */
+    var->state = aggregate_source_get(json_integer_value(fru_o),
+        json_integer_value(id_o));
+    if (!var->state) {
       return -1;
     }
-
-    s->fru = json_integer_value(fru_o);
-    s->id  = json_integer_value(id_o);
-
-    var->state = s;
   } else {
     return -1;
   }
@@ -327,6 +323,10 @@ static int load_linear_cond_eq(aggregate_sensor_t *snr, json_t *obj)
     goto bail_exp_parse;
   }
   strncpy(snr->cond_key, json_string_value(tmp2), MAX_KEY_LEN);
+  snr->cond = aggregate_cond_get(snr->cond_type, snr->cond_key);
+  if (!snr->cond) {
+    goto bail_exp_parse;
+  }
   tmp2 = json_object_get(tmp, "value_map");
   if (!tmp2) {
     DEBUG("Getting key value_map failed!\n");
@@ -486,6 +486,7 @@ int load_aggregate_conf(const char *file)
   size_t i;
   int ret = -1;
   
+  aggregate_cache_reset();
   conf = json_load_file(file, 0, &error);
   if (!conf) {
     DEBUG("Loading %s failed!\n", file);
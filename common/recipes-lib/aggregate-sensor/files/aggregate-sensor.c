@@ -23,6 +23,9 @@
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <openbmc/pal_sensors.h>
 #include <openbmc/kv.h>
 #include <jansson.h>
@@ -41,19 +44,87 @@
 size_t g_sensors_count = 0;
 aggregate_sensor_t *g_sensors = NULL;
 
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int g_pass = 0;
+static struct sensor_src *g_sources = NULL;
+static cond_cache_t *g_conds = NULL;
+
 int get_sensor_value(void *state, float *value)
 {
   struct sensor_src *snr = (struct sensor_src *)state;
   assert(snr);
   assert(value);
-  return sensor_cache_read(snr->fru, snr->id, value);
+  if (snr->pass != g_pass) {
+    snr->ret = sensor_cache_read(snr->fru, snr->id, &snr->value);
+    snr->pass = g_pass;
+  }
+  if (snr->ret) {
+    return snr->ret;
+  }
+  *value = snr->value;
+  return 0;
 }
 
-int
-aggregate_sensor_count(size_t *count)
+struct sensor_src *aggregate_source_get(uint8_t fru, uint8_t id)
 {
-  *count = g_sensors_count;
-  return 0;
+  struct sensor_src *s;
+
+  for (s = g_sources; s; s = s->next) {
+    if (s->fru == fru && s->id == id) {
+      return s;
+    }
+  }
+  s = calloc(1, sizeof(*s));
+  if (!s) {
+    return NULL;
+  }
+  s->fru = fru;
+  s->id = id;
+  s->next = g_sources;
+  g_sources = s;
+  return s;
+}
+
+cond_cache_t *aggregate_cond_get(cond_key_type type, const char *key)
+{
+  cond_cache_t *c;
+
+  for (c = g_conds; c; c = c->next) {
+    if (c->type == type && !strncmp(c->key, key, sizeof(c->key))) {
+      return c;
+    }
+  }
+  c = calloc(1, sizeof(*c));
+  if (!c) {
+    return NULL;
+  }
+  c->type = type;
+  strncpy(c->key, key, sizeof(c->key) - 1);
+  /* Without a watch the key is read every time */
+  c->watch = kv_watch_add(c->key, type == KEY_PATH ? KV_FPATH :
+      type == KEY_PERSISTENT ? KV_FPERSIST : 0);
+
+  c->next = g_conds;
+  g_conds = c;
+  return c;
+}
+
+void aggregate_cache_reset(void)
+{
+  struct sensor_src *s;
+  cond_cache_t *c;
+
+  pthread_mutex_lock(&g_lock);
+  while ((s = g_sources) != NULL) {
+    g_sources = s->next;
+    free(s);
+  }
+  while ((c = g_conds) != NULL) {
+    g_conds = c->next;
+    kv_watch_del(c->watch);
+    free(c);
+  }
+  pthread_mutex_unlock(&g_lock);
 }
 
 int get_key(cond_key_type type, const char *cond_key, char *cond_value)
@@ -86,20 +157,43 @@ int get_key(cond_key_type type, const char *cond_key, char *cond_value)
   return ret;
 }
 
+static int cond_read(cond_cache_t *c, char *cond_value)
+{
+  if (!c->watch || kv_watch_stale(c->watch)) {
+    memset(c->value, 0, sizeof(c->value));
+    c->ret = get_key(c->type, c->key, c->value);
+  }
+  if (c->ret) {
+    return c->ret;
+  }
+  memcpy(cond_value, c->value, sizeof(c->value));
+  return 0;
+}
+
+/* Start an evaluation pass: sources are read again, once */
+static void begin_pass(void)
+{
+  if (++g_pass == 0) {
+    g_pass = 1;
+  }
+}
 
 int
-aggregate_sensor_read(size_t index, float *value)
+aggregate_sensor_count(size_t *count)
+{
+  *count = g_sensors_count;
+  return 0;
+}
+
+static int
+sensor_evaluate(aggregate_sensor_t *snr, float *value)
 {
   char cond_value[MAX_VALUE_LEN] = {0};
   size_t i;
   int f_idx = -1;
-  aggregate_sensor_t *snr;
-  if (index >= g_sensors_count) {
-    return -1;
-  }
-  snr = &g_sensors[index];
+
   if (snr->conditional) {
-    if (!get_key(snr->cond_type, snr->cond_key, cond_value)) {
+    if (!cond_read(snr->cond, cond_value)) {
       for (i = 0; i < snr->value_map_size; i++) {
         if (!strncmp(snr->value_map[i].condition_value, cond_value,
             sizeof(snr->value_map[i].condition_value))) {
@@ -120,6 +214,38 @@ aggregate_sensor_read(size_t index, float *value)
   return expression_evaluate(snr->expressions[f_idx], value);
 }
 
+int
+aggregate_sensor_read(size_t index, float *value)
+{
+  int ret;
+
+  if (index >= g_sensors_count) {
+    return -1;
+  }
+  pthread_mutex_lock(&g_lock);
+  begin_pass();
+  ret = sensor_evaluate(&g_sensors[index], value);
+  pthread_mutex_unlock(&g_lock);
+  return ret;
+}
+
+int
+aggregate_sensor_read_all(float *values, int *status, size_t count)
+{
+  size_t i;
+
+  if (count > g_sensors_count) {
+    count = g_sensors_count;
+  }
+  pthread_mutex_lock(&g_lock);
+  begin_pass();
+  for (i = 0; i < count; i++) {
+    status[i] = sensor_evaluate(&g_sensors[i], &values[i]);
+  }
+  pthread_mutex_unlock(&g_lock);
+  return (int)count;
+}
+
 int
 aggregate_sensor_threshold(size_t index, thresh_sensor_t *thresh)
 {
@@ -26,6 +26,11 @@
 
 int aggregate_sensor_count(size_t *count);
 int aggregate_sensor_read(size_t index, float *value);
+/* Reads the first 'count' aggregate sensors in one pass: a source used
+ * by several of them is read once. status[i] is the return code of
+ * sensor i as aggregate_sensor_read() would give it. Returns the number
+ * of sensors read */
+int aggregate_sensor_read_all(float *values, int *status, size_t count);
 int aggregate_sensor_threshold(size_t index, thresh_sensor_t *thresh);
 int aggregate_sensor_name(size_t index, char *name);
 int aggregate_sensor_units(size_t index, char *units);
@@ -19,262 +19,399 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <string.h>
 #include <assert.h>
 #include "math_expression.h"
 
 typedef enum {
-  TERM_VARIABLE,
-  TERM_CONSTANT
-} term_type;
+  INS_CONSTANT, /* push constant */
+  INS_VARIABLE, /* push value of variable 'slot' */
+  INS_NEGATE,   /* -X */
+  INS_ADD,      /* L + R */
+  INS_SUBTRACT, /* L - R */
+  INS_MULTIPLY, /* L * R */
+  INS_DIVIDE,   /* L / R */
+  INS_MIN,      /* functions of the top 'argc' values */
+  INS_MAX,
+  INS_AVG,
+  INS_SUM,
+  INS_ABS,
+} insn_op_type;
 
 typedef struct {
-  term_type type;
-  union {
-    variable_type var;
-    float         constant;
-  } term;
-} expression_term_type;
-
-typedef enum {
-  OP_INVALID = 0, /* No R value */
-  OP_ADD, /* L + R */
-  OP_SUBTRACT, /* L - R */
-  OP_MULTIPLY, /* L * R */
-  OP_DIVIDE /* L / R */
-} operator_type;
+  uint8_t op;
+  uint8_t argc;
+  uint16_t slot;
+  float constant;
+} insn_type;
 
 struct expression_type_s {
-  operator_type type;
-  expression_term_type *left_exp_term;
-  expression_type      *left_exp_group;
-  expression_term_type *right_exp_term;
-  expression_type      *right_exp_group;
-  expression_type      *parent;
+  size_t num_insns;
+  insn_type *insns;
+  /* Distinct variables used by the program, indexed by slot */
+  size_t num_vars;
+  variable_type *vars;
+  size_t max_depth;
+};
+
+static const struct {
+  const char *name;
+  insn_op_type op;
+  bool variadic;
+} functions[] = {
+  {"min", INS_MIN, true},
+  {"max", INS_MAX, true},
+  {"avg", INS_AVG, true},
+  {"sum", INS_SUM, true},
+  {"abs", INS_ABS, false},
 };
 
-static operator_type get_operator(char *str)
+#define MAX_FUNC_ARGS 255
+
+typedef enum {
+  TOK_END,
+  TOK_NUMBER,
+  TOK_NAME,
+  TOK_CHAR,
+  TOK_INVALID,
+} token_type;
+
+typedef struct {
+  const char *pos;
+  token_type type;
+  char text[32];
+  float number;
+  char c;
+  /* Variables the expression may use */
+  variable_type *avail;
+  size_t num_avail;
+  expression_type *exp;
+  size_t alloc_insns;
+} parser_type;
+
+static void next_token(parser_type *p)
 {
-  operator_type op;
+  const char *s = p->pos;
+  char *end;
+  size_t len;
 
-  if (str[1] != '\0') {
-    return OP_INVALID;
+  while (isspace((unsigned char)*s))
+    s++;
+  if (*s == '\0') {
+    p->type = TOK_END;
+  } else if (isdigit((unsigned char)*s) || *s == '.') {
+    p->number = strtof(s, &end);
+    p->type = end == s ? TOK_INVALID : TOK_NUMBER;
+    s = end;
+  } else if (isalpha((unsigned char)*s) || *s == '_') {
+    for (len = 0; isalnum((unsigned char)s[len]) || s[len] == '_'; len++)
+      ;
+    if (len >= sizeof(p->text)) {
+      p->type = TOK_INVALID;
+    } else {
+      memcpy(p->text, s, len);
+      p->text[len] = '\0';
+      p->type = TOK_NAME;
+    }
+    s += len;
+  } else if (strchr("+-*/(),", *s)) {
+    p->type = TOK_CHAR;
+    p->c = *s++;
+  } else {
+    p->type = TOK_INVALID;
   }
+  p->pos = s;
+}
 
-  switch(str[0]) {
-    case '+':
-      op = OP_ADD;
-      break;
-    case '-':
-      op = OP_SUBTRACT;
-      break;
-    case '*':
-      op = OP_MULTIPLY;
-      break;
-    case '/':
-      op = OP_DIVIDE;
-      break;
-    default:
-      op = OP_INVALID;
-      break;
-  }
-  return op;
+static bool is_char(parser_type *p, char c)
+{
+  return p->type == TOK_CHAR && p->c == c;
 }
 
-static bool is_constant(char *str)
+static int emit(parser_type *p, insn_op_type op, uint8_t argc,
+    uint16_t slot, float constant)
 {
-  bool period_done = false;
-  if (str[0] == '-')
-    str++;
-  while(*str) {
-    if (period_done == false && *str == '.') {
-      period_done = true;
-    } else if (!isdigit(*str)) {
-      return false;
+  expression_type *exp = p->exp;
+  insn_type *ins;
+
+  if (exp->num_insns == p->alloc_insns) {
+    size_t n = p->alloc_insns ? p->alloc_insns * 2 : 16;
+    ins = realloc(exp->insns, n * sizeof(insn_type));
+    if (!ins) {
+      return -1;
     }
-    str++;
+    exp->insns = ins;
+    p->alloc_insns = n;
   }
-  return true;
+  ins = &exp->insns[exp->num_insns++];
+  ins->op = op;
+  ins->argc = argc;
+  ins->slot = slot;
+  ins->constant = constant;
+  return 0;
 }
 
-static expression_type *alloc_expression(expression_type *parent)
+/* Slot of a variable in the program, added on its first use */
+static int variable_slot(parser_type *p, const char *name)
 {
-  expression_type *o = calloc(1, sizeof(expression_type));
-  if (!o) {
-    return NULL;
+  expression_type *exp = p->exp;
+  variable_type *vars;
+  size_t i;
+
+  for (i = 0; i < exp->num_vars; i++) {
+    if (!strncmp(name, exp->vars[i].name, sizeof(exp->vars[i].name))) {
+      return (int)i;
+    }
+  }
+  for (i = 0; i < p->num_avail; i++) {
+    if (!strncmp(name, p->avail[i].name, sizeof(p->avail[i].name))) {
+      break;
+    }
+  }
+  if (i == p->num_avail || exp->num_vars > UINT16_MAX) {
+    /* Could not find the variable */
+    return -1;
   }
-  o->parent = parent;
-  return o;
+  vars = realloc(exp->vars, (exp->num_vars + 1) * sizeof(variable_type));
+  if (!vars) {
+    return -1;
+  }
+  exp->vars = vars;
+  exp->vars[exp->num_vars] = p->avail[i];
+  return (int)exp->num_vars++;
 }
 
-static expression_term_type *alloc_expression_term(char *name, variable_type *va, int num)
+static int parse_sum(parser_type *p);
+
+static int parse_call(parser_type *p, const char *name)
 {
-  int i;
-  expression_term_type *term = calloc(1, sizeof(expression_term_type));
-  if (!term) {
-    return NULL;
-  }
-  term->type = is_constant(name) ? TERM_CONSTANT : TERM_VARIABLE;
-  if (term->type == TERM_CONSTANT) {
-    term->term.constant = atof(name);
-  } else {
-    /* Look for the variable name in the list and copy it over */
-    for (i = 0; i < num; i++) {
-      if (!strncmp(name, va[i].name, sizeof(va[i].name))) {
-        term->term.var = va[i];
-        break;
-      }
+  size_t i, argc = 0;
+
+  for (i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+    if (!strcmp(name, functions[i].name)) {
+      break;
     }
-    if (i == num) {
-      /* Could not find the variable */
-      free(term);
-      return NULL;
+  }
+  if (i == sizeof(functions) / sizeof(functions[0])) {
+    return -1;
+  }
+  do {
+    /* Skip the '(' or ',' before the argument */
+    next_token(p);
+    if (parse_sum(p)) {
+      return -1;
     }
+    argc++;
+  } while (is_char(p, ',') && argc < MAX_FUNC_ARGS);
+  if (!is_char(p, ')') || (!functions[i].variadic && argc != 1)) {
+    return -1;
   }
-  return term;
+  next_token(p);
+  return emit(p, functions[i].op, (uint8_t)argc, 0, 0);
 }
 
-static int expression_term_evaluate(expression_term_type *term, float *value)
+/* primary := number | name | name ( args ) | ( sum ) | - primary */
+static int parse_primary(parser_type *p)
 {
-  if (term->type == TERM_CONSTANT) {
-    *value = term->term.constant;
+  expression_type *exp = p->exp;
+  char name[sizeof(p->text)];
+  int slot;
+
+  if (p->type == TOK_NUMBER) {
+    float number = p->number;
+    next_token(p);
+    return emit(p, INS_CONSTANT, 0, 0, number);
+  }
+  if (is_char(p, '-')) {
+    next_token(p);
+    if (parse_primary(p)) {
+      return -1;
+    }
+    /* Fold negative constants */
+    if (exp->insns[exp->num_insns - 1].op == INS_CONSTANT) {
+      exp->insns[exp->num_insns - 1].constant *= -1;
+      return 0;
+    }
+    return emit(p, INS_NEGATE, 1, 0, 0);
+  }
+  if (is_char(p, '(')) {
+    next_token(p);
+    if (parse_sum(p) || !is_char(p, ')')) {
+      return -1;
+    }
+    next_token(p);
     return 0;
   }
-  return term->term.var.value(term->term.var.state, value);
+  if (p->type == TOK_NAME) {
+    strcpy(name, p->text);
+    next_token(p);
+    if (is_char(p, '(')) {
+      return parse_call(p, name);
+    }
+    slot = variable_slot(p, name);
+    if (slot < 0) {
+      return -1;
+    }
+    return emit(p, INS_VARIABLE, 0, (uint16_t)slot, 0);
+  }
+  return -1;
 }
 
-expression_type *expression_parse(const char *user_str, variable_type *vars, size_t num)
+/* product := primary { ( '*' | '/' ) primary } */
+static int parse_product(parser_type *p)
 {
-  char *token, *saveptr;
-  expression_type *tmp, *current = NULL, *ret = NULL;
-  char *str;
+  char op;
 
-  str = calloc(strlen(user_str) + 1, 1);
-  if (!str) {
-    return NULL;
+  if (parse_primary(p)) {
+    return -1;
+  }
+  while (is_char(p, '*') || is_char(p, '/')) {
+    op = p->c;
+    next_token(p);
+    if (parse_primary(p) ||
+        emit(p, op == '*' ? INS_MULTIPLY : INS_DIVIDE, 2, 0, 0)) {
+      return -1;
+    }
   }
-  strcpy(str, user_str);
+  return 0;
+}
 
-  ret = current = alloc_expression(NULL);
-  if (!current) {
-    free(str);
-    return NULL;
+/* sum := product { ( '+' | '-' ) product } */
+static int parse_sum(parser_type *p)
+{
+  char op;
+
+  if (parse_product(p)) {
+    return -1;
+  }
+  while (is_char(p, '+') || is_char(p, '-')) {
+    op = p->c;
+    next_token(p);
+    if (parse_product(p) ||
+        emit(p, op == '+' ? INS_ADD : INS_SUBTRACT, 2, 0, 0)) {
+      return -1;
+    }
   }
+  return 0;
+}
 
-  for(token = strtok_r(str, " \n", &saveptr);
-      token != NULL;
-      token = strtok_r(NULL, " \n", &saveptr)) {
-
-    assert(current);
-
-    if (!strncmp(token, "(", 2)) {
-      /* Start a new group and set it as current */
-      current = alloc_expression(current);
-      if (!current) {
-        goto free_bail;
-      }
-    } else if (!strncmp(token, ")", 2)) {
-      expression_type *parent = current->parent;
-      /* Close the current group, set it as the parent's
-       * left (if empty) or right term and finally set
-       * the parent as the current group. */
-      if (parent->left_exp_term == NULL && parent->left_exp_group == NULL) {
-        parent->left_exp_group = current;
-      } else if (parent->right_exp_term == NULL && parent->right_exp_group == NULL) {
-        parent->right_exp_group = current;
-      } 
-      current = parent;
-    } else if(get_operator(token) != OP_INVALID) {
-      if (current->type == OP_INVALID) {
-        /* Simple case, we have parsed the left term
-         * and just parsing the operator. Just set it */
-        current->type = get_operator(token);
-      } else {
-        /* If the current expression is already a valid
-         * operation, then this is the second + in a + b + c.
-         * Thus, artificially close the current group, create
-         * a parent group with the left expression as the current
-         * group and then set the new one as the current with
-         * its operator set to the freshly parsed operator */
-        tmp = alloc_expression(current->parent);
-        if (!tmp) {
-          goto free_bail;
-        }
-        tmp->left_exp_group = current;
-        current->parent = tmp;
-        tmp->type = get_operator(token);
-        current = tmp;
-      }
+/* Stack depth the program needs, so evaluation never checks bounds */
+static size_t program_depth(expression_type *exp)
+{
+  size_t i, depth = 0, max = 0;
+
+  for (i = 0; i < exp->num_insns; i++) {
+    insn_type *ins = &exp->insns[i];
+    if (ins->op == INS_CONSTANT || ins->op == INS_VARIABLE) {
+      depth++;
     } else {
-      expression_term_type *term = alloc_expression_term(token, vars, num);
-      if (!term) {
-        goto free_bail;
-      }
-      /* This is either a variable or a constant. Allocate
-       * a expression term and set it as the left (if available) or
-       * right of the current expression group */
-      if (current->left_exp_term == NULL && current->left_exp_group == NULL) {
-        current->left_exp_term = term;
-      } else if (current->right_exp_term == NULL && current->right_exp_term == NULL) {
-        current->right_exp_term = term;
-      } else {
-        assert(0);
-      }
+      depth -= ins->argc - 1;
+    }
+    if (depth > max) {
+      max = depth;
     }
   }
-  /* We are done parsing, ensure that we are the top group
-   * and the user is not missing any unclosed parenthesis */
-  assert(current->parent == NULL);
-  free(str);
-  return current;
-free_bail:
-  /* Free the partially created tree if it exists */
-  expression_destroy(ret);
-  return NULL;
+  assert(depth == 1);
+  return max;
+}
+
+expression_type *expression_parse(const char *str, variable_type *vars, size_t num)
+{
+  parser_type p = {0};
+
+  p.exp = calloc(1, sizeof(expression_type));
+  if (!p.exp) {
+    return NULL;
+  }
+  p.pos = str;
+  p.avail = vars;
+  p.num_avail = num;
+  next_token(&p);
+  if (parse_sum(&p) || p.type != TOK_END) {
+    expression_destroy(p.exp);
+    return NULL;
+  }
+  p.exp->max_depth = program_depth(p.exp);
+  return p.exp;
 }
 
 int expression_evaluate(expression_type *exp, float *value)
 {
-  float l_val, r_val;
+  float vals[exp->num_vars + 1];
+  float stack[exp->max_depth];
+  size_t i, j, sp = 0;
+  float *args, res;
   int ret;
-  assert(exp->left_exp_term || exp->left_exp_group);
-  ret = exp->left_exp_term ? expression_term_evaluate(exp->left_exp_term, &l_val) :
-    expression_evaluate(exp->left_exp_group, &l_val);
-  if (ret) {
-    return ret;
-  }
 
-  if (!exp->right_exp_term && !exp->right_exp_group) {
-    /* Example use case would be the expression ( a + b ). This would be parsed
-     * as ( ( a + b ) ) thus, the outer redundant group would have ( a + b )
-     * as the left expression group with nothing on the right. Hense just
-     * return success with the evaluation of the left expression. */
-    *value = l_val;
-    return 0;
-  }
-  ret = exp->right_exp_term ? expression_term_evaluate(exp->right_exp_term, &r_val) :
-    expression_evaluate(exp->right_exp_group, &r_val);
-  if (ret) {
-    return ret;
+  for (i = 0; i < exp->num_vars; i++) {
+    ret = exp->vars[i].value(exp->vars[i].state, &vals[i]);
+    if (ret) {
+      return ret;
+    }
   }
 
-  switch(exp->type) {
-    case OP_ADD:
-      *value = l_val + r_val;
-      break;
-    case OP_SUBTRACT:
-      *value = l_val - r_val;
-      break;
-    case OP_MULTIPLY:
-      *value = l_val * r_val;
-      break;
-    case OP_DIVIDE:
-      *value = l_val / r_val;
-      break;
-    default:
-      assert(0);
+  for (i = 0; i < exp->num_insns; i++) {
+    insn_type *ins = &exp->insns[i];
+
+    switch (ins->op) {
+      case INS_CONSTANT:
+        stack[sp++] = ins->constant;
+        continue;
+      case INS_VARIABLE:
+        stack[sp++] = vals[ins->slot];
+        continue;
+      case INS_NEGATE:
+        stack[sp - 1] = -stack[sp - 1];
+        continue;
+      case INS_ABS:
+        if (stack[sp - 1] < 0)
+          stack[sp - 1] = -stack[sp - 1];
+        continue;
+      default:
+        break;
+    }
+
+    sp -= ins->argc;
+    args = &stack[sp];
+    switch (ins->op) {
+      case INS_ADD:
+        res = args[0] + args[1];
+        break;
+      case INS_SUBTRACT:
+        res = args[0] - args[1];
+        break;
+      case INS_MULTIPLY:
+        res = args[0] * args[1];
+        break;
+      case INS_DIVIDE:
+        res = args[0] / args[1];
+        break;
+      case INS_MIN:
+      case INS_MAX:
+        res = args[0];
+        for (j = 1; j < ins->argc; j++) {
+          if (ins->op == INS_MIN ? args[j] < res : args[j] > res)
+            res = args[j];
+        }
+        break;
+      case INS_AVG:
+      case INS_SUM:
+        res = 0;
+        for (j = 0; j < ins->argc; j++) {
+          res += args[j];
+        }
+        if (ins->op == INS_AVG)
+          res /= ins->argc;
+        break;
+      default:
+        assert(0);
+        return -1;
+    }
+    stack[sp++] = res;
   }
+  *value = stack[0];
   return 0;
 }
 
@@ -283,59 +420,39 @@ void expression_destroy(expression_type *exp)
   if (!exp) {
     return;
   }
-  if (exp->left_exp_term)
-    free(exp->left_exp_term);
-  else if (exp->left_exp_group)
-    expression_destroy(exp->left_exp_group);
-  if (exp->right_exp_term)
-    free(exp->right_exp_term);
-  else if (exp->right_exp_group)
-    expression_destroy(exp->right_exp_group);
+  free(exp->insns);
+  free(exp->vars);
   free(exp);
 }
 
 void expression_print(expression_type *exp)
 {
-  printf("( ");
-  if (exp->left_exp_term) {
-    if (exp->left_exp_term->type == TERM_CONSTANT) {
-      printf("%2.5f ", exp->left_exp_term->term.constant);
-    } else {
-      printf("%s ", exp->left_exp_term->term.var.name);
-    }
-  } else {
-      expression_print(exp->left_exp_group);
-  }
+  static const char *names[] = {
+    [INS_NEGATE] = "neg",
+    [INS_ADD] = "+",
+    [INS_SUBTRACT] = "-",
+    [INS_MULTIPLY] = "*",
+    [INS_DIVIDE] = "/",
+    [INS_MIN] = "min",
+    [INS_MAX] = "max",
+    [INS_AVG] = "avg",
+    [INS_SUM] = "sum",
+    [INS_ABS] = "abs",
+  };
+  size_t i;
 
-  switch(exp->type) {
-    case OP_ADD:
-      printf("+ ");
-      break;
-    case OP_SUBTRACT:
-      printf("- ");
-      break;
-    case OP_MULTIPLY:
-      printf("* ");
-      break;
-    case OP_DIVIDE:
-      printf("/ ");
-      break;
-    default:
-      /* This case is possible only if there is no right term */
-      assert(exp->right_exp_term == NULL && exp->right_exp_group == NULL);
-      break;
-  }
-
-  if (exp->right_exp_term) {
-    if (exp->right_exp_term->type == TERM_CONSTANT) {
-      printf("%2.5f ", exp->right_exp_term->term.constant);
+  for (i = 0; i < exp->num_insns; i++) {
+    insn_type *ins = &exp->insns[i];
+    if (ins->op == INS_CONSTANT) {
+      printf("%2.5f ", ins->constant);
+    } else if (ins->op == INS_VARIABLE) {
+      printf("%s ", exp->vars[ins->slot].name);
+    } else if (ins->op >= INS_MIN && ins->op != INS_ABS) {
+      printf("%s/%u ", names[ins->op], ins->argc);
     } else {
-      printf("%s ", exp->right_exp_term->term.var.name);
+      printf("%s ", names[ins->op]);
     }
-  } else if (exp->right_exp_group) {
-    expression_print(exp->right_exp_group);
   }
-  printf(") ");
 }
 
 #ifdef __EXPRESSION_TEST__
@@ -372,6 +489,10 @@ int main(int argc, char *argv[])
     *((float *)vi->state) = atof(tmp);
   }
   op = expression_parse(argv[1], input, num);
+  if (!op) {
+    printf("Parsing failed\n");
+    return 1;
+  }
   printf("Input:\n");
   for(i = 0; i < num; i++) {
     int rc;
@@ -19,16 +19,20 @@
 #ifndef _MATH_EXPRESSION_H_
 #define _MATH_EXPRESSION_H_
 /* Rules:
- * 1. Expression is always parsed left to right with no regard to operator
- *    precedence. When in doubt, use parenthesis. Also use
- *    expression_print() which should clearly show the order of evaluation.
- *    Example: Input: "4 * a + 5 * b - 6" ->
- *    ( ( ( ( 4.00000 * a  ) + 5.00000  ) * b  ) - 6.00000  ) which is most
- *    probably not what you want. Hence use "( 4 * a ) + ( 5 * b ) - 6" ->
- *    ( ( ( 4.00000 * a  ) + ( 5.00000 * b  )  ) - 6.00000  )
+ * 1. The usual precedence applies: unary minus binds tighter than '*'
+ *    and '/', which bind tighter than '+' and '-'. Operators of the same
+ *    precedence are evaluated left to right, so "4 * a + 5 * b - 6" is
+ *    ( ( ( 4 * a ) + ( 5 * b ) ) - 6 ). Parenthesis work as expected.
  *
- * 2. Expressions are parsed using spaces. So, 'a*b+c' is invalid while
- *    'a * b + c' is valid.
+ * 2. Spaces between tokens are optional: 'a*b+c' and 'a * b + c' are
+ *    the same expression.
+ *
+ * 3. The functions min(), max(), avg() and sum() take one or more
+ *    comma separated arguments, abs() takes one.
+ *    Example: "max( inlet0, inlet1 ) + abs( offset )"
+ *
+ * The expression is compiled into a flat postfix program. Every variable
+ * is fetched once per evaluation, however many times it is referenced.
  */
 
 /* The function which is fed into expression_parse which stores this 
@@ -59,14 +63,15 @@ typedef struct expression_type_s expression_type;
  * the scope of 'value' & 'state' if they are dynamic objects */
 expression_type *expression_parse(const char *str, variable_type *vars, size_t num);
 
-/* Evaluate the expression. Note, multiple calls to the functions
- * provided in 'vars' in expression_parse might be made */
+/* Evaluate the expression. The value function of each variable used
+ * is called once, before the program runs */
 int expression_evaluate(expression_type *op, float *value);
 
 /* Destroy the object created in expression_parse */
 void expression_destroy(expression_type *exp);
 
-/* Prints the expression with information on the order of evaluation */
+/* Prints the compiled program in postfix order, which is the order of
+ * evaluation */
 void expression_print(expression_type *exp);
 
 #endif
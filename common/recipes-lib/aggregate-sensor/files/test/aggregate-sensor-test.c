@@ -23,15 +23,20 @@
 #include <unistd.h>
 #include <libgen.h>
 #include <assert.h>
+#include <sys/stat.h>
 #include <jansson.h>
-#include "aggregate-sensor.h"
+#include "aggregate-sensor-internal.h"
 #include <openbmc/kv.h>
 #include <openbmc/pal_sensors.h>
 #include <openbmc/cmock.h>
 
-DECLARE_MOCK_FUNC(int, kv_get, char *, char *, size_t *, unsigned int);
+DECLARE_MOCK_FUNC(int, kv_get, const char *, char *, size_t *, unsigned int);
 DECLARE_MOCK_FUNC(int, sensor_cache_read, uint8_t, uint8_t, float *);
 
+/* Key locations of libkv, pointed at the test directories */
+extern const char *cache_store;
+extern const char *kv_store;
+
 static void init_sensors(const char *json_file, size_t exp_sensors)
 {
   int ret;
@@ -142,7 +147,7 @@ DEFINE_TEST(test_cond_lexp)
   MOCK_END(kv_get);
   MOCK_END(sensor_cache_read);
 
-  int mocked_kv_get1(char *key, char *value, size_t *len, unsigned int flags)
+  int mocked_kv_get1(const char *key, char *value, size_t *len, unsigned int flags)
   {
     ASSERT_EQ(flags, 0, "Flags are for non-persistent kv");
     if (!strcmp(key, "my_key")) {
@@ -161,7 +166,7 @@ DEFINE_TEST(test_cond_lexp)
   MOCK_END(kv_get);
   MOCK_END(sensor_cache_read);
 
-  int mocked_kv_get2(char *key, char *value, size_t *len, unsigned int flags)
+  int mocked_kv_get2(const char *key, char *value, size_t *len, unsigned int flags)
   {
     ASSERT_EQ(flags, 0, "Flags are for non-persistent kv");
     if (!strcmp(key, "my_key")) {
@@ -199,7 +204,7 @@ DEFINE_TEST(test_cond_lexp)
   MOCK_END(sensor_cache_read);
 
   // kv_get succeeds, but returns an unknown value.
-  int mocked_kv_get3(char *key, char *value, size_t *len, unsigned int flags)
+  int mocked_kv_get3(const char *key, char *value, size_t *len, unsigned int flags)
   {
     ASSERT_EQ(flags, KV_FPERSIST, "Flags are for persistent kv");
     if (!strcmp(key, "my_key")) {
@@ -220,7 +225,7 @@ DEFINE_TEST(test_cond_lexp)
   MOCK_END(kv_get);
   MOCK_END(sensor_cache_read);
 
-  int mocked_kv_get4(char *key, char *value, size_t *len, unsigned int flags)
+  int mocked_kv_get4(const char *key, char *value, size_t *len, unsigned int flags)
   {
     ASSERT_EQ(flags, KV_FPERSIST, "Flags are for persistent kv");
     if (!strcmp(key, "my_key")) {
@@ -274,16 +279,145 @@ DEFINE_TEST(test_lexp_source_exp)
   ret = aggregate_sensor_read(0, &val);
   ASSERT_NEQ(ret, 0, "agg-read should fail");
   ASSERT_CALL_COUNT(sensor_cache_read, 1, 2, "cache read called at least once");
+  MOCK_END(sensor_cache_read);
+}
+
+DEFINE_TEST(test_lexp_func)
+{
+  float vals[2];
+  int status[2];
+  int ret;
+
+  init_sensors("./test_lexp_func.json", 2);
+
+  int mocked_read1(uint8_t fru, uint8_t snr, float *value) {
+    ASSERT((fru == 1 && snr == 1) || (fru == 2 && snr == 2), "Expected FRU/SNRID");
+    *value = snr == 1 ? 3.0 : 5.0;
+    return 0;
+  }
+  MOCK(sensor_cache_read, mocked_read1);
+  ret = aggregate_sensor_read_all(vals, status, 2);
+  ASSERT_EQ(ret, 2, "Both sensors read");
+  ASSERT_CALL_COUNT(sensor_cache_read, 2, 2, "Each source read once");
+  ASSERT_EQ(status[0], 0, "test_func read success");
+  /* max(3, 5) * 2 + abs(3 - 5) / 2 = 10 + 1 = 11 */
+  ASSERT_EQ_FLT(vals[0], 11.0, "Correct value of functions");
+  ASSERT_EQ(status[1], 0, "test_prec read success");
+  /* 3 + (5 * 2) - (-avg(3, 5, 4)) = 3 + 10 + 4 = 17 */
+  ASSERT_EQ_FLT(vals[1], 17.0, "Correct value with precedence");
+  MOCK_END(sensor_cache_read);
+}
+
+DEFINE_TEST(test_read_all)
+{
+  float vals[2];
+  int status[2];
+  int ret;
+
+  init_sensors("./test_clexp.json", 2);
+
+  int mocked_kv_get(const char *key, char *value, size_t *len, unsigned int flags)
+  {
+    strcpy(value, (flags & KV_FPERSIST) ? "V2" : "V1");
+    if (len)
+      *len = strlen(value);
+    return 0;
+  }
+  int mocked_snr_read(uint8_t fru, uint8_t snr, float *value)
+  {
+    ASSERT(fru == 1 && snr == 1, "Expected FRU/SNRID");
+    *value = 10.0;
+    return 0;
+  }
+  MOCK(kv_get, mocked_kv_get);
+  MOCK(sensor_cache_read, mocked_snr_read);
+  ret = aggregate_sensor_read_all(vals, status, 2);
+  ASSERT_EQ(ret, 2, "Both sensors read");
+  ASSERT_CALL_COUNT(sensor_cache_read, 1, 1, "Shared source read once");
+  ASSERT_CALL_COUNT(kv_get, 2, 2, "Each condition key read");
+  ASSERT(status[0] == 0 && status[1] == 0, "Both reads succeed");
+  ASSERT_EQ_FLT(vals[0], 96.0, "V1 => exp1");
+  ASSERT_EQ_FLT(vals[1], 103.0, "V2 => exp2");
+  MOCK_END(kv_get);
+  MOCK_END(sensor_cache_read);
+}
+
+static void write_key(const char *path, const char *value)
+{
+  FILE *fp = fopen(path, "w");
+  ASSERT(fp != NULL, "Key file created");
+  fputs(value, fp);
+  fclose(fp);
+}
+
+DEFINE_TEST(test_cond_cache)
+{
+  float val;
+  int ret;
+
+  mkdir("./test_kv", 0755);
+  write_key("./test_kv/my_key", "V1");
+  cache_store = "./test_kv/%s";
+  init_sensors("./test_clexp.json", 2);
+
+  int mocked_kv_get(const char *key, char *value, size_t *len, unsigned int flags)
+  {
+    FILE *fp = fopen("./test_kv/my_key", "r");
+    size_t n;
+    ASSERT(fp != NULL, "Key file exists");
+    n = fread(value, 1, MAX_VALUE_LEN - 1, fp);
+    value[n] = '\0';
+    fclose(fp);
+    if (len)
+      *len = n;
+    return 0;
+  }
+  MOCK(kv_get, mocked_kv_get);
+  MOCK_RETURN(sensor_cache_read, 0);
+  ret = aggregate_sensor_read(0, &val);
+  ASSERT_EQ(ret, 0, "agg-read success");
+  ret = aggregate_sensor_read(0, &val);
+  ASSERT_EQ(ret, 0, "agg-read success");
+  ASSERT_CALL_COUNT(kv_get, 1, 1, "Unchanged key read once");
+  MOCK_END(kv_get);
+  MOCK_END(sensor_cache_read);
+
+  int mocked_snr_read(uint8_t fru, uint8_t snr, float *value)
+  {
+    *value = 10.0;
+    return 0;
+  }
+  write_key("./test_kv/my_key", "V2");
+  MOCK(kv_get, mocked_kv_get);
+  MOCK(sensor_cache_read, mocked_snr_read);
+  ret = aggregate_sensor_read(0, &val);
+  ASSERT_EQ(ret, 0, "agg-read success");
+  ASSERT_CALL_COUNT(kv_get, 1, 1, "Changed key read again");
+  ASSERT_EQ_FLT(val, 103.0, "New value of the key used");
+  MOCK_END(kv_get);
+  MOCK_END(sensor_cache_read);
+
+  cache_store = "./no_such_dir/%s";
+  unlink("./test_kv/my_key");
+  rmdir("./test_kv");
 }
 
 int main(int argc, char *argv[])
 {
   chdir(dirname(argv[0]));
 
+  /* Condition keys are read every time unless their directory can be
+   * watched; only test_cond_cache sets up a directory */
+  cache_store = "./no_such_dir/%s";
+  kv_store = "./no_such_dir/%s";
+
   CALL_TEST(test_bad_source_exp);
   CALL_TEST(test_null);
   CALL_TEST(test_lexp);
   CALL_TEST(test_cond_lexp);
   CALL_TEST(test_lexp_source_exp);
+  CALL_TEST(test_lexp_func);
+  CALL_TEST(test_read_all);
+  CALL_TEST(test_cond_cache);
   return 0;
 }
@@ -1,12 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <openbmc/ast-jtag.h>
 #include "cpld.h"
 #include "lattice.h"
 
-#define MAX_RETRY 4000
+#define BUSY_TIMEOUT_MS 5000
+#define ERASE_TIMEOUT_MS 60000
 #define LATTICE_COL_SIZE 128
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -39,6 +44,31 @@ enum
   Both_CF_UFM = 1,
 };
 
+/*
+ * The parsed fuse map of the last JED file is kept in JED_CACHE_FILE,
+ * keyed by the hash of the JED file, so that programming the same image
+ * again (retries, several CPLDs of a board) skips parsing it. The cache
+ * is only used from a directory nobody else can write to, and its fuse
+ * data must match the JED checksum again when it is loaded.
+ */
+#define JED_CACHE_DIR  "/run/cpld"
+#define JED_CACHE_FILE JED_CACHE_DIR "/jed_cache"
+#define JED_CACHE_MAGIC 0x4a454443 //"JEDC"
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t file_size;
+  uint64_t file_hash;
+  uint64_t QF;
+  uint32_t CF_Line;
+  uint32_t UFM_Line;
+  uint32_t Version;
+  uint32_t CheckSum;
+  uint32_t FEARBits;
+  uint32_t FeatureRow;
+} JEDCacheHeader;
+
 
 
 /*search the index of char in string*/
@@ -133,60 +163,67 @@ ShiftData(char *data, unsigned int *result, int len)
   return ret;
 }
 
-static unsigned int
-LCMXO2Family_Check_Device_Status(int mode)
+static long
+elapsed_ms(struct timespec *start)
 {
-  int RETRY = MAX_RETRY;
-  unsigned int buf[4] = {0};
-
-  switch (mode)
-  {
-    case CHECK_BUSY:
-      ast_jtag_run_test_idle(0, 0, 3);
-      do
-      {
-	ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, LCMXO2_LSC_CHECK_BUSY);
-	usleep(1000);
+  struct timespec now;
 
-	buf[0] = 0x0;
-
-	ast_jtag_tdo_xfer(0, 8, &buf[0]);
-
-	buf[0] = (buf[0] >> 7) & 0x1;
-
-	if (buf[0] == 0x0)
-	{
-	  break;
-	}
-	RETRY--;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000 +
+         (now.tv_nsec - start->tv_nsec) / 1000000;
+}
 
-      } while ( RETRY );
-      break;
+/*poll the busy flag or the busy/fail status bits until they clear or
+  timeout_ms passes, return the last value*/
+static unsigned int
+LCMXO2Family_Check_Device_Status(int mode, int timeout_ms)
+{
+  struct timespec start;
+  unsigned int buf[4] = {0};
+  unsigned int delay = 20;
 
-    case CHECK_STATUS:
-      ast_jtag_run_test_idle( 0, 0, 3);
-      do
-      {
-	ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, LCMXO2_LSC_READ_STATUS);
-	usleep(1000);
+  clock_gettime(CLOCK_MONOTONIC, &start);
 
-	buf[0] = 0x0;
+  ast_jtag_run_test_idle(0, 0, 3);
 
-	ast_jtag_tdo_xfer(0, 32, &buf[0]);
+  //the instruction stays loaded, only its data register is read again
+  //while polling (LOOP/SDR/ENDLOOP in the SVF)
+  if (mode == CHECK_BUSY)
+  {
+    ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, LCMXO2_LSC_CHECK_BUSY);
+  }
+  else
+  {
+    ast_jtag_sir_xfer(0, LATTICE_INS_LENGTH, LCMXO2_LSC_READ_STATUS);
+  }
 
-	buf[0] = (buf[0] >> 12) & 0x3;
+  while (1)
+  {
+    buf[0] = 0x0;
 
-	if (buf[0] == 0x0)
-	{
-	  break;
-	}
-	RETRY--;
-      } while ( RETRY );
-      break;
+    if (mode == CHECK_BUSY)
+    {
+      ast_jtag_tdo_xfer(0, 8, &buf[0]);
+      buf[0] = (buf[0] >> 7) & 0x1;
+    }
+    else
+    {
+      ast_jtag_tdo_xfer(0, 32, &buf[0]);
+      buf[0] = (buf[0] >> 12) & 0x3;
+    }
 
-    default:
+    if (buf[0] == 0x0 || elapsed_ms(&start) >= timeout_ms)
+    {
       break;
+    }
 
+    //a row is programmed in well under 1ms, so start polling fast and
+    //back off for the long operations (erase)
+    usleep(delay);
+    if (delay < 1000)
+    {
+      delay *= 2;
+    }
   }
 
   return buf[0];
@@ -218,7 +255,7 @@ LCMXO2Family_SendCFdata(CPLDInfo *dev_info)
 
     //usleep(1000);
 
-    status = LCMXO2Family_Check_Device_Status(CHECK_BUSY);
+    status = LCMXO2Family_Check_Device_Status(CHECK_BUSY, BUSY_TIMEOUT_MS);
     if (status != 0)
     {
       printf("[%s]Write CF Error, status = %x\n", __func__, status);
@@ -256,7 +293,7 @@ LCMXO2Family_SendUFMdata(CPLDInfo *dev_info)
 
     //usleep(1000);
 
-    status = LCMXO2Family_Check_Device_Status(CHECK_BUSY);
+    status = LCMXO2Family_Check_Device_Status(CHECK_BUSY, BUSY_TIMEOUT_MS);
     if (status != 0)
     {
       printf("[%s]Write UFM Error, status = %x\n", __func__, status);
@@ -573,6 +610,234 @@ LCMXO2Family_JED_File_Parser(FILE *jed_fd, CPLDInfo *dev_info, int cf_size, int
   return ret;
 }
 
+/*FNV-1a hash of the whole JED file*/
+static int
+LCMXO2Family_JED_Hash(FILE *jed_fd, uint64_t *hash, uint32_t *size)
+{
+  unsigned char buf[4096];
+  size_t len, i;
+
+  *hash = 0xcbf29ce484222325ULL;
+  *size = 0;
+
+  fseek(jed_fd, 0, SEEK_SET);
+  while ( (len = fread(buf, 1, sizeof(buf), jed_fd)) > 0 )
+  {
+    for ( i = 0; i < len; i++ )
+    {
+      *hash = (*hash ^ buf[i]) * 0x100000001b3ULL;
+    }
+    *size += len;
+  }
+
+  if ( ferror(jed_fd) )
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+/*make sure the cache directory exists and is private to us*/
+static int
+LCMXO2Family_JED_Cache_Dir(void)
+{
+  struct stat st;
+
+  if ( mkdir(JED_CACHE_DIR, 0700) < 0 && errno != EEXIST )
+  {
+    return -1;
+  }
+
+  if ( lstat(JED_CACHE_DIR, &st) < 0 || !S_ISDIR(st.st_mode) ||
+       st.st_uid != geteuid() || (st.st_mode & 0077) != 0 )
+  {
+    printf("[%s] %s is not private, JED cache disabled\n", __func__, JED_CACHE_DIR);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*checksum of the CF fuse data, computed as LCMXO2Family_JED_File_Parser() does*/
+static unsigned int
+LCMXO2Family_CF_CheckSum(CPLDInfo *dev_info)
+{
+  unsigned int sum = 0;
+  unsigned int i;
+
+  for ( i = 0; i < dev_info->CF_Line * 4; i++ )
+  {
+    sum += (dev_info->CF[i]>>24) & 0xff;
+    sum += (dev_info->CF[i]>>16) & 0xff;
+    sum += (dev_info->CF[i]>>8)  & 0xff;
+    sum += (dev_info->CF[i])     & 0xff;
+  }
+
+  return sum & 0xffff;
+}
+
+static int
+LCMXO2Family_JED_Cache_Load(CPLDInfo *dev_info, uint64_t hash, uint32_t size)
+{
+  JEDCacheHeader hdr;
+  size_t cf_size, ufm_size;
+  int ret = -1;
+  FILE *fp;
+
+  if ( LCMXO2Family_JED_Cache_Dir() < 0 )
+  {
+    return -1;
+  }
+
+  fp = fopen(JED_CACHE_FILE, "r");
+  if ( NULL == fp )
+  {
+    return -1;
+  }
+
+  if ( fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != JED_CACHE_MAGIC ||
+       hdr.file_hash != hash || hdr.file_size != size || hdr.CF_Line == 0 )
+  {
+    goto exit;
+  }
+
+  cf_size = (hdr.CF_Line * LATTICE_COL_SIZE) / 8;
+  ufm_size = (hdr.UFM_Line * LATTICE_COL_SIZE) / 8;
+
+  dev_info->CF = (unsigned int*)malloc(cf_size);
+  if ( NULL == dev_info->CF || fread(dev_info->CF, cf_size, 1, fp) != 1 )
+  {
+    goto exit;
+  }
+
+  if ( ufm_size )
+  {
+    dev_info->UFM = (unsigned int*)malloc(ufm_size);
+    if ( NULL == dev_info->UFM || fread(dev_info->UFM, ufm_size, 1, fp) != 1 )
+    {
+      goto exit;
+    }
+  }
+
+  dev_info->QF = hdr.QF;
+  dev_info->CF_Line = hdr.CF_Line;
+  dev_info->UFM_Line = hdr.UFM_Line;
+  dev_info->Version = hdr.Version;
+  dev_info->CheckSum = hdr.CheckSum;
+  dev_info->FEARBits = hdr.FEARBits;
+  dev_info->FeatureRow = hdr.FeatureRow;
+
+  if ( dev_info->CheckSum == 0 || LCMXO2Family_CF_CheckSum(dev_info) != dev_info->CheckSum )
+  {
+    printf("[%s] JED cache CheckSum Error, parsing the JED file\n", __func__);
+    goto exit;
+  }
+  ret = 0;
+
+exit:
+  if ( ret < 0 )
+  {
+    free(dev_info->CF);
+    free(dev_info->UFM);
+    dev_info->CF = NULL;
+    dev_info->UFM = NULL;
+  }
+  fclose(fp);
+  return ret;
+}
+
+static void
+LCMXO2Family_JED_Cache_Store(CPLDInfo *dev_info, uint64_t hash, uint32_t size)
+{
+  const char *tmp_path = JED_CACHE_FILE ".tmp";
+  JEDCacheHeader hdr = {0};
+  size_t cf_size = (dev_info->CF_Line * LATTICE_COL_SIZE) / 8;
+  size_t ufm_size = (dev_info->UFM_Line * LATTICE_COL_SIZE) / 8;
+  FILE *fp;
+  int ok;
+
+  hdr.magic = JED_CACHE_MAGIC;
+  hdr.file_size = size;
+  hdr.file_hash = hash;
+  hdr.QF = dev_info->QF;
+  hdr.CF_Line = dev_info->CF_Line;
+  hdr.UFM_Line = dev_info->UFM_Line;
+  hdr.Version = dev_info->Version;
+  hdr.CheckSum = dev_info->CheckSum;
+  hdr.FEARBits = dev_info->FEARBits;
+  hdr.FeatureRow = dev_info->FeatureRow;
+
+  if ( LCMXO2Family_JED_Cache_Dir() < 0 )
+  {
+    return;
+  }
+
+  fp = fopen(tmp_path, "w");
+  if ( NULL == fp )
+  {
+    return;
+  }
+
+  ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+       fwrite(dev_info->CF, cf_size, 1, fp) == 1 &&
+       (ufm_size == 0 || fwrite(dev_info->UFM, ufm_size, 1, fp) == 1);
+  if ( fclose(fp) != 0 || !ok || rename(tmp_path, JED_CACHE_FILE) != 0 )
+  {
+    unlink(tmp_path);
+  }
+}
+
+/*get the fuse map of the JED file, from the cache if it was parsed before*/
+static int
+LCMXO2Family_JED_Load(FILE *jed_fd, CPLDInfo *dev_info)
+{
+  uint64_t hash = 0;
+  uint32_t size = 0;
+  int cf_size = 0;
+  int ufm_size = 0;
+  int cacheable;
+  int ret;
+
+  cacheable = (LCMXO2Family_JED_Hash(jed_fd, &hash, &size) == 0);
+  if ( cacheable && LCMXO2Family_JED_Cache_Load(dev_info, hash, size) == 0 )
+  {
+#ifdef CPLD_DEBUG
+    printf("[%s] Using cached JED data %016llx\n", __func__, (unsigned long long)hash);
+#endif
+    return 0;
+  }
+
+  //set file pointer to the beginning
+  fseek(jed_fd, 0, SEEK_SET);
+
+  //get update data size
+  ret = LCMXO2Family_Get_Update_Data_Size(jed_fd, &cf_size, &ufm_size);
+  if ( ret < 0 )
+  {
+    printf("[%s] Update Data Size Error!\n", __func__);
+    return ret;
+  }
+
+  //set file pointer to the beginning
+  fseek(jed_fd, 0, SEEK_SET);
+
+  //parse info from JED file and calculate checksum
+  ret = LCMXO2Family_JED_File_Parser(jed_fd, dev_info, cf_size, ufm_size);
+  if ( ret < 0 )
+  {
+    printf("[%s] JED file CheckSum Error!\n", __func__);
+    return ret;
+  }
+
+  if ( cacheable )
+  {
+    LCMXO2Family_JED_Cache_Store(dev_info, hash, size);
+  }
+
+  return 0;
+}
+
 static int
 LCMXO2Family_cpld_verify(CPLDInfo *dev_info)
 {
@@ -656,7 +921,7 @@ LCMXO2Family_cpld_Start()
   ast_jtag_tdi_xfer(0, LATTICE_INS_LENGTH, dr_data);
 
   //LSC_CHECK_BUSY(0xF0) instruction
-  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_BUSY);
+  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_BUSY, BUSY_TIMEOUT_MS);
 
   if (dr_data[0] != 0)
   {
@@ -672,7 +937,7 @@ LCMXO2Family_cpld_Start()
   printf("[%s] READ_STATUS(0x3C)!\n", __func__);
 #endif
   //READ_STATUS(0x3C) instruction
-  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_STATUS);
+  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_STATUS, BUSY_TIMEOUT_MS);
 
   if (dr_data[0] != 0)
   {
@@ -702,7 +967,7 @@ LCMXO2Family_cpld_End()
 
   //Read CHECK_BUSY
 
-  status = LCMXO2Family_Check_Device_Status(CHECK_BUSY);
+  status = LCMXO2Family_Check_Device_Status(CHECK_BUSY, BUSY_TIMEOUT_MS);
   if (status != 0)
   {
     printf("[%s] Device Busy, status = %x\n", __func__, status);
@@ -713,7 +978,7 @@ LCMXO2Family_cpld_End()
   printf("[%s] READ_STATUS: %x\n", __func__, ret);
 #endif
 
-  status = LCMXO2Family_Check_Device_Status(CHECK_STATUS);
+  status = LCMXO2Family_Check_Device_Status(CHECK_STATUS, BUSY_TIMEOUT_MS);
   if (status != 0)
   {
     printf("[%s] Device Busy, status = %x\n", __func__, status);
@@ -809,7 +1074,7 @@ LCMXO2Family_cpld_Erase(int erase_type)
 
   ast_jtag_tdi_xfer(0, LATTICE_INS_LENGTH, dr_data);
 
-  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_BUSY);
+  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_BUSY, ERASE_TIMEOUT_MS);
 
   if (dr_data[0] != 0)
   {
@@ -826,7 +1091,7 @@ LCMXO2Family_cpld_Erase(int erase_type)
   printf("[%s] READ_STATUS!\n", __func__);
 #endif
 
-  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_STATUS);
+  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_STATUS, BUSY_TIMEOUT_MS);
 
   if (dr_data[0] != 0)
   {
@@ -887,7 +1152,7 @@ LCMXO2Family_cpld_program(CPLDInfo *dev_info)
 #endif
 
   //Read the status bit
-  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_STATUS);
+  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_STATUS, BUSY_TIMEOUT_MS);
 
   if (dr_data[0] != 0)
   {
@@ -918,7 +1183,7 @@ LCMXO2Family_cpld_program(CPLDInfo *dev_info)
 #endif
 
   //Read the status bit
-  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_STATUS);
+  dr_data[0] = LCMXO2Family_Check_Device_Status(CHECK_STATUS, BUSY_TIMEOUT_MS);
 
   if (dr_data[0] != 0)
   {
@@ -982,10 +1247,10 @@ int
 LCMXO2Family_cpld_update(FILE *jed_fd)
 {
   CPLDInfo dev_info = {0};
-  int cf_size = 0;
-  int ufm_size = 0;
   int erase_type = 0;
   int ret;
+  struct timespec start;
+  long load_ms = 0, erase_ms = 0, program_ms = 0, verify_ms = 0;
 
 #ifdef CPLD_DEBUG
   printf("[%s]\n",__func__);
@@ -998,25 +1263,11 @@ LCMXO2Family_cpld_update(FILE *jed_fd)
     goto error_exit;
   }
 
-  //set file pointer to the beginning
-  fseek(jed_fd, 0, SEEK_SET);
-
-  //get update data size
-  ret = LCMXO2Family_Get_Update_Data_Size(jed_fd, &cf_size, &ufm_size);
-  if ( ret < 0 )
-  {
-    printf("[%s] Update Data Size Error!\n", __func__);
-    goto error_exit;
-  }
-
-  //set file pointer to the beginning
-  fseek(jed_fd, 0, SEEK_SET);
-
-  //parse info from JED file and calculate checksum
-  ret = LCMXO2Family_JED_File_Parser(jed_fd, &dev_info, cf_size, ufm_size);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ret = LCMXO2Family_JED_Load(jed_fd, &dev_info);
+  load_ms = elapsed_ms(&start);
   if ( ret < 0 )
   {
-    printf("[%s] JED file CheckSum Error!\n", __func__);
     goto error_exit;
   }
 
@@ -1036,21 +1287,27 @@ LCMXO2Family_cpld_update(FILE *jed_fd)
     erase_type = Only_CF;
   }
 
+  clock_gettime(CLOCK_MONOTONIC, &start);
   ret = LCMXO2Family_cpld_Erase(erase_type);
+  erase_ms = elapsed_ms(&start);
   if ( ret < 0 )
   {
     printf("[%s] Erase failed!\n", __func__);
     goto error_exit;
   }
 
+  clock_gettime(CLOCK_MONOTONIC, &start);
   ret = LCMXO2Family_cpld_program(&dev_info);
+  program_ms = elapsed_ms(&start);
   if ( ret < 0 )
   {
     printf("[%s] Program failed!\n", __func__);
     goto error_exit;
   }
 
+  clock_gettime(CLOCK_MONOTONIC, &start);
   ret = LCMXO2Family_cpld_verify(&dev_info);
+  verify_ms = elapsed_ms(&start);
   if ( ret < 0 )
   {
     printf("[%s] Verify Failed!\n", __func__);
@@ -1065,6 +1322,9 @@ LCMXO2Family_cpld_update(FILE *jed_fd)
   }
 
 error_exit:
+  printf("[%s] Time: load %ldms, erase %ldms, program %ldms, verify %ldms\n",
+         __func__, load_ms, erase_ms, program_ms, verify_ms);
+
   if ( NULL != dev_info.CF )
   {
     free(dev_info.CF);
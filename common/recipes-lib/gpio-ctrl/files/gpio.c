@@ -20,7 +20,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <poll.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <string.h>
 #include <ctype.h>
@@ -29,6 +29,9 @@
 #include <libgen.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <linux/limits.h>
 
 #include "gpio_int.h"
@@ -501,24 +504,185 @@ int gpio_set_init_value(gpio_desc_t *gdesc, gpio_value_t value)
 	return GPIO_OPS()->set_pin_init_value(gdesc, value);
 }
 
+/*
+ * gpio poll engine: all the pins of a gpiopoll descriptor are registered
+ * on one epoll instance, and events are dispatched by the thread calling
+ * gpio_poll(), in the order the kernel queued them. A pin is watched by
+ * POLLPRI on the fd of its backend, and its value re-read on each edge.
+ */
+#define GPOLL_KEY(idx, timer)	(((uint32_t)(idx) << 1) | ((timer) ? 1 : 0))
+#define GPOLL_KEY_IDX(key)	((key) >> 1)
+#define GPOLL_KEY_TIMER(key)	((key) & 1)
+#define GPOLL_STOP_KEY		UINT32_MAX
+#define GPOLL_MAX_EVENTS	32
+
+static void gpoll_pin_release(gpiopoll_pin_t *desc)
+{
+	if (desc->timer_fd >= 0) {
+		close(desc->timer_fd);
+		desc->timer_fd = -1;
+	}
+	if (desc->gpio && gpio_close(desc->gpio)) {
+		GLOG_ERR("Close failed for GPIO: %s <%s>\n",
+			 desc->cfg.shadow, strerror(errno));
+	}
+	desc->gpio = NULL;
+}
+
+static int gpoll_pin_fd(gpiopoll_pin_t *desc)
+{
+	return GPIO_OPS()->get_pin_poll_fd(desc->gpio);
+}
+
+static int gpoll_pin_setup(gpiopoll_desc_t *gpdesc, int idx)
+{
+	gpiopoll_pin_t *desc = &gpdesc->pins[idx];
+	struct epoll_event ev = {0};
+	int fd;
+
+	fd = gpoll_pin_fd(desc);
+	if (fd < 0)
+		return -1;
+	ev.events = EPOLLPRI;
+	ev.data.u32 = GPOLL_KEY(idx, false);
+	if (epoll_ctl(gpdesc->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		return -1;
+
+	if (desc->cfg.debounce_ms > 0) {
+		desc->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+						TFD_NONBLOCK | TFD_CLOEXEC);
+		if (desc->timer_fd < 0)
+			return -1;
+		ev.events = EPOLLIN;
+		ev.data.u32 = GPOLL_KEY(idx, true);
+		if (epoll_ctl(gpdesc->epoll_fd, EPOLL_CTL_ADD,
+			      desc->timer_fd, &ev) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void gpoll_pin_drop(gpiopoll_desc_t *gpdesc, gpiopoll_pin_t *desc)
+{
+	int fd = gpoll_pin_fd(desc);
+
+	if (fd >= 0)
+		epoll_ctl(gpdesc->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	if (desc->timer_fd >= 0)
+		epoll_ctl(gpdesc->epoll_fd, EPOLL_CTL_DEL, desc->timer_fd, NULL);
+	desc->pending = false;
+	desc->failed = true;
+}
+
+static void gpoll_report(gpiopoll_pin_t *desc, gpio_value_t value,
+			 const struct timespec *ts)
+{
+	desc->last_value = desc->curr_value;
+	desc->curr_value = value;
+	desc->ts = *ts;
+	desc->cfg.handler(desc, desc->last_value, desc->curr_value);
+}
+
+static void gpoll_edge(gpiopoll_pin_t *desc, gpio_value_t value,
+		       const struct timespec *ts)
+{
+	struct itimerspec its = {{0}};
+
+	if (desc->timer_fd < 0) {
+		gpoll_report(desc, value, ts);
+		return;
+	}
+
+	/* Every edge of a burst restarts the quiet period. */
+	desc->pending = true;
+	desc->pend_value = value;
+	desc->pend_ts = *ts;
+	its.it_value.tv_sec = desc->cfg.debounce_ms / 1000;
+	its.it_value.tv_nsec = (desc->cfg.debounce_ms % 1000) * 1000000L;
+	timerfd_settime(desc->timer_fd, 0, &its, NULL);
+}
+
+static int gpoll_pin_event(gpiopoll_pin_t *desc)
+{
+	struct timespec ts;
+	gpio_value_t value;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	/* Reading the value also re-arms POLLPRI. */
+	if (gpio_get_value(desc->gpio, &value))
+		return -1;
+	gpoll_edge(desc, value, &ts);
+	return 0;
+}
+
+static int gpoll_pin_timer(gpiopoll_pin_t *desc)
+{
+	uint64_t expired;
+	gpio_value_t value = desc->pend_value;
+
+	if (read(desc->timer_fd, &expired, sizeof(expired)) < 0 ||
+	    !desc->pending)
+		return 0;
+	desc->pending = false;
+
+	/* The value read at the edge may still be bouncing. */
+	if (gpio_get_value(desc->gpio, &value))
+		return -1;
+	gpoll_report(desc, value, &desc->pend_ts);
+	return 0;
+}
+
+static bool gpoll_debounce_pending(gpiopoll_desc_t *gpdesc)
+{
+	int i;
+
+	for (i = 0; i < gpdesc->num_pins; i++) {
+		if (gpdesc->pins[i].pending)
+			return true;
+	}
+	return false;
+}
+
 gpiopoll_desc_t* gpio_poll_open(struct gpiopoll_config *config,
 				size_t num_config)
 {
 	int i;
 	gpiopoll_desc_t *ret;
+	struct epoll_event stop_ev = {0};
 
 	ret = calloc(1, sizeof(gpiopoll_desc_t));
 	if (!ret) {
 		return NULL;
 	}
+	ret->epoll_fd = -1;
+	ret->stop_fd = -1;
 	ret->num_pins = num_config;
 	ret->pins = calloc(num_config, sizeof(ret->pins[0]));
 	if (!ret->pins) {
 		goto err_pins_alloc_bail;
 	}
+	for (i = 0; i < num_config; i++) {
+		ret->pins[i].timer_fd = -1;
+	}
+	pthread_mutex_init(&ret->lock, NULL);
+	pthread_cond_init(&ret->cond, NULL);
+
+	ret->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	ret->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ret->epoll_fd < 0 || ret->stop_fd < 0) {
+		GLOG_ERR("Failed to create poll descriptors <%s>\n",
+			 strerror(errno));
+		goto err_bail;
+	}
+	stop_ev.events = EPOLLIN;
+	stop_ev.data.u32 = GPOLL_STOP_KEY;
+	if (epoll_ctl(ret->epoll_fd, EPOLL_CTL_ADD, ret->stop_fd, &stop_ev)) {
+		GLOG_ERR("Failed to watch stop event <%s>\n", strerror(errno));
+		goto err_bail;
+	}
+
 	for (i = 0; i < num_config; i++) {
 		gpiopoll_pin_t *desc = &ret->pins[i];
-		desc->handler_started = false;
 		desc->cfg = config[i];
 		if (config[i].handler == NULL || config[i].shadow[0] == '\0') {
 			GLOG_ERR("Incorrect configuration at index: %d\n", i);
@@ -545,6 +709,11 @@ gpiopoll_desc_t* gpio_poll_open(struct gpiopoll_config *config,
 				 desc->cfg.shadow, strerror(errno));
 			goto err_bail;
 		}
+		if (gpoll_pin_setup(ret, i)) {
+			GLOG_ERR("Failed to watch GPIO: %s <%s>\n",
+				 desc->cfg.shadow, strerror(errno));
+			goto err_bail;
+		}
 		desc->curr_value = desc->last_value;
 		if (desc->cfg.init_value) {
 			desc->cfg.init_value(desc, desc->curr_value);
@@ -553,10 +722,14 @@ gpiopoll_desc_t* gpio_poll_open(struct gpiopoll_config *config,
 	return ret;
 err_bail:
 	for (i = 0; i < num_config; i++) {
-		gpiopoll_pin_t *desc = &ret->pins[i];
-		if (desc->gpio)
-			gpio_close(desc->gpio);
-	}
+		gpoll_pin_release(&ret->pins[i]);
+	}
+	if (ret->epoll_fd >= 0)
+		close(ret->epoll_fd);
+	if (ret->stop_fd >= 0)
+		close(ret->stop_fd);
+	pthread_cond_destroy(&ret->cond);
+	pthread_mutex_destroy(&ret->lock);
 	free(ret->pins);
 err_pins_alloc_bail:
 	free(ret);
@@ -571,93 +744,107 @@ int gpio_poll_close(gpiopoll_desc_t *gpdesc)
 		return -1;
 	}
 
-	for (i = 0; i < gpdesc->num_pins; i++) {
-		gpiopoll_pin_t *desc = &gpdesc->pins[i];
-		if (desc->handler_started) {
-			int rc = pthread_cancel(desc->tid);
-			if(rc != 0) {
-				GLOG_ERR("Kill of thread failed for GPIO: %s <%s>\n",
-					 desc->cfg.shadow, strerror(rc));
-			}
-			desc->handler_started = false;
-		}
-		if (gpio_close(desc->gpio)) {
-			GLOG_ERR("Close failed for GPIO: %s <%s>\n",
-				 desc->cfg.shadow, strerror(errno));
+	/* Stop a running gpio_poll() and wait for it to return. */
+	pthread_mutex_lock(&gpdesc->lock);
+	if (gpdesc->running) {
+		if (pthread_equal(gpdesc->tid, pthread_self())) {
+			pthread_mutex_unlock(&gpdesc->lock);
+			GLOG_ERR("gpio_poll_close() called from a handler\n");
+			errno = EDEADLK;
+			return -1;
 		}
+		eventfd_write(gpdesc->stop_fd, 1);
+		while (gpdesc->running)
+			pthread_cond_wait(&gpdesc->cond, &gpdesc->lock);
 	}
+	pthread_mutex_unlock(&gpdesc->lock);
+
+	for (i = 0; i < gpdesc->num_pins; i++) {
+		gpoll_pin_release(&gpdesc->pins[i]);
+	}
+	close(gpdesc->epoll_fd);
+	close(gpdesc->stop_fd);
+	pthread_cond_destroy(&gpdesc->cond);
+	pthread_mutex_destroy(&gpdesc->lock);
 	free(gpdesc->pins);
 	free(gpdesc);
 	return 0;
 }
 
-static void *gpio_poll_handler(void *priv)
-{
-	gpiopoll_pin_t *desc = (gpiopoll_pin_t *)priv;
-	int rc;
-
-	assert(GPIO_OPS()->poll_pin != NULL);
-
-	while (1) {
-		rc = GPIO_OPS()->poll_pin(desc->gpio, desc->timeout);
-		if (rc < 0) {
-			GLOG_ERR("Wait failed with rc=%d for GPIO: %s <%s>\n",
-				 rc, desc->cfg.shadow, strerror(errno));
-			break;
-		}
-		desc->last_value = desc->curr_value;
-		if (gpio_get_value(desc->gpio, &desc->curr_value)) {
-			GLOG_ERR("Getting current value failed for GPIO: %s <%s>\n",
-				 desc->cfg.shadow, strerror(errno));
-			break;
-		}
-		desc->cfg.handler(desc, desc->last_value, desc->curr_value);
-	}
-	return NULL;
-}
-
 int gpio_poll(gpiopoll_desc_t *gpdesc, int timeout)
 {
-	int i;
+	struct epoll_event events[GPOLL_MAX_EVENTS];
+	int i, n, rc = 0;
+	int active;
+	bool stop = false;
 
 	if (!gpdesc || !gpdesc->pins) {
 		return -1;
 	}
 
-	for (i = 0; i < gpdesc->num_pins; i++) {
-		int rc;
-		gpiopoll_pin_t *desc = &gpdesc->pins[i];
-		assert(desc->handler_started == false);
-		desc->timeout = timeout;
-		rc = pthread_create(&desc->tid, NULL, gpio_poll_handler, desc);
-		if (rc) {
-			GLOG_ERR("Create of handler thread failed for GPIO: %s <%s>\n",
-				 desc->cfg.shadow, strerror(rc));
-			if (gpio_close(desc->gpio)) {
-				GLOG_ERR("Close failed for GPIO: %s <%s>\n",
-					 desc->cfg.shadow, strerror(errno));
-			}
-			continue;
-		}
-		desc->handler_started = true;
+	pthread_mutex_lock(&gpdesc->lock);
+	if (gpdesc->running) {
+		pthread_mutex_unlock(&gpdesc->lock);
+		errno = EBUSY;
+		return -1;
 	}
+	gpdesc->running = true;
+	gpdesc->tid = pthread_self();
+	pthread_mutex_unlock(&gpdesc->lock);
 
+	active = 0;
 	for (i = 0; i < gpdesc->num_pins; i++) {
-		int rc;
-		void *res;
-		gpiopoll_pin_t *desc = &gpdesc->pins[i];
-		if (!desc->handler_started) {
-			continue;
+		if (!gpdesc->pins[i].failed)
+			active++;
+	}
+
+	while (!stop && active > 0) {
+		n = epoll_wait(gpdesc->epoll_fd, events, GPOLL_MAX_EVENTS,
+			       timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			GLOG_ERR("epoll_wait() returned error: %s\n",
+				 strerror(errno));
+			rc = -1;
+			break;
 		}
-		rc = pthread_join(desc->tid, &res);
-		if (rc != 0) {
-			GLOG_ERR("Pthread_join fialed for %s <%s>\n",
-				 desc->cfg.shadow, strerror(rc));
-		} else if (res == PTHREAD_CANCELED) {
-			GLOG_ERR("Potential race condition between close and poll");
+		/* Let debounce timers which are still running expire. */
+		if (n == 0 && !gpoll_debounce_pending(gpdesc))
+			break;
+
+		for (i = 0; i < n; i++) {
+			uint32_t key = events[i].data.u32;
+			gpiopoll_pin_t *desc;
+
+			if (key == GPOLL_STOP_KEY) {
+				eventfd_t val;
+				eventfd_read(gpdesc->stop_fd, &val);
+				stop = true;
+				break;
+			}
+			desc = &gpdesc->pins[GPOLL_KEY_IDX(key)];
+			if (desc->failed)
+				continue;
+			if ((GPOLL_KEY_TIMER(key) ? gpoll_pin_timer(desc) :
+						    gpoll_pin_event(desc)) != 0) {
+				GLOG_ERR("Getting current value failed for GPIO: %s <%s>\n",
+					 desc->cfg.shadow, strerror(errno));
+				gpoll_pin_drop(gpdesc, desc);
+				active--;
+			}
 		}
 	}
-	return 0;
+	if (active == 0) {
+		GLOG_ERR("No GPIO left to poll\n");
+		rc = -1;
+	}
+
+	pthread_mutex_lock(&gpdesc->lock);
+	gpdesc->running = false;
+	pthread_cond_broadcast(&gpdesc->cond);
+	pthread_mutex_unlock(&gpdesc->lock);
+	return rc;
 }
 
 const struct gpiopoll_config *gpio_poll_get_config(gpiopoll_pin_t *gpdesc)
@@ -675,3 +862,13 @@ gpio_desc_t *gpio_poll_get_descriptor(gpiopoll_pin_t *gpdesc)
 	}
 	return gpdesc->gpio;
 }
+
+int gpio_poll_get_timestamp(gpiopoll_pin_t *gpdesc, struct timespec *ts)
+{
+	if (!gpdesc || !ts) {
+		errno = EINVAL;
+		return -1;
+	}
+	*ts = gpdesc->ts;
+	return 0;
+}
@@ -102,18 +102,31 @@ struct gpiochip_desc {
 
 
 struct gpiopoll_pin_desc {
-	bool         handler_started;
 	struct gpiopoll_config cfg;
 	gpio_value_t last_value;
 	gpio_value_t curr_value;
-	pthread_t    tid;
 	gpio_desc_t  *gpio;
-	int          timeout;
+	int          timer_fd;	/* debounce timer, -1 if not debounced */
+	bool         pending;	/* debounce timer is running */
+	bool         failed;	/* dropped from the poll loop */
+	gpio_value_t pend_value;
+	struct timespec pend_ts;
+	struct timespec ts;	/* time of the event being handled */
 };
 
+/*
+ * All pins of a descriptor are multiplexed on one epoll instance and
+ * handled by the thread which calls gpio_poll().
+ */
 struct gpiopoll_desc {
 	int num_pins;
 	gpiopoll_pin_t *pins;
+	int epoll_fd;
+	int stop_fd;		/* eventfd to wake gpio_poll() up */
+	bool running;
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
 };
 
 /*
@@ -145,7 +158,12 @@ struct gpio_backend_ops {
 	int (*get_pin_edge)(gpio_desc_t *gdesc, gpio_edge_t *edge);
 	int (*set_pin_edge)(gpio_desc_t *gdesc, gpio_edge_t edge);
 	int (*set_pin_init_value)(gpio_desc_t *gdesc, gpio_value_t value);
-	int (*poll_pin)(gpio_desc_t *gdesc, int timeout);
+
+	/*
+	 * Function to watch edges of a gpio pin: returns a fd which raises
+	 * POLLPRI on edges and has to be re-read by get_pin_value afterwards.
+	 */
+	int (*get_pin_poll_fd)(gpio_desc_t *gdesc);
 
 	/*
 	 * Function to enumerate gpio chips.
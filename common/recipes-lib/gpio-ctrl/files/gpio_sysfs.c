@@ -23,7 +23,6 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
-#include <poll.h>
 #include <fcntl.h>
 #include <libgen.h>
 #include <dirent.h>
@@ -599,33 +598,21 @@ static int sysfs_gpiochip_enumerate(gpiochip_desc_t *chips, size_t size)
 	return i;
 }
 
-static int sysfs_gpio_poll(gpio_desc_t *gdesc, int timeout)
+static int sysfs_gpio_get_poll_fd(gpio_desc_t *gdesc)
 {
-	struct pollfd fdset = {0};
-	int rc;
+	char pathname[PATH_MAX];
 
 	assert(IS_VALID_GPIO_DESC(gdesc));
 	if (GPIO_EDGE_FD(gdesc) < 0) {
 		GLOG_WARN("Potential bug. waiting without defining edge");
 	}
-	fdset.fd = GPIO_VALUE_FD(gdesc);
-	fdset.events = POLLPRI;
-	fdset.revents = 0;
-	do {
-		rc = poll(&fdset, 1, timeout);
-	} while (rc < 0 && errno == EINTR);
-	if (rc < 0) {
-		GLOG_ERR("poll() returned error: %s\n", strerror(errno));
-		return -1;
-	}
-	if (rc == 0) {
-		return -ETIMEDOUT;
-	}
-	if (!(fdset.revents & POLLPRI)) {
-		GLOG_ERR("poll() returned without POLLPRI");
-		return -1;
+	if (GPIO_VALUE_FD(gdesc) < 0) {
+		gsysfs_value_abspath(pathname, sizeof(pathname),
+				     gdesc->pin_num);
+		if (gsysfs_setup_fd(pathname, &GPIO_VALUE_FD(gdesc)) != 0)
+			return -1;
 	}
-	return 0;
+	return GPIO_VALUE_FD(gdesc);
 }
 
 struct gpio_backend_ops gpio_sysfs_ops = {
@@ -642,7 +629,7 @@ struct gpio_backend_ops gpio_sysfs_ops = {
 	.get_pin_edge = sysfs_gpio_get_edge,
 	.set_pin_edge = sysfs_gpio_set_edge,
 	.set_pin_init_value = sysfs_gpio_set_init_value,
-	.poll_pin = sysfs_gpio_poll,
+	.get_pin_poll_fd = sysfs_gpio_get_poll_fd,
 
 	.chip_enumerate = sysfs_gpiochip_enumerate,
 };
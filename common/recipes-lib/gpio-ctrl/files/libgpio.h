@@ -49,6 +49,7 @@ extern "C" {
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include <linux/limits.h>
 
 /*
@@ -123,6 +124,11 @@ struct gpiopoll_config {
 	/* (optional) Called once during creation. This allows the user
 	 * to set the state machine at the initial value of the given GPIO */
 	void (*init_value)(gpiopoll_pin_t *gpdesc, gpio_value_t value);
+
+	/* (optional) Debounce time in milliseconds. When set, a burst of
+	 * edges is reported by a single handler call once the pin has been
+	 * quiet for this long. 0 reports every edge. */
+	int debounce_ms;
 };
 
 /*
@@ -224,6 +230,12 @@ int gpio_poll_close(gpiopoll_desc_t *gpdesc);
 /*
  * Function to poll on a set of gpio pins: the registered handlers will
  * be called when pin state is changed.
+ * All pins are watched by the calling thread, and handlers are called
+ * one at a time in the order the events occurred, so a handler which
+ * blocks delays the events of the other pins.
+ * The function returns when no event was seen for "timeout" milliseconds
+ * (-1 waits forever), or when gpio_poll_close() is called from another
+ * thread.
  *
  * Return:
  *   0 for success, and -1 on failures.
@@ -253,6 +265,16 @@ const struct gpiopoll_config *gpio_poll_get_config(gpiopoll_pin_t *gpdesc);
  */
 gpio_desc_t *gpio_poll_get_descriptor(gpiopoll_pin_t *gpdesc);
 
+/*
+ * Function to retrieve the time (CLOCK_MONOTONIC) of the edge being
+ * reported to the handler, that is the time the edge was picked up.
+ * With debouncing, it is the time of the last edge of the burst.
+ *
+ * Return:
+ *   0 for success, and -1 on failures.
+ */
+int gpio_poll_get_timestamp(gpiopoll_pin_t *gpdesc, struct timespec *ts);
+
 /*
  * gpio chip related functions.
  */
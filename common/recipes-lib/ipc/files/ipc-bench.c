@@ -0,0 +1,209 @@
+/*
+ *
+ * Copyright 2020-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Load generator for ipc services. Drives ipc_send_req() from a number
+ * of concurrent threads and reports the latency distribution. Without
+ * -e an in-process echo service is started, which measures the ipc
+ * library alone.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+
+#define BENCH_ENDPOINT "ipc_bench"
+#define MAX_REQ_LEN 256
+#define MAX_RESP_LEN 1024
+
+typedef struct {
+  pthread_t tid;
+  int count;
+  int errors;
+  uint64_t *lat_us;
+} bench_thread_t;
+
+static const char *endpoint = BENCH_ENDPOINT;
+static uint8_t req[MAX_REQ_LEN] = {0x18, 0x01};
+static size_t req_len = 2;
+static int timeout = 5;
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int echo_handler(client_t *cli)
+{
+  uint8_t buf[MAX_REQ_LEN];
+  size_t len = sizeof(buf);
+
+  if (ipc_recv_req(cli, buf, &len, timeout) || len == 0)
+    return -1;
+  return ipc_send_resp(cli, buf, len);
+}
+
+static void *bench_thread(void *arg)
+{
+  bench_thread_t *t = (bench_thread_t *)arg;
+  uint8_t resp[MAX_RESP_LEN];
+  size_t resp_len;
+  uint64_t start;
+  int i;
+
+  for (i = 0; i < t->count; i++) {
+    resp_len = sizeof(resp);
+    start = now_us();
+    if (ipc_send_req(endpoint, req, req_len, resp, &resp_len, timeout)) {
+      t->errors++;
+      t->lat_us[i] = UINT64_MAX;
+      continue;
+    }
+    t->lat_us[i] = now_us() - start;
+  }
+  return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog)
+{
+  printf("Usage: %s [-e endpoint] [-c concurrency] [-n requests] [-w workers] [-t timeout] [req bytes...]\n", prog);
+  printf("  -e endpoint     ipc endpoint to load (default: in-process echo service)\n");
+  printf("  -c concurrency  number of client threads (default: 4)\n");
+  printf("  -n requests     requests per client thread (default: 1000)\n");
+  printf("  -w workers      worker threads of the echo service (default: 4)\n");
+  printf("  -t timeout      per request timeout in seconds (default: 5)\n");
+  printf("  req bytes       request payload in hex (default: 18 01)\n");
+}
+
+int main(int argc, char **argv)
+{
+  bench_thread_t *threads;
+  uint64_t *all, start, elapsed;
+  int concurrency = 4, count = 1000, workers = 4;
+  int i, j, opt, n = 0, errors = 0;
+  bool self = true;
+
+  while ((opt = getopt(argc, argv, "e:c:n:w:t:h")) != -1) {
+    switch (opt) {
+      case 'e':
+        endpoint = optarg;
+        self = false;
+        break;
+      case 'c':
+        concurrency = atoi(optarg);
+        break;
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'w':
+        workers = atoi(optarg);
+        break;
+      case 't':
+        timeout = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : -1;
+    }
+  }
+  if (concurrency <= 0 || count <= 0 || workers <= 0) {
+    usage(argv[0]);
+    return -1;
+  }
+  if (optind < argc) {
+    for (req_len = 0; optind < argc && req_len < MAX_REQ_LEN; optind++) {
+      req[req_len++] = (uint8_t)strtoul(argv[optind], NULL, 16);
+    }
+  }
+
+  if (self) {
+    if (ipc_start_svc_ex(endpoint, echo_handler, workers, workers, NULL, NULL)) {
+      printf("Failed to start echo service\n");
+      return -1;
+    }
+    usleep(100 * 1000);
+  }
+
+  threads = calloc(concurrency, sizeof(*threads));
+  all = calloc((size_t)concurrency * count, sizeof(uint64_t));
+  if (!threads || !all) {
+    printf("Out of memory\n");
+    return -1;
+  }
+
+  start = now_us();
+  for (i = 0; i < concurrency; i++) {
+    threads[i].count = count;
+    threads[i].lat_us = all + (size_t)i * count;
+    if (pthread_create(&threads[i].tid, NULL, bench_thread, &threads[i])) {
+      printf("Failed to create client thread %d\n", i);
+      return -1;
+    }
+  }
+  for (i = 0; i < concurrency; i++) {
+    pthread_join(threads[i].tid, NULL);
+    errors += threads[i].errors;
+  }
+  elapsed = now_us() - start;
+
+  /* Failed requests sort to the end and are left out */
+  qsort(all, (size_t)concurrency * count, sizeof(uint64_t), cmp_u64);
+  n = concurrency * count - errors;
+
+  printf("Endpoint:    %s\n", endpoint);
+  printf("Concurrency: %d\n", concurrency);
+  printf("Requests:    %d (%d failed)\n", concurrency * count, errors);
+  printf("Throughput:  %.1f req/s\n", elapsed ? (double)n * 1000000 / elapsed : 0.0);
+  if (n > 0) {
+    j = (n * 50 + 99) / 100 - 1;
+    printf("p50:         %llu us\n", (unsigned long long)all[j < 0 ? 0 : j]);
+    j = (n * 99 + 99) / 100 - 1;
+    printf("p99:         %llu us\n", (unsigned long long)all[j < 0 ? 0 : j]);
+    printf("max:         %llu us\n", (unsigned long long)all[n - 1]);
+  }
+
+  if (self) {
+    ipc_svc_stats_t st;
+    if (ipc_get_svc_stats(endpoint, &st) == 0) {
+      printf("Service:     queue max %u, p50 %llu us, p99 %llu us\n",
+          st.queue_max,
+          (unsigned long long)ipc_stats_percentile(&st, 50),
+          (unsigned long long)ipc_stats_percentile(&st, 99));
+    }
+  }
+
+  free(all);
+  free(threads);
+  return errors ? -1 : 0;
+}
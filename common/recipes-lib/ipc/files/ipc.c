@@ -22,11 +22,18 @@
 #include <syslog.h>
 #include <pthread.h>
 #include <string.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #include "ipc.h"
 
@@ -53,8 +60,31 @@
 #define MAX_RETRIES 5
 #define CLIENT_TIMEOUT 16
 
-#define WAIT_CLIENT_RETRIES 5
 #define ACCEPT_RECOVER_RETRIES 5
+#define LISTEN_BACKLOG 64
+#define MAX_EVENTS 16
+#define LOOP_TICK_MS 1000
+
+/* Counters are dumped to this file when they changed */
+#define STATS_PATH "/tmp/%s.stats"
+#define STATS_INTERVAL 10
+
+/*
+ * Framed connections. A client which starts the connection with a
+ * frame header keeps it open and may have several requests in flight;
+ * every request and response carries a header with the request id.
+ * The first header byte is never a valid first byte of an IPMI or
+ * IPMB request, which is how one-shot clients are told apart.
+ */
+#define IPC_FRAME_MAGIC 0x435049FB  /* FB 'I' 'P' 'C' */
+#define IPC_FRAME_MAX   4096
+
+/* Server closes framed connections idle for this long. Clients stop
+ * reusing them after half of it, so they never race the close. */
+#define PCONN_IDLE_TIMEOUT 60
+
+/* Framed connections cached per client thread */
+#define CONN_CACHE_SIZE 4
 
 #define SAVE_ERRNO_RUN(exp)  \
   do {                       \
@@ -63,6 +93,64 @@
     errno = saved_errno;     \
   } while (0)
 
+#define container_of(ptr, type, member) \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+
+typedef struct {
+  uint32_t magic;
+  uint32_t id;
+  uint32_t len;
+} frame_hdr_t;
+
+enum {
+  EP_LISTEN,
+  EP_WAKE,
+  EP_CONN,
+  EP_PCONN,
+};
+
+struct pconn_s;
+
+/* Per-request state wrapped around the client handed to handlers.
+ * Requests of a framed connection carry their payload along. */
+typedef struct conn_s {
+  client_t cli;
+  int ep_type;
+  struct conn_s *prev, *next;  /* Idle list, loop thread only */
+  uint64_t accept_us;
+  uint64_t ready_us;
+  struct pconn_s *parent;
+  uint32_t req_id;
+  size_t req_len;
+  uint8_t req[];
+} conn_t;
+
+/* A framed connection. The loop thread owns reading from it, workers
+ * write responses under wlock. Freed once the loop and every request
+ * in flight dropped their reference. */
+typedef struct pconn_s {
+  int ep_type;
+  int fd;
+  int refs;
+  bool dead;
+  bool stalled;                /* Out of request slots, not reading */
+  pthread_mutex_t wlock;
+  uint64_t last_us;
+  struct pconn_s *prev, *next;
+  size_t rx_len;
+  uint8_t rx[sizeof(frame_hdr_t) + IPC_FRAME_MAX];
+} pconn_t;
+
+/*
+ * One thread per service multiplexes the listening socket and all
+ * accepted connections on epoll. A request is handed to the worker
+ * pool once it is readable, so a slow or idle client never ties up a
+ * worker. Requests in flight are bounded by workers + queue depth;
+ * beyond that new clients wait in the listen backlog and framed
+ * connections are not read from, instead of refusing anybody.
+ * Workers are started when a request finds none idle, up to
+ * num_workers, so a large limit costs nothing until it is used.
+ */
 struct service_s {
   ipc_handle_req_t handle_req;
   client_t base_cli;
@@ -70,8 +158,48 @@ struct service_s {
   pthread_cond_t  cond;
   int             num_active;
   int             active_limit;
+  int             num_workers;
+  int             num_started;
+  int             num_idle;
+  conn_t          **queue;
+  int             q_head;
+  int             q_len;
+  int             sock;
+  int             epfd;
+  int             evfd;
+  int             listen_tag;
+  int             wake_tag;
+  bool            accept_paused;
+  conn_t          *idle;
+  pconn_t         *pconns;
+  pconn_t         *graveyard;
+  ipc_svc_stats_t stats;
+  uint64_t        stats_gen;
+  struct service_s *next;
 };
 
+struct ipc_conn_s {
+  int fd;
+  uint32_t next_id;
+  uint64_t last_us;
+  pid_t pid;
+  char endpoint[MAX_ENDPOINT_LEN];
+};
+
+static pthread_mutex_t svc_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static service_t *svc_list = NULL;
+
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static bool cache_ok = false;
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static void set_sock_timeout(int sock, int timeout)
 {
   if (timeout >= 0) {
@@ -84,45 +212,277 @@ static void set_sock_timeout(int sock, int timeout)
   }
 }
 
-int ipc_send_req(const char *endpoint, uint8_t *req, size_t req_len,
-                 uint8_t *resp, size_t *resp_len, int timeout)
+static int sock_connect(const char *endpoint)
 {
   struct sockaddr_un remote;
-  int len, retry, sockfd;
-  size_t max_resp;
+  int len, sockfd;
 
-  if (!req || !req_len || !resp || !resp_len || !*resp_len) {
-    DEBUG("%s(%s) bad parameters passed", __func__, endpoint);
-    errno = EINVAL;
-    return -1;
-  }
-
-
-  if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+  if ((sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
     DEBUG("%s(%s) failed to create socket (%s)", __func__, endpoint, strerror(errno));
     return -1;
   }
 
-  set_sock_timeout(sockfd, timeout);
-
   remote.sun_family = AF_UNIX;
   sprintf(remote.sun_path, "/tmp/%s", endpoint);
   len = strlen(remote.sun_path) + sizeof(remote.sun_family);
 
   if (connect(sockfd, (struct sockaddr *)&remote, len) == -1) {
     DEBUG("%s(%s) failed to connect (%s)", __func__, endpoint, strerror(errno));
-    goto error;
+    SAVE_ERRNO_RUN(close(sockfd));
+    return -1;
   }
-  
+  return sockfd;
+}
+
+/* Write a whole frame, header and payload in one go where possible */
+static int frame_write(int fd, uint32_t id, const uint8_t *buf, size_t len)
+{
+  frame_hdr_t hdr = {IPC_FRAME_MAGIC, id, (uint32_t)len};
+  struct iovec iov[2] = {
+    {&hdr, sizeof(hdr)},
+    {(void *)buf, len},
+  };
+  struct msghdr msg = {0};
+  ssize_t n;
+
+  msg.msg_iov = iov;
+  msg.msg_iovlen = len ? 2 : 1;
+  while (msg.msg_iovlen) {
+    n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    while (msg.msg_iovlen && n >= (ssize_t)msg.msg_iov[0].iov_len) {
+      n -= msg.msg_iov[0].iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen) {
+      msg.msg_iov[0].iov_base = (char *)msg.msg_iov[0].iov_base + n;
+      msg.msg_iov[0].iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Deadline of a response wait, timeout seconds from now. This is one
+ * budget for the whole framed response, not a per-recv() timeout which
+ * restarts on every partial read. A timeout of 0 or less waits for as
+ * long as it takes, like the plain socket without SO_RCVTIMEO did.
+ */
+static uint64_t recv_deadline(int timeout)
+{
+  if (timeout <= 0)
+    return UINT64_MAX;
+  return now_us() + (uint64_t)timeout * 1000000;
+}
+
+/* Read exactly len bytes unless the deadline passes first */
+static int read_full(int fd, void *buf, size_t len, uint64_t deadline)
+{
+  struct pollfd pfd = {fd, POLLIN, 0};
+  size_t got = 0;
+  ssize_t n;
+  uint64_t now;
+
+  while (got < len) {
+    now = now_us();
+    if (now >= deadline) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    n = poll(&pfd, 1, deadline == UINT64_MAX ? -1 :
+             (int)((deadline - now + 999) / 1000));
+    if (n < 0 && errno != EINTR)
+      return -1;
+    if (n <= 0)
+      continue;
+    n = recv(fd, (char *)buf + got, len - got, MSG_DONTWAIT);
+    if (n == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+        continue;
+      return -1;
+    }
+    got += n;
+  }
+  return 0;
+}
+
+ipc_conn_t *ipc_conn_open(const char *endpoint)
+{
+  ipc_conn_t *conn;
+
+  if (!endpoint || strlen(endpoint) >= MAX_ENDPOINT_LEN - 1) {
+    errno = EINVAL;
+    return NULL;
+  }
+  conn = calloc(1, sizeof(*conn));
+  if (!conn)
+    return NULL;
+  conn->fd = sock_connect(endpoint);
+  if (conn->fd < 0) {
+    SAVE_ERRNO_RUN(free(conn));
+    return NULL;
+  }
+  strcpy(conn->endpoint, endpoint);
+  conn->pid = getpid();
+  conn->last_us = now_us();
+  return conn;
+}
+
+void ipc_conn_close(ipc_conn_t *conn)
+{
+  if (conn) {
+    close(conn->fd);
+    free(conn);
+  }
+}
+
+int ipc_conn_send(ipc_conn_t *conn, const uint8_t *req, size_t req_len, uint32_t *id)
+{
+  if (!conn || !req || !req_len || req_len > IPC_FRAME_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (frame_write(conn->fd, ++conn->next_id, req, req_len)) {
+    DEBUG("%s(%s) failed to send (%s)", __func__, conn->endpoint, strerror(errno));
+    return -1;
+  }
+  conn->last_us = now_us();
+  if (id)
+    *id = conn->next_id;
+  return 0;
+}
+
+int ipc_conn_recv(ipc_conn_t *conn, uint32_t *id, uint8_t *resp, size_t *resp_len, int timeout)
+{
+  uint64_t deadline = recv_deadline(timeout);
+  uint8_t drop[64];
+  frame_hdr_t hdr;
+  size_t len, chunk;
+
+  if (!conn || !resp || !resp_len) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (read_full(conn->fd, &hdr, sizeof(hdr), deadline))
+    return -1;
+  if (hdr.magic != IPC_FRAME_MAGIC || hdr.len > IPC_FRAME_MAX) {
+    errno = EPROTO;
+    return -1;
+  }
+  len = hdr.len < *resp_len ? hdr.len : *resp_len;
+  if (read_full(conn->fd, resp, len, deadline))
+    return -1;
+  /* Truncate like a plain recv() would, but keep the stream in sync */
+  for (; len < hdr.len; len += chunk) {
+    chunk = hdr.len - len < sizeof(drop) ? hdr.len - len : sizeof(drop);
+    if (read_full(conn->fd, drop, chunk, deadline))
+      return -1;
+  }
+  conn->last_us = now_us();
+  *resp_len = hdr.len < *resp_len ? hdr.len : *resp_len;
+  if (id)
+    *id = hdr.id;
+  return 0;
+}
+
+static void cache_destroy(void *arg)
+{
+  ipc_conn_t **cache = (ipc_conn_t **)arg;
+  int i;
+
+  for (i = 0; i < CONN_CACHE_SIZE; i++) {
+    if (cache[i] && cache[i]->pid == getpid())
+      ipc_conn_close(cache[i]);
+  }
+  free(cache);
+}
+
+static void cache_init(void)
+{
+  cache_ok = pthread_key_create(&cache_key, cache_destroy) == 0;
+}
+
+static ipc_conn_t **cache_get(void)
+{
+  ipc_conn_t **cache;
+
+  pthread_once(&cache_once, cache_init);
+  if (!cache_ok)
+    return NULL;
+  cache = pthread_getspecific(cache_key);
+  if (!cache) {
+    cache = calloc(CONN_CACHE_SIZE, sizeof(*cache));
+    if (cache && pthread_setspecific(cache_key, cache)) {
+      free(cache);
+      cache = NULL;
+    }
+  }
+  return cache;
+}
+
+/* Connection of this thread to endpoint, opened on demand. A forked
+ * child must not share the parent's sockets, those entries are just
+ * forgotten (closing our copy of the fd is harmless). */
+static ipc_conn_t **cache_lookup(ipc_conn_t **cache, const char *endpoint, bool *reused)
+{
+  ipc_conn_t **slot = &cache[0];
+  uint64_t now = now_us();
+  int i;
+
+  *reused = false;
+  for (i = 0; i < CONN_CACHE_SIZE; i++) {
+    ipc_conn_t *c = cache[i];
+    if (c && (c->pid != getpid() ||
+              now - c->last_us > (uint64_t)PCONN_IDLE_TIMEOUT * 1000000 / 2)) {
+      ipc_conn_close(c);
+      cache[i] = c = NULL;
+    }
+    if (c && !strcmp(c->endpoint, endpoint)) {
+      *reused = true;
+      return &cache[i];
+    }
+    /* Prefer an empty entry, else the least recently used one */
+    if (*slot && (!c || c->last_us < (*slot)->last_us))
+      slot = &cache[i];
+  }
+  if (*slot) {
+    ipc_conn_close(*slot);
+  }
+  *slot = ipc_conn_open(endpoint);
+  return *slot ? slot : NULL;
+}
+
+static int send_req_once(const char *endpoint, uint8_t *req, size_t req_len,
+                         uint8_t *resp, size_t *resp_len, int timeout)
+{
+  int len, retry = 0, sockfd;
+  size_t max_resp;
+
+  if ((sockfd = sock_connect(endpoint)) < 0) {
+    return -1;
+  }
+
+  set_sock_timeout(sockfd, timeout);
+
   if (send(sockfd, req, req_len, MSG_NOSIGNAL) != req_len) {
     DEBUG("%s(%s) failed to send (%s)", __func__, endpoint, strerror(errno));
     goto error;
   }
 
+  /* SO_RCVTIMEO is the whole budget like recv_deadline(), only
+   * signals are retried */
   max_resp = *resp_len;
   while ((len = recv(sockfd, resp, max_resp, 0)) < 0) {
-    if ((errno != EINTR && errno != EWOULDBLOCK) ||
-        (retry++ >= MAX_RETRIES)) {
+    if (errno != EINTR || retry++ >= MAX_RETRIES) {
       DEBUG("%s(%s) failed to recv (%s)", __func__, endpoint, strerror(errno));
       goto error;
     }
@@ -139,8 +499,61 @@ error:
   return -1;
 }
 
+int ipc_send_req(const char *endpoint, uint8_t *req, size_t req_len,
+                 uint8_t *resp, size_t *resp_len, int timeout)
+{
+  ipc_conn_t **cache, **slot;
+  uint32_t id, rid;
+  size_t len;
+  bool reused;
+
+  if (!req || !req_len || !resp || !resp_len || !*resp_len) {
+    DEBUG("%s(%s) bad parameters passed", __func__, endpoint);
+    errno = EINVAL;
+    return -1;
+  }
+
+  cache = cache_get();
+  if (!cache || strlen(endpoint) >= MAX_ENDPOINT_LEN - 1 || req_len > IPC_FRAME_MAX) {
+    return send_req_once(endpoint, req, req_len, resp, resp_len, timeout);
+  }
+
+  if (!(slot = cache_lookup(cache, endpoint, &reused))) {
+    return -1;
+  }
+  if (ipc_conn_send(*slot, req, req_len, &id)) {
+    /* The service may have restarted since we last used the
+     * connection, nothing was delivered so try a fresh one */
+    ipc_conn_close(*slot);
+    *slot = NULL;
+    if (!reused || !(slot = cache_lookup(cache, endpoint, &reused)) ||
+        ipc_conn_send(*slot, req, req_len, &id)) {
+      goto error;
+    }
+  }
+
+  do {
+    len = *resp_len;
+    if (ipc_conn_recv(*slot, &rid, resp, &len, timeout)) {
+      DEBUG("%s(%s) failed to recv (%s)", __func__, endpoint, strerror(errno));
+      goto error;
+    }
+  } while (rid != id);
+  *resp_len = len;
+  return 0;
+
+error:
+  /* A late response would confuse the next request, start over */
+  if (slot && *slot) {
+    SAVE_ERRNO_RUN(ipc_conn_close(*slot));
+    *slot = NULL;
+  }
+  return -1;
+}
+
 int ipc_recv_req(client_t *cli, uint8_t *req, size_t *req_len, int timeout)
 {
+  conn_t *conn = (conn_t *)cli;
   int r;
   int ret = -1;
   int max = (int)*req_len;
@@ -148,6 +561,12 @@ int ipc_recv_req(client_t *cli, uint8_t *req, size_t *req_len, int timeout)
     return -1;
   }
 
+  if (conn->parent) {
+    *req_len = conn->req_len < *req_len ? conn->req_len : *req_len;
+    memcpy(req, conn->req, *req_len);
+    return 0;
+  }
+
   set_sock_timeout(cli->fd, timeout);
   
   for (r = 0; r < MAX_RETRIES; r++) {
@@ -166,91 +585,520 @@ int ipc_recv_req(client_t *cli, uint8_t *req, size_t *req_len, int timeout)
   return ret;
 }
 
-static void cli_done(client_t *cli)
+static void lat_record(ipc_svc_stats_t *stats, uint64_t us)
+{
+  int b = 0;
+
+  while (b < IPC_LAT_BUCKETS - 1 && us >= (2ULL << b))
+    b++;
+  stats->lat_hist[b]++;
+  stats->lat_total_us += us;
+  if (us > stats->lat_max_us)
+    stats->lat_max_us = us;
+}
+
+static void wake_loop(service_t *svc)
+{
+  uint64_t one = 1;
+
+  if (write(svc->evfd, &one, sizeof(one)) != sizeof(one)) {
+    DEBUG("%s(%s) failed to wake loop (%s)", __func__, svc->base_cli.endpoint, strerror(errno));
+  }
+}
+
+/* Release a request slot and let the loop accept again */
+static void slot_release(service_t *svc)
+{
+  pthread_mutex_lock(&svc->mutex);
+  svc->num_active--;
+  svc->stats.active = svc->num_active;
+  svc->stats_gen++;
+  pthread_mutex_unlock(&svc->mutex);
+  wake_loop(svc);
+}
+
+static bool slot_take(service_t *svc)
+{
+  bool ok;
+
+  pthread_mutex_lock(&svc->mutex);
+  ok = svc->num_active < svc->active_limit;
+  if (ok) {
+    svc->num_active++;
+    svc->stats.active = svc->num_active;
+    svc->stats_gen++;
+  }
+  pthread_mutex_unlock(&svc->mutex);
+  return ok;
+}
+
+static void pconn_put(service_t *svc, pconn_t *p)
+{
+  int refs;
+
+  pthread_mutex_lock(&svc->mutex);
+  refs = --p->refs;
+  pthread_mutex_unlock(&svc->mutex);
+  if (refs == 0) {
+    close(p->fd);
+    pthread_mutex_destroy(&p->wlock);
+    free(p);
+  }
+}
+
+static int pconn_write(pconn_t *p, uint32_t id, const uint8_t *buf, size_t len)
+{
+  int ret;
+
+  pthread_mutex_lock(&p->wlock);
+  ret = p->dead ? -1 : frame_write(p->fd, id, buf, len);
+  pthread_mutex_unlock(&p->wlock);
+  return ret;
+}
+
+static void cli_done_status(client_t *cli, bool ok)
 {
   service_t *svc = cli->svc;
+  conn_t *conn = (conn_t *)cli;
   cli->svc = NULL;
   if (svc) {
-    close(cli->fd);
-    free(cli);
+    uint64_t lat = now_us() - conn->ready_us;
+    if (conn->parent) {
+      /* Tell a framed client right away, a one-shot client learns it
+       * from the connection being closed */
+      if (!ok)
+        pconn_write(conn->parent, conn->req_id, NULL, 0);
+      pconn_put(svc, conn->parent);
+    } else {
+      close(cli->fd);
+    }
+    free(conn);
     pthread_mutex_lock(&svc->mutex);
-    svc->num_active--;
-    pthread_cond_signal(&svc->cond);
+    if (ok) {
+      svc->stats.completed++;
+      lat_record(&svc->stats, lat);
+    } else {
+      svc->stats.failed++;
+    }
     pthread_mutex_unlock(&svc->mutex);
+    slot_release(svc);
   }
 }
 
 int ipc_send_resp(client_t *cli, uint8_t *resp, size_t resp_len)
 {
+  conn_t *conn = (conn_t *)cli;
   int ret = 0;
   if (!cli || !resp || !resp_len) {
     return -1;
   }
-  if (send(cli->fd, resp, resp_len, MSG_NOSIGNAL) < 0) {
-    DEBUG("%s(%s) failed to recv (%s)", __func__, cli->endpoint, strerror(errno));
+  if (conn->parent) {
+    ret = pconn_write(conn->parent, conn->req_id, resp, resp_len);
+  } else if (send(cli->fd, resp, resp_len, MSG_NOSIGNAL) < 0) {
     ret = -1;
+  }
+  if (ret) {
+    DEBUG("%s(%s) failed to send (%s)", __func__, cli->endpoint, strerror(errno));
   } else {
-    cli_done(cli);
+    cli_done_status(cli, true);
   }
   return ret;
 }
 
-static void *conn_handler(void *param)
+static void *worker_thread(void *param)
 {
-  client_t *cli = (client_t *)param;
-  ipc_handle_req_t handle_req = cli->svc->handle_req;
-  if(handle_req(cli)) {
-    cli_done(cli);
+  service_t *svc = (service_t *)param;
+  conn_t *conn;
+
+  /* Counted idle from start_worker() on, so enqueue() does not start
+   * another one for the same request. */
+  pthread_mutex_lock(&svc->mutex);
+  while (1) {
+    while (svc->q_len == 0) {
+      pthread_cond_wait(&svc->cond, &svc->mutex);
+    }
+    svc->num_idle--;
+    conn = svc->queue[svc->q_head];
+    svc->q_head = (svc->q_head + 1) % svc->active_limit;
+    svc->q_len--;
+    svc->stats.queue_depth = svc->q_len;
+    svc->stats.requests++;
+    svc->stats_gen++;
+    pthread_mutex_unlock(&svc->mutex);
+
+    if (svc->handle_req(&conn->cli)) {
+      cli_done_status(&conn->cli, false);
+    }
+    pthread_mutex_lock(&svc->mutex);
+    svc->num_idle++;
   }
-  pthread_exit(NULL);
   return NULL;
 }
 
-static client_t *get_client(service_t *svc)
+static void idle_add(service_t *svc, conn_t *conn)
 {
-  client_t *cli = NULL;
-  struct timespec ts;
-  struct timeval tp;
-  int rc;
+  conn->prev = NULL;
+  conn->next = svc->idle;
+  if (svc->idle)
+    svc->idle->prev = conn;
+  svc->idle = conn;
+}
+
+static void idle_del(service_t *svc, conn_t *conn)
+{
+  if (conn->prev)
+    conn->prev->next = conn->next;
+  else
+    svc->idle = conn->next;
+  if (conn->next)
+    conn->next->prev = conn->prev;
+  conn->prev = conn->next = NULL;
+}
+
+/* Start one more worker. Called with svc->mutex held. */
+static int start_worker(service_t *svc)
+{
+  pthread_attr_t attr;
+  pthread_t tid;
+  int ret;
 
-  gettimeofday(&tp, NULL);
-  ts.tv_sec = tp.tv_sec + CLIENT_TIMEOUT + 1;
-  ts.tv_nsec = 0;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_attr_setstacksize(&attr, STACK_SIZE);
+  ret = pthread_create(&tid, &attr, worker_thread, svc);
+  pthread_attr_destroy(&attr);
+  if (ret) {
+    ERROR("%s(%s) failed to create worker (%s)", __func__, svc->base_cli.endpoint, strerror(ret));
+    return -1;
+  }
+  svc->num_started++;
+  svc->num_idle++;
+  return 0;
+}
 
+/* Queue a request for the workers. It holds a slot, and the queue has
+ * room for as many entries as there are slots. */
+static void enqueue(service_t *svc, conn_t *conn)
+{
+  int tail;
+
+  conn->ready_us = now_us();
   pthread_mutex_lock(&svc->mutex);
-  while (svc->num_active >= svc->active_limit) {
-    rc = pthread_cond_timedwait(&svc->cond, &svc->mutex, &ts);
-    if (rc == ETIMEDOUT) {
-      break;
+  tail = (svc->q_head + svc->q_len) % svc->active_limit;
+  svc->queue[tail] = conn;
+  svc->q_len++;
+  svc->stats.queue_depth = svc->q_len;
+  if (svc->q_len > svc->stats.queue_max)
+    svc->stats.queue_max = svc->q_len;
+  svc->stats_gen++;
+  if (svc->q_len > svc->num_idle && svc->num_started < svc->num_workers)
+    start_worker(svc);
+  pthread_cond_signal(&svc->cond);
+  pthread_mutex_unlock(&svc->mutex);
+}
+
+static void pconn_events(service_t *svc, pconn_t *p, uint32_t events)
+{
+  struct epoll_event ev = {0};
+
+  ev.events = events;
+  ev.data.ptr = &p->ep_type;
+  epoll_ctl(svc->epfd, EPOLL_CTL_MOD, p->fd, &ev);
+}
+
+/* Unhook a framed connection. It is released once the current batch
+ * of events is done, which may still refer to it. */
+static void pconn_kill(service_t *svc, pconn_t *p)
+{
+  epoll_ctl(svc->epfd, EPOLL_CTL_DEL, p->fd, NULL);
+  pthread_mutex_lock(&p->wlock);
+  p->dead = true;
+  pthread_mutex_unlock(&p->wlock);
+  if (p->prev)
+    p->prev->next = p->next;
+  else
+    svc->pconns = p->next;
+  if (p->next)
+    p->next->prev = p->prev;
+  p->prev = NULL;
+  p->next = svc->graveyard;
+  svc->graveyard = p;
+}
+
+/* Read from a framed connection and queue every complete request, as
+ * long as there are free slots. */
+static void pconn_pump(service_t *svc, pconn_t *p)
+{
+  frame_hdr_t hdr;
+  conn_t *conn;
+  size_t flen;
+  ssize_t n;
+
+  while (1) {
+    if (p->rx_len >= sizeof(hdr)) {
+      memcpy(&hdr, p->rx, sizeof(hdr));
+      if (hdr.magic != IPC_FRAME_MAGIC || hdr.len == 0 || hdr.len > IPC_FRAME_MAX) {
+        ERROR("%s(%s) bad frame, closing connection", __func__, svc->base_cli.endpoint);
+        pconn_kill(svc, p);
+        return;
+      }
+      flen = sizeof(hdr) + hdr.len;
+      if (p->rx_len >= flen) {
+        if (!slot_take(svc)) {
+          if (!p->stalled)
+            pconn_events(svc, p, 0);
+          p->stalled = true;
+          return;
+        }
+        conn = calloc(1, sizeof(*conn) + hdr.len);
+        if (!conn) {
+          slot_release(svc);
+          pconn_kill(svc, p);
+          return;
+        }
+        memcpy(&conn->cli, &svc->base_cli, sizeof(conn->cli));
+        conn->cli.fd = p->fd;
+        conn->ep_type = EP_CONN;
+        conn->parent = p;
+        conn->req_id = hdr.id;
+        conn->req_len = hdr.len;
+        memcpy(conn->req, p->rx + sizeof(hdr), hdr.len);
+        p->rx_len -= flen;
+        memmove(p->rx, p->rx + flen, p->rx_len);
+        pthread_mutex_lock(&svc->mutex);
+        p->refs++;
+        pthread_mutex_unlock(&svc->mutex);
+        enqueue(svc, conn);
+        continue;
+      }
     }
+    if (p->stalled) {
+      pconn_events(svc, p, EPOLLIN | EPOLLRDHUP);
+      p->stalled = false;
+    }
+
+    n = recv(p->fd, p->rx + p->rx_len, sizeof(p->rx) - p->rx_len, MSG_DONTWAIT);
+    if (n > 0) {
+      p->rx_len += n;
+      p->last_us = now_us();
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      return;
+    pconn_kill(svc, p);
+    return;
+  }
+}
+
+/* Turn a freshly accepted connection into a framed one */
+static void pconn_create(service_t *svc, conn_t *conn)
+{
+  struct epoll_event ev;
+  struct timeval tv = {CLIENT_TIMEOUT, 0};
+  pconn_t *p;
+
+  p = calloc(1, sizeof(*p));
+  if (!p) {
+    close(conn->cli.fd);
+    free(conn);
+    slot_release(svc);
+    return;
   }
-  if (rc != ETIMEDOUT) {
-    cli = calloc(1, sizeof(*cli));
-    if (cli) {
-      svc->num_active++;
-      memcpy(cli, &svc->base_cli, sizeof(*cli));
+  p->ep_type = EP_PCONN;
+  p->fd = conn->cli.fd;
+  p->refs = 1;
+  p->last_us = now_us();
+  pthread_mutex_init(&p->wlock, NULL);
+  /* Never let a client which stopped reading block a worker for good */
+  setsockopt(p->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  /* The connection itself does not hold a request slot */
+  free(conn);
+  slot_release(svc);
+
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.ptr = &p->ep_type;
+  if (epoll_ctl(svc->epfd, EPOLL_CTL_ADD, p->fd, &ev)) {
+    close(p->fd);
+    free(p);
+    return;
+  }
+  p->prev = NULL;
+  p->next = svc->pconns;
+  if (svc->pconns)
+    svc->pconns->prev = p;
+  svc->pconns = p;
+  pconn_pump(svc, p);
+}
+
+static void dispatch(service_t *svc, conn_t *conn)
+{
+  uint32_t magic = IPC_FRAME_MAGIC;
+  uint8_t peek[sizeof(magic)];
+  ssize_t n;
+
+  n = recv(conn->cli.fd, peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return;
+
+  epoll_ctl(svc->epfd, EPOLL_CTL_DEL, conn->cli.fd, NULL);
+  idle_del(svc, conn);
+  if (n > 0 && !memcmp(peek, &magic, n)) {
+    if (n < sizeof(peek)) {
+      /* Header split across writes, wait for the rest */
+      struct epoll_event ev = {EPOLLIN | EPOLLRDHUP, {.ptr = &conn->ep_type}};
+      epoll_ctl(svc->epfd, EPOLL_CTL_ADD, conn->cli.fd, &ev);
+      idle_add(svc, conn);
+      return;
     }
+    pconn_create(svc, conn);
+    return;
   }
+  enqueue(svc, conn);
+}
+
+static void listen_ctl(service_t *svc, bool enable)
+{
+  struct epoll_event ev = {0};
+
+  if (svc->accept_paused == !enable)
+    return;
+  ev.events = enable ? EPOLLIN : 0;
+  ev.data.ptr = &svc->listen_tag;
+  epoll_ctl(svc->epfd, EPOLL_CTL_MOD, svc->sock, &ev);
+  svc->accept_paused = !enable;
+}
+
+/* Accept as many pending clients as there are free slots. Returns -1
+ * on a persistent accept failure. */
+static int accept_clients(service_t *svc)
+{
+  struct epoll_event ev;
+  conn_t *conn;
+  int fd;
+
+  while (1) {
+    if (!slot_take(svc)) {
+      listen_ctl(svc, false);
+      return 0;
+    }
+
+    fd = accept(svc->sock, NULL, NULL);
+    if (fd < 0) {
+      SAVE_ERRNO_RUN(slot_release(svc));
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+          errno == ECONNABORTED)
+        return 0;
+      return -1;
+    }
+
+    conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+      close(fd);
+      slot_release(svc);
+      return 0;
+    }
+    memcpy(&conn->cli, &svc->base_cli, sizeof(conn->cli));
+    conn->cli.fd = fd;
+    conn->ep_type = EP_CONN;
+    conn->accept_us = now_us();
+
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = &conn->ep_type;
+    if (epoll_ctl(svc->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+      close(fd);
+      free(conn);
+      slot_release(svc);
+      return 0;
+    }
+    idle_add(svc, conn);
+  }
+}
+
+/* Drop clients which connected but never sent a request, and framed
+ * connections nobody used for a while */
+static void reap_idle(service_t *svc)
+{
+  uint64_t now = now_us();
+  uint64_t deadline = now - (uint64_t)CLIENT_TIMEOUT * 1000000;
+  conn_t *conn, *next;
+  pconn_t *p, *pnext;
+  int refs;
+
+  for (conn = svc->idle; conn; conn = next) {
+    next = conn->next;
+    if (conn->accept_us > deadline)
+      continue;
+    DEBUG("%s(%s) dropping idle client", __func__, svc->base_cli.endpoint);
+    epoll_ctl(svc->epfd, EPOLL_CTL_DEL, conn->cli.fd, NULL);
+    idle_del(svc, conn);
+    close(conn->cli.fd);
+    free(conn);
+    pthread_mutex_lock(&svc->mutex);
+    svc->stats.timeouts++;
+    pthread_mutex_unlock(&svc->mutex);
+    slot_release(svc);
+  }
+
+  deadline = now - (uint64_t)PCONN_IDLE_TIMEOUT * 1000000;
+  for (p = svc->pconns; p; p = pnext) {
+    pnext = p->next;
+    pthread_mutex_lock(&svc->mutex);
+    refs = p->refs;
+    pthread_mutex_unlock(&svc->mutex);
+    if (refs == 1 && p->rx_len == 0 && p->last_us < deadline)
+      pconn_kill(svc, p);
+  }
+}
+
+static void dump_stats(service_t *svc)
+{
+  ipc_svc_stats_t st;
+  char path[64], tmp[72];
+  FILE *fp;
+  int i;
+
+  if (ipc_get_svc_stats(svc->base_cli.endpoint, &st))
+    return;
+  snprintf(path, sizeof(path), STATS_PATH, svc->base_cli.endpoint);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if (!(fp = fopen(tmp, "w")))
+    return;
+  pthread_mutex_lock(&svc->mutex);
+  i = svc->num_started;
   pthread_mutex_unlock(&svc->mutex);
-  return cli;
+  fprintf(fp, "workers: %d\nworkers_started: %d\nlimit: %d\nactive: %u\n",
+      svc->num_workers, i, svc->active_limit, st.active);
+  fprintf(fp, "queue_depth: %u\nqueue_max: %u\n", st.queue_depth, st.queue_max);
+  fprintf(fp, "requests: %llu\ncompleted: %llu\nfailed: %llu\ntimeouts: %llu\n",
+      (unsigned long long)st.requests, (unsigned long long)st.completed,
+      (unsigned long long)st.failed, (unsigned long long)st.timeouts);
+  fprintf(fp, "latency_p50_us: %llu\nlatency_p99_us: %llu\nlatency_max_us: %llu\n",
+      (unsigned long long)ipc_stats_percentile(&st, 50),
+      (unsigned long long)ipc_stats_percentile(&st, 99),
+      (unsigned long long)st.lat_max_us);
+  for (i = 0; i < IPC_LAT_BUCKETS; i++) {
+    if (st.lat_hist[i])
+      fprintf(fp, "latency_lt_%lluus: %llu\n", 2ULL << i,
+          (unsigned long long)st.lat_hist[i]);
+  }
+  fclose(fp);
+  rename(tmp, path);
 }
 
 static void *svc_thread(void *param)
 {
   service_t *svc = (service_t *)param;
   client_t *base_cli = &svc->base_cli;
-  struct sockaddr_un local, remote;
-  int sock, conn;
-  pthread_attr_t attr;
-  int len;
-  int cli_retries = WAIT_CLIENT_RETRIES;
+  struct epoll_event ev, events[MAX_EVENTS];
+  struct sockaddr_un local;
+  pconn_t *p, *pnext;
+  uint64_t val, dumped_gen = 0;
+  time_t last_dump = 0;
+  int len, i, n, type;
   int acc_retries = ACCEPT_RECOVER_RETRIES;
 
-  pthread_attr_init(&attr);
-  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-  pthread_attr_setstacksize(&attr, STACK_SIZE);
-
-  if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+  if ((svc->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
     DEBUG("%s(%s) failed to create socket (%s)", __func__, base_cli->endpoint, strerror(errno));
     goto bail;
   }
@@ -259,65 +1107,159 @@ static void *svc_thread(void *param)
   sprintf(local.sun_path, "/tmp/%s", base_cli->endpoint);
   unlink(local.sun_path);
   len = strlen(local.sun_path) + sizeof(local.sun_family);
-  if (bind(sock, (struct sockaddr *)&local, len) == -1) {
+  if (bind(svc->sock, (struct sockaddr *)&local, len) == -1) {
     DEBUG("%s(%s) failed to bind (%s)", __func__, base_cli->endpoint, strerror(errno));
     goto close_bail;
   }
 
-  if (listen(sock, 5) == -1) {
+  if (listen(svc->sock, LISTEN_BACKLOG) == -1) {
     DEBUG("%s(%s) failed to listen (%s)", __func__, base_cli->endpoint, strerror(errno));
     goto close_bail;
   }
 
+  svc->epfd = epoll_create1(EPOLL_CLOEXEC);
+  svc->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (svc->epfd < 0 || svc->evfd < 0) {
+    CRITICAL("%s(%s) failed to set up epoll (%s)", __func__, base_cli->endpoint, strerror(errno));
+    goto close_bail;
+  }
+  svc->listen_tag = EP_LISTEN;
+  svc->wake_tag = EP_WAKE;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &svc->listen_tag;
+  epoll_ctl(svc->epfd, EPOLL_CTL_ADD, svc->sock, &ev);
+  ev.data.ptr = &svc->wake_tag;
+  epoll_ctl(svc->epfd, EPOLL_CTL_ADD, svc->evfd, &ev);
+
+  /* The rest are started by enqueue() as requests need them */
+  pthread_mutex_lock(&svc->mutex);
+  i = start_worker(svc);
+  pthread_mutex_unlock(&svc->mutex);
+  if (i)
+    goto close_bail;
+
   while (1) {
-    socklen_t t = sizeof(remote);
-    pthread_t tid;
-    client_t *cli = get_client(svc);
-    if (!cli) {
-      if (--cli_retries <= 0) {
-        CRITICAL("%s(%s) outstanding clients %d exceeded limit %d",
-          __func__, base_cli->endpoint, svc->num_active, svc->active_limit);
-        break;
-      }
-      ERROR("%s(%s) outstanding clients %d exceeded limit %d retrying in 5 seconds",
-        __func__, base_cli->endpoint, svc->num_active, svc->active_limit);
-      sleep(5);
-      continue;
+    n = epoll_wait(svc->epfd, events, MAX_EVENTS, LOOP_TICK_MS);
+    if (n < 0 && errno != EINTR) {
+      CRITICAL("%s(%s) epoll failed (%s)", __func__, base_cli->endpoint, strerror(errno));
+      break;
     }
-    cli_retries = WAIT_CLIENT_RETRIES;
-
-    while (--acc_retries > 0 && (conn = accept(sock, (struct sockaddr *)&remote, &t)) < 0) {
-      ERROR("%s(%s) failed to accept (%s) retrying in 5 seconds", __func__, base_cli->endpoint, strerror(errno));
-      sleep(5);
-      continue;
+    for (i = 0; i < n; i++) {
+      type = *(int *)events[i].data.ptr;
+      if (type == EP_LISTEN) {
+        if (accept_clients(svc) == 0) {
+          acc_retries = ACCEPT_RECOVER_RETRIES;
+        } else if (--acc_retries > 0) {
+          ERROR("%s(%s) failed to accept (%s) retrying in 5 seconds", __func__, base_cli->endpoint, strerror(errno));
+          sleep(5);
+        } else {
+          CRITICAL("%s(%s) failed to accept (%s)", __func__, base_cli->endpoint, strerror(errno));
+          goto close_bail;
+        }
+      } else if (type == EP_WAKE) {
+        if (read(svc->evfd, &val, sizeof(val)) < 0) {
+          DEBUG("%s(%s) eventfd read failed (%s)", __func__, base_cli->endpoint, strerror(errno));
+        }
+        /* Slots freed up, resume whoever was waiting for one */
+        for (p = svc->pconns; p; p = pnext) {
+          pnext = p->next;
+          if (p->stalled)
+            pconn_pump(svc, p);
+        }
+        listen_ctl(svc, true);
+      } else if (type == EP_PCONN) {
+        p = container_of(events[i].data.ptr, pconn_t, ep_type);
+        if (p->dead)
+          continue;
+        if (p->stalled && (events[i].events & (EPOLLHUP | EPOLLERR)))
+          pconn_kill(svc, p);
+        else
+          pconn_pump(svc, p);
+      } else {
+        dispatch(svc, container_of(events[i].data.ptr, conn_t, ep_type));
+      }
     }
-    if (acc_retries <= 0 || conn < 0) {
-      CRITICAL("%s(%s) failed to accept (%s) retrying in 5 seconds", __func__, base_cli->endpoint, strerror(errno));
-      cli_done(cli);
-      break;
+    reap_idle(svc);
+    while ((p = svc->graveyard)) {
+      svc->graveyard = p->next;
+      pconn_put(svc, p);
     }
-    acc_retries = ACCEPT_RECOVER_RETRIES;
-    cli->fd = conn;
-    if (pthread_create(&tid, &attr, conn_handler, (void *)cli)) {
-      CRITICAL("%s(%s) failed to create thread (%s)", __func__, base_cli->endpoint, strerror(errno));
-      cli_done(cli);
+
+    if (time(NULL) - last_dump >= STATS_INTERVAL) {
+      pthread_mutex_lock(&svc->mutex);
+      val = svc->stats_gen;
+      pthread_mutex_unlock(&svc->mutex);
+      if (val != dumped_gen) {
+        dump_stats(svc);
+        dumped_gen = val;
+      }
+      last_dump = time(NULL);
     }
   }
 close_bail:
-  close(sock);
+  close(svc->sock);
 bail:
   pthread_exit(NULL);
   return NULL;
 }
 
-int ipc_start_svc(const char *endpoint, ipc_handle_req_t handle_req, int max_active, void *svc_cookie, pthread_t *waiter)
+int ipc_get_svc_stats(const char *endpoint, ipc_svc_stats_t *stats)
+{
+  service_t *svc;
+  int ret = -1;
+
+  if (!endpoint || !stats) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&svc_list_mutex);
+  for (svc = svc_list; svc; svc = svc->next) {
+    if (!strcmp(svc->base_cli.endpoint, endpoint)) {
+      pthread_mutex_lock(&svc->mutex);
+      memcpy(stats, &svc->stats, sizeof(*stats));
+      pthread_mutex_unlock(&svc->mutex);
+      ret = 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&svc_list_mutex);
+  if (ret)
+    errno = ENOENT;
+  return ret;
+}
+
+uint64_t ipc_stats_percentile(const ipc_svc_stats_t *stats, int pct)
+{
+  uint64_t total = 0, acc = 0, target;
+  int i;
+
+  for (i = 0; i < IPC_LAT_BUCKETS; i++)
+    total += stats->lat_hist[i];
+  if (total == 0)
+    return 0;
+  target = (total * pct + 99) / 100;
+  for (i = 0; i < IPC_LAT_BUCKETS; i++) {
+    acc += stats->lat_hist[i];
+    if (acc >= target)
+      break;
+  }
+  /* Upper bound of the bucket, but never beyond the worst case seen */
+  if (i >= IPC_LAT_BUCKETS - 1 || (2ULL << i) > stats->lat_max_us)
+    return stats->lat_max_us;
+  return 2ULL << i;
+}
+
+int ipc_start_svc_ex(const char *endpoint, ipc_handle_req_t handle_req,
+                     int num_workers, int queue_depth, void *svc_cookie,
+                     pthread_t *waiter)
 {
   pthread_t tid;
   pthread_attr_t attr;
   int ret = 0;
   service_t *svc;
 
-  if (strlen(endpoint) >= MAX_ENDPOINT_LEN - 1) {
+  if (strlen(endpoint) >= MAX_ENDPOINT_LEN - 1 || num_workers <= 0 ||
+      queue_depth < 0) {
     return -1;
   }
 
@@ -325,6 +1267,12 @@ int ipc_start_svc(const char *endpoint, ipc_handle_req_t handle_req, int max_act
   if (!svc) {
     return -1;
   }
+  svc->active_limit = num_workers + queue_depth;
+  svc->queue = calloc(svc->active_limit, sizeof(conn_t *));
+  if (!svc->queue) {
+    free(svc);
+    return -1;
+  }
 
   strcpy(svc->base_cli.endpoint, endpoint);
   svc->base_cli.svc_cookie = svc_cookie;
@@ -334,7 +1282,13 @@ int ipc_start_svc(const char *endpoint, ipc_handle_req_t handle_req, int max_act
   pthread_cond_init(&svc->cond, NULL);
   svc->base_cli.svc = svc;
   svc->num_active = 0;
-  svc->active_limit = max_active;
+  svc->num_workers = num_workers;
+  svc->sock = svc->epfd = svc->evfd = -1;
+
+  pthread_mutex_lock(&svc_list_mutex);
+  svc->next = svc_list;
+  svc_list = svc;
+  pthread_mutex_unlock(&svc_list_mutex);
 
   pthread_attr_init(&attr);
   if (!waiter)
@@ -342,6 +1296,10 @@ int ipc_start_svc(const char *endpoint, ipc_handle_req_t handle_req, int max_act
 
   if (pthread_create(&tid, &attr, svc_thread, svc)) {
       DEBUG("%s(%s) failed to start thread (%s)", __func__, endpoint, strerror(errno));
+      pthread_mutex_lock(&svc_list_mutex);
+      svc_list = svc->next;
+      pthread_mutex_unlock(&svc_list_mutex);
+      free(svc->queue);
       free(svc);
       ret = -1;
   }
@@ -353,6 +1311,14 @@ int ipc_start_svc(const char *endpoint, ipc_handle_req_t handle_req, int max_act
   return ret;
 }
 
+int ipc_start_svc(const char *endpoint, ipc_handle_req_t handle_req, int max_active, void *svc_cookie, pthread_t *waiter)
+{
+  /* Historically max_active bounded the handler threads; keep that
+   * many workers and allow as many more requests to queue up. */
+  return ipc_start_svc_ex(endpoint, handle_req, max_active, max_active,
+                          svc_cookie, waiter);
+}
+
 #ifdef __TEST__
 #include <assert.h>
 char *svc_cookie = "test_cookie";
@@ -382,9 +1348,63 @@ int test_handle_req(client_t *cli)
   return 0;
 }
 
+int echo_handle_req(client_t *cli)
+{
+  uint8_t req[32];
+  size_t len = sizeof(req);
+
+  if (ipc_recv_req(cli, req, &len, 1) != 0)
+    return -1;
+  /* Later requests finish first, responses come back out of order */
+  usleep((8 - req[0] % 8) * 10000);
+  return ipc_send_resp(cli, req, len);
+}
+
+void test_pipelined(void)
+{
+  ipc_conn_t *conn;
+  uint8_t req[4], resp[32];
+  uint32_t ids[8], id;
+  size_t len;
+  int i, j, seen = 0;
+
+  assert(ipc_start_svc_ex("test_echo", echo_handle_req, 4, 4, NULL, NULL) == 0);
+  sleep(1);
+  conn = ipc_conn_open("test_echo");
+  assert(conn != NULL);
+  for (i = 0; i < 8; i++) {
+    memset(req, i, sizeof(req));
+    assert(ipc_conn_send(conn, req, sizeof(req), &ids[i]) == 0);
+  }
+  for (i = 0; i < 8; i++) {
+    len = sizeof(resp);
+    assert(ipc_conn_recv(conn, &id, resp, &len, 5) == 0);
+    assert(len == sizeof(req));
+    for (j = 0; j < 8 && ids[j] != id; j++)
+      ;
+    assert(j < 8 && resp[0] == j);
+    seen |= 1 << j;
+  }
+  assert(seen == 0xff);
+  ipc_conn_close(conn);
+
+  /* Cached connection for ipc_send_req, and a one-shot client */
+  for (i = 0; i < 3; i++) {
+    memset(req, i, sizeof(req));
+    len = sizeof(resp);
+    assert(ipc_send_req("test_echo", req, sizeof(req), resp, &len, 2) == 0);
+    assert(len == sizeof(req) && resp[0] == i);
+  }
+  len = sizeof(resp);
+  assert(send_req_once("test_echo", req, sizeof(req), resp, &len, 2) == 0);
+  assert(len == sizeof(req) && resp[0] == 2);
+  printf("Pipelined requests succeeded!\n");
+}
+
 int main(int argc, char *argv[])
 {
   int rc;
+  test_pipelined();
   rc = ipc_start_svc("test_svc", test_handle_req, 1, svc_cookie, NULL);
   assert(rc == 0);
   sleep(1);
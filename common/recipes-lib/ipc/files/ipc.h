@@ -3,9 +3,13 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <stdbool.h>
 
 #define MAX_ENDPOINT_LEN 32
 
+/* Latency histogram buckets, bucket n counts requests under 2^(n+1) us */
+#define IPC_LAT_BUCKETS 24
+
 struct client_s;
 typedef struct client_s client_t;
 
@@ -21,9 +25,37 @@ struct client_s {
   service_t *svc;
 };
 
+typedef struct {
+  uint64_t requests;    /* Requests handed to a worker */
+  uint64_t completed;   /* Requests answered */
+  uint64_t failed;      /* Handler returned an error */
+  uint64_t timeouts;    /* Clients dropped for never sending a request */
+  uint32_t active;      /* Accepted connections not yet done */
+  uint32_t queue_depth; /* Requests waiting for a worker */
+  uint32_t queue_max;   /* High watermark of queue_depth */
+  uint32_t reserved;
+  uint64_t lat_total_us;
+  uint64_t lat_max_us;
+  uint64_t lat_hist[IPC_LAT_BUCKETS];
+} ipc_svc_stats_t;
+
+/* Long-lived connection with several requests in flight */
+struct ipc_conn_s;
+typedef struct ipc_conn_s ipc_conn_t;
+
+/* timeout is the time in seconds to wait for the whole response, 0 or
+ * less waits forever. The same applies to ipc_conn_recv(). */
 int ipc_send_req(const char *endpoint, uint8_t *req, size_t req_len, uint8_t *resp, size_t *resp_len, int timeout);
 int ipc_recv_req(client_t *cli, uint8_t *req, size_t *req_len, int timeout);
 int ipc_send_resp(client_t *cli, uint8_t *resp, size_t resp_len);
 int ipc_start_svc(const char *endpoint, ipc_handle_req_t handle_req, int max_active, void *cookie, pthread_t *waiter);
+int ipc_start_svc_ex(const char *endpoint, ipc_handle_req_t handle_req, int num_workers, int queue_depth, void *cookie, pthread_t *waiter);
+int ipc_get_svc_stats(const char *endpoint, ipc_svc_stats_t *stats);
+uint64_t ipc_stats_percentile(const ipc_svc_stats_t *stats, int pct);
+
+ipc_conn_t *ipc_conn_open(const char *endpoint);
+void ipc_conn_close(ipc_conn_t *conn);
+int ipc_conn_send(ipc_conn_t *conn, const uint8_t *req, size_t req_len, uint32_t *id);
+int ipc_conn_recv(ipc_conn_t *conn, uint32_t *id, uint8_t *resp, size_t *resp_len, int timeout);
 
 #endif
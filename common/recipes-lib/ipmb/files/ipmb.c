@@ -101,7 +101,7 @@ lib_ipmb_handle(unsigned char bus_id,
   sprintf(sock_path, "%s_%d", SOCK_PATH_IPMB, bus_id);
 
   if (ipc_send_req(sock_path, request, (size_t)req_len, response,
-                   &resp_len, TIMEOUT_IPMB) != 0) {
+                   &resp_len, TIMEOUT_IPMB_CLIENT) != 0) {
     return -1;
   }
 
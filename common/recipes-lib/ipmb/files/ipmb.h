@@ -46,6 +46,9 @@ extern "C" {
 #if !defined(TIMEOUT_IPMB)
   #define TIMEOUT_IPMB 8
 #endif
+// ipmbd may wait TIMEOUT_IPMB for a flow control window and again for
+// the response, clients of its socket wait for both
+#define TIMEOUT_IPMB_CLIENT (2 * TIMEOUT_IPMB + 1)
 #define MIN_IPMB_REQ_LEN 7
 #define MAX_IPMB_RES_LEN 300
 #define MIN_IPMB_RES_LEN 8
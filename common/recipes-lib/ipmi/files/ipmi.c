@@ -23,6 +23,7 @@
 #include "ipmi.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -30,6 +31,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <openbmc/ipc.h>
 
 #define MAX_IPMI_RES_LEN 300
@@ -48,3 +51,102 @@ lib_ipmi_handle(unsigned char *request, unsigned char req_len,
     *res_len = (unsigned short)resp_len;
   }
 }
+
+/*
+ * Read up to max SEL records of a node in one request, starting at
+ * rec_id (0x0000 for the oldest record) and skipping the records added
+ * before since. Returns the number of records, or -1.
+ */
+int
+lib_ipmi_get_sel_range(uint8_t node, uint16_t rec_id, uint32_t since,
+            ipmi_sel_range_rec_t *recs, int max, uint16_t *next_id) {
+
+  ipmi_sel_range_req_t req;
+  uint8_t buf[sizeof(ipmi_sel_range_res_t) +
+              IPMI_SEL_RANGE_MAX * sizeof(ipmi_sel_range_rec_t)];
+  ipmi_sel_range_res_t *res = (ipmi_sel_range_res_t *)buf;
+  size_t resp_len = sizeof(buf);
+
+  memset(&req, 0, sizeof(req));
+  req.node = node;
+  req.rec_id = rec_id;
+  req.since = since;
+  req.max = (max > IPMI_SEL_RANGE_MAX) ? IPMI_SEL_RANGE_MAX : max;
+
+  if (ipc_send_req(SOCK_PATH_IPMI_SEL, (uint8_t *)&req, sizeof(req), buf,
+                   &resp_len, TIMEOUT_IPMI + 1) ||
+      resp_len < sizeof(ipmi_sel_range_res_t) || res->count < 0 ||
+      res->count > req.max ||
+      resp_len != sizeof(ipmi_sel_range_res_t) +
+                  res->count * sizeof(ipmi_sel_range_rec_t)) {
+    return -1;
+  }
+
+  memcpy(recs, res->recs, res->count * sizeof(ipmi_sel_range_rec_t));
+  *next_id = res->next_id;
+  return res->count;
+}
+
+/*
+ * Map kcsd's shared statistics read-only. The mapping is kept for the
+ * life of the process, kcsd never unlinks the object.
+ */
+static const kcs_stats_t *
+kcs_stats_map(void) {
+
+  static const kcs_stats_t *kcs_stats = NULL;
+  const kcs_stats_t *map, *expected = NULL;
+  int fd;
+
+  if ((map = __atomic_load_n(&kcs_stats, __ATOMIC_ACQUIRE)) != NULL) {
+    return map;
+  }
+
+  fd = shm_open(SHM_PATH_KCS, O_RDONLY, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  map = mmap(NULL, sizeof(kcs_stats_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  if (!__atomic_compare_exchange_n(&kcs_stats, &expected, map, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    munmap((void *)map, sizeof(kcs_stats_t));
+    map = expected;
+  }
+  return map;
+}
+
+/*
+ * Copy of the KCS statistics published by kcsd. Counters are updated
+ * without locking, so a snapshot may be off by the request in flight.
+ */
+int
+lib_ipmi_get_kcs_stats(kcs_stats_t *stats) {
+
+  const kcs_stats_t *map = kcs_stats_map();
+
+  if (!map) {
+    return -1;
+  }
+  memcpy(stats, map, sizeof(kcs_stats_t));
+  return 0;
+}
+
+/*
+ * Time of the last KCS request, or 0 if there was none since the BMC
+ * booted (or kcsd never ran). kcsd restarts keep it.
+ */
+time_t
+lib_ipmi_kcs_last_req(void) {
+
+  const kcs_stats_t *map = kcs_stats_map();
+
+  if (!map) {
+    return 0;
+  }
+  return (time_t)__atomic_load_n(&map->last_req, __ATOMIC_RELAXED);
+}
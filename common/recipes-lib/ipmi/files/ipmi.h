@@ -26,8 +26,10 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <time.h>
 
 #define SOCK_PATH_IPMI "ipmi_socket"
+#define SOCK_PATH_IPMI_SEL "ipmi_sel_socket"
 
 #define IPMI_SEL_VERSION  0x51
 #define IPMI_SDR_VERSION  0x51
@@ -652,8 +654,67 @@ enum RESTART_CAUSE {
   RESTART_CAUSE_RTC_WAKEUP = 0xB,
 };
 
+// Bulk read of a node's SEL from ipmid on SOCK_PATH_IPMI_SEL, for local
+// tools which would otherwise need one Get SEL Entry per record.
+#define IPMI_SEL_RANGE_MAX 180
+
+typedef struct
+{
+  uint8_t node;
+  uint8_t reserved;
+  uint16_t rec_id;  // first record to read, 0x0000 for the oldest one
+  uint32_t since;   // skip records added before this time, 0 for none
+  uint16_t max;
+} __attribute__((packed)) ipmi_sel_range_req_t;
+
+typedef struct
+{
+  uint16_t rec_id;
+  uint32_t time;    // BMC time the record was added
+  uint8_t msg[SIZE_SEL_REC];
+} __attribute__((packed)) ipmi_sel_range_rec_t;
+
+typedef struct
+{
+  int16_t count;    // -1 if rec_id is not in the SEL
+  uint16_t next_id; // 0xFFFF after the last record
+  ipmi_sel_range_rec_t recs[];
+} __attribute__((packed)) ipmi_sel_range_res_t;
+
+// kcsd keeps its liveness timestamp and per-command latency in POSIX
+// shared memory, so monitors can check for KCS traffic without a file.
+#define SHM_PATH_KCS "/kcsd_stats"
+#define KCS_STATS_CMDS 64
+#define KCS_LAT_BUCKETS 24  // bucket n counts requests under 2^(n+1) us
+
+typedef struct
+{
+  uint8_t netfn;
+  uint8_t cmd;
+  uint16_t reserved;
+  uint32_t count;
+  uint64_t total_us;
+  uint64_t max_us;
+  uint32_t lat_hist[KCS_LAT_BUCKETS];
+} kcs_cmd_stats_t;
+
+typedef struct
+{
+  uint32_t last_req;  // time() of the last KCS request, 0 for none;
+                      // 32-bit so that it is atomic on any BMC
+  uint32_t reserved;
+  uint64_t requests;
+  uint32_t num_cmds;  // used entries of cmds[]
+  uint32_t dropped;   // requests not recorded as cmds[] was full
+  kcs_cmd_stats_t cmds[KCS_STATS_CMDS];
+} kcs_stats_t;
+
 void lib_ipmi_handle(unsigned char *request, unsigned char req_len,
                  unsigned char *response, unsigned short *res_len);
+int lib_ipmi_get_sel_range(uint8_t node, uint16_t rec_id, uint32_t since,
+                 ipmi_sel_range_rec_t *recs, int max, uint16_t *next_id);
+int lib_ipmi_get_kcs_stats(kcs_stats_t *stats);
+time_t lib_ipmi_kcs_last_req(void);
 
 #ifdef __cplusplus
 } // extern "C"
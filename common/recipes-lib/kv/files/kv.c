@@ -28,11 +28,19 @@
 #include <string.h>
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
 #include "kv.h"
 
 /* Used for the non-persist database */
 const char *cache_store = "/tmp/cache_store/%s";
 const char *kv_store    = "/mnt/data/kv_store/%s";
+/* Shared memory index of recently used keys */
+const char *kv_index_shm = "kv_index";
 
 #ifdef DEBUG
 #ifdef __TEST__
@@ -44,6 +52,106 @@ const char *kv_store    = "/mnt/data/kv_store/%s";
 #define KV_DEBUG(fmt, ...)
 #endif
 
+/*
+ * All processes share an index of keys in /dev/shm. Each bucket is
+ * guarded by a sequence counter: readers copy an entry out and retry
+ * if a writer raced with them, writers serialize on the counter. A
+ * process dying mid-update can therefore never wedge the store.
+ *
+ * The key files stay the backing store, since scripts read and write
+ * them directly. Non-persistent keys are therefore still written to
+ * their file on every change, which is cheap on tmpfs. A cached entry
+ * is trusted for KV_REVALIDATE_MS, after that a single stat() tells
+ * whether the file changed under us.
+ *
+ * Rewrites of existing persistent keys are appended to a journal on
+ * flash instead of rewriting the key file. The journal is folded back
+ * into the key files on the first use after boot, and by the next
+ * kv_set() of a persistent key once it grew past KV_JOURNAL_MAX or
+ * holds records older than KV_JOURNAL_MAX_AGE. This way a key that
+ * changes many times between two compactions costs a single key file
+ * rewrite. Until then the key file of a rewritten persistent key is
+ * stale, so those have to be read through kv_get() or the kv tool.
+ *
+ * Updates of an entry, its key file and its journal records are
+ * serialized by a robust process-shared mutex in the bucket, so the
+ * three always agree. Readers which hit the cache never take it.
+ * Compaction moves the journal aside, so writers keep appending to a
+ * fresh one meanwhile, and takes the bucket locks one key at a time. A
+ * key file changed or removed by somebody else (a script) wins over
+ * journaled values of that key which were not yet written back.
+ */
+#define KV_INDEX_MAGIC      0x4b564933  /* "KVI3" */
+#define KV_INDEX_FRESH      0
+#define KV_INDEX_BUSY       1
+#define KV_INDEX_READY      2
+#define KV_INDEX_WAIT_MS    2000
+
+#define KV_BUCKETS          256
+#define KV_BUCKET_SLOTS     8
+#define KV_SEQ_RETRY        64
+#define KV_SEQ_WRITE_SPIN   1024
+#define KV_REVALIDATE_MS    1000
+
+#define KV_ENT_VALID        (1 << 0)
+#define KV_ENT_PERSIST      (1 << 1)
+#define KV_ENT_DIRTY        (1 << 2)  /* Journal is newer than key file */
+
+#define KV_JOURNAL_NAME     ".kv_journal"
+#define KV_JOURNAL_OLD      KV_JOURNAL_NAME ".old"  /* Being compacted */
+#define KV_JOURNAL_MAGIC    0x4b564a52  /* "KVJR" */
+#define KV_JOURNAL_MAX      (16 * 1024)
+#define KV_JOURNAL_MAX_AGE  30000
+
+typedef struct {
+  int64_t mtime_ns;
+  uint64_t ino;
+  int64_t size;
+} kv_stamp_t;
+
+typedef struct {
+  char key[MAX_KEY_LEN];
+  char value[MAX_VALUE_LEN];
+  uint16_t len;
+  uint16_t flags;
+  uint32_t reserved;
+  kv_stamp_t stamp;     /* Key file state the value was synced with */
+  int64_t checked_ms;   /* Last time stamp was compared to the file */
+} kv_entry_t;
+
+typedef struct {
+  uint32_t seq;
+  uint32_t reserved;
+  pthread_mutex_t lock;  /* Serializes entry, key file and journal updates */
+  kv_entry_t ent[KV_BUCKET_SLOTS];
+} kv_bucket_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t state;
+  int64_t journal_since; /* Time of the oldest uncompacted record */
+  int64_t journal_size;  /* Journal size after the last append */
+  pthread_mutex_t compact_lock;
+  kv_bucket_t bucket[KV_BUCKETS];
+} kv_index_t;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t klen;
+  uint16_t vlen;
+  uint32_t crc;
+} kv_jrec_t;
+
+#define KV_JREC_MAX (sizeof(kv_jrec_t) + MAX_KEY_LEN + MAX_VALUE_LEN)
+
+/* Journal records collected by kv_set_multi() and written at once */
+typedef struct {
+  char *buf;
+  size_t len;
+} kv_jbatch_t;
+
+static int kv_journal_compact(kv_index_t *idx, bool all);
+
 static void mkdir_recurse(char *dir, mode_t mode)
 {
   if (access(dir, F_OK) == -1) {
@@ -56,40 +164,430 @@ static void mkdir_recurse(char *dir, mode_t mode)
   }
 }
 
-static void key_path_setup(char *kpath, const char *key, unsigned int flags)
+static void key_path(char *kpath, const char *key, unsigned int flags)
 {
-  char path[MAX_KEY_PATH_LEN];
-  /* Create the path if they dont already exist */
   if ((flags & KV_FPERSIST) != 0) {
     sprintf(kpath, kv_store, key);
   } else {
     sprintf(kpath, cache_store, key);
   }
+}
+
+static void key_path_setup(char *kpath, const char *key, unsigned int flags)
+{
+  char path[MAX_KEY_PATH_LEN];
+  /* Create the path if they dont already exist */
+  key_path(kpath, key, flags);
   strcpy(path, kpath);
   mkdir_recurse(dirname(path), 0777);
 }
 
-/*
-*  set key::value
-*  len is the size of value. If 0, it is assumed value is
-*      a string and strlen() is used to determine the length.
-*  flags is bitmask of options.
-*
-*  return 0 on success, negative error code on failure.
-*/
-int
-kv_set(const char *key, const char *value, size_t len, unsigned int flags) {
+static int64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void stamp_from_stat(kv_stamp_t *stamp, const struct stat *st)
+{
+  stamp->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+  stamp->ino = st->st_ino;
+  stamp->size = st->st_size;
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  int i;
+
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static uint32_t key_hash(const char *key, unsigned int flags)
+{
+  uint32_t h = 2166136261u;
+
+  while (*key) {
+    h ^= (uint8_t)*key++;
+    h *= 16777619u;
+  }
+  if (flags & KV_FPERSIST)
+    h ^= 0x9e3779b9;
+  return h;
+}
+
+static void mutex_lock_robust(pthread_mutex_t *lock)
+{
+  /* A process died holding the lock. Whatever it left half done is
+   * caught by the stamp checks, carry on. */
+  if (pthread_mutex_lock(lock) == EOWNERDEAD)
+    pthread_mutex_consistent(lock);
+}
+
+static void mutex_init_robust(pthread_mutex_t *lock)
+{
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+static void index_lock_init(kv_index_t *idx)
+{
+  int i;
+
+  mutex_init_robust(&idx->compact_lock);
+  for (i = 0; i < KV_BUCKETS; i++)
+    mutex_init_robust(&idx->bucket[i].lock);
+}
+
+static kv_index_t *kv_index_get(void)
+{
+  static kv_index_t *index = NULL;
+  kv_index_t *idx, *expected = NULL;
+  size_t share_size = sizeof(kv_index_t);
+  uint32_t magic = 0, state = KV_INDEX_FRESH;
+  struct stat st;
+  int64_t deadline;
+  int fd;
+
+  idx = __atomic_load_n(&index, __ATOMIC_ACQUIRE);
+  if (idx != NULL)
+    return idx;
+
+  fd = shm_open(kv_index_shm, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    KV_DEBUG("kv: shm_open %s failed, err %d", kv_index_shm, errno);
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0 ||
+      (st.st_size < share_size && ftruncate(fd, share_size) != 0)) {
+    KV_DEBUG("kv: sizing %s failed, err %d", kv_index_shm, errno);
+    close(fd);
+    return NULL;
+  }
+  idx = mmap(NULL, share_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (idx == MAP_FAILED) {
+    KV_DEBUG("kv: mmap %s failed, err %d", kv_index_shm, errno);
+    return NULL;
+  }
+
+  if (!__atomic_compare_exchange_n(&idx->magic, &magic, KV_INDEX_MAGIC,
+        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+      magic != KV_INDEX_MAGIC) {
+    syslog(LOG_WARNING, "kv: bad index magic 0x%x", magic);
+    munmap(idx, share_size);
+    return NULL;
+  }
+
+  /* First user after boot replays whatever the journal still holds
+   * into the key files before anybody trusts them. */
+  if (__atomic_compare_exchange_n(&idx->state, &state, KV_INDEX_BUSY,
+        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    index_lock_init(idx);
+    kv_journal_compact(idx, true);
+    __atomic_store_n(&idx->state, KV_INDEX_READY, __ATOMIC_RELEASE);
+  } else {
+    deadline = now_ms() + KV_INDEX_WAIT_MS;
+    while (__atomic_load_n(&idx->state, __ATOMIC_ACQUIRE) != KV_INDEX_READY) {
+      if (now_ms() > deadline) {
+        munmap(idx, share_size);
+        return NULL;
+      }
+      usleep(1000);
+    }
+  }
+
+  if (!__atomic_compare_exchange_n(&index, &expected, idx,
+        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    munmap(idx, share_size);
+    idx = expected;
+  }
+  return idx;
+}
+
+static kv_bucket_t *bucket_get(kv_index_t *idx, const char *key, unsigned int flags)
+{
+  return &idx->bucket[key_hash(key, flags) % KV_BUCKETS];
+}
+
+static void key_lock(kv_index_t *idx, const char *key, unsigned int flags)
+{
+  mutex_lock_robust(&bucket_get(idx, key, flags)->lock);
+}
+
+static void key_unlock(kv_index_t *idx, const char *key, unsigned int flags)
+{
+  pthread_mutex_unlock(&bucket_get(idx, key, flags)->lock);
+}
+
+static uint32_t bucket_write_begin(kv_bucket_t *b)
+{
+  uint32_t seq;
+  int spin;
+
+  for (spin = 0; spin < KV_SEQ_WRITE_SPIN; spin++) {
+    seq = __atomic_load_n(&b->seq, __ATOMIC_RELAXED);
+    if (!(seq & 1) &&
+        __atomic_compare_exchange_n(&b->seq, &seq, seq + 1,
+          false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return seq + 1;
+    }
+    sched_yield();
+  }
+  /* Previous writer died in the middle of an update, take over */
+  seq = __atomic_load_n(&b->seq, __ATOMIC_RELAXED) | 1;
+  __atomic_store_n(&b->seq, seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return seq;
+}
+
+static void bucket_write_end(kv_bucket_t *b, uint32_t seq)
+{
+  __atomic_store_n(&b->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+static kv_entry_t *
+bucket_find(kv_bucket_t *b, const char *key, unsigned int flags)
+{
+  uint16_t ns = (flags & KV_FPERSIST) ? KV_ENT_PERSIST : 0;
+  int i;
+
+  for (i = 0; i < KV_BUCKET_SLOTS; i++) {
+    kv_entry_t *e = &b->ent[i];
+    if ((e->flags & KV_ENT_VALID) && (e->flags & KV_ENT_PERSIST) == ns &&
+        !strncmp(e->key, key, MAX_KEY_LEN)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/* Pick a slot for a new key: a free one, or the least recently
+ * validated entry which does not hold unflushed journal data. */
+static kv_entry_t *bucket_alloc(kv_bucket_t *b)
+{
+  kv_entry_t *victim = NULL;
+  int i;
+
+  for (i = 0; i < KV_BUCKET_SLOTS; i++) {
+    kv_entry_t *e = &b->ent[i];
+    if (!(e->flags & KV_ENT_VALID))
+      return e;
+    if (e->flags & KV_ENT_DIRTY)
+      continue;
+    if (victim == NULL || e->checked_ms < victim->checked_ms)
+      victim = e;
+  }
+  return victim;
+}
+
+/* Copy a cached entry out. Returns 1 if found, 0 if not cached and
+ * -1 if a consistent copy could not be taken. */
+static int
+cache_lookup(kv_index_t *idx, const char *key, unsigned int flags, kv_entry_t *out)
+{
+  kv_bucket_t *b = bucket_get(idx, key, flags);
+  kv_entry_t *e;
+  uint32_t seq;
+  int retry, found;
+
+  for (retry = 0; retry < KV_SEQ_RETRY; retry++) {
+    seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      sched_yield();
+      continue;
+    }
+    e = bucket_find(b, key, flags);
+    found = (e != NULL);
+    if (found)
+      memcpy(out, e, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&b->seq, __ATOMIC_RELAXED) == seq)
+      return found;
+  }
+  return -1;
+}
+
+/* Insert or refresh the entry of key. dirty marks the value as newer
+ * than its key file. Returns -1 if the bucket has no room. */
+static int
+cache_update(kv_index_t *idx, const char *key, unsigned int flags,
+             const char *value, size_t len, const kv_stamp_t *stamp, bool dirty)
+{
+  kv_bucket_t *b = bucket_get(idx, key, flags);
+  kv_entry_t *e;
+  uint32_t seq;
+  int ret = 0;
+
+  seq = bucket_write_begin(b);
+  e = bucket_find(b, key, flags);
+  if (e == NULL && (e = bucket_alloc(b)) != NULL) {
+    strncpy(e->key, key, MAX_KEY_LEN - 1);
+    e->key[MAX_KEY_LEN - 1] = '\0';
+  }
+  if (e != NULL) {
+    memcpy(e->value, value, len);
+    e->len = len;
+    e->flags = KV_ENT_VALID;
+    if (flags & KV_FPERSIST)
+      e->flags |= KV_ENT_PERSIST;
+    if (dirty)
+      e->flags |= KV_ENT_DIRTY;
+    if (stamp)
+      e->stamp = *stamp;
+    e->checked_ms = now_ms();
+  } else {
+    ret = -1;
+  }
+  bucket_write_end(b, seq);
+  return ret;
+}
+
+/* Key file was written with value, clear the dirty bit if nothing
+ * newer went to the journal in the meantime. */
+static void
+cache_mark_clean(kv_index_t *idx, const char *key, const char *value,
+                 size_t len, const kv_stamp_t *stamp)
+{
+  kv_bucket_t *b = bucket_get(idx, key, KV_FPERSIST);
+  kv_entry_t *e;
+  uint32_t seq;
+
+  seq = bucket_write_begin(b);
+  e = bucket_find(b, key, KV_FPERSIST);
+  if (e != NULL && e->len == len && !memcmp(e->value, value, len)) {
+    e->flags &= ~KV_ENT_DIRTY;
+    e->stamp = *stamp;
+    e->checked_ms = now_ms();
+  }
+  bucket_write_end(b, seq);
+}
+
+static void
+cache_touch(kv_index_t *idx, const char *key, unsigned int flags)
+{
+  kv_bucket_t *b = bucket_get(idx, key, flags);
+  kv_entry_t *e;
+  uint32_t seq;
+
+  seq = bucket_write_begin(b);
+  e = bucket_find(b, key, flags);
+  if (e != NULL)
+    e->checked_ms = now_ms();
+  bucket_write_end(b, seq);
+}
+
+/* Drop the entry of key. Entries holding journal data are kept
+ * unless force is given. */
+static void
+cache_invalidate(kv_index_t *idx, const char *key, unsigned int flags, bool force)
+{
+  kv_bucket_t *b = bucket_get(idx, key, flags);
+  kv_entry_t *e;
+  uint32_t seq;
+
+  seq = bucket_write_begin(b);
+  e = bucket_find(b, key, flags);
+  if (e != NULL && (force || !(e->flags & KV_ENT_DIRTY)))
+    e->flags = 0;
+  bucket_write_end(b, seq);
+}
+
+/* Is the cached copy still based on what the key file holds? Journaled
+ * writes leave the key file alone, so this holds for dirty entries too
+ * unless the file was changed or removed behind our back. */
+static bool
+cache_is_fresh(kv_index_t *idx, const char *key, unsigned int flags,
+               const kv_entry_t *e, bool force)
+{
+  char kpath[MAX_KEY_PATH_LEN];
+  kv_stamp_t stamp;
+  struct stat st;
+
+  if (!force && now_ms() - e->checked_ms < KV_REVALIDATE_MS)
+    return true;
+
+  key_path(kpath, key, flags);
+  if (stat(kpath, &st) != 0)
+    return false;
+  stamp_from_stat(&stamp, &st);
+  if (memcmp(&stamp, &e->stamp, sizeof(stamp)))
+    return false;
+  cache_touch(idx, key, flags);
+  return true;
+}
+
+static int
+file_get(const char *key, char *value, size_t *len, unsigned int flags,
+         kv_stamp_t *stamp)
+{
   FILE *fp;
-  int rc, ret = -1;
+  int rc, ret=-1;
   char kpath[MAX_KEY_PATH_LEN] = {0};
-  bool present = true;
-  char curr_value[MAX_VALUE_LEN] = {0};
+  struct stat st;
 
-  if (key == NULL || value == NULL) {
-    errno = EINVAL;
+  key_path(kpath, key, flags);
+
+  fp = fopen(kpath, "r");
+  if (!fp) {
+    KV_DEBUG("kv_get: failed to open %s, err %d", kpath, errno);
     return -1;
   }
 
+  rc = flock(fileno(fp), LOCK_SH);
+  if (rc < 0) {
+    KV_DEBUG("kv_get: failed to flock %s, err %d", kpath, errno);
+    goto close_bail;
+  }
+
+  rc = (int) fread(value, 1, MAX_VALUE_LEN, fp);
+  if (rc < 0 || ferror(fp)) {
+    KV_DEBUG("kv_get: failed to read %s", kpath);
+    goto unlock_bail;
+  }
+  if (len)
+    *len = rc;
+  if (stamp) {
+    if (fstat(fileno(fp), &st) != 0)
+      goto unlock_bail;
+    stamp_from_stat(stamp, &st);
+  }
+  ret = 0;
+unlock_bail:
+  rc = flock(fileno(fp), LOCK_UN);
+  if (rc < 0) {
+    KV_DEBUG("kv_get: failed to unlock flock on %s, err %d", kpath, errno);
+    ret = -1;
+  }
+close_bail:
+  fclose(fp);
+  return ret;
+}
+
+static int
+file_set(const char *key, const char *value, size_t len, unsigned int flags,
+         kv_stamp_t *stamp, bool sync)
+{
+  FILE *fp;
+  int rc, ret = -1;
+  char kpath[MAX_KEY_PATH_LEN] = {0};
+  bool present = true;
+  char curr_value[MAX_VALUE_LEN] = {0};
+  struct stat st;
+
   key_path_setup(kpath, key, flags);
 
   /* If the key already exists, and user wants to create it,
@@ -99,11 +597,6 @@ kv_set(const char *key, const char *value, size_t len, unsigned int flags) {
     return -1;
   }
 
-  /* Optimizes a lot of things */
-  if (len == 0) {
-    len = strlen(value);
-  }
-
   fp = fopen(kpath, "r+");
   if (!fp && (errno == ENOENT)) {
     fp = fopen(kpath, "w");
@@ -121,12 +614,13 @@ kv_set(const char *key, const char *value, size_t len, unsigned int flags) {
   }
 
   // Check if we are writing the same value. If so, exit early
-  // to save on number of times flash is updated.
-  if (present && (flags & KV_FPERSIST)) {
+  // to save on number of times flash is updated, and to leave the
+  // file of an unchanged key alone.
+  if (present) {
     rc = (int)fread(curr_value, 1, MAX_VALUE_LEN, fp);
     if (len == rc && !memcmp(value, curr_value, len)) {
       ret = 0;
-      goto unlock_bail;
+      goto stamp_bail;
     }
     fseek(fp, 0, SEEK_SET);
   }
@@ -147,7 +641,16 @@ kv_set(const char *key, const char *value, size_t len, unsigned int flags) {
     KV_DEBUG("kv_set: Wrote only %d of %d bytes as value", (int)ret, (int)len);
     goto unlock_bail;
   }
+  if (sync)
+    fsync(fileno(fp));
   ret = 0;
+stamp_bail:
+  if (stamp) {
+    if (fstat(fileno(fp), &st) == 0)
+      stamp_from_stat(stamp, &st);
+    else
+      ret = -1;
+  }
 unlock_bail:
   rc = flock(fileno(fp), LOCK_UN);
   if (rc < 0) {
@@ -159,6 +662,365 @@ close_bail:
   return ret;
 }
 
+static size_t
+journal_record(char *buf, const char *key, const char *value, size_t len)
+{
+  kv_jrec_t rec;
+  size_t klen = strlen(key);
+
+  rec.magic = KV_JOURNAL_MAGIC;
+  rec.klen = klen;
+  rec.vlen = len;
+  rec.crc = crc32_update(crc32_update(0, key, klen), value, len);
+  memcpy(buf, &rec, sizeof(rec));
+  memcpy(buf + sizeof(rec), key, klen);
+  memcpy(buf + sizeof(rec) + klen, value, len);
+  return sizeof(rec) + klen + len;
+}
+
+static int journal_append(kv_index_t *idx, const char *buf, size_t len)
+{
+  char jpath[MAX_KEY_PATH_LEN];
+  struct stat st, cur;
+  int64_t since, now = now_ms();
+  int fd, ret = -1;
+
+  key_path_setup(jpath, KV_JOURNAL_NAME, KV_FPERSIST);
+  for (;;) {
+    fd = open(jpath, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+      KV_DEBUG("kv_set: failed to open %s, err %d", jpath, errno);
+      return -1;
+    }
+    if (flock(fd, LOCK_EX) < 0) {
+      KV_DEBUG("kv_set: failed to flock %s, err %d", jpath, errno);
+      close(fd);
+      return -1;
+    }
+    /* Compaction moved the journal aside while we waited */
+    if (fstat(fd, &st) == 0 && stat(jpath, &cur) == 0 && st.st_ino == cur.st_ino)
+      break;
+    flock(fd, LOCK_UN);
+    close(fd);
+  }
+  if (write(fd, buf, len) == len && fstat(fd, &st) == 0)
+    ret = 0;
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  if (ret == 0) {
+    since = 0;
+    __atomic_compare_exchange_n(&idx->journal_since, &since, now,
+        false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    __atomic_store_n(&idx->journal_size, st.st_size, __ATOMIC_RELAXED);
+  }
+  return ret;
+}
+
+/* Is it time to fold the journal back? */
+static bool journal_due(kv_index_t *idx)
+{
+  int64_t since = __atomic_load_n(&idx->journal_since, __ATOMIC_RELAXED);
+
+  return __atomic_load_n(&idx->journal_size, __ATOMIC_RELAXED) >= KV_JOURNAL_MAX ||
+         (since && now_ms() - since >= KV_JOURNAL_MAX_AGE);
+}
+
+/* Should key still be written back? Only if its entry is dirty and
+ * its key file is untouched since the value was journaled: a clean
+ * entry means the record was superseded by a key file write, a changed
+ * file means somebody else wrote it. The newest value is returned in
+ * e, records in the current journal may be newer than the folded one.
+ * Called with the lock of key's bucket held. */
+static bool
+journal_keep(kv_index_t *idx, const char *key, kv_entry_t *e)
+{
+  int cached;
+
+  cached = cache_lookup(idx, key, KV_FPERSIST, e);
+  if (cached != 1 || !(e->flags & KV_ENT_DIRTY))
+    return false;
+  if (!cache_is_fresh(idx, key, KV_FPERSIST, e, true)) {
+    syslog(LOG_WARNING, "kv: %s changed outside of kv, dropping journaled value", key);
+    cache_invalidate(idx, key, KV_FPERSIST, true);
+    return false;
+  }
+  return true;
+}
+
+/* Write the journal at jpath back into the key files. Only the last
+ * value of every key is written, each key file at most once. At boot
+ * (all) the index is empty and every record is written as is. */
+static int journal_fold(kv_index_t *idx, const char *jpath, bool all)
+{
+  char key[MAX_KEY_LEN];
+  char *buf = NULL;
+  size_t *last = NULL;
+  size_t nlast = 0, off, i;
+  struct stat st;
+  kv_jrec_t rec;
+  kv_entry_t e;
+  kv_stamp_t stamp;
+  int fd, ret = -1;
+
+  fd = open(jpath, O_RDONLY);
+  if (fd < 0)
+    return errno == ENOENT ? 0 : -1;
+  if (fstat(fd, &st) != 0)
+    goto bail;
+  if (st.st_size == 0) {
+    ret = 0;
+    goto bail;
+  }
+
+  buf = malloc(st.st_size);
+  last = malloc(sizeof(size_t) * (st.st_size / sizeof(kv_jrec_t) + 1));
+  if (!buf || !last || pread(fd, buf, st.st_size, 0) != st.st_size)
+    goto bail;
+
+  /* Collect the offset of the newest record of every key. A torn or
+   * corrupted record ends the journal. */
+  for (off = 0; off + sizeof(rec) <= st.st_size; ) {
+    memcpy(&rec, buf + off, sizeof(rec));
+    if (rec.magic != KV_JOURNAL_MAGIC || rec.klen == 0 ||
+        rec.klen >= MAX_KEY_LEN || rec.vlen > MAX_VALUE_LEN ||
+        off + sizeof(rec) + rec.klen + rec.vlen > st.st_size ||
+        crc32_update(0, buf + off + sizeof(rec), rec.klen + rec.vlen) != rec.crc) {
+      syslog(LOG_WARNING, "kv: journal truncated at offset %zu", off);
+      break;
+    }
+    for (i = 0; i < nlast; i++) {
+      kv_jrec_t *r = (kv_jrec_t *)(buf + last[i]);
+      if (r->klen == rec.klen &&
+          !memcmp(buf + last[i] + sizeof(rec), buf + off + sizeof(rec), rec.klen))
+        break;
+    }
+    last[i] = off;
+    if (i == nlast)
+      nlast++;
+    off += sizeof(rec) + rec.klen + rec.vlen;
+  }
+
+  ret = 0;
+  for (i = 0; i < nlast && ret == 0; i++) {
+    char *p = buf + last[i];
+    memcpy(&rec, p, sizeof(rec));
+    memcpy(key, p + sizeof(rec), rec.klen);
+    key[rec.klen] = '\0';
+    p += sizeof(rec) + rec.klen;
+    if (all) {
+      ret = file_set(key, p, rec.vlen, KV_FPERSIST, NULL, true);
+    } else {
+      key_lock(idx, key, KV_FPERSIST);
+      if (journal_keep(idx, key, &e)) {
+        ret = file_set(key, e.value, e.len, KV_FPERSIST, &stamp, true);
+        if (ret == 0)
+          cache_mark_clean(idx, key, e.value, e.len, &stamp);
+      }
+      key_unlock(idx, key, KV_FPERSIST);
+    }
+    if (ret)
+      syslog(LOG_WARNING, "kv: failed to write back %s", key);
+  }
+bail:
+  free(last);
+  free(buf);
+  close(fd);
+  return ret;
+}
+
+/* Fold the journal back into the key files. The journal is renamed to
+ * KV_JOURNAL_OLD first, a leftover of an interrupted compaction is
+ * folded before that. Only one process compacts at a time, others
+ * leave it to that one. At boot (all) the index is not published yet. */
+static int kv_journal_compact(kv_index_t *idx, bool all)
+{
+  char jpath[MAX_KEY_PATH_LEN];
+  char opath[MAX_KEY_PATH_LEN];
+  struct stat st;
+  bool moved = false;
+  int fd, rc, ret = -1;
+
+  if (!all) {
+    rc = pthread_mutex_trylock(&idx->compact_lock);
+    if (rc == EBUSY)
+      return 0;
+    if (rc == EOWNERDEAD)
+      pthread_mutex_consistent(&idx->compact_lock);
+    else if (rc != 0)
+      return -1;
+  }
+
+  key_path(jpath, KV_JOURNAL_NAME, KV_FPERSIST);
+  key_path(opath, KV_JOURNAL_OLD, KV_FPERSIST);
+  if (journal_fold(idx, opath, all))
+    goto bail;
+  unlink(opath);
+
+  fd = open(jpath, O_RDWR);
+  if (fd < 0) {
+    if (errno == ENOENT)
+      ret = 0;
+    goto bail;
+  }
+  if (flock(fd, LOCK_EX) < 0) {
+    close(fd);
+    goto bail;
+  }
+  if (fstat(fd, &st) == 0 && st.st_size > 0 && rename(jpath, opath) == 0)
+    moved = true;
+  __atomic_store_n(&idx->journal_since, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&idx->journal_size, 0, __ATOMIC_RELAXED);
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  ret = 0;
+  if (moved) {
+    ret = journal_fold(idx, opath, all);
+    if (ret == 0)
+      unlink(opath);
+  }
+bail:
+  if (!all)
+    pthread_mutex_unlock(&idx->compact_lock);
+  return ret;
+}
+
+/* Called with the lock of key's bucket held */
+static int
+kv_set_one(kv_index_t *idx, const char *key, const char *value, size_t len,
+           unsigned int flags, kv_jbatch_t *batch)
+{
+  kv_entry_t e;
+  kv_stamp_t stamp;
+  int cached = 0;
+  char rec[KV_JREC_MAX];
+  size_t rlen;
+
+  if (key == NULL || value == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Optimizes a lot of things */
+  if (len == 0) {
+    len = strlen(value);
+  }
+
+  /* Keys or values the index can not hold go straight to the file */
+  if (idx == NULL || strlen(key) >= MAX_KEY_LEN || len > MAX_VALUE_LEN)
+    return file_set(key, value, len, flags, NULL, false);
+
+  cached = cache_lookup(idx, key, flags, &e);
+  if (cached == 1 && !cache_is_fresh(idx, key, flags, &e, true)) {
+    /* The key file was changed outside of kv, that write wins over
+     * what the journal holds and this one goes to the file */
+    cache_invalidate(idx, key, flags, true);
+    cached = 0;
+  }
+
+  if (cached == 1) {
+    /* The key exists, so it can not be created */
+    if (flags & KV_FCREATE) {
+      KV_DEBUG("kv_set: FCREATE is provided and %s already exist!\n", key);
+      return -1;
+    }
+    /* Writing the same value is a no-op */
+    if (e.len == len && !memcmp(e.value, value, len))
+      return 0;
+
+    /* Rewrite of a persistent key goes to the journal */
+    if (flags & KV_FPERSIST) {
+      if (cache_update(idx, key, flags, value, len, &e.stamp, true) == 0) {
+        rlen = journal_record(rec, key, value, len);
+        if (batch) {
+          memcpy(batch->buf + batch->len, rec, rlen);
+          batch->len += rlen;
+          return 0;
+        }
+        if (journal_append(idx, rec, rlen) == 0)
+          return 0;
+        cache_invalidate(idx, key, flags, true);
+      }
+    }
+  }
+
+  if (file_set(key, value, len, flags, &stamp, false))
+    return -1;
+  cache_update(idx, key, flags, value, len, &stamp, false);
+  return 0;
+}
+
+static int
+kv_get_one(kv_index_t *idx, const char *key, char *value, size_t *len,
+           unsigned int flags)
+{
+  kv_entry_t e;
+  kv_stamp_t stamp;
+  size_t rlen;
+  int cached, ret = 0;
+
+  if (key == NULL || value == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (idx == NULL || strlen(key) >= MAX_KEY_LEN)
+    return file_get(key, value, len, flags, NULL);
+
+  if (cache_lookup(idx, key, flags, &e) == 1 &&
+      cache_is_fresh(idx, key, flags, &e, false)) {
+    memcpy(value, e.value, e.len);
+    if (len)
+      *len = e.len;
+    return 0;
+  }
+
+  /* Fill from the key file under the bucket lock, so a concurrent
+   * kv_set() can not have its journaled value replaced by the older
+   * file */
+  key_lock(idx, key, flags);
+  cached = cache_lookup(idx, key, flags, &e);
+  if (cached == 1 && cache_is_fresh(idx, key, flags, &e, true)) {
+    memcpy(value, e.value, e.len);
+    rlen = e.len;
+  } else {
+    if (cached == 1)
+      cache_invalidate(idx, key, flags, true);
+    ret = file_get(key, value, &rlen, flags, &stamp);
+    if (ret == 0)
+      cache_update(idx, key, flags, value, rlen, &stamp, false);
+  }
+  key_unlock(idx, key, flags);
+
+  if (ret == 0 && len)
+    *len = rlen;
+  return ret;
+}
+
+/*
+*  set key::value
+*  len is the size of value. If 0, it is assumed value is
+*      a string and strlen() is used to determine the length.
+*  flags is bitmask of options.
+*
+*  return 0 on success, negative error code on failure.
+*/
+int
+kv_set(const char *key, const char *value, size_t len, unsigned int flags) {
+  kv_index_t *idx = kv_index_get();
+  int ret;
+
+  if (idx == NULL || key == NULL)
+    return kv_set_one(NULL, key, value, len, flags, NULL);
+  key_lock(idx, key, flags);
+  ret = kv_set_one(idx, key, value, len, flags, NULL);
+  key_unlock(idx, key, flags);
+  if ((flags & KV_FPERSIST) && journal_due(idx))
+    kv_journal_compact(idx, false);
+  return ret;
+}
+
 /*
 *  get key::value
 *  len is the return size of value. If NULL then this information
@@ -169,46 +1031,327 @@ close_bail:
 */
 int
 kv_get(const char *key, char *value, size_t *len, unsigned int flags) {
-  FILE *fp;
-  int rc, ret=-1;
-  char kpath[MAX_KEY_PATH_LEN] = {0};
+  return kv_get_one(kv_index_get(), key, value, len, flags);
+}
 
-  if (key == NULL || value == NULL) {
+/*
+*  get several keys at once. Every pair gets its own status;
+*  value must point to a buffer of MAX_VALUE_LEN bytes.
+*
+*  return the number of keys which could not be read.
+*/
+int
+kv_get_multi(kv_pair_t *pairs, size_t count, unsigned int flags) {
+  kv_index_t *idx = kv_index_get();
+  int failed = 0;
+  size_t i;
+
+  if (pairs == NULL) {
     errno = EINVAL;
     return -1;
   }
+  for (i = 0; i < count; i++) {
+    pairs[i].status = kv_get_one(idx, pairs[i].key, pairs[i].value,
+                                 &pairs[i].len, flags);
+    if (pairs[i].status)
+      failed++;
+  }
+  return failed;
+}
 
-  key_path_setup(kpath, key, flags);
+/* Take or release the bucket locks of all keys of a batch. They are
+ * always taken in bucket order, so two batches can not deadlock. */
+static void
+multi_lock(kv_index_t *idx, kv_pair_t *pairs, size_t count,
+           unsigned int flags, bool lock)
+{
+  bool used[KV_BUCKETS] = {false};
+  size_t i;
 
-  fp = fopen(kpath, "r");
-  if (!fp) {
-    KV_DEBUG("kv_get: failed to open %s, err %d", kpath, errno);
+  for (i = 0; i < count; i++) {
+    if (pairs[i].key != NULL)
+      used[bucket_get(idx, pairs[i].key, flags) - idx->bucket] = true;
+  }
+  for (i = 0; i < KV_BUCKETS; i++) {
+    if (!used[i])
+      continue;
+    if (lock)
+      mutex_lock_robust(&idx->bucket[i].lock);
+    else
+      pthread_mutex_unlock(&idx->bucket[i].lock);
+  }
+}
+
+/*
+*  set several keys at once. Rewrites of persistent keys are
+*  committed to flash with a single journal write.
+*
+*  return the number of keys which could not be written.
+*/
+int
+kv_set_multi(kv_pair_t *pairs, size_t count, unsigned int flags) {
+  kv_index_t *idx = kv_index_get();
+  kv_jbatch_t batch = {NULL, 0};
+  kv_jbatch_t *pbatch = NULL;
+  int failed = 0;
+  size_t i;
+
+  if (pairs == NULL) {
+    errno = EINVAL;
     return -1;
   }
+  if (idx && (flags & KV_FPERSIST)) {
+    batch.buf = malloc(KV_JREC_MAX * count);
+    if (batch.buf)
+      pbatch = &batch;
+  }
+  if (idx)
+    multi_lock(idx, pairs, count, flags, true);
+  for (i = 0; i < count; i++) {
+    pairs[i].status = kv_set_one(idx, pairs[i].key, pairs[i].value,
+                                 pairs[i].len, flags, pbatch);
+    if (pairs[i].status)
+      failed++;
+  }
+  if (pbatch && batch.len && journal_append(idx, batch.buf, batch.len)) {
+    /* Nothing of the batch made it to flash. Write the keys one by
+     * one, unchanged key files are left alone by file_set(). */
+    for (i = 0; i < count; i++) {
+      if (pairs[i].status)
+        continue;
+      cache_invalidate(idx, pairs[i].key, flags, true);
+      pairs[i].status = kv_set_one(idx, pairs[i].key, pairs[i].value,
+                                   pairs[i].len, flags, NULL);
+      if (pairs[i].status)
+        failed++;
+    }
+  }
+  if (idx) {
+    multi_lock(idx, pairs, count, flags, false);
+    if ((flags & KV_FPERSIST) && journal_due(idx))
+      kv_journal_compact(idx, false);
+  }
+  free(batch.buf);
+  return failed;
+}
 
-  rc = flock(fileno(fp), LOCK_EX);
-  if (rc < 0) {
-    KV_DEBUG("kv_get: failed to flock %s, err %d", kpath, errno);
-    goto close_bail;
+/*
+ * Key watches, for readers which cache what they derived from a key.
+ * The watch is on the directory of the key file, so the file may come
+ * and go. All the watches of a process share one inotify instance,
+ * which is only read when it has events pending. A persistent key
+ * rewritten through the journal does not touch its key file until the
+ * journal is compacted, so the journal is watched as well and any
+ * change of it expires the watches of all persistent keys.
+ */
+#define KV_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+    IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct kv_watch_s {
+  char dir[MAX_KEY_PATH_LEN + 2];  /* watched directory */
+  const char *name;                /* key file name in dir */
+  unsigned int flags;
+  int wd;
+  bool valid;
+  struct kv_watch_s *next;
+};
+
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static kv_watch_t *watch_list = NULL;
+static int watch_fd = -1;
+static int journal_wd = -1;  /* watch of the directory of the journal */
+
+static bool watch_persist(const kv_watch_t *w)
+{
+  return (w->flags & (KV_FPERSIST | KV_FPATH)) == KV_FPERSIST;
+}
+
+/* Expire the watches of all persistent keys. Called with watch_lock held */
+static void watch_expire_persist(void)
+{
+  kv_watch_t *o;
+
+  for (o = watch_list; o; o = o->next) {
+    if (watch_persist(o)) {
+      o->valid = false;
+    }
   }
+}
 
-  rc = (int) fread(value, 1, MAX_VALUE_LEN, fp);
-  if (rc < 0 || ferror(fp)) {
-    KV_DEBUG("kv_get: failed to read %s", kpath);
-    goto unlock_bail;
+/* (Re)establish the watch of the directory, and of the journal for a
+ * persistent key. Called with watch_lock held */
+static void watch_start(kv_watch_t *w)
+{
+  char jpath[MAX_KEY_PATH_LEN];
+  kv_watch_t *o;
+
+  if (watch_fd < 0) {
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0) {
+      return;
+    }
   }
-  if (len)
-    *len = rc;
-  ret = 0;
-unlock_bail:
-  rc = flock(fileno(fp), LOCK_UN);
-  if (rc < 0) {
-    KV_DEBUG("kv_get: failed to unlock flock on %s, err %d", kpath, errno);
-    ret = -1;
+  if (w->wd < 0) {
+    w->wd = inotify_add_watch(watch_fd, w->dir, KV_WATCH_MASK);
+    /* Keys in one directory share the watch; whatever they cached
+     * before it was (re)established cannot be trusted */
+    for (o = watch_list; w->wd >= 0 && o; o = o->next) {
+      if (o->wd == w->wd) {
+        o->valid = false;
+      }
+    }
+  }
+  if (watch_persist(w) && journal_wd < 0) {
+    key_path(jpath, KV_JOURNAL_NAME, KV_FPERSIST);
+    journal_wd = inotify_add_watch(watch_fd, dirname(jpath), KV_WATCH_MASK);
+    if (journal_wd >= 0) {
+      watch_expire_persist();
+    }
   }
-close_bail:
-  fclose(fp);
-  return ret;
+}
+
+/* Invalidate the watches of the keys inotify reported a change of.
+ * Called with watch_lock held */
+static void watch_drain(void)
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *ev;
+  struct pollfd pfd;
+  kv_watch_t *w;
+  ssize_t len;
+  char *p;
+
+  if (watch_fd < 0) {
+    return;
+  }
+  pfd.fd = watch_fd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN)) {
+    return;
+  }
+  while ((len = read(watch_fd, buf, sizeof(buf))) > 0) {
+    for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+      ev = (const struct inotify_event *)p;
+      if (journal_wd >= 0 && ev->wd == journal_wd) {
+        if (ev->mask & IN_IGNORED) {
+          journal_wd = -1;
+          watch_expire_persist();
+        } else if (ev->len == 0 || !strcmp(ev->name, KV_JOURNAL_NAME)) {
+          watch_expire_persist();
+        }
+      }
+      for (w = watch_list; w; w = w->next) {
+        if (ev->mask & IN_Q_OVERFLOW) {
+          w->valid = false;
+        } else if (w->wd == ev->wd) {
+          if (ev->mask & IN_IGNORED) {
+            /* The directory is gone, watch it again on the next use */
+            w->wd = -1;
+            w->valid = false;
+          } else if (ev->len == 0 || !strcmp(ev->name, w->name)) {
+            w->valid = false;
+          }
+        }
+      }
+    }
+  }
+}
+
+kv_watch_t *
+kv_watch_add(const char *key, unsigned int flags) {
+  kv_watch_t *w;
+  char *name;
+
+  if (strlen(key) >= MAX_KEY_LEN) {
+    return NULL;
+  }
+  w = calloc(1, sizeof(*w));
+  if (!w) {
+    return NULL;
+  }
+  if (flags & KV_FPATH) {
+    snprintf(w->dir, sizeof(w->dir), "%s", key);
+  } else {
+    key_path(w->dir, key, flags);
+  }
+  w->flags = flags;
+  w->wd = -1;
+
+  name = strrchr(w->dir, '/');
+  if (name == w->dir) {
+    /* File in the root directory: keep the slash */
+    memmove(w->dir + 2, w->dir + 1, strlen(w->dir));
+    name = w->dir + 1;
+  }
+  if (name) {
+    *name++ = '\0';
+    w->name = name;
+  } else {
+    /* Relative to the current directory */
+    memmove(w->dir + 2, w->dir, strlen(w->dir) + 1);
+    w->dir[0] = '.';
+    w->dir[1] = '\0';
+    w->name = w->dir + 2;
+  }
+
+  pthread_mutex_lock(&watch_lock);
+  w->next = watch_list;
+  watch_list = w;
+  pthread_mutex_unlock(&watch_lock);
+  return w;
+}
+
+int
+kv_watch_stale(kv_watch_t *w) {
+  bool stale, watched;
+
+  pthread_mutex_lock(&watch_lock);
+  watch_drain();
+  if (w->wd < 0 || (watch_persist(w) && journal_wd < 0)) {
+    watch_start(w);
+  }
+  watched = w->wd >= 0 && (!watch_persist(w) || journal_wd >= 0);
+  stale = !w->valid || !watched;
+  if (stale) {
+    /* Valid from now on; a change while the caller reads the key is
+     * reported next time */
+    w->valid = watched;
+  }
+  pthread_mutex_unlock(&watch_lock);
+  return stale;
+}
+
+void
+kv_watch_del(kv_watch_t *w) {
+  kv_watch_t **pp, *o;
+  bool shared = false;
+
+  if (!w) {
+    return;
+  }
+  pthread_mutex_lock(&watch_lock);
+  for (pp = &watch_list; *pp; pp = &(*pp)->next) {
+    if (*pp == w) {
+      *pp = w->next;
+      break;
+    }
+  }
+  for (o = watch_list; o; o = o->next) {
+    if (w->wd >= 0 && o->wd == w->wd) {
+      shared = true;
+    }
+  }
+  /* The journal stays watched as long as the inotify instance lives */
+  if (w->wd >= 0 && !shared && w->wd != journal_wd) {
+    inotify_rm_watch(watch_fd, w->wd);
+  }
+  if (!watch_list && watch_fd >= 0) {
+    close(watch_fd);
+    watch_fd = -1;
+    journal_wd = -1;
+  }
+  pthread_mutex_unlock(&watch_lock);
+  free(w);
 }
 
 #ifdef __TEST__
@@ -220,11 +1363,14 @@ int main(int argc, char *argv[])
 
   cache_store = "./test/tmp/%s";
   kv_store    = "./test/persist/%s";
+  kv_index_shm = "kv_index_test";
+  shm_unlink(kv_index_shm);
 
   assert(kv_set("test1", "val", 0, KV_FPERSIST) == 0);
   printf("SUCCESS: Creating persist key func call\n");
   assert(access("./test/persist/test1", F_OK) == 0);
   printf("SUCCESS: key file created as expected!\n");
+  memset(value, 0, sizeof(value));
   assert(kv_get("test1", value, NULL, KV_FPERSIST) == 0);
   printf("SUCCESS: Read of key succeeded!\n");
   assert(strcmp(value, "val") == 0);
@@ -234,6 +1380,7 @@ int main(int argc, char *argv[])
   printf("SUCCESS: Creating non-persist key func call\n");
   assert(access("./test/tmp/test1", F_OK) == 0);
   printf("SUCCESS: key file created as expected!\n");
+  memset(value, 0, sizeof(value));
   assert(kv_get("test1", value, NULL, 0) == 0);
   printf("SUCCESS: Read of key succeeded!\n");
   assert(strcmp(value, "val") == 0);
@@ -261,7 +1408,113 @@ int main(int argc, char *argv[])
   assert(strcmp(value, "val2") == 0);
   printf("SUCCESS: KV_FCREATE succeeded on non-existing key\n");
 
+  {
+    struct stat st1, st2;
+
+    assert(file_set("test3", "same", 4, 0, NULL, false) == 0);
+    assert(stat("./test/tmp/test3", &st1) == 0);
+    usleep(10000);
+    assert(file_set("test3", "same", 4, 0, NULL, false) == 0);
+    assert(stat("./test/tmp/test3", &st2) == 0);
+    assert(!memcmp(&st1.st_mtim, &st2.st_mtim, sizeof(st1.st_mtim)));
+    printf("SUCCESS: Unchanged value left the key file alone\n");
+  }
+
+  assert(kv_set("test1", "val3", 0, KV_FPERSIST) == 0);
+  assert(access("./test/persist/" KV_JOURNAL_NAME, F_OK) == 0);
+  memset(value, 0, sizeof(value));
+  assert(kv_get("test1", value, NULL, KV_FPERSIST) == 0);
+  assert(strcmp(value, "val3") == 0);
+  assert(kv_journal_compact(kv_index_get(), false) == 0);
+  memset(value, 0, sizeof(value));
+  assert(file_get("test1", value, NULL, KV_FPERSIST, NULL) == 0);
+  assert(strcmp(value, "val3") == 0);
+  printf("SUCCESS: Persistent rewrite went through the journal\n");
+
+  {
+    char v1[MAX_VALUE_LEN] = {0}, v2[MAX_VALUE_LEN] = {0};
+    kv_pair_t set[] = {{"multi1", "a", 0}, {"multi2", "bb", 0}};
+    kv_pair_t get[] = {{"multi1", v1}, {"multi2", v2}, {"multi3", value}};
+
+    assert(kv_set_multi(set, 2, 0) == 0);
+    assert(kv_get_multi(get, 3, 0) == 1);
+    assert(strcmp(v1, "a") == 0 && get[0].len == 1);
+    assert(strcmp(v2, "bb") == 0 && get[1].len == 2);
+    assert(get[2].status != 0);
+    printf("SUCCESS: Batch set and get\n");
+  }
+
+  {
+    struct stat st;
+
+    /* Journaled value of a key whose file is rewritten by a script */
+    assert(kv_set("ext1", "a", 0, KV_FPERSIST) == 0);
+    assert(kv_set("ext1", "b", 0, KV_FPERSIST) == 0);
+    sleep(1);
+    system("echo -n script > ./test/persist/ext1");
+    memset(value, 0, sizeof(value));
+    assert(kv_get("ext1", value, NULL, KV_FPERSIST) == 0);
+    assert(strcmp(value, "script") == 0);
+    assert(kv_journal_compact(kv_index_get(), false) == 0);
+    memset(value, 0, sizeof(value));
+    assert(file_get("ext1", value, NULL, KV_FPERSIST, NULL) == 0);
+    assert(strcmp(value, "script") == 0);
+    printf("SUCCESS: External write wins over the journal\n");
+
+    /* ... and one whose file is removed */
+    assert(kv_set("ext2", "a", 0, KV_FPERSIST) == 0);
+    assert(kv_set("ext2", "b", 0, KV_FPERSIST) == 0);
+    unlink("./test/persist/ext2");
+    assert(kv_journal_compact(kv_index_get(), false) == 0);
+    assert(stat("./test/persist/ext2", &st) != 0);
+    assert(kv_get("ext2", value, NULL, KV_FPERSIST) != 0);
+    printf("SUCCESS: External delete wins over the journal\n");
+  }
+
+  {
+    kv_watch_t *w;
+
+    assert(kv_set("watch1", "a", 0, 0) == 0);
+    w = kv_watch_add("watch1", 0);
+    assert(w != NULL);
+    assert(kv_watch_stale(w) != 0);
+    assert(kv_watch_stale(w) == 0);
+    assert(kv_set("watch1", "b", 0, 0) == 0);
+    assert(kv_watch_stale(w) != 0);
+    assert(kv_watch_stale(w) == 0);
+    assert(kv_set("watch2", "b", 0, 0) == 0);
+    assert(kv_watch_stale(w) == 0);
+    rename("./test/tmp/watch1", "./test/tmp/watch1.old");
+    assert(kv_watch_stale(w) != 0);
+    rename("./test/tmp/watch1.old", "./test/tmp/watch1");
+    assert(kv_watch_stale(w) != 0);
+    assert(kv_watch_stale(w) == 0);
+    kv_watch_del(w);
+    printf("SUCCESS: Watched key reported stale on changes only\n");
+  }
+
+  {
+    kv_watch_t *w, *wp;
+
+    assert(kv_set("watch1", "a", 0, 0) == 0);
+    assert(kv_set("sub/pwatch", "a", 0, KV_FPERSIST) == 0);
+    w = kv_watch_add("watch1", 0);
+    wp = kv_watch_add("sub/pwatch", KV_FPERSIST);
+    assert(w != NULL && wp != NULL);
+    assert(kv_watch_stale(w) != 0 && kv_watch_stale(wp) != 0);
+    assert(kv_watch_stale(w) == 0 && kv_watch_stale(wp) == 0);
+    /* Journaled rewrite, the key file stays as it is */
+    assert(kv_set("sub/pwatch", "b", 0, KV_FPERSIST) == 0);
+    assert(kv_watch_stale(wp) != 0);
+    assert(kv_watch_stale(w) == 0);
+    assert(kv_watch_stale(wp) == 0);
+    kv_watch_del(w);
+    kv_watch_del(wp);
+    printf("SUCCESS: Journaled rewrite reported on persistent watches\n");
+  }
+
   system("rm -rf ./test");
+  shm_unlink(kv_index_shm);
 
   return 0;
 }
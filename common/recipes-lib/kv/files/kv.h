@@ -41,8 +41,35 @@ extern "C" {
 /* Will set the key:value only if the key does not already exist */
 #define KV_FCREATE        (1 << 1)
 
+/* kv_watch_add(): the key is the path of a file, not a kv key */
+#define KV_FPATH          (1 << 2)
+
+/* One key of a kv_get_multi()/kv_set_multi() call */
+typedef struct {
+  const char *key;
+  char *value;    /* get: buffer of MAX_VALUE_LEN bytes, set: data */
+  size_t len;     /* get: length read, set: length (0 for strlen) */
+  int status;     /* 0 on success, -1 on failure */
+} kv_pair_t;
+
 int kv_get(const char *key, char *value, size_t *len, unsigned int flags);
 int kv_set(const char *key, const char *value, size_t len, unsigned int flags);
+int kv_get_multi(kv_pair_t *pairs, size_t count, unsigned int flags);
+int kv_set_multi(kv_pair_t *pairs, size_t count, unsigned int flags);
+
+/*
+ * Watch of a key for readers which cache what they derived from its
+ * value. kv_watch_stale() returns non-zero when that has to be derived
+ * again: on the first call, after the key file changed, and on every
+ * call while the directory of the key cannot be watched. The caller
+ * then reads the key itself; a change during that read is reported by
+ * the next call.
+ */
+typedef struct kv_watch_s kv_watch_t;
+
+kv_watch_t *kv_watch_add(const char *key, unsigned int flags);
+int kv_watch_stale(kv_watch_t *w);
+void kv_watch_del(kv_watch_t *w);
 
 #ifdef __cplusplus
 }
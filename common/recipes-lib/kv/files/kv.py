@@ -24,18 +24,22 @@ lkv_hndl = ctypes.CDLL("libkv.so")
 
 FPERSIST = 1
 FCREATE = 2
+MAX_VALUE_LEN = 256
 
 
 class KeyOperationFailure(Exception):
     pass
 
 
-def kv_get(key, flags=0):
+def kv_get(key, flags=0, binary=False):
     key_c = ctypes.create_string_buffer(key.encode())
-    value = ctypes.create_string_buffer(64)
-    ret = lkv_hndl.kv_get(key_c, value, 0, ctypes.c_uint(flags))
+    value = ctypes.create_string_buffer(MAX_VALUE_LEN)
+    length = ctypes.c_size_t(0)
+    ret = lkv_hndl.kv_get(key_c, value, ctypes.byref(length), ctypes.c_uint(flags))
     if ret != 0:
         raise KeyOperationFailure
+    if binary:
+        return value.raw[: length.value]
     return value.value.decode()
 
 
@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sched.h>
 #include <errno.h>
 #include <openbmc/kv.h>
 #include "obmc-pal.h"
@@ -45,33 +46,93 @@
 #define DEBUG_STR(...)
 #endif
 
-#define MAX_DATA_NUM    2000
-
 #define CACHE_READ_RETRY 5
 
+/* Shared sensor table. One fixed-size slot per (fru, sensor_num), so
+ * a lookup is a plain index into the mapping. The object is sparse;
+ * only pages of FRUs that are actually polled get backed by memory. */
+#define SNR_TABLE_SHM       "sensor_cache_tbl"
+#define SNR_TABLE_MAGIC     0x534e5243  /* "SNRC" */
+#define SNR_TABLE_VERSION   1
+#define SNR_TABLE_FRUS      256
+#define SNR_TABLE_SENSORS   256
+
+#define SNR_ENTRY_VALID     (1 << 0)  /* Entry was written at least once */
+#define SNR_ENTRY_AVAILABLE (1 << 1)  /* Last reading was not NA */
+#define SNR_ENTRY_MIRRORED  (1 << 2)  /* kv mirror holds the NA/value state */
+
+/* Readers spin at most this many times on a torn read before giving up */
+#define SNR_SEQ_RETRY       64
+/* Writers wait at most this many times for a concurrent writer */
+#define SNR_SEQ_WRITE_SPIN  1024
+
+/* The kv file of a sensor is refreshed at most this often (in seconds)
+ * while its value changes. Availability changes are mirrored at once.
+ * The file is kept for tools which read /tmp/cache_store directly. */
+#define SNR_KV_MIRROR_INTERVAL 10
+
+/* History of the available readings of each sensor, in a second shared
+ * object mapped once per process. Sensors get a slot from a pool the
+ * first time they are written; only slots in use are backed by memory.
+ * A slot holds a ring of the last MAX_DATA_NUM readings and a ring of
+ * hourly min/max/avg summaries. Writers of a sensor are serialized by
+ * the write section of its table entry, so each ring has one writer
+ * at a time and readers never lock. */
+#define SNR_HIST_SHM        "sensor_history_tbl"
+#define SNR_HIST_MAGIC      0x534e5248  /* "SNRH" */
+#define SNR_HIST_VERSION    1
+#define SNR_HIST_SLOTS      2048
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entry_size;
+  uint32_t reserved;
+} sensor_shm_hdr_t;
+
 typedef struct {
-  long log_time;
+  uint32_t seq;         /* Odd while a write is in progress */
+  uint32_t flags;
   float value;
-} sensor_data_t;
+  float mirror_value;   /* Value last written to the kv mirror */
+  int64_t log_time;     /* Time of the last write */
+  int64_t mirror_time;  /* Time of the last kv mirror write */
+} sensor_entry_t;
+
+typedef struct {
+  sensor_shm_hdr_t hdr;
+  sensor_entry_t entry[SNR_TABLE_FRUS][SNR_TABLE_SENSORS];
+} sensor_table_t;
 
 typedef struct {
-  int index;
-  sensor_data_t data[MAX_DATA_NUM];
-} sensor_shm_t;
+  uint32_t pos;         /* Ring position + 1 it was written at, 0 if none */
+  int32_t log_time;
+  float value;
+} sensor_sample_t;
 
 typedef struct {
-  long log_time;
+  uint32_t seq;         /* Odd while a write is in progress */
+  int32_t log_time;     /* Start of the hour */
+  uint32_t count;
   float sum;
-  float count;
-  float avg;
-  float max;
   float min;
-} sensor_coarse_data_t;
+  float max;
+} sensor_summary_t;
 
 typedef struct {
-  int index;
-  sensor_coarse_data_t data[MAX_COARSE_DATA_NUM];
-} sensor_coarse_shm_t;
+  uint32_t head;        /* Readings written so far */
+  uint32_t coarse;      /* Index of the current summary */
+  sensor_sample_t data[MAX_DATA_NUM];
+  sensor_summary_t summary[MAX_COARSE_DATA_NUM];
+} sensor_hist_t;
+
+typedef struct {
+  sensor_shm_hdr_t hdr;
+  uint32_t next_slot;   /* Slots handed out so far */
+  uint32_t reserved;
+  uint16_t slot_idx[SNR_TABLE_FRUS][SNR_TABLE_SENSORS]; /* Slot + 1 */
+  sensor_hist_t slot[SNR_HIST_SLOTS];
+} sensor_hist_table_t;
 
 static int
 sensor_key_get(uint8_t fru, uint8_t sensor_num, char *key)
@@ -84,154 +145,184 @@ sensor_key_get(uint8_t fru, uint8_t sensor_num, char *key)
     if (pal_get_fru_name(fru, fruname))
       return -1;
   }
-  sprintf(key, "%s_sensor%d", fruname, sensor_num);
+  if (key)
+    sprintf(key, "%s_sensor%d", fruname, sensor_num);
   return 0;
 }
 
-static int
-sensor_coarse_key_get(uint8_t fru, uint8_t sensor_num, char *key)
+/* Map a shared table once per process. The first process to get here
+ * stamps the header; a fresh object is zero-filled, which is a valid
+ * empty table. */
+static void *
+sensor_shm_get(void **cache, const char *name, size_t share_size,
+    uint32_t magic, uint32_t version, uint32_t entry_size)
 {
-  int ret = sensor_key_get(fru, sensor_num, key);
-  if (ret) {
-    return ret;
-  }
-  strcat(key, "_coarse");
-  return 0;
-}
-
-static int
-cache_set_coarse_history(char *key, float value) {
+  sensor_shm_hdr_t *tbl;
+  void *expected = NULL;
+  struct stat st;
+  uint32_t old_magic = 0;
   int fd;
-  int share_size = sizeof(sensor_coarse_shm_t);
-  void *ptr;
-  sensor_coarse_shm_t *snr_shm;
-  long current_time;
-  int ret = ERR_FAILURE;
 
-  fd = shm_open(key, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
-  if (fd < 0) {
-    DEBUG_STR("%s: shm_open %s failed, errno = %d", __FUNCTION__, key, errno);
-    return -1;
+  tbl = __atomic_load_n(cache, __ATOMIC_ACQUIRE);
+  if (tbl != NULL) {
+    return tbl;
   }
 
-  if (flock(fd, LOCK_EX) < 0) {
-    syslog(LOG_INFO, "%s: file-lock %s failed errno = %d\n", __FUNCTION__, key, errno);
-    goto close_bail;
+  fd = shm_open(name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    DEBUG_STR("%s: shm_open %s failed, errno = %d", __FUNCTION__, name, errno);
+    return NULL;
   }
 
-  if (ftruncate(fd, share_size) != 0) {
-    syslog(LOG_INFO, "%s: truncate %s failed errno = %d\n", __FUNCTION__, key, errno);
-    goto close_bail;
+  /* Only grow the object, never truncate a table someone else sized */
+  if (fstat(fd, &st) != 0 || (st.st_size < share_size &&
+        ftruncate(fd, share_size) != 0)) {
+    syslog(LOG_INFO, "%s: truncate %s failed errno = %d\n", __FUNCTION__, name, errno);
+    close(fd);
+    return NULL;
   }
 
-  ptr = mmap(NULL, share_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  if (ptr == MAP_FAILED) {
-    syslog(LOG_INFO, "%s: mmap %s failed, errno = %d", __FUNCTION__, key, errno);
-    goto unlock_bail;
+  tbl = mmap(NULL, share_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (tbl == MAP_FAILED) {
+    syslog(LOG_INFO, "%s: mmap %s failed, errno = %d", __FUNCTION__, name, errno);
+    return NULL;
   }
 
-  snr_shm = (sensor_coarse_shm_t *)ptr;
-  current_time = time(NULL);
-  if (snr_shm->data[snr_shm->index].log_time == 0) {
-    sensor_coarse_data_t *s = &snr_shm->data[snr_shm->index];
-    s->log_time = current_time;
-    s->avg = s->sum = s->max = s->min = value;
-    s->count = 1;
-  } else {
-    sensor_coarse_data_t *s = &snr_shm->data[snr_shm->index];
-    /* If the log was started less than an hour ago, then 
-     * continue to log to this entry */
-    if (difftime(current_time, s->log_time) < COARSE_THRESHOLD) {
-      s->sum += value;
-      s->count += 1;
-      if (value > s->max)
-        s->max = value;
-      if (value < s->min)
-        s->min = value;
-      s->avg = s->sum / s->count;
-    } else {
-      /* Start logging to the next entry */
-      snr_shm->index = (snr_shm->index + 1) % MAX_COARSE_DATA_NUM;
-      s = &snr_shm->data[snr_shm->index];
-      memset(s, 0, sizeof(*s));
-      s->log_time = current_time;
-      s->avg = s->sum = s->max = s->min = value;
-      s->count = 1;
+  if (!__atomic_compare_exchange_n(&tbl->magic, &old_magic, magic,
+        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    if (old_magic != magic) {
+      syslog(LOG_WARNING, "%s: bad %s magic 0x%x", __FUNCTION__, name, old_magic);
+      munmap(tbl, share_size);
+      return NULL;
     }
+  } else {
+    tbl->version = version;
+    tbl->entry_size = entry_size;
   }
 
-  if (munmap(ptr, share_size) != 0) {
-    syslog(LOG_INFO, "%s: munmap %s failed, errno = %d", __FUNCTION__, key, errno);
-    goto unlock_bail;
-  }
-  ret = 0;
-
-unlock_bail:
-  if (flock(fd, LOCK_UN) < 0) {
-    syslog(LOG_INFO, "%s: file-unlock %s failed errno = %d\n", __FUNCTION__, key, errno);
-    ret = -1;
+  if (!__atomic_compare_exchange_n(cache, &expected, tbl,
+        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    /* Lost the race with another thread of this process */
+    munmap(tbl, share_size);
+    tbl = expected;
   }
-close_bail:
-  close(fd);
-  return ret;
+  return tbl;
 }
 
-static int
-cache_set_history(char *key, float value) {
+static sensor_table_t *
+sensor_table_get(void)
+{
+  static void *table = NULL;
 
-  int fd;
-  int share_size = sizeof(sensor_shm_t);
-  void *ptr;
-  sensor_shm_t *snr_shm;
-  int ret = ERR_FAILURE;
+  return sensor_shm_get(&table, SNR_TABLE_SHM, sizeof(sensor_table_t),
+      SNR_TABLE_MAGIC, SNR_TABLE_VERSION, sizeof(sensor_entry_t));
+}
 
-  fd = shm_open(key, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
-  if (fd < 0) {
-    DEBUG_STR("%s: shm_open %s failed, errno = %d", __FUNCTION__, key, errno);
-    return -1;
-  }
+/* History slot of a sensor. With create set, a slot is assigned to the
+ * sensor if it has none; two writers racing on the first reading of a
+ * sensor may leak a slot, which only costs address space. */
+static sensor_hist_t *
+sensor_hist_get(uint8_t fru, uint8_t sensor_num, bool create)
+{
+  static void *table = NULL;
+  sensor_hist_table_t *tbl;
+  uint16_t idx, expected = 0;
+  uint32_t slot;
 
-  if (flock(fd, LOCK_EX) < 0) {
-    syslog(LOG_INFO, "%s: file-lock %s failed errno = %d\n", __FUNCTION__, key, errno);
-    goto close_bail;
+  tbl = sensor_shm_get(&table, SNR_HIST_SHM, sizeof(sensor_hist_table_t),
+      SNR_HIST_MAGIC, SNR_HIST_VERSION, sizeof(sensor_hist_t));
+  if (tbl == NULL) {
+    return NULL;
   }
 
-  if (ftruncate(fd, share_size) != 0) {
-    syslog(LOG_INFO, "%s: truncate %s failed errno = %d\n", __FUNCTION__, key, errno);
-    goto close_bail;
+  idx = __atomic_load_n(&tbl->slot_idx[fru][sensor_num], __ATOMIC_ACQUIRE);
+  if (idx != 0 || !create) {
+    return idx ? &tbl->slot[idx - 1] : NULL;
   }
 
-  ptr = mmap(NULL, share_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  if (ptr == MAP_FAILED) {
-    syslog(LOG_INFO, "%s: mmap %s failed, errno = %d", __FUNCTION__, key, errno);
-    goto unlock_bail;
+  slot = __atomic_fetch_add(&tbl->next_slot, 1, __ATOMIC_RELAXED);
+  if (slot >= SNR_HIST_SLOTS) {
+    __atomic_store_n(&tbl->next_slot, SNR_HIST_SLOTS, __ATOMIC_RELAXED);
+    DEBUG_STR("%s: out of history slots", __FUNCTION__);
+    return NULL;
+  }
+  if (!__atomic_compare_exchange_n(&tbl->slot_idx[fru][sensor_num], &expected,
+        slot + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    slot = expected - 1;
   }
+  return &tbl->slot[slot];
+}
 
-  snr_shm = (sensor_shm_t *)ptr;
-  snr_shm->data[snr_shm->index].log_time = time(NULL);
-  snr_shm->data[snr_shm->index].value = value;
-  snr_shm->index = (snr_shm->index + 1) % MAX_DATA_NUM;
+static sensor_entry_t *
+sensor_entry_get(uint8_t fru, uint8_t sensor_num)
+{
+  sensor_table_t *tbl = sensor_table_get();
 
-  if (munmap(ptr, share_size) != 0) {
-    syslog(LOG_INFO, "%s: munmap %s failed, errno = %d", __FUNCTION__, key, errno);
-    goto unlock_bail;
+  if (tbl == NULL) {
+    return NULL;
   }
-  ret = 0;
+  return &tbl->entry[fru][sensor_num];
+}
 
-unlock_bail:
-  if (flock(fd, LOCK_UN) < 0) {
-    syslog(LOG_INFO, "%s: file-unlock %s failed errno = %d\n", __FUNCTION__, key, errno);
-    ret = -1;
+/* Take the entry for writing by moving its sequence to an odd number.
+ * A writer which died mid-update leaves the sequence odd; in that case
+ * we take over the entry after spinning for a while. */
+static uint32_t
+sensor_entry_write_begin(sensor_entry_t *e)
+{
+  uint32_t seq;
+  int spin;
+
+  for (spin = 0; spin < SNR_SEQ_WRITE_SPIN; spin++) {
+    seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+    if (!(seq & 1) &&
+        __atomic_compare_exchange_n(&e->seq, &seq, seq + 1,
+          false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return seq + 1;
+    }
+    sched_yield();
   }
-close_bail:
-  close(fd);
-  return ret;
+  seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED) | 1;
+  __atomic_store_n(&e->seq, seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return seq;
 }
 
-int __attribute__((weak))
-sensor_cache_read(uint8_t fru, uint8_t sensor_num, float *value)
+static void
+sensor_entry_write_end(sensor_entry_t *e, uint32_t seq)
+{
+  __atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Take a consistent snapshot of an entry without locking it */
+static int
+sensor_entry_read(sensor_entry_t *e, sensor_entry_t *snap)
+{
+  uint32_t seq;
+  int retry;
+
+  for (retry = 0; retry < SNR_SEQ_RETRY; retry++) {
+    seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      sched_yield();
+      continue;
+    }
+    snap->flags = e->flags;
+    snap->value = e->value;
+    snap->log_time = e->log_time;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq) {
+      snap->seq = seq;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int
+sensor_kv_read(uint8_t fru, uint8_t sensor_num, float *value)
 {
-#ifndef DBUS_SENSOR_SVC
   int ret;
   char key[MAX_KEY_LEN];
   char str[MAX_VALUE_LEN];
@@ -246,7 +337,7 @@ sensor_cache_read(uint8_t fru, uint8_t sensor_num, float *value)
     }
   }
   if (ret < 0) {
-    DEBUG_STR("sensor_cache_read: cache_get %s failed.\n", key);
+    DEBUG_STR("sensor_kv_read: cache_get %s failed.\n", key);
     return ERR_SENSOR_NA;
   }
   if (0 == strcmp(str, "NA")) {
@@ -255,17 +346,13 @@ sensor_cache_read(uint8_t fru, uint8_t sensor_num, float *value)
 
   *((float*)value) = atof(str);
   return 0;
-#else
-  return sensor_svc_read(fru, sensor_num, value);
-#endif
 }
 
-int
-sensor_cache_write(uint8_t fru, uint8_t sensor_num, bool available, float value)
+static int
+sensor_kv_write(uint8_t fru, uint8_t sensor_num, bool available, float value)
 {
   char key[MAX_KEY_LEN];
   char str[MAX_VALUE_LEN];
-  int ret;
 
   if (sensor_key_get(fru, sensor_num, key))
     return ERR_UNKNOWN_FRU;
@@ -275,15 +362,189 @@ sensor_cache_write(uint8_t fru, uint8_t sensor_num, bool available, float value)
   else
     strcpy(str, "NA");
 
-  ret = kv_set(key, str, 0, 0);
-  if (ret) {
-    DEBUG_STR("sensor_cache_write: cache_set %s failed.\n", key);
+  if (kv_set(key, str, 0, 0)) {
+    DEBUG_STR("sensor_kv_write: cache_set %s failed.\n", key);
     return ERR_FAILURE;
   }
-  if (available) {
-    cache_set_history(key, value);
-    if (sensor_coarse_key_get(fru, sensor_num, key) == 0) {
-      cache_set_coarse_history(key, value);
+  return 0;
+}
+
+/* Append a reading; called within the write section of the sensor */
+static void
+sensor_hist_append(uint8_t fru, uint8_t sensor_num, int32_t now, float value)
+{
+  sensor_hist_t *h;
+  sensor_sample_t *d;
+  sensor_summary_t *c;
+  uint32_t pos, idx;
+
+  h = sensor_hist_get(fru, sensor_num, true);
+  if (h == NULL) {
+    return;
+  }
+
+  /* The position doubles as the sequence of the sample: invalidate it,
+   * fill the sample, then publish the new position and head. */
+  pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+  d = &h->data[pos % MAX_DATA_NUM];
+  __atomic_store_n(&d->pos, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  d->log_time = now;
+  d->value = value;
+  __atomic_store_n(&d->pos, pos + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&h->head, pos + 1, __ATOMIC_RELEASE);
+
+  idx = __atomic_load_n(&h->coarse, __ATOMIC_RELAXED) % MAX_COARSE_DATA_NUM;
+  c = &h->summary[idx];
+  if (c->log_time != 0 && difftime(now, c->log_time) >= COARSE_THRESHOLD) {
+    /* Start logging to the next entry */
+    idx = (idx + 1) % MAX_COARSE_DATA_NUM;
+    c = &h->summary[idx];
+  }
+  __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  if (c->log_time == 0 || idx != h->coarse) {
+    c->log_time = now;
+    c->sum = c->max = c->min = value;
+    c->count = 1;
+  } else {
+    /* If the log was started less than an hour ago, then
+     * continue to log to this entry */
+    c->sum += value;
+    c->count += 1;
+    if (value > c->max)
+      c->max = value;
+    if (value < c->min)
+      c->min = value;
+  }
+  __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&h->coarse, idx, __ATOMIC_RELEASE);
+}
+
+/* Consistent copy of the reading written at ring position pos */
+static bool
+sensor_hist_sample(sensor_hist_t *h, uint32_t pos, sensor_sample_t *snap)
+{
+  sensor_sample_t *d = &h->data[pos % MAX_DATA_NUM];
+
+  if (__atomic_load_n(&d->pos, __ATOMIC_ACQUIRE) != pos + 1) {
+    return false;
+  }
+  snap->log_time = d->log_time;
+  snap->value = d->value;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&d->pos, __ATOMIC_RELAXED) == pos + 1;
+}
+
+static bool
+sensor_hist_summary(sensor_hist_t *h, uint32_t idx, sensor_summary_t *snap)
+{
+  sensor_summary_t *c = &h->summary[idx];
+  uint32_t seq;
+  int retry;
+
+  for (retry = 0; retry < SNR_SEQ_RETRY; retry++) {
+    seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      sched_yield();
+      continue;
+    }
+    snap->log_time = c->log_time;
+    snap->count = c->count;
+    snap->sum = c->sum;
+    snap->min = c->min;
+    snap->max = c->max;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&c->seq, __ATOMIC_RELAXED) == seq) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int __attribute__((weak))
+sensor_cache_read(uint8_t fru, uint8_t sensor_num, float *value)
+{
+  return sensor_cache_read_time(fru, sensor_num, value, NULL);
+}
+
+int
+sensor_cache_read_time(uint8_t fru, uint8_t sensor_num, float *value,
+    int64_t *log_time)
+{
+  if (log_time)
+    *log_time = 0;
+#ifndef DBUS_SENSOR_SVC
+  sensor_entry_t *e;
+  sensor_entry_t snap;
+
+  e = sensor_entry_get(fru, sensor_num);
+  if (e == NULL || sensor_entry_read(e, &snap) ||
+      !(snap.flags & SNR_ENTRY_VALID)) {
+    /* Not in the table yet (or a writer is stuck), values written
+     * straight to the kv store are still honored */
+    return sensor_kv_read(fru, sensor_num, value);
+  }
+  if (log_time)
+    *log_time = snap.log_time;
+  if (!(snap.flags & SNR_ENTRY_AVAILABLE)) {
+    return ERR_SENSOR_NA;
+  }
+  *value = snap.value;
+  return 0;
+#else
+  return sensor_svc_read(fru, sensor_num, value);
+#endif
+}
+
+int
+sensor_cache_write(uint8_t fru, uint8_t sensor_num, bool available, float value)
+{
+  char key[MAX_KEY_LEN];
+  sensor_entry_t *e;
+  uint32_t seq, flags;
+  int64_t now = time(NULL);
+  bool mirror;
+
+  if (sensor_key_get(fru, sensor_num, key))
+    return ERR_UNKNOWN_FRU;
+
+  e = sensor_entry_get(fru, sensor_num);
+  if (e == NULL) {
+    /* No shared table, fall back to the kv store alone */
+    if (sensor_kv_write(fru, sensor_num, available, value))
+      return ERR_FAILURE;
+  } else {
+    seq = sensor_entry_write_begin(e);
+    flags = e->flags;
+    if (!(flags & SNR_ENTRY_MIRRORED) ||
+        available != !!(flags & SNR_ENTRY_AVAILABLE)) {
+      mirror = true;
+    } else {
+      mirror = available && value != e->mirror_value &&
+               (now - e->mirror_time) >= SNR_KV_MIRROR_INTERVAL;
+    }
+    flags = SNR_ENTRY_VALID | (flags & SNR_ENTRY_MIRRORED);
+    if (available)
+      flags |= SNR_ENTRY_AVAILABLE;
+    if (mirror) {
+      flags |= SNR_ENTRY_MIRRORED;
+      e->mirror_value = value;
+      e->mirror_time = now;
+    }
+    e->value = value;
+    e->log_time = now;
+    e->flags = flags;
+    if (available)
+      sensor_hist_append(fru, sensor_num, now, value);
+    sensor_entry_write_end(e, seq);
+
+    /* File I/O is done outside of the write section so readers
+     * never spin on it. On failure retry with the next write. */
+    if (mirror && sensor_kv_write(fru, sensor_num, available, value)) {
+      seq = sensor_entry_write_begin(e);
+      e->flags &= ~SNR_ENTRY_MIRRORED;
+      sensor_entry_write_end(e, seq);
     }
   }
   return 0;
@@ -308,66 +569,32 @@ static int
 sensor_read_short_history(uint8_t fru, uint8_t sensor_num, float *min,
     float *average, float *max, int start_time)
 {
-  char key[MAX_KEY_LEN] = {0};
-  int fd;
-  int share_size = sizeof(sensor_shm_t);
-  void *ptr;
-  sensor_shm_t *snr_shm;
-  int16_t read_index;
+  sensor_hist_t *h;
+  sensor_sample_t d;
+  uint32_t head, pos;
   uint16_t count = 0;
-  float read_val;
   double total = 0;
-  int ret = ERR_FAILURE;
+  int ret;
 
-  if (sensor_key_get(fru, sensor_num, key))
+  if (sensor_key_get(fru, sensor_num, NULL))
     return ERR_UNKNOWN_FRU;
 
-  fd = shm_open(key, O_RDONLY, S_IRUSR | S_IWUSR);
-  if (fd < 0) {
-    DEBUG_STR("%s: shm_open %s failed, errno = %d", __FUNCTION__, key, errno);
-    return ERR_FAILURE;
-  }
-
-  if (flock(fd, LOCK_EX) < 0) {
-    syslog(LOG_INFO, "%s: file-lock %s failed errno = %d\n", __FUNCTION__, key, errno);
-    goto close_bail;
-  }
-
-  ptr = mmap(NULL, share_size, PROT_READ, MAP_SHARED, fd, 0);
-  if (ptr == MAP_FAILED) {
-    syslog(LOG_INFO, "%s: mmap %s failed, errno = %d", __FUNCTION__, key, errno);
-    goto unlock_bail;
-  }
-
-  snr_shm = (sensor_shm_t *)ptr;
-  read_index = snr_shm->index - 1;
-  if (read_index < 0) {
-    read_index += MAX_DATA_NUM;
-  }
-
-  read_val = snr_shm->data[read_index].value;
-  *min = read_val;
-  *max = read_val;
-
-  while ((snr_shm->data[read_index].log_time >= start_time) && (count < MAX_DATA_NUM)) {
-    read_val = snr_shm->data[read_index].value;
-    if (read_val > *max)
-      *max = read_val;
-    if (read_val < *min)
-      *min = read_val;
-
-    total += read_val;
-    count++;
-    if ((--read_index) < 0) {
-      read_index += MAX_DATA_NUM;
+  h = sensor_hist_get(fru, sensor_num, false);
+  if (h != NULL) {
+    head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+    /* Newest first; a sample overwritten under us ends the scan */
+    for (pos = head; pos > 0 && count < MAX_DATA_NUM; pos--) {
+      if (!sensor_hist_sample(h, pos - 1, &d) || d.log_time < start_time)
+        break;
+      if (count == 0 || d.value > *max)
+        *max = d.value;
+      if (count == 0 || d.value < *min)
+        *min = d.value;
+      total += d.value;
+      count++;
     }
   }
 
-  if (munmap(ptr, share_size) != 0) {
-    syslog(LOG_INFO, "%s: munmap %s failed, errno = %d", __FUNCTION__, key, errno);
-    goto unlock_bail;
-  }
-
   /* If none found in history, just return the cached value */
   if (!count) {
     float read_value;
@@ -379,75 +606,40 @@ sensor_read_short_history(uint8_t fru, uint8_t sensor_num, float *min,
   }
 
   *average = total / count;
-  ret = 0;
-unlock_bail:
-  if (flock(fd, LOCK_UN) < 0) {
-    syslog(LOG_INFO, "%s: file-unlock %s failed errno = %d\n", __FUNCTION__, key, errno);
-    ret = -1;
-  }
-close_bail:
-  close(fd);
-  return ret;
+  return 0;
 }
 
 static int
 sensor_read_long_history(uint8_t fru, uint8_t sensor_num, float *min,
     float *average, float *max, int start_time)
 {
-  char key[MAX_KEY_LEN] = {0};
-  int fd;
-  int share_size = sizeof(sensor_coarse_shm_t);
-  void *ptr;
-  sensor_coarse_shm_t *snr_shm;
-  sensor_coarse_data_t *s;
-  int16_t read_index;
+  sensor_hist_t *h;
+  sensor_summary_t c;
+  uint32_t idx;
   uint16_t count = 0;
   double total = 0;
-  int ret = ERR_FAILURE;
+  int ret;
 
-  if (sensor_coarse_key_get(fru, sensor_num, key))
+  if (sensor_key_get(fru, sensor_num, NULL))
     return ERR_UNKNOWN_FRU;
 
-  fd = shm_open(key, O_RDONLY, S_IRUSR | S_IWUSR);
-  if (fd < 0) {
-    DEBUG_STR("%s: shm_open %s failed, errno = %d", __FUNCTION__, key, errno);
-    return ERR_FAILURE;
-  }
-
-  if (flock(fd, LOCK_EX) < 0) {
-    syslog(LOG_INFO, "%s: file-lock %s failed errno = %d\n", __FUNCTION__, key, errno);
-    goto close_bail;
-  }
-
-  ptr = mmap(NULL, share_size, PROT_READ, MAP_SHARED, fd, 0);
-  if (ptr == MAP_FAILED) {
-    syslog(LOG_INFO, "%s: mmap %s failed, errno = %d", __FUNCTION__, key, errno);
-    goto unlock_bail;
-  }
-
-  snr_shm = (sensor_coarse_shm_t *)ptr;
-  read_index = snr_shm->index;
-  total = 0;
   *max = -FLT_MAX;
   *min = FLT_MAX;
-  while (count < MAX_COARSE_DATA_NUM) {
-    s = &snr_shm->data[read_index];
-    if (s->log_time < start_time) {
-      break;
+  h = sensor_hist_get(fru, sensor_num, false);
+  if (h != NULL) {
+    idx = __atomic_load_n(&h->coarse, __ATOMIC_ACQUIRE);
+    while (count < MAX_COARSE_DATA_NUM) {
+      if (!sensor_hist_summary(h, idx, &c) || c.count == 0 ||
+          c.log_time < start_time)
+        break;
+      if (c.max > *max)
+        *max = c.max;
+      if (c.min < *min)
+        *min = c.min;
+      total += c.sum / c.count;
+      count++;
+      idx = (idx + MAX_COARSE_DATA_NUM - 1) % MAX_COARSE_DATA_NUM;
     }
-    if (s->max > *max)
-      *max = s->max;
-    if (s->min < *min)
-      *min = s->min;
-    total += s->avg;
-    count++;
-    if ((--read_index) < 0) {
-      read_index += MAX_COARSE_DATA_NUM;
-    }
-  }
-  if (munmap(ptr, share_size) != 0) {
-    syslog(LOG_INFO, "%s: munmap %s failed, errno = %d", __FUNCTION__, key, errno);
-    goto unlock_bail;
   }
 
   /* If none found in history, just return the cached value */
@@ -461,15 +653,7 @@ sensor_read_long_history(uint8_t fru, uint8_t sensor_num, float *min,
   }
 
   *average = total / count;
-  ret = 0;
-unlock_bail:
-  if (flock(fd, LOCK_UN) < 0) {
-    syslog(LOG_INFO, "%s: file-unlock %s failed errno = %d\n", __FUNCTION__, key, errno);
-    ret = -1;
-  }
-close_bail:
-  close(fd);
-  return ret;
+  return 0;
 }
 
 int
@@ -486,67 +670,89 @@ sensor_read_history(uint8_t fru, uint8_t sensor_num, float *min, float *average,
   return sensor_read_short_history(fru, sensor_num, min, average, max, start_time);
 }
 
-static int sensor_clear_history_helper(char *shm_name, int share_size)
+int sensor_clear_history(uint8_t fru, uint8_t sensor_num)
 {
-  int fd;
-  long *shm;
-  int ret = ERR_FAILURE;
+  sensor_entry_t *e;
+  sensor_hist_t *h;
+  uint32_t seq;
 
-  fd = shm_open(shm_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
-  if (fd < 0) {
-    return ERR_FAILURE;
-  }
-  if (flock(fd, LOCK_EX) < 0) {
-    syslog(LOG_INFO, "%s: file-lock %s failed errno = %d\n", __FUNCTION__, shm_name, errno);
-    goto close_bail;
-  }
-
-  if (ftruncate(fd, share_size) != 0) {
-    syslog(LOG_INFO, "%s: truncate %s failed errno = %d\n", __FUNCTION__, shm_name, errno);
-    goto close_bail;
-  }
+  if (sensor_key_get(fru, sensor_num, NULL))
+    return ERR_UNKNOWN_FRU;
 
-  shm = (long *)mmap(NULL, share_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  if (shm == MAP_FAILED) {
-    syslog(LOG_INFO, "%s: mmap %s failed, errno = %d", __FUNCTION__, shm_name, errno);
-    goto unlock_bail;
+  e = sensor_entry_get(fru, sensor_num);
+  h = sensor_hist_get(fru, sensor_num, false);
+  if (e == NULL || h == NULL) {
+    /* Nothing was ever recorded */
+    return e == NULL ? ERR_FAILURE : 0;
   }
 
-  memset(shm, 0, share_size);
-  if (munmap(shm, share_size) != 0) {
-    syslog(LOG_INFO, "%s: munmap %s failed, errno = %d", __FUNCTION__, shm_name, errno);
-    goto unlock_bail;
-  }
-  ret = 0;
-unlock_bail:
-  if (flock(fd, LOCK_UN) < 0) {
-    syslog(LOG_INFO, "%s: file-unlock %s failed errno = %d\n", __FUNCTION__, shm_name, errno);
-    ret = -1;
-  }
-close_bail:
-  close(fd);
-  return ret;
+  /* Exclude writers of the sensor; readers see empty samples */
+  seq = sensor_entry_write_begin(e);
+  memset(h->data, 0, sizeof(h->data));
+  memset(h->summary, 0, sizeof(h->summary));
+  __atomic_store_n(&h->coarse, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->head, 0, __ATOMIC_RELEASE);
+  sensor_entry_write_end(e, seq);
+  return 0;
 }
 
-int sensor_clear_history(uint8_t fru, uint8_t sensor_num)
+int sensor_history_export(uint8_t fru, uint8_t sensor_num, void *buf, size_t len)
 {
-  char key[MAX_KEY_LEN] = {0};
-  int ret1, ret2;
-
-  if (sensor_key_get(fru, sensor_num, key))
+  sensor_hist_export_t *hdr = buf;
+  sensor_hist_point_t *pt;
+  sensor_hist_summary_t *sm;
+  sensor_hist_t *h;
+  sensor_sample_t d;
+  sensor_summary_t c;
+  uint32_t head, pos, first, idx, i, n;
+
+  if (sensor_key_get(fru, sensor_num, NULL))
     return ERR_UNKNOWN_FRU;
+  if (buf == NULL || len < SNR_HIST_EXPORT_MAX)
+    return ERR_FAILURE;
 
-  ret1 = sensor_clear_history_helper(key, sizeof(sensor_shm_t));
-  if (ret1) {
-    syslog(LOG_INFO, "Clearing history failed: %d\n", ret1);
-  }
-  if (sensor_coarse_key_get(fru, sensor_num, key))
-    return ERR_UNKNOWN_FRU;
-  ret2 = sensor_clear_history_helper(key, sizeof(sensor_coarse_shm_t));
-  if (ret2) {
-    syslog(LOG_INFO, "Clearing coarse history failed: %d\n", ret2);
-  }
-  return ret1 || ret2 ? ERR_FAILURE : 0;
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->magic = SNR_HIST_EXPORT_MAGIC;
+  hdr->version = SNR_HIST_EXPORT_VERSION;
+  hdr->fru = fru;
+  hdr->sensor_num = sensor_num;
+
+  h = sensor_hist_get(fru, sensor_num, false);
+  if (h == NULL)
+    return sizeof(*hdr);
+
+  /* Readings, oldest first */
+  pt = (sensor_hist_point_t *)(hdr + 1);
+  head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+  first = head > MAX_DATA_NUM ? head - MAX_DATA_NUM : 0;
+  n = 0;
+  for (pos = first; pos < head; pos++) {
+    if (!sensor_hist_sample(h, pos, &d))
+      continue;
+    pt[n].log_time = d.log_time;
+    pt[n].value = d.value;
+    n++;
+  }
+  hdr->samples = n;
+
+  /* Hourly summaries, oldest first */
+  sm = (sensor_hist_summary_t *)(pt + n);
+  idx = __atomic_load_n(&h->coarse, __ATOMIC_ACQUIRE);
+  n = 0;
+  for (i = 1; i <= MAX_COARSE_DATA_NUM; i++) {
+    if (!sensor_hist_summary(h, (idx + i) % MAX_COARSE_DATA_NUM, &c) ||
+        c.count == 0)
+      continue;
+    sm[n].log_time = c.log_time;
+    sm[n].count = c.count;
+    sm[n].min = c.min;
+    sm[n].max = c.max;
+    sm[n].avg = c.sum / c.count;
+    n++;
+  }
+  hdr->summaries = n;
+
+  return (uint8_t *)(sm + n) - (uint8_t *)buf;
 }
 
 int __attribute__((weak))
@@ -568,6 +774,16 @@ pal_get_sensor_poll_interval(uint8_t fru, uint8_t sensor_num, uint32_t *value)
   return PAL_EOK;
 }
 
+/*
+ * Sub-second poll interval for sensord. Unsupported by default, in which
+ * case sensord uses pal_get_sensor_poll_interval() in seconds.
+ */
+int __attribute__((weak))
+pal_get_sensor_poll_interval_ms(uint8_t fru, uint8_t sensor_num, uint32_t *value)
+{
+  return PAL_ENOTSUP;
+}
+
 int __attribute__((weak))
 pal_get_fru_discrete_list(uint8_t fru, uint8_t **sensor_list, int *cnt)
 {
@@ -699,6 +915,12 @@ pal_sensor_sdr_init(uint8_t fru, void *sinfo)
   return -1;
 }
 
+int __attribute__((weak))
+pal_get_fru_sdr_path(uint8_t fru, char *path)
+{
+  return PAL_ENOTSUP;
+}
+
 int __attribute__((weak))
 pal_get_all_thresh_from_file(uint8_t fru, thresh_sensor_t *sinfo, int mode) {
   int fd;
@@ -27,6 +27,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /* Error codes returned */
 #define ERR_UNKNOWN_FRU -1
@@ -69,17 +70,55 @@ typedef struct {
 #define AGGREGATE_SENSOR_FRU_ID   0xff
 #define AGGREGATE_SENSOR_FRU_NAME "aggregate"
 
+/* Number of readings kept in the fine grained history */
+#define MAX_DATA_NUM 2000
 /* Store enough coarse data for 30 days, configurable */
 #define MAX_COARSE_DATA_NUM (30 * 24)
 /* Any history more than an hour, loses its granularity and
  * it starts to get accounted in the COARSE grained calculations */
 #define COARSE_THRESHOLD ((double)3600)
 
+/* Binary export of the history of a sensor: this header, followed by
+ * 'samples' readings and 'summaries' hourly summaries, oldest first. */
+#define SNR_HIST_EXPORT_MAGIC   0x58454853  /* "SHEX" */
+#define SNR_HIST_EXPORT_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t fru;
+  uint8_t sensor_num;
+  uint32_t samples;
+  uint32_t summaries;
+} sensor_hist_export_t;
+
+typedef struct {
+  int32_t log_time;
+  float value;
+} sensor_hist_point_t;
+
+typedef struct {
+  int32_t log_time;
+  uint32_t count;
+  float min;
+  float max;
+  float avg;
+} sensor_hist_summary_t;
+
+#define SNR_HIST_EXPORT_MAX (sizeof(sensor_hist_export_t) + \
+    MAX_DATA_NUM * sizeof(sensor_hist_point_t) + \
+    MAX_COARSE_DATA_NUM * sizeof(sensor_hist_summary_t))
+
 /* Functions */
 
 /* Read a cached value of the given sensor */
 int sensor_cache_read(uint8_t fru, uint8_t sensor_num, float *value);
 
+/* Same as sensor_cache_read(), also returns the time the value was
+ * written, or 0 if it is not known */
+int sensor_cache_read_time(uint8_t fru, uint8_t sensor_num, float *value,
+    int64_t *log_time);
+
 /* Writes the cache explicitly */
 int sensor_cache_write(uint8_t fru, uint8_t sensor_num, bool available, float value);
 
@@ -90,6 +129,10 @@ int sensor_read_history(uint8_t fru, uint8_t sensor_num, float *min,
 /* Clear the sensor history */
 int sensor_clear_history(uint8_t fru, uint8_t sensor_num);
 
+/* Export the sensor history into buf, which must hold at least
+ * SNR_HIST_EXPORT_MAX bytes. Returns the number of bytes used. */
+int sensor_history_export(uint8_t fru, uint8_t sensor_num, void *buf, size_t len);
+
 /* Read sensor directly from the hardware. Note, this function does not
  * protect the caller from other readers. The caller should ensure
  * exclusivity. The simplest method being limiting all calls to this
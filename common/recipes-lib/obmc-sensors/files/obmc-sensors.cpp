@@ -16,7 +16,9 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <cmath>
 #include <syslog.h>
+#include "obmc-sensors.h"
 #include "sensorlist.hpp"
 
 #ifndef SENSOR_CONF
@@ -24,68 +26,148 @@
 #endif
 SensorList sensors(SENSOR_CONF);
 
-extern "C" int sensors_read(const char *chip, const char *label, float *value)
+static const char *fan_chip()
+{
+  if (sensors.find("aspeed_pwm_tacho-isa-0000") != sensors.end()) {
+    return "aspeed_pwm_tacho-isa-0000";
+  }
+  return "ast_pwm-isa-0000";
+}
+
+static const char *adc_chip()
+{
+  if (sensors.find("iio_hwmon-isa-0000") != sensors.end()) {
+    return "iio_hwmon-isa-0000";
+  }
+  return "ast_adc-isa-0000";
+}
+
+static Sensor *to_sensor(sensors_handle_t *handle)
+{
+  return reinterpret_cast<Sensor *>(handle);
+}
+
+extern "C" sensors_handle_t *sensors_get_handle(const char *chip, const char *label)
+{
+  if (!chip || !label) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  try {
+    return reinterpret_cast<sensors_handle_t *>(sensors.at(chip)->at(label).get());
+  } catch (std::out_of_range &e) {
+    syslog(LOG_ERR, "Lookup(%s:%s): Out of range exception: %s\n", chip, label, e.what());
+  }
+  errno = ENOENT;
+  return nullptr;
+}
+
+extern "C" sensors_handle_t *sensors_get_fan_handle(const char *label)
+{
+  return sensors_get_handle(fan_chip(), label);
+}
+
+extern "C" sensors_handle_t *sensors_get_adc_handle(const char *label)
+{
+  return sensors_get_handle(adc_chip(), label);
+}
+
+extern "C" int sensors_read_handle(sensors_handle_t *handle, float *value)
 {
   int ret = -1;
-  if (!chip || !label || !value) {
+  if (!handle || !value) {
     errno = EINVAL;
     return -1;
   }
 
+  Sensor *snr = to_sensor(handle);
   try {
-    *value = sensors.at(chip)->at(label)->read();
+    *value = snr->read();
     ret = 0;
-  } catch (std::out_of_range &e) {
-    syslog(LOG_ERR, "Read(%s:%s): Out of range exception: %s\n", chip, label, e.what());
   } catch (std::system_error &e) {
-    syslog(LOG_ERR, "Read(%s:%s): System error: %s - %s\n", chip, label, e.code().message().c_str(), e.what());
+    syslog(LOG_ERR, "Read(%s:%s): System error: %s - %s\n", snr->get_chip_path(),
+        snr->get_label().c_str(), e.code().message().c_str(), e.what());
   } catch (...) {
-    syslog(LOG_CRIT, "Read(%s:%s) Unknown error", chip, label);
+    syslog(LOG_CRIT, "Read(%s:%s) Unknown error", snr->get_chip_path(), snr->get_label().c_str());
   }
   return ret;
 }
 
-extern "C" int sensors_write(const char *chip, const char *label, float value)
+extern "C" int sensors_write_handle(sensors_handle_t *handle, float value)
 {
   int ret = -1;
-  if (!chip || !label || !value) {
+  if (!handle) {
     errno = EINVAL;
     return -1;
   }
+
+  Sensor *snr = to_sensor(handle);
   try {
-    sensors.at(chip)->at(label)->write(value);
+    snr->write(value);
     ret = 0;
-  } catch (std::out_of_range &e) {
-    syslog(LOG_ERR, "Write(%s:%s): Out of range exception: %s\n", chip, label, e.what());
   } catch (std::system_error &e) {
-    syslog(LOG_ERR, "Write(%s:%s): System error: %s - %s\n", chip, label, e.code().message().c_str(), e.what());
+    syslog(LOG_ERR, "Write(%s:%s): System error: %s - %s\n", snr->get_chip_path(),
+        snr->get_label().c_str(), e.code().message().c_str(), e.what());
   } catch (...) {
-    syslog(LOG_CRIT, "Write(%s:%s) Unknown error", chip, label);
+    syslog(LOG_CRIT, "Write(%s:%s) Unknown error", snr->get_chip_path(), snr->get_label().c_str());
   }
   return ret;
 }
 
-extern "C" int sensors_read_fan(const char *label, float *value)
+extern "C" int sensors_read_handles(sensors_handle_t *const *handles, float *values, int cnt)
 {
-  if (sensors.find("aspeed_pwm_tacho-isa-0000") != sensors.end()) {
-    return sensors_read("aspeed_pwm_tacho-isa-0000", label, value);
+  int failed = 0;
+  if (!handles || !values || cnt < 0) {
+    errno = EINVAL;
+    return -1;
   }
-  return sensors_read("ast_pwm-isa-0000", label, value);
+
+  for (int i = 0; i < cnt; i++) {
+    if (!handles[i] || sensors_read_handle(handles[i], &values[i])) {
+      values[i] = NAN;
+      failed++;
+    }
+  }
+  return failed;
 }
 
-extern "C" int sensors_write_fan(const char *label, float value)
+extern "C" int sensors_read(const char *chip, const char *label, float *value)
 {
-  if (sensors.find("aspeed_pwm_tacho-isa-0000") != sensors.end()) {
-    return sensors_write("aspeed_pwm_tacho-isa-0000", label, value);
+  if (!chip || !label || !value) {
+    errno = EINVAL;
+    return -1;
+  }
+  sensors_handle_t *handle = sensors_get_handle(chip, label);
+  if (!handle) {
+    return -1;
   }
-  return sensors_write("ast_pwm-isa-0000", label, value);
+  return sensors_read_handle(handle, value);
 }
 
-extern "C" int sensors_read_adc(const char *label, float *value)
+extern "C" int sensors_write(const char *chip, const char *label, float value)
 {
-  if (sensors.find("iio_hwmon-isa-0000") != sensors.end()) {
-    return sensors_read("iio_hwmon-isa-0000", label, value);
+  if (!chip || !label || !value) {
+    errno = EINVAL;
+    return -1;
+  }
+  sensors_handle_t *handle = sensors_get_handle(chip, label);
+  if (!handle) {
+    return -1;
   }
-  return sensors_read("ast_adc-isa-0000", label, value);
+  return sensors_write_handle(handle, value);
+}
+
+extern "C" int sensors_read_fan(const char *label, float *value)
+{
+  return sensors_read(fan_chip(), label, value);
+}
+
+extern "C" int sensors_write_fan(const char *label, float value)
+{
+  return sensors_write(fan_chip(), label, value);
 }
 
+extern "C" int sensors_read_adc(const char *label, float *value)
+{
+  return sensors_read(adc_chip(), label, value);
+}
@@ -36,6 +36,24 @@
 extern "C" {
 #endif
 
+// Opaque handle to a chip's sensor. Valid for the life of the process.
+typedef struct sensors_handle sensors_handle_t;
+
+// Look up the sensor once, so that it can be read without the name
+// lookups. Returns NULL (errno set) if the chip or label does not exist.
+sensors_handle_t *sensors_get_handle(const char *chip, const char *label);
+
+// Look up a fan (fan1-fanN, pwm1-pwmN) or ADC sensor
+sensors_handle_t *sensors_get_fan_handle(const char *label);
+sensors_handle_t *sensors_get_adc_handle(const char *label);
+
+// Read/write the sensor behind the handle
+int sensors_read_handle(sensors_handle_t *handle, float *value);
+int sensors_write_handle(sensors_handle_t *handle, float value);
+
+// Read cnt sensors in one call. Sensors which could not be read
+// (or NULL handles) get a NAN value. Returns the number of failures.
+int sensors_read_handles(sensors_handle_t *const *handles, float *values, int cnt);
 
 // Read the given chip's sensor value
 int sensors_read(const char *chip, const char *label, float *value);
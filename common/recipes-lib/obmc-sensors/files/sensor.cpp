@@ -16,11 +16,76 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 #include <map>
+#include <cmath>
+#include <cstdlib>
+#include <fcntl.h>
 #include <syslog.h>
+#include <unistd.h>
 #include "sensor.hpp"
 
 using namespace std;
 
+void SysfsAttr::open_fd()
+{
+  fd = ::open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+  if (fd < 0) {
+    throw system_error(errno, std::generic_category(), "Open " + path);
+  }
+}
+
+void SysfsAttr::close_fd()
+{
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+void SysfsAttr::close()
+{
+  lock_guard<mutex> guard(lock);
+  close_fd();
+}
+
+double SysfsAttr::read()
+{
+  char buf[32];
+  char *end;
+  ssize_t len;
+  lock_guard<mutex> guard(lock);
+
+  if (fd < 0) {
+    open_fd();
+  }
+  len = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (len < 0) {
+    int err = errno;
+    close_fd();
+    throw system_error(err, std::generic_category(), "Read " + path);
+  }
+  buf[len] = '\0';
+  double val = strtod(buf, &end);
+  if (end == buf) {
+    throw system_error(EIO, std::generic_category(), "Invalid value in " + path);
+  }
+  return val;
+}
+
+void SysfsAttr::write(long val)
+{
+  string str = to_string(val) + "\n";
+  lock_guard<mutex> guard(lock);
+
+  if (fd < 0) {
+    open_fd();
+  }
+  if (pwrite(fd, str.c_str(), str.size(), 0) < 0) {
+    int err = errno;
+    close_fd();
+    throw system_error(err, std::generic_category(), "Write " + path);
+  }
+}
+
 void Sensor::initialize()
 {
   const std::map<sensors_feature_type, sensors_subfeature_type> interested_subfeatures = {
@@ -67,8 +132,47 @@ void Sensor::initialize()
 	if (subfeature == nullptr) {
     throw system_error(ENOENT, std::generic_category(), "Sensor Read Failure");
 	}
+  input.set_path(string(chip->path) + "/" + subfeature->name);
 }
 
+// libsensors reads the input attribute, divides it by a scale depending
+// on the type and applies the "compute" statement of the configuration,
+// if any. There is no API to tell whether a compute statement exists, so
+// compare the value libsensors returned against the raw attribute. A zero
+// or changing reading cannot tell, so try again on the next read.
+void Sensor::probe_direct_read(double value)
+{
+  const std::map<sensors_feature_type, double> scales = {
+    {SENSORS_FEATURE_IN, 1000.0},
+    {SENSORS_FEATURE_FAN, 1.0},
+    {SENSORS_FEATURE_TEMP, 1000.0},
+    {SENSORS_FEATURE_POWER, 1000000.0},
+    {SENSORS_FEATURE_ENERGY, 1000000.0},
+    {SENSORS_FEATURE_CURR, 1000.0},
+    {SENSORS_FEATURE_HUMIDITY, 1000.0}
+  };
+  double raw, check;
+
+  try {
+    raw = input.read();
+    if (sensors_get_value(chip, subfeature->number, &check) ||
+        check != value || raw != input.read()) {
+      return;
+    }
+  } catch (std::system_error &e) {
+    return;
+  }
+  if (raw == 0) {
+    return;
+  }
+  double s = scales.at(feature->type);
+  if (fabs(raw / s - value) <= fabs(value) * 1e-6) {
+    scale = s;
+  } else {
+    scale = -1;
+    input.close();
+  }
+}
 
 float Sensor::read()
 {
@@ -76,9 +180,15 @@ float Sensor::read()
   if (subfeature == nullptr) {
     throw system_error(ENOTSUP, std::generic_category(), "Sensor feature not supported");
   }
+  if (scale > 0) {
+    return float(input.read() / scale);
+  }
   if (sensors_get_value(chip, subfeature->number, &value)) {
     throw system_error(EIO, std::generic_category(), "Sensor Read Failure");
   }
+  if (scale == 0) {
+    probe_direct_read(value);
+  }
   return float(value);
 }
 
@@ -95,26 +205,19 @@ void Sensor::write(float value)
 
 void PWMSensor::initialize()
 {
-  path = string(chip->path) + "/" + name;
+  pwm.set_path(string(chip->path) + "/" + name, true);
 }
 
 float PWMSensor::read()
 {
-	InFile file;
-  file.open(path);
-  int val;
-  file >> val;
-  file.close();
+  int val = int(pwm.read());
   return float(val) * 100.0 / 255.0;
 }
 
 void PWMSensor::write(float value)
 {
-  OutFile file;
   int val = int(value * 255.0 / 100.0);
-  file.open(path);
-  file << val << endl;
-  file.close();
+  pwm.write(val);
 }
 
 int LegacyPWMSensor::unit_max()
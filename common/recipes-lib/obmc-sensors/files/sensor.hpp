@@ -19,6 +19,7 @@
 #define _SENSOR_HPP_
 #include <string>
 #include <fstream>
+#include <mutex>
 #include <system_error>
 #include <sensors/sensors.h>
 
@@ -38,6 +39,37 @@ class InFile : public std::ifstream {
     }
 };
 
+// sysfs attribute which is kept open between accesses. Every read
+// re-reads the attribute from offset 0, so the cost is a single pread()
+// instead of open/read/close. The file is reopened after an error, in
+// case the device went away and came back.
+class SysfsAttr {
+  std::string path;
+  bool writable;
+  int fd;
+  std::mutex lock;
+  void open_fd();
+  void close_fd();
+  public:
+    SysfsAttr() : path(), writable(false), fd(-1), lock() {}
+    ~SysfsAttr() {close();}
+
+    // Set the path of the attribute. It is opened on first use.
+    void set_path(const std::string &_path, bool _writable = false) {
+      close();
+      path = _path;
+      writable = _writable;
+    }
+
+    // Read the attribute as a number
+    double read();
+
+    // Write an integer value to the attribute
+    void write(long val);
+
+    void close();
+};
+
 // Sensor capable of reading/writing sensor values.
 // Not all sensors might support writing.
 class Sensor {
@@ -47,9 +79,17 @@ class Sensor {
   const sensors_subfeature *subfeature;
   std::string name;
   std::string label;
+  // Input attribute of the subfeature, read directly when the value
+  // libsensors computes is the raw value divided by scale.
+  // scale is 0 until that has been checked, and negative when the
+  // value has to go through libsensors.
+  SysfsAttr input;
+  double scale;
+  void probe_direct_read(double value);
   public:
     Sensor(const sensors_chip_name *_c, const sensors_feature *_feature)
-      : chip(_c), feature(_feature), subfeature(nullptr), name(), label("") {}
+      : chip(_c), feature(_feature), subfeature(nullptr), name(), label(""),
+        input(), scale(0) {}
     virtual ~Sensor() {}
 
     // Initialize a sensor.
@@ -58,6 +98,9 @@ class Sensor {
     // Get the label
     std::string get_label() {return label;}
 
+    // Get the sysfs path of the chip
+    const char *get_chip_path() {return chip->path;}
+
     // Reads the current value of the sensor
     virtual float read();
 
@@ -69,10 +112,10 @@ class Sensor {
 // 4.18 kernels and above
 class PWMSensor : public Sensor {
   protected:
-  std::string path;
+  SysfsAttr pwm;
   public:
     PWMSensor(const sensors_chip_name *fanchip, const std::string &_name)
-      : Sensor(fanchip, nullptr), path() {name = _name; label = _name;}
+      : Sensor(fanchip, nullptr), pwm() {name = _name; label = _name;}
     virtual ~PWMSensor() {}
 
     // Initialize a sensor.
@@ -29,6 +29,7 @@
 #include <stddef.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <openbmc/ncsi.h>
@@ -319,6 +320,13 @@ void pldmCreateUpdateComponentCmd(pldm_fw_pkg_hdr_t *pFwPkgHdr, uint8_t compIdx,
 
   printf("\n\nCMD_UPDATE_COMPONENT\n");
 
+  // RequestFirmwareData that follows refers to this component
+  pFwPkgHdr->curComp = compIdx;
+  memset(&pFwPkgHdr->progress, 0, sizeof(pFwPkgHdr->progress));
+  pFwPkgHdr->progress.compIdx = compIdx;
+  pFwPkgHdr->progress.compCnt = pFwPkgHdr->componentImageCnt;
+  pFwPkgHdr->progress.size = pCompImgInfo->size;
+
   genReqCommonFields(PLDM_TYPE_FIRMWARE_UPDATE, CMD_UPDATE_COMPONENT, &(pPldmCdb->common[0]));
 
   pCmdPayload->class = pCompImgInfo->class;
@@ -360,6 +368,15 @@ void pldmCreateActivateFirmwareCmd(pldm_cmd_req *pPldmCdb)
 }
 
 
+void pldmCreateCancelUpdateCmd(pldm_cmd_req *pPldmCdb)
+{
+  printf("\n\nCMD_CANCEL_UPDATE\n");
+
+  genReqCommonFields(PLDM_TYPE_FIRMWARE_UPDATE, CMD_CANCEL_UPDATE, &(pPldmCdb->common[0]));
+  pPldmCdb->payload_size = PLDM_COMMON_REQ_LEN;
+}
+
+
 // helper function to check if a given UUID is a PLDM FW Package
 int isPldmFwUuid(char *uuid)
 {
@@ -480,9 +497,38 @@ void printComponentImgInfo(pldm_fw_pkg_hdr_t *pFwPkgHdr, int index)
 }
 
 
+// CRC-32 (ISO 3309, as used by zlib) as required for the package header
+// checksum in DSP0267. Call with crc = 0 to start, feed further blocks
+// with the previous result.
+static uint32_t
+pldm_crc32(uint32_t crc, const unsigned char *buf, size_t len)
+{
+  static uint32_t table[256];
+  static int tableInit = 0;
+  uint32_t c;
+  int i, j;
+
+  if (!tableInit) {
+    for (i = 0; i < 256; i++) {
+      c = i;
+      for (j = 0; j < 8; j++)
+        c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+      table[i] = c;
+    }
+    tableInit = 1;
+  }
+
+  crc = ~crc;
+  while (len--)
+    crc = table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+
 // Given a PLDM Firmware package, this function will
 //  1. allocate a pldm_fw_pkg_hdr_t structure representing this package,
-//  2. read PLDM firmware package to RAM
+//  2. map PLDM firmware package read-only, component data is paged in
+//     from the file as it is transferred rather than copied to RAM
 //  3. initialize header info area of pldm_fw_pkg_hdr_t
 //  4. returns
 //       1. pointer to the struct,
@@ -491,48 +537,50 @@ void printComponentImgInfo(pldm_fw_pkg_hdr_t *pFwPkgHdr, int index)
 int
 init_pkg_hdr_info(char *path, pldm_fw_pkg_hdr_t** pFwPkgHdr, int *pOffset)
 {
-  FILE *fp;
-  int rcnt, size;
+  int fd;
+  size_t size;
   struct stat buf;
+  void *map;
 
   // Open the file exclusively for read
-  fp = fopen(path, "r");
-  if (!fp) {
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
     printf("ERROR: invalid file path :%s!\n", path);
     return -1;
   }
 
-  stat(path, &buf);
+  if (fstat(fd, &buf) < 0) {
+    printf("ERROR: stat %s failed, errno=%d\n", path, errno);
+    close(fd);
+    return -1;
+  }
   size = buf.st_size;
-  printf("size of file is %d bytes\n", size);
+  printf("size of file is %zu bytes\n", size);
+  if (size < offsetof(pldm_fw_pkg_hdr_info_t, versionString)) {
+    printf("ERROR: %s is too small for a PLDM package\n", path);
+    close(fd);
+    return -1;
+  }
 
   // allocate pointer structure to access fw pkg header
   *pFwPkgHdr = (pldm_fw_pkg_hdr_t *)calloc(1, sizeof(pldm_fw_pkg_hdr_t));
   if (!(*pFwPkgHdr)) {
-    printf("ERROR: pFwPkgHdr malloc failed, size %d\n", sizeof(pldm_fw_pkg_hdr_t));
-    fclose(fp);
+    printf("ERROR: pFwPkgHdr malloc failed, size %zu\n", sizeof(pldm_fw_pkg_hdr_t));
+    close(fd);
     return -1;
   }
 
-  // allocate actual buffer to store fw package header
-  (*pFwPkgHdr)->rawHdrBuf = (unsigned char *)calloc(1, size);
-  if (!(*pFwPkgHdr)->rawHdrBuf) {
-    printf("ERROR: rawHdrBuf malloc failed, size %d\n", size);
-    fclose(fp);
+  // the mapping stays valid after the fd is closed
+  map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    printf("ERROR: mmap %s failed, size %zu, errno=%d\n", path, size, errno);
     return -1;
   }
-
-  // Move the file pointer to the start and read the entire package header
-  fseek(fp, 0, SEEK_SET);
-  rcnt = fread((*pFwPkgHdr)->rawHdrBuf, 1, size, fp);
-  if (rcnt < size) {
-    printf("ERROR: rawHdrBuf read, rcnt(%d) < %d", rcnt,
-           size);
-    fclose(fp);
-    return -1;
-  }
-  fclose(fp);
-
+  // components are read front to back, pages behind can be dropped
+  madvise(map, size, MADV_SEQUENTIAL);
+  (*pFwPkgHdr)->rawHdrBuf = (unsigned char *)map;
+  (*pFwPkgHdr)->pkgSize = size;
 
   (*pFwPkgHdr)->phdrInfo = (pldm_fw_pkg_hdr_info_t *)(*pFwPkgHdr)->rawHdrBuf;
   printHdrInfo((*pFwPkgHdr)->phdrInfo, 1);
@@ -557,6 +605,10 @@ init_device_id_records(pldm_fw_pkg_hdr_t* pFwPkgHdr, int *pOffset)
 {
   int i;
 
+  if (*pOffset >= pFwPkgHdr->pkgSize) {
+    printf("ERROR: device ID area at 0x%x exceeds package size\n", *pOffset);
+    return -1;
+  }
   pFwPkgHdr->devIdRecordCnt = pFwPkgHdr->rawHdrBuf[*pOffset];
   *pOffset += sizeof(pFwPkgHdr->devIdRecordCnt);
   DBG_PRINT("\n\n Number of Device ID Record in package (devIdRecordCnt) =%d\n",
@@ -589,6 +641,10 @@ init_device_id_records(pldm_fw_pkg_hdr_t* pFwPkgHdr, int *pOffset)
     //    that are variable length
     int  subOffset = *pOffset;
 
+    if (subOffset + sizeof(pldm_fw_dev_id_records_fixed_len_t) > pFwPkgHdr->pkgSize) {
+      printf("ERROR: devRec[%d] at 0x%x exceeds package size\n", i, subOffset);
+      return -1;
+    }
     pDevIdRec->pRecords = (pldm_fw_dev_id_records_fixed_len_t *)(pFwPkgHdr->rawHdrBuf + subOffset);
     subOffset += sizeof(pldm_fw_dev_id_records_fixed_len_t);
     pDevIdRec->pApplicableComponents = (uint8_t *)(pFwPkgHdr->rawHdrBuf + subOffset);
@@ -641,7 +697,11 @@ init_component_img_info(pldm_fw_pkg_hdr_t* pFwPkgHdr, int *pOffset)
 {
   int i;
 
-  pFwPkgHdr->componentImageCnt = pFwPkgHdr->rawHdrBuf[*pOffset];
+  if (*pOffset + sizeof(pFwPkgHdr->componentImageCnt) > pFwPkgHdr->pkgSize) {
+    printf("ERROR: component area at 0x%x exceeds package size\n", *pOffset);
+    return -1;
+  }
+  pFwPkgHdr->componentImageCnt = *(uint16_t *)(pFwPkgHdr->rawHdrBuf + *pOffset);
   *pOffset += sizeof(pFwPkgHdr->componentImageCnt);
   DBG_PRINT("\n\n Number of Component in package (componentImageCnt) =%d\n",
               pFwPkgHdr->componentImageCnt);
@@ -657,9 +717,20 @@ init_component_img_info(pldm_fw_pkg_hdr_t* pFwPkgHdr, int *pOffset)
   }
   for (i=0; i<pFwPkgHdr->componentImageCnt; ++i)
   {
+    if (*pOffset + offsetof(pldm_component_img_info_t, versionString) >
+        pFwPkgHdr->pkgSize) {
+      printf("ERROR: Component[%d] at 0x%x exceeds package size\n", i, *pOffset);
+      return -1;
+    }
     pFwPkgHdr->pCompImgInfo[i] = (pldm_component_img_info_t *)(pFwPkgHdr->rawHdrBuf + *pOffset);
     printComponentImgInfo(pFwPkgHdr, i);
 
+    if ((uint64_t)pFwPkgHdr->pCompImgInfo[i]->locationOffset +
+        pFwPkgHdr->pCompImgInfo[i]->size > pFwPkgHdr->pkgSize) {
+      printf("ERROR: Component[%d] image exceeds package size\n", i);
+      return -1;
+    }
+
     // move pointer to next Component image, taking int account of variable
     //  version size
     *pOffset += offsetof(pldm_component_img_info_t, versionString) +
@@ -695,7 +766,7 @@ free_pldm_pkg_data(pldm_fw_pkg_hdr_t **pFwPkgHdr)
     free((*pFwPkgHdr)->pCompImgInfo);
   }
   if ((*pFwPkgHdr)->rawHdrBuf) {
-    free((*pFwPkgHdr)->rawHdrBuf);
+    munmap((*pFwPkgHdr)->rawHdrBuf, (*pFwPkgHdr)->pkgSize);
   }
   free(*pFwPkgHdr);
   return;
@@ -709,7 +780,8 @@ pldm_parse_fw_pkg(char *path) {
   int offset = 0;
 
   // firmware package header
-  pldm_fw_pkg_hdr_t *pFwPkgHdr;
+  pldm_fw_pkg_hdr_t *pFwPkgHdr = NULL;
+  uint32_t chksum;
 
   // initialize pFwPkgHdr access pointer as fw package header contains
   // multiple variable size fields
@@ -734,9 +806,18 @@ pldm_parse_fw_pkg(char *path) {
   }
 
   // pkg header checksum
+  if (offset + sizeof(uint32_t) > pFwPkgHdr->pkgSize) {
+    printf("ERROR: header checksum at 0x%x exceeds package size\n", offset);
+    goto error_exit;
+  }
   pFwPkgHdr->pkgHdrChksum = *(uint32_t *)(pFwPkgHdr->rawHdrBuf+ offset);
+  chksum = pldm_crc32(0, pFwPkgHdr->rawHdrBuf, offset);
   offset += sizeof(uint32_t);
   printf("\n\nPDLM Firmware Package Checksum=0x%x\n", pFwPkgHdr->pkgHdrChksum);
+  if (chksum != pFwPkgHdr->pkgHdrChksum) {
+    printf("ERROR: header checksum mismatch, calculated 0x%x\n", chksum);
+    goto error_exit;
+  }
 
   if (pFwPkgHdr->phdrInfo->headerSize != offset) {
     printf("ERROR: header size(0x%x) and processed data (0x%x) mismatch\n",
@@ -752,46 +833,80 @@ error_exit:
   return 0;
 }
 
-static
-int handlePldmReqFwData(pldm_fw_pkg_hdr_t *pkgHdr, pldm_cmd_req *pCmd, pldm_response *pldmRes)
+// Report a change in transfer progress to the registered callback
+static void
+notifyFwProgress(pldm_fw_pkg_hdr_t *pkgHdr)
 {
-  PLDM_RequestFWData_t *pReqDataCmd = (PLDM_RequestFWData_t *)pCmd->payload;
-  // for now assumes  it's always component 0
-  unsigned char *pComponent =
-       (unsigned char*)(pkgHdr->rawHdrBuf + pkgHdr->pCompImgInfo[0]->locationOffset);
-  uint32_t componentSize = pkgHdr->pCompImgInfo[0]->size;
+  // pldm_fw_pkg_hdr_t is packed, hand out an aligned copy
+  pldm_fw_progress_t progress = pkgHdr->progress;
 
-  // calculate how much FW data is left to transfer and if any padding is needed
-  int compBytesLeft = componentSize - pReqDataCmd->offset;
-  int numPaddingNeeded = pReqDataCmd->length > compBytesLeft ?
-                   (pReqDataCmd->length - compBytesLeft) : 0;
+  if (pkgHdr->progressCb)
+    pkgHdr->progressCb(&progress, pkgHdr->progressArg);
+}
 
+void
+pldm_set_fw_progress_cb(pldm_fw_pkg_hdr_t *pFwPkgHdr, pldm_fw_progress_cb cb,
+                        void *arg)
+{
+  pFwPkgHdr->progressCb = cb;
+  pFwPkgHdr->progressArg = arg;
+}
 
+static
+int handlePldmReqFwData(pldm_fw_pkg_hdr_t *pkgHdr, pldm_cmd_req *pCmd, pldm_response *pldmRes)
+{
+  PLDM_RequestFWData_t *pReqDataCmd = (PLDM_RequestFWData_t *)pCmd->payload;
+  // data is served from the component last sent in UpdateComponent
+  pldm_component_img_info_t *pCompImgInfo = pkgHdr->pCompImgInfo[pkgHdr->curComp];
+  const unsigned char *pComponent = pkgHdr->rawHdrBuf + pCompImgInfo->locationOffset;
+  uint32_t componentSize = pCompImgInfo->size;
+  uint32_t offset = pReqDataCmd->offset;
+  uint32_t length = pReqDataCmd->length;
+  uint32_t compBytesLeft, dataLen;
 
-  printf("%s offset = 0x%x, length = 0x%x, compBytesLeft=%d, numPadding=%d\n",
-         __FUNCTION__, pReqDataCmd->offset, pReqDataCmd->length, compBytesLeft,
-         numPaddingNeeded);
   memcpy(pldmRes->common, pCmd->common, PLDM_COMMON_REQ_LEN);
   // clear Req bit in PLDM response header
   pldmRes->common[PLDM_IID_OFFSET] &= PLDM_RESP_MASK;
-  // hard code success for now, need to check length in the future
-  pldmRes->common[PLDM_CC_OFFSET] = CC_SUCCESS;
+  pldmRes->resp_size = PLDM_COMMON_RES_LEN;
 
+  if (offset >= componentSize) {
+    printf("%s offset 0x%x beyond component[%d] size 0x%x\n", __FUNCTION__,
+           offset, pkgHdr->curComp, componentSize);
+    pldmRes->common[PLDM_CC_OFFSET] = CC_DATA_OUT_OF_RANGE;
+    return 0;
+  }
+  if (length == 0 || length > gPldm_transfer_size) {
+    printf("%s invalid length 0x%x\n", __FUNCTION__, length);
+    pldmRes->common[PLDM_CC_OFFSET] = CC_INVALID_TRANSFER_LENTH;
+    return 0;
+  }
+  pldmRes->common[PLDM_CC_OFFSET] = CC_SUCCESS;
 
-  if (numPaddingNeeded > 0) {
-    printf("%s %d bytes padding added\n", __FUNCTION__, numPaddingNeeded);
-    memcpy(pldmRes->response, pComponent + pReqDataCmd->offset, compBytesLeft);
-    memset(pldmRes->response + compBytesLeft, 0, numPaddingNeeded);
-  } else {
-    memcpy(pldmRes->response, pComponent + pReqDataCmd->offset, pReqDataCmd->length);
+  // copy straight from the package mapping, the device may read past the
+  // end of the component and expects zero padding there
+  compBytesLeft = componentSize - offset;
+  dataLen = length > compBytesLeft ? compBytesLeft : length;
+  memcpy(pldmRes->response, pComponent + offset, dataLen);
+  if (dataLen < length) {
+    memset(pldmRes->response + dataLen, 0, length - dataLen);
+  }
+  pldmRes->resp_size = PLDM_COMMON_RES_LEN + length;
+
+  // checksum the component as it goes out, retried chunks are not
+  // counted again
+  if (offset == pkgHdr->progress.offset) {
+    pkgHdr->progress.crc32 = pldm_crc32(pkgHdr->progress.crc32,
+                                        pComponent + offset, dataLen);
+    pkgHdr->progress.offset += dataLen;
+    notifyFwProgress(pkgHdr);
   }
-  pldmRes->resp_size = PLDM_COMMON_RES_LEN + pReqDataCmd->length;
 
   return 0;
 }
 
 static
-int handlePldmFwTransferComplete(pldm_cmd_req *pCmd, pldm_response *pRes)
+int handlePldmFwTransferComplete(pldm_fw_pkg_hdr_t *pkgHdr, pldm_cmd_req *pCmd,
+                                 pldm_response *pRes)
 {
   PLDM_TransferComplete_t *pReqDataCmd = (PLDM_TransferComplete_t *)pCmd->payload;
   int ret = 0;
@@ -801,6 +916,10 @@ int handlePldmFwTransferComplete(pldm_cmd_req *pCmd, pldm_response *pRes)
     ret = -1;
   }
 
+  pkgHdr->progress.done = 1;
+  pkgHdr->progress.result = pReqDataCmd->transferResult;
+  notifyFwProgress(pkgHdr);
+
   memcpy(pRes->common, pCmd->common, PLDM_COMMON_REQ_LEN);
   // clear Req bit in PLDM response header
   pRes->common[PLDM_IID_OFFSET] &= PLDM_RESP_MASK;
@@ -863,7 +982,7 @@ int pldmFwUpdateCmdHandler(pldm_fw_pkg_hdr_t *pkgHdr, pldm_cmd_req *pCmd, pldm_r
     case CMD_TRANSFER_COMPLETE:
       printf("handle CMD_TRANSFER_COMPLETE\n");
       dbgPrintCdb(pCmd);
-      ret = handlePldmFwTransferComplete(pCmd, pRes);
+      ret = handlePldmFwTransferComplete(pkgHdr, pCmd, pRes);
       break;
     case CMD_VERIFY_COMPLETE:
       printf("handle CMD_VERIFY_COMPLETE\n");
@@ -56,6 +56,8 @@ void genReqCommonFields(PldmType type, PldmFWCmds cmd, uint8_t *common);
 void dbgPrintCdb(pldm_cmd_req *cdb);
 
 void free_pldm_pkg_data           (pldm_fw_pkg_hdr_t **pFwPkgHdr);
+void pldm_set_fw_progress_cb      (pldm_fw_pkg_hdr_t *pFwPkgHdr,
+                                   pldm_fw_progress_cb cb, void *arg);
 void pldmCreateReqUpdateCmd       (pldm_fw_pkg_hdr_t *pFwPkgHdr,
                                    pldm_cmd_req *pPldmCdb,
                                    int pldm_bufsize);
@@ -64,6 +66,7 @@ void pldmCreatePassComponentTblCmd(pldm_fw_pkg_hdr_t *pFwPkgHdr, uint8_t compIdx
 void pldmCreateUpdateComponentCmd (pldm_fw_pkg_hdr_t *pFwPkgHdr, uint8_t compIdx,
                                    pldm_cmd_req *pPldmCdb);
 void pldmCreateActivateFirmwareCmd(pldm_cmd_req *pPldmCdb);
+void pldmCreateCancelUpdateCmd    (pldm_cmd_req *pPldmCdb);
 
 void pldmCreateGetVersionCmd(uint8_t pldmType, pldm_cmd_req *pPldmCdb);
 void pldmHandleGetVersionResp(PLDM_GetPldmVersion_Response_t *pPldmResp,
@@ -180,11 +180,27 @@ typedef struct {
 } __attribute__((packed)) pldm_component_img_info_t;
 
 
+// Progress of a component transfer, reported through the callback set
+// with pldm_set_fw_progress_cb()
+typedef struct {
+  uint16_t compIdx;
+  uint16_t compCnt;
+  uint32_t offset;   // bytes of the component transferred in order so far
+  uint32_t size;     // component size
+  uint32_t crc32;    // CRC-32 of the first offset bytes of the component
+  uint8_t  done;     // set once the device sent TransferComplete
+  uint8_t  result;   // transferResult of TransferComplete
+} pldm_fw_progress_t;
+
+typedef void (*pldm_fw_progress_cb)(const pldm_fw_progress_t *progress, void *arg);
+
+
 // defines PLDM firmwar package header structure,
 //  figure 5 on DSP0267 1.0.0
 //  detailed layout in Table 3
 typedef struct {
-  unsigned char *rawHdrBuf; // unparsed hdr buffer data bytes
+  unsigned char *rawHdrBuf; // read-only mapping of the whole package
+  size_t pkgSize;           // size of the mapping
 
   // Use pointers for acccessing/interpreting hdr buffer above
 
@@ -201,6 +217,12 @@ typedef struct {
 
   // package header checksum area
   uint32_t pkgHdrChksum;
+
+  // component being transferred, set by pldmCreateUpdateComponentCmd()
+  uint16_t curComp;
+  pldm_fw_progress_t progress;
+  pldm_fw_progress_cb progressCb;
+  void *progressArg;
 } __attribute__((packed)) pldm_fw_pkg_hdr_t;
 
 #define PLDM_MAX_XFER_SIZE (MAX_PLDM_MSG_SIZE - PLDM_COMMON_RES_LEN)
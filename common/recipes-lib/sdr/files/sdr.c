@@ -29,6 +29,9 @@
 #include <syslog.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <openbmc/pal_sensors.h>
 #include "sdr.h"
 
 #define FIELD_RATE_UNIT(x)  ((x & (0x07 << 3)) >> 3)
@@ -46,6 +49,47 @@
 #endif
 
 #define MAX_NAME_LEN        16
+#define MAX_FRU_ID          256
+
+/*
+ * Per sensor data derived from the SDR once, when the SDR of a FRU is
+ * loaded, instead of on every lookup.
+ */
+typedef struct {
+  bool valid;
+  bool units_set;     /* units is meaningful, see _sdr_get_sensor_units() */
+  bool name_set;
+  int name_ret;
+  char name[48];
+  char units[64];
+  /* y = (m * x + b) * r */
+  uint16_t m;
+  double b;
+  double r;
+  sdr_full_t sdr;
+} sdr_snr_entry_t;
+
+/*
+ * Parsed SDR of a FRU, built on first use and shared by all the lookups
+ * of the process. Every lookup checks the SDR file the platform names
+ * for the FRU, and the SDR is rebuilt once it was written, replaced,
+ * created or removed. Platforms without an SDR file have a fixed SDR;
+ * sdr_cache_invalidate() forces a rebuild in any case.
+ */
+typedef struct {
+  uint32_t gen;
+  bool has_path;
+  bool has_file;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  sdr_snr_entry_t snr[MAX_SENSOR_NUM + 1];
+} sdr_cache_t;
+
+static pthread_mutex_t g_sdr_lock = PTHREAD_MUTEX_INITIALIZER;
+static sdr_cache_t *g_sdr_cache[MAX_FRU_ID];
+static uint32_t g_sdr_gen[MAX_FRU_ID];
 
 /* Array for BCD Plus definition. */
 const char bcd_plus_array[] = "0123456789 -.XXX";
@@ -211,30 +255,17 @@ _sdr_get_sensor_units(sdr_full_t *sdr, uint8_t *op, uint8_t *modifier,
   return 0;
 }
 
+static int sdr_cache_lookup(uint8_t fru, uint8_t snr_num, sdr_snr_entry_t *ent);
+
 int
 sdr_get_sensor_units(uint8_t fru, uint8_t snr_num, char *units) {
 
   int ret = 0;
-  uint8_t op;
-  uint8_t modifier;
-  sdr_full_t *sdr;
-
-  sensor_info_t sinfo[MAX_SENSOR_NUM] = {0};
+  sdr_snr_entry_t ent;
 
-  if (pal_sensor_sdr_init(fru, sinfo) < 0) {
-    sdr = NULL;
-  } else {
-    sdr = &sinfo[snr_num].sdr;
-  }
-
-  if (sdr != NULL) {
-    ret = _sdr_get_sensor_units(sdr, &op, &modifier, units);
-    if (ret < 0) {
-#ifdef DEBUG
-      syslog(LOG_ERR, "_sdr_get_sensor_units failed for FRU: %d snr_num: %d",
-          fru, snr_num);
-#endif
-    }
+  if (sdr_cache_lookup(fru, snr_num, &ent) == 0) {
+    if (ent.units_set)
+      strcpy(units, ent.units);
   } else {
     ret = pal_get_sensor_units(fru, snr_num, units);
     if (ret < 0) {
@@ -333,27 +364,186 @@ _sdr_get_sensor_name(sdr_full_t *sdr, char *name) {
   return 0;
 }
 
-int
-sdr_get_sensor_name(uint8_t fru, uint8_t snr_num, char *name) {
+/* Conversion factors of the SDR, y = (m * x + b * 10^b_exp) * 10^r_exp */
+static void
+sdr_get_conv(sdr_full_t *sdr, sdr_snr_entry_t *ent) {
+  uint8_t m_lsb, m_msb;
+  uint8_t b_lsb, b_msb;
+  uint16_t b;
+  int8_t b_exp, r_exp;
 
-  int ret = 0;
-  sdr_full_t *sdr;
+  m_lsb = sdr->m_val;
+  m_msb = sdr->m_tolerance >> 6;
+  ent->m = (m_msb << 8) | m_lsb;
 
-  sensor_info_t sinfo[MAX_SENSOR_NUM] = {0};
+  b_lsb = sdr->b_val;
+  b_msb = sdr->b_accuracy >> 6;
+  b = (b_msb << 8) | b_lsb;
 
-  if (pal_sensor_sdr_init(fru, sinfo) < 0) {
-    sdr = NULL;
-  } else {
-    sdr = &sinfo[snr_num].sdr;
+  // exponents are 2's complement 4-bit number
+  b_exp = sdr->rb_exp & 0xF;
+  if (b_exp > 7) {
+    b_exp = (~b_exp + 1) & 0xF;
+    b_exp = -b_exp;
+  }
+  r_exp = (sdr->rb_exp >> 4) & 0xF;
+  if (r_exp > 7) {
+    r_exp = (~r_exp + 1) & 0xF;
+    r_exp = -r_exp;
   }
 
-  if (sdr != NULL) {
-    ret = _sdr_get_sensor_name(sdr, name);
+  ent->b = b * pow(10, b_exp);
+  ent->r = pow(10, r_exp);
+}
+
+/*
+ * Identify the SDR file of the FRU. Returns -1 if the platform has none
+ * to watch, 0 if it exists and 1 if it does not exist (yet).
+ */
+static int
+sdr_file_stat(uint8_t fru, struct stat *st) {
+  char path[64] = {0};
+
+  if (pal_get_fru_sdr_path(fru, path) < 0 || path[0] == '\0')
+    return -1;
+  return stat(path, st) == 0 ? 0 : 1;
+}
+
+static sdr_cache_t *
+sdr_cache_build(uint8_t fru, uint32_t gen, int *ret) {
+  sdr_cache_t *cache;
+  sensor_info_t *sinfo;
+  sdr_snr_entry_t *ent;
+  struct stat st;
+  uint8_t op, modifier;
+  int i;
+
+  cache = calloc(1, sizeof(sdr_cache_t));
+  sinfo = calloc(MAX_SENSOR_NUM + 1, sizeof(sensor_info_t));
+  if (cache == NULL || sinfo == NULL) {
+    free(cache);
+    free(sinfo);
+    *ret = -1;
+    return NULL;
+  }
+
+  // stat before reading, so a concurrent rewrite invalidates this copy
+  cache->gen = gen;
+  i = sdr_file_stat(fru, &st);
+  cache->has_path = i >= 0;
+  if (i == 0) {
+    cache->has_file = true;
+    cache->dev = st.st_dev;
+    cache->ino = st.st_ino;
+    cache->size = st.st_size;
+    cache->mtime = st.st_mtim;
+  }
+
+  *ret = pal_sensor_sdr_init(fru, sinfo);
+  if (*ret < 0) {
+    free(sinfo);
+    free(cache);
+    return NULL;
+  }
+
+  for (i = 0; i <= MAX_SENSOR_NUM; i++) {
+    ent = &cache->snr[i];
+    ent->valid = sinfo[i].valid;
+    memcpy(&ent->sdr, &sinfo[i].sdr, sizeof(sdr_full_t));
+    ent->name_ret = _sdr_get_sensor_name(&ent->sdr, ent->name);
+    ent->name_set = ent->name_ret == 0 &&
+      FIELD_TYPE(ent->sdr.str_type_len) != TYPE_BINARY;
+    ent->units_set = FIELD_PERCENTAGE(ent->sdr.sensor_units1) ||
+      (ent->sdr.sensor_units2 > 0 &&
+       ent->sdr.sensor_units2 <= MAX_SENSOR_BASE_UNIT);
+    _sdr_get_sensor_units(&ent->sdr, &op, &modifier, ent->units);
+    sdr_get_conv(&ent->sdr, ent);
+  }
+  free(sinfo);
+  return cache;
+}
+
+static bool
+sdr_cache_fresh(uint8_t fru, sdr_cache_t *cache) {
+  struct stat st;
+
+  if (cache->gen != g_sdr_gen[fru])
+    return false;
+  if (!cache->has_path)
+    return true;
+  // built without the file, it is fresh until the file shows up
+  if (sdr_file_stat(fru, &st) != 0)
+    return !cache->has_file;
+  if (!cache->has_file)
+    return false;
+  return st.st_dev == cache->dev && st.st_ino == cache->ino &&
+    st.st_size == cache->size &&
+    st.st_mtim.tv_sec == cache->mtime.tv_sec &&
+    st.st_mtim.tv_nsec == cache->mtime.tv_nsec;
+}
+
+/*
+ * Copy the cached SDR data of a sensor, loading the SDR of the FRU if
+ * needed. Returns the pal_sensor_sdr_init() error if there is no SDR.
+ * Failures are not cached, the next lookup asks the platform again.
+ */
+static int
+sdr_cache_lookup(uint8_t fru, uint8_t snr_num, sdr_snr_entry_t *ent) {
+  sdr_cache_t *cache, *old;
+  uint32_t gen;
+  int ret = 0;
+
+  pthread_mutex_lock(&g_sdr_lock);
+  cache = g_sdr_cache[fru];
+  if (cache != NULL && sdr_cache_fresh(fru, cache)) {
+    memcpy(ent, &cache->snr[snr_num], sizeof(*ent));
+    pthread_mutex_unlock(&g_sdr_lock);
+    return 0;
+  }
+  gen = g_sdr_gen[fru];
+  pthread_mutex_unlock(&g_sdr_lock);
+
+  // parse without the lock, pal_sensor_sdr_init() may wait for the file
+  cache = sdr_cache_build(fru, gen, &ret);
+  if (cache == NULL)
+    return ret;
+
+  pthread_mutex_lock(&g_sdr_lock);
+  old = g_sdr_cache[fru];
+  g_sdr_cache[fru] = cache;
+  memcpy(ent, &cache->snr[snr_num], sizeof(*ent));
+  pthread_mutex_unlock(&g_sdr_lock);
+  free(old);
+  return 0;
+}
+
+void
+sdr_cache_invalidate(uint8_t fru) {
+  sdr_cache_t *old;
+
+  pthread_mutex_lock(&g_sdr_lock);
+  g_sdr_gen[fru]++;
+  old = g_sdr_cache[fru];
+  g_sdr_cache[fru] = NULL;
+  pthread_mutex_unlock(&g_sdr_lock);
+  free(old);
+}
+
+int
+sdr_get_sensor_name(uint8_t fru, uint8_t snr_num, char *name) {
+
+  int ret = 0;
+  sdr_snr_entry_t ent;
+
+  if (sdr_cache_lookup(fru, snr_num, &ent) == 0) {
+    ret = ent.name_ret;
     if (ret < 0) {
 #ifdef DEBUG
       syslog(LOG_ERR, "_sdr_get_sensor_name failed for FRU: %d snr_num: %d",
           fru, snr_num);
 #endif
+    } else if (ent.name_set) {
+      strcpy(name, ent.name);
     }
   } else {
     ret = pal_get_sensor_name(fru, snr_num, name);
@@ -370,16 +560,9 @@ sdr_get_sensor_name(uint8_t fru, uint8_t snr_num, char *name) {
 
 /* Get the threshold values from the SDRs */
 static int
-get_sdr_thresh_val(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
-    uint8_t thresh, void *value) {
+get_sdr_thresh_val(sdr_snr_entry_t *ent, uint8_t thresh, void *value) {
 
-  int ret;
-  uint8_t x;
-  uint8_t m_lsb, m_msb;
-  uint16_t m = 0;
-  uint8_t b_lsb, b_msb;
-  uint16_t b = 0;
-  int8_t b_exp, r_exp;
+  sdr_full_t *sdr = &ent->sdr;
   uint8_t thresh_val;
 
   switch (thresh) {
@@ -415,29 +598,7 @@ get_sdr_thresh_val(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
   }
 
   // y = (mx + b * 10^b_exp) * 10^r_exp
-  x = thresh_val;
-
-  m_lsb = sdr->m_val;
-  m_msb = sdr->m_tolerance >> 6;
-  m = (m_msb << 8) | m_lsb;
-
-  b_lsb = sdr->b_val;
-  b_msb = sdr->b_accuracy >> 6;
-  b = (b_msb << 8) | b_lsb;
-
-  // exponents are 2's complement 4-bit number
-  b_exp = sdr->rb_exp & 0xF;
-  if (b_exp > 7) {
-    b_exp = (~b_exp + 1) & 0xF;
-    b_exp = -b_exp;
-  }
-  r_exp = (sdr->rb_exp >> 4) & 0xF;
-  if (r_exp > 7) {
-    r_exp = (~r_exp + 1) & 0xF;
-    r_exp = -r_exp;
-  }
-
-  * (float *) value = ((m * x) + (b * pow(10, b_exp))) * (pow(10, r_exp));
+  * (float *) value = ((ent->m * thresh_val) + ent->b) * ent->r;
 
   return 0;
 }
@@ -450,34 +611,28 @@ get_sdr_thresh_val(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
  * value in flag field.
  */
 static int
-_sdr_get_snr_thresh(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
+_sdr_get_snr_thresh(uint8_t fru, sdr_snr_entry_t *ent, uint8_t snr_num,
     thresh_sensor_t *snr) {
 
-  int ret;
-  int value;
   float fvalue;
-  uint8_t op, modifier;
 
   snr->curr_state = NORMAL_STATE;
 
-  if (_sdr_get_sensor_name(sdr, snr->name)) {
+  if (ent->name_ret) {
 #ifdef DEBUG
     syslog(LOG_WARNING, "sdr_get_sensor_name: FRU %d: num: 0x%X: reading name"
         " from SDR failed.", fru, snr_num);
 #endif
     return -1;
   }
+  if (ent->name_set)
+    strcpy(snr->name, ent->name);
 
   // TODO: Add support for modifier (Mostly modifier is zero)
-  if (_sdr_get_sensor_units(sdr, &op, &modifier, snr->units)) {
-#ifdef DEBUG
-    syslog(LOG_WARNING, "sdr_get_sensor_units: FRU %d: num 0x%X: reading units"
-        " from SDR failed.", fru, snr_num);
-#endif
-    return -1;
-  }
+  if (ent->units_set)
+    strcpy(snr->units, ent->units);
 
-  if (get_sdr_thresh_val(fru, sdr, snr_num, UCR_THRESH, &fvalue)) {
+  if (get_sdr_thresh_val(ent, UCR_THRESH, &fvalue)) {
 #ifdef DEBUG
     syslog(LOG_ERR,
         "get_sdr_thresh_val: failed for FRU: %d, num: 0x%X, %-16s, UCR_THRESH",
@@ -490,7 +645,7 @@ _sdr_get_snr_thresh(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
     }
   }
 
-  if (get_sdr_thresh_val(fru, sdr, snr_num, UNC_THRESH, &fvalue)) {
+  if (get_sdr_thresh_val(ent, UNC_THRESH, &fvalue)) {
 #ifdef DEBUG
     syslog(LOG_ERR,
         "get_sdr_thresh_val: failed for FRU: %d, num: 0x%X, %-16s, UNC_THRESH",
@@ -503,7 +658,7 @@ _sdr_get_snr_thresh(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
     }
   }
 
-  if (get_sdr_thresh_val(fru, sdr, snr_num, UNR_THRESH, &fvalue)) {
+  if (get_sdr_thresh_val(ent, UNR_THRESH, &fvalue)) {
 #ifdef DEBUG
     syslog(LOG_ERR,
         "get_sdr_thresh_val: failed for FRU: %d, num: 0x%X, %-16s, UNR_THRESH",
@@ -516,7 +671,7 @@ _sdr_get_snr_thresh(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
     }
   }
 
-  if (get_sdr_thresh_val(fru, sdr, snr_num, LCR_THRESH, &fvalue)) {
+  if (get_sdr_thresh_val(ent, LCR_THRESH, &fvalue)) {
 #ifdef DEBUG
     syslog(LOG_ERR,
         "get_sdr_thresh_val: failed for FRU: %d, num: 0x%X, %-16s, LCR_THRESH",
@@ -529,7 +684,7 @@ _sdr_get_snr_thresh(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
     }
   }
 
-  if (get_sdr_thresh_val(fru, sdr, snr_num, LNC_THRESH, &fvalue)) {
+  if (get_sdr_thresh_val(ent, LNC_THRESH, &fvalue)) {
 #ifdef DEBUG
     syslog(LOG_ERR,
         "get_sdr_thresh_val: failed for FRU: %d, num: 0x%X, %-16s, LNC_THRESH",
@@ -542,7 +697,7 @@ _sdr_get_snr_thresh(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
     }
   }
 
-  if (get_sdr_thresh_val(fru, sdr, snr_num, LNR_THRESH, &fvalue)) {
+  if (get_sdr_thresh_val(ent, LNR_THRESH, &fvalue)) {
 #ifdef DEBUG
     syslog(LOG_ERR,
         "get_sdr_thresh_val: failed for FRU: %d, num: 0x%X, %-16s, LNR_THRESH",
@@ -555,7 +710,7 @@ _sdr_get_snr_thresh(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
     }
   }
 
-  if (get_sdr_thresh_val(fru, sdr, snr_num, POS_HYST, &fvalue)) {
+  if (get_sdr_thresh_val(ent, POS_HYST, &fvalue)) {
 #ifdef DEBUG
     syslog(LOG_ERR,
         "get_sdr_thresh_val: failed for FRU: %d, num: 0x%X, %-16s, POS_HYST",
@@ -565,7 +720,7 @@ _sdr_get_snr_thresh(uint8_t fru, sdr_full_t *sdr, uint8_t snr_num,
     snr->pos_hyst = fvalue;
   }
 
-  if (get_sdr_thresh_val(fru, sdr, snr_num, NEG_HYST, &fvalue)) {
+  if (get_sdr_thresh_val(ent, NEG_HYST, &fvalue)) {
 #ifdef DEBUG
     syslog(LOG_ERR,
         "get_sdr_thresh_val: failed for FRU: %d, num: 0x%X, %-16s, NEG_HYST",
@@ -582,7 +737,8 @@ int
 sdr_get_snr_thresh(uint8_t fru, uint8_t snr_num, thresh_sensor_t *snr) {
 
   int ret = 0;
-  sdr_full_t *sdr;
+  sdr_snr_entry_t ent;
+  sdr_snr_entry_t *sdr;
 #ifdef DEBUG
   int cnt = 0;
 #endif /* DEBUG */
@@ -592,9 +748,7 @@ sdr_get_snr_thresh(uint8_t fru, uint8_t snr_num, thresh_sensor_t *snr) {
   char initflag[64] = {0};
   char fru_name[8];
 
-  sensor_info_t sinfo[MAX_SENSOR_NUM] = {0};
-
-  ret = pal_sensor_sdr_init(fru, sinfo);
+  ret = sdr_cache_lookup(fru, snr_num, &ent);
 
   while (ret == ERR_NOT_READY) {
 
@@ -607,13 +761,13 @@ sdr_get_snr_thresh(uint8_t fru, uint8_t snr_num, thresh_sensor_t *snr) {
     syslog(LOG_INFO, "sdr_get_snr_thresh: fru: %d, ret: %d cnt: %d", fru, ret, cnt++);
 #endif /* DEBUG */
     msleep(50);
-    ret = pal_sensor_sdr_init(fru, sinfo);
+    ret = sdr_cache_lookup(fru, snr_num, &ent);
   }
 
   if (ret < 0) {
     sdr = NULL;
   } else {
-    sdr = &sinfo[snr_num].sdr;
+    sdr = &ent;
   }
 
   /* Set all the threshold options set in the flag */
@@ -687,3 +841,149 @@ sdr_get_snr_thresh(uint8_t fru, uint8_t snr_num, thresh_sensor_t *snr) {
 
   return ret;
 }
+
+/* Status of a reading as sensor-util reports it */
+static void
+sdr_snr_status(float fvalue, thresh_sensor_t *thresh, char *status) {
+
+  const char *st = thresh->flag == 0 ? "ns" : "ok";
+
+  if (GETBIT(thresh->flag, UNC_THRESH) && (FORMAT_CONV(fvalue) >= FORMAT_CONV(thresh->unc_thresh)))
+    st = "unc";
+  if (GETBIT(thresh->flag, UCR_THRESH) && (FORMAT_CONV(fvalue) >= FORMAT_CONV(thresh->ucr_thresh)))
+    st = "ucr";
+  if (GETBIT(thresh->flag, UNR_THRESH) && (FORMAT_CONV(fvalue) >= FORMAT_CONV(thresh->unr_thresh)))
+    st = "unr";
+  if (GETBIT(thresh->flag, LNC_THRESH) && (FORMAT_CONV(fvalue) <= FORMAT_CONV(thresh->lnc_thresh)))
+    st = "lnc";
+  if (GETBIT(thresh->flag, LCR_THRESH) && (FORMAT_CONV(fvalue) <= FORMAT_CONV(thresh->lcr_thresh)))
+    st = "lcr";
+  if (GETBIT(thresh->flag, LNR_THRESH) && (FORMAT_CONV(fvalue) <= FORMAT_CONV(thresh->lnr_thresh)))
+    st = "lnr";
+  strcpy(status, st);
+}
+
+static int
+sdr_snapshot_list(uint8_t fru, const uint8_t *sensor_list, int sensor_cnt,
+                  sdr_snr_snapshot_t *snrs, int max) {
+
+  static const char *state_status[] = {
+    "ns", "ok", "nc", "cr", "nr", "lnc", "lcr", "lnr", "unc", "ucr", "unr"
+  };
+  const uint16_t thresh_mask = GETMASK(UCR_THRESH) | GETMASK(UNC_THRESH) |
+    GETMASK(UNR_THRESH) | GETMASK(LCR_THRESH) | GETMASK(LNC_THRESH) |
+    GETMASK(LNR_THRESH);
+  int i, n = 0, ret;
+  int nic_fru = pal_get_nic_fru_id();
+  thresh_sensor_t thresh;
+  sdr_snr_snapshot_t *snr;
+  float fvalue;
+  bool pldm;
+
+  for (i = 0; i < sensor_cnt && n < max; i++) {
+    uint8_t snr_num = sensor_list[i];
+
+    memset(&thresh, 0, sizeof(thresh));
+    ret = sdr_get_snr_thresh(fru, snr_num, &thresh);
+    pal_alter_sensor_thresh_flag(fru, snr_num, &thresh.flag);
+    if (ret == ERR_SENSOR_NA)
+      return ERR_SENSOR_NA;
+    if (ret < 0)
+      continue;
+
+    snr = &snrs[n];
+    memset(snr, 0, sizeof(*snr));
+    snr->snr_num = snr_num;
+    pldm = fru == nic_fru && snr_num >= PLDM_SENSOR_START &&
+      snr_num <= PLDM_SENSOR_END;
+
+    // only sensord reads sensors, the others have no value to report
+    if (pal_sensor_is_cached(fru, snr_num)) {
+      ret = sensor_cache_read_time(fru, snr_num, &fvalue, &snr->log_time);
+    } else {
+      snr->flags |= SDR_SNR_UNCACHED;
+      ret = -1;
+    }
+
+    if (ret < 0) {
+      // unavailable PLDM sensors are not reported
+      if (pldm)
+        continue;
+      strcpy(snr->status, "na");
+    } else {
+      snr->flags |= SDR_SNR_AVAILABLE;
+      snr->value = fvalue;
+      if (pldm && snr_num >= PLDM_STATE_SENSOR_START) {
+        unsigned int state = (unsigned int)fvalue;
+        snr->flags |= SDR_SNR_STATE;
+        strcpy(snr->status, state < sizeof(state_status)/sizeof(state_status[0]) ?
+            state_status[state] : "ns");
+      } else {
+        sdr_snr_status(fvalue, &thresh, snr->status);
+      }
+    }
+
+    strncpy(snr->name, thresh.name, sizeof(snr->name) - 1);
+    strncpy(snr->units, thresh.units, sizeof(snr->units) - 1);
+    snr->thresh_flag = thresh.flag & thresh_mask;
+    snr->ucr_thresh = thresh.ucr_thresh;
+    snr->unc_thresh = thresh.unc_thresh;
+    snr->unr_thresh = thresh.unr_thresh;
+    snr->lcr_thresh = thresh.lcr_thresh;
+    snr->lnc_thresh = thresh.lnc_thresh;
+    snr->lnr_thresh = thresh.lnr_thresh;
+    n++;
+  }
+
+  return n;
+}
+
+/* Same checks as sensor-util does before reading a FRU */
+static int
+sdr_snapshot_fru_check(uint8_t fru) {
+  uint8_t status = 0;
+  int ret;
+
+  ret = pal_is_fru_prsnt(fru, &status);
+  if (ret < 0)
+    return ret;
+  if (status == 0)
+    return SDR_ERR_NOT_PRESENT;
+
+  ret = pal_is_fru_ready(fru, &status);
+  if (ret < 0 || status == 0)
+    return SDR_ERR_NOT_READY;
+  return 0;
+}
+
+int
+sdr_get_fru_snapshot(uint8_t fru, sdr_snr_snapshot_t *snrs, int max) {
+  uint8_t *sensor_list;
+  int sensor_cnt, ret;
+
+  // aggregate sensors are not described by an SDR
+  if (fru == AGGREGATE_SENSOR_FRU_ID || snrs == NULL || max <= 0)
+    return -1;
+
+  ret = sdr_snapshot_fru_check(fru);
+  if (ret < 0)
+    return ret;
+  ret = pal_get_fru_sensor_list(fru, &sensor_list, &sensor_cnt);
+  if (ret < 0)
+    return ret;
+  return sdr_snapshot_list(fru, sensor_list, sensor_cnt, snrs, max);
+}
+
+int
+sdr_get_snr_snapshot(uint8_t fru, const uint8_t *snr_nums, int cnt,
+                     sdr_snr_snapshot_t *snrs) {
+  int ret;
+
+  if (fru == AGGREGATE_SENSOR_FRU_ID || snr_nums == NULL || snrs == NULL ||
+      cnt <= 0)
+    return -1;
+  ret = sdr_snapshot_fru_check(fru);
+  if (ret < 0)
+    return ret;
+  return sdr_snapshot_list(fru, snr_nums, cnt, snrs, cnt);
+}
@@ -40,6 +40,58 @@ int sdr_get_sensor_name(uint8_t fru, uint8_t snr_num, char *name);
 int sdr_get_sensor_units(uint8_t fru, uint8_t snr_num, char *units);
 int sdr_get_snr_thresh(uint8_t fru, uint8_t snr_num, thresh_sensor_t *snr);
 
+/*
+ * The parsed SDR of each FRU is cached per process and reloaded whenever
+ * the SDR file named by pal_get_fru_sdr_path() changes, appears or goes
+ * away, so readers need not call this. It forces a reload, for an SDR
+ * updated by other means than that file.
+ */
+void sdr_cache_invalidate(uint8_t fru);
+
+/* Flags of sdr_snr_snapshot_t */
+#define SDR_SNR_AVAILABLE 0x01  /* value holds a reading */
+#define SDR_SNR_STATE     0x02  /* PLDM state sensor, value is the state */
+#define SDR_SNR_UNCACHED  0x04  /* not polled by sensord, no reading kept */
+
+/* Snapshot errors, besides those of pal_get_fru_sensor_list() */
+#define SDR_ERR_NOT_PRESENT -10
+#define SDR_ERR_NOT_READY   -11
+
+/* A sensor of a FRU as reported by sdr_get_fru_snapshot() */
+typedef struct {
+  uint8_t snr_num;
+  uint8_t flags;
+  uint16_t thresh_flag;   /* GETMASK(UCR_THRESH) ... of the set thresholds */
+  float value;
+  int64_t log_time;       /* when value was read, 0 if not known */
+  char status[4];         /* "ok", "ucr", ... as sensor-util prints it */
+  char name[32];
+  char units[64];
+  float ucr_thresh;
+  float unc_thresh;
+  float unr_thresh;
+  float lcr_thresh;
+  float lnc_thresh;
+  float lnr_thresh;
+} sdr_snr_snapshot_t;
+
+/*
+ * Fill snrs with the cached reading, status, units and thresholds of
+ * every sensor of a FRU, at most max of them. Sensors are never read
+ * here, those sensord does not poll are flagged SDR_SNR_UNCACHED.
+ * Returns the number of sensors filled in, SDR_ERR_NOT_PRESENT or
+ * SDR_ERR_NOT_READY for a FRU sensor-util would not read either, or
+ * ERR_SENSOR_NA if the SDR of the FRU is missing.
+ */
+int sdr_get_fru_snapshot(uint8_t fru, sdr_snr_snapshot_t *snrs, int max);
+
+/*
+ * Same as sdr_get_fru_snapshot(), for the cnt sensors of snr_nums only;
+ * snrs must hold cnt entries. Unknown sensors are left out.
+ */
+int sdr_get_snr_snapshot(uint8_t fru, const uint8_t *snr_nums, int cnt,
+                         sdr_snr_snapshot_t *snrs);
+
 #define FORMAT_CONV(X) ((int)(X*100 + 0.5)*0.01)  //take the second decimal place
 
 #ifdef __cplusplus
@@ -0,0 +1,151 @@
+#!/usr/bin/env python
+#
+# Copyright 2020-present Facebook. All Rights Reserved.
+#
+# This program file is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by the
+# Free Software Foundation; version 2 of the License.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program in a file named COPYING; if not, write to the
+# Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor,
+# Boston, MA 02110-1301 USA
+#
+import ctypes
+
+
+lsdr_hndl = ctypes.CDLL("libsdr.so")
+
+MAX_SENSORS = 256
+
+SDR_SNR_AVAILABLE = 0x01
+SDR_SNR_STATE = 0x02
+SDR_SNR_UNCACHED = 0x04
+
+SDR_ERR_NOT_PRESENT = -10
+SDR_ERR_NOT_READY = -11
+
+# Bit of each threshold in thresh_flag, in the order sensor-util prints them
+THRESHOLDS = [("UCR", 1), ("UNC", 2), ("UNR", 3), ("LCR", 4), ("LNC", 5), ("LNR", 6)]
+
+# Names of the states reported by PLDM state sensors
+SENSOR_STATES = [
+    "Unknown",
+    "Normal",
+    "Warning",
+    "Critical",
+    "Fatal",
+    "LowerWarning",
+    "LowerCritical",
+    "LowerFatal",
+    "UpperWarning",
+    "UpperCritical",
+    "UpperFatal",
+]
+
+
+class SensorSnapshot(ctypes.Structure):
+    _fields_ = [
+        ("snr_num", ctypes.c_uint8),
+        ("flags", ctypes.c_uint8),
+        ("thresh_flag", ctypes.c_uint16),
+        ("value", ctypes.c_float),
+        ("log_time", ctypes.c_int64),
+        ("status", ctypes.c_char * 4),
+        ("name", ctypes.c_char * 32),
+        ("units", ctypes.c_char * 64),
+        ("ucr_thresh", ctypes.c_float),
+        ("unc_thresh", ctypes.c_float),
+        ("unr_thresh", ctypes.c_float),
+        ("lcr_thresh", ctypes.c_float),
+        ("lnc_thresh", ctypes.c_float),
+        ("lnr_thresh", ctypes.c_float),
+    ]
+
+
+class SnapshotFailure(Exception):
+    def __init__(self, ret):
+        self.ret = ret
+
+
+lsdr_hndl.sdr_get_fru_snapshot.argtypes = [
+    ctypes.c_uint8,
+    ctypes.POINTER(SensorSnapshot),
+    ctypes.c_int,
+]
+lsdr_hndl.sdr_get_fru_snapshot.restype = ctypes.c_int
+lsdr_hndl.sdr_get_snr_snapshot.argtypes = [
+    ctypes.c_uint8,
+    ctypes.POINTER(ctypes.c_uint8),
+    ctypes.c_int,
+    ctypes.POINTER(SensorSnapshot),
+]
+lsdr_hndl.sdr_get_snr_snapshot.restype = ctypes.c_int
+
+
+def sdr_get_fru_snapshot(fru):
+    """
+    Return every sensor of the FRU as a dict with its number, name,
+    value (None if not available), units, status, the time of the
+    reading and the thresholds which are set. Only readings kept by
+    sensord are reported, "cached" is False for the other sensors.
+    This does not fork, and the GIL is released while the library
+    runs, so it can be called from an executor thread.
+    """
+    snrs = (SensorSnapshot * MAX_SENSORS)()
+    ret = lsdr_hndl.sdr_get_fru_snapshot(fru, snrs, MAX_SENSORS)
+    if ret < 0:
+        raise SnapshotFailure(ret)
+    return _snapshot_dicts(snrs[:ret])
+
+
+def sdr_get_snr_snapshot(fru, snr_nums):
+    """
+    Same as sdr_get_fru_snapshot(), for the sensors numbered snr_nums only
+    """
+    if not snr_nums:
+        return []
+    nums = (ctypes.c_uint8 * len(snr_nums))(*snr_nums)
+    snrs = (SensorSnapshot * len(snr_nums))()
+    ret = lsdr_hndl.sdr_get_snr_snapshot(fru, nums, len(snr_nums), snrs)
+    if ret < 0:
+        raise SnapshotFailure(ret)
+    return _snapshot_dicts(snrs[:ret])
+
+
+def _snapshot_dicts(snrs):
+    result = []
+    for snr in snrs:
+        value = None
+        if snr.flags & SDR_SNR_AVAILABLE:
+            if snr.flags & SDR_SNR_STATE:
+                state = int(snr.value)
+                if 0 <= state < len(SENSOR_STATES):
+                    value = SENSOR_STATES[state]
+                else:
+                    value = SENSOR_STATES[0]
+            else:
+                value = snr.value
+        thresholds = {}
+        for name, bit in THRESHOLDS:
+            if snr.thresh_flag & (1 << bit):
+                thresholds[name] = getattr(snr, name.lower() + "_thresh")
+        result.append(
+            {
+                "id": snr.snr_num,
+                "name": snr.name.decode(),
+                "value": value,
+                "units": snr.units.decode(),
+                "status": snr.status.decode(),
+                "time": snr.log_time,
+                "cached": not (snr.flags & SDR_SNR_UNCACHED),
+                "thresholds": thresholds,
+            }
+        )
+    return result
@@ -24,6 +24,9 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
 #ifndef __TEST__
 #include <syslog.h>
 #endif
@@ -50,6 +53,8 @@
 
 #define MAX_NUM_CONDITIONS 32
 #define MAX_NUM_TABLES     32
+#define MAX_NUM_FRUS       256
+#define MAX_NUM_SENSORS    256
 
 typedef struct {
   char cond_value[MAX_VALUE_LEN];
@@ -76,6 +81,7 @@ typedef struct {
   char    name[32];
   uint8_t fru;
   uint8_t id;
+  bool    interpolate;
   size_t  num_tables;
   correction_table_t tables[MAX_NUM_TABLES];
   size_t  default_table;
@@ -83,10 +89,17 @@ typedef struct {
   char    cond_key[MAX_KEY_LEN];
   size_t  value_map_size;
   value_map_element_t value_map[MAX_NUM_CONDITIONS];
+  /* Table selected by the last read of the condition key, valid
+   * until the kv watch reports the key stale */
+  kv_watch_t *watch;
+  size_t  cur_table;
 } sensor_correction_t;
 
 static sensor_correction_t *g_sensors = NULL;
 static size_t g_sensors_count = 0;
+/* g_index[fru][sensor_id], a row is allocated for FRUs with corrections */
+static sensor_correction_t **g_index[MAX_NUM_FRUS] = {NULL};
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int get_table(value_map_element_t *value_map, size_t num, char *value, size_t *idx)
 {
@@ -103,13 +116,48 @@ static int get_table(value_map_element_t *value_map, size_t num, char *value, si
 
 static sensor_correction_t *get_correction(uint8_t fru, uint8_t sensor_id)
 {
-  size_t i;
-  for(i = 0; i < g_sensors_count; i++) {
-    if (g_sensors[i].fru == fru && g_sensors[i].id == sensor_id) {
-      return &g_sensors[i];
+  if (!g_index[fru]) {
+    return NULL;
+  }
+  return g_index[fru][sensor_id];
+}
+
+static int cmp_element(const void *a, const void *b)
+{
+  float va = ((const correction_element_t *)a)->cond_value;
+  float vb = ((const correction_element_t *)b)->cond_value;
+  return va < vb ? -1 : va > vb;
+}
+
+/* Correction for cond_value: the one of the last entry not above it,
+ * or interpolated between the entries around it. Below the first entry
+ * the first correction applies, above the last one the last. */
+static float get_table_correction(correction_table_t *table, bool interpolate,
+    float cond_value)
+{
+  correction_element_t *e = table->corr_table;
+  size_t lo = 0, hi = table->num;
+
+  /* Find the first entry above cond_value */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (cond_value < e[mid].cond_value) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
     }
   }
-  return NULL;
+  if (lo == 0) {
+    return e[0].correction;
+  }
+  if (!interpolate || lo == table->num ||
+      e[lo].cond_value == e[lo - 1].cond_value) {
+    return e[lo - 1].correction;
+  }
+  return e[lo - 1].correction +
+    (e[lo].correction - e[lo - 1].correction) *
+    (cond_value - e[lo - 1].cond_value) /
+    (e[lo].cond_value - e[lo - 1].cond_value);
 }
 
 static int load_table(json_t *obj, correction_table_t *tbl)
@@ -130,8 +178,7 @@ static int load_table(json_t *obj, correction_table_t *tbl)
     json_t *cond_value_o, *correction_o;
     if (!e || !json_is_array(e) || json_array_size(e) != 2) {
       DEBUG("Could not get correction: %zu\n", i);
-      free(tbl->corr_table);
-      return -1;
+      goto bail;
     }
     cond_value_o = json_array_get(e, 0);
     correction_o = json_array_get(e, 1);
@@ -139,13 +186,19 @@ static int load_table(json_t *obj, correction_table_t *tbl)
         !json_is_number(cond_value_o) ||
         !json_is_number(correction_o)) {
       DEBUG("Invalid value in index: %zu\n", i);
-      free(tbl->corr_table);
-      return -1;
+      goto bail;
     }
     tbl->corr_table[i].cond_value = get_float(cond_value_o);
     tbl->corr_table[i].correction = get_float(correction_o);
   }
+  /* Lookups are binary searches */
+  qsort(tbl->corr_table, tbl->num, sizeof(correction_element_t), cmp_element);
   return 0;
+bail:
+  /* free_corrections() frees the tables of the sensor again */
+  free(tbl->corr_table);
+  tbl->corr_table = NULL;
+  return -1;
 }
 
 static int search_table(const char *table_name, sensor_correction_t *snr, size_t *idx)
@@ -168,6 +221,9 @@ static int load_conditional_sensor_correction(json_t *obj, sensor_correction_t *
   void *iter;
   size_t i;
 
+  tmp = json_object_get(obj, "interpolate");
+  snr->interpolate = tmp && json_is_true(tmp);
+
   tmp = json_object_get(obj, "tables");
   if (!tmp) {
     DEBUG("Could not get tables\n");
@@ -249,6 +305,10 @@ static int load_conditional_sensor_correction(json_t *obj, sensor_correction_t *
     strncpy(snr->value_map[i].cond_value, value_str, MAX_VALUE_LEN);
     snr->value_map[i].table_idx = idx;
   }
+
+  /* Without a watch the key is read on every correction */
+  snr->watch = kv_watch_add(snr->cond_key,
+      snr->cond_key_type == KEY_PERSISTENT ? KV_FPERSIST : 0);
   return 0;
 }
 
@@ -297,7 +357,64 @@ static int load_sensor_correction(json_t *obj, sensor_correction_t *snr)
   return ret;
 }
 
-int sensor_correction_init(const char *file)
+static void free_corrections(void)
+{
+  size_t i, j;
+
+  for (i = 0; i < MAX_NUM_FRUS; i++) {
+    free(g_index[i]);
+    g_index[i] = NULL;
+  }
+  for (i = 0; i < g_sensors_count; i++) {
+    kv_watch_del(g_sensors[i].watch);
+    for (j = 0; j < g_sensors[i].num_tables; j++) {
+      free(g_sensors[i].tables[j].corr_table);
+    }
+  }
+  free(g_sensors);
+  g_sensors = NULL;
+  g_sensors_count = 0;
+}
+
+static int index_corrections(void)
+{
+  sensor_correction_t *snr;
+  size_t i;
+
+  for (i = 0; i < g_sensors_count; i++) {
+    snr = &g_sensors[i];
+    if (!g_index[snr->fru]) {
+      g_index[snr->fru] = calloc(MAX_NUM_SENSORS, sizeof(sensor_correction_t *));
+      if (!g_index[snr->fru]) {
+        return -1;
+      }
+    }
+    /* As before, the first correction listed for a sensor wins */
+    if (!g_index[snr->fru][snr->id]) {
+      g_index[snr->fru][snr->id] = snr;
+    }
+  }
+  return 0;
+}
+
+/* Table to use for the current value of the condition key */
+static size_t cond_table(sensor_correction_t *snr)
+{
+  char value[MAX_VALUE_LEN] = {0};
+  unsigned int flags;
+
+  if (snr->watch && !kv_watch_stale(snr->watch)) {
+    return snr->cur_table;
+  }
+  flags = snr->cond_key_type == KEY_PERSISTENT ? KV_FPERSIST : 0;
+  if (kv_get(snr->cond_key, value, NULL, flags) ||
+      get_table(snr->value_map, snr->value_map_size, value, &snr->cur_table)) {
+    snr->cur_table = snr->default_table;
+  }
+  return snr->cur_table;
+}
+
+static int load_corrections(const char *file)
 {
   json_t *conf, *tmp;
   json_error_t error;
@@ -343,41 +460,46 @@ int sensor_correction_init(const char *file)
   json_decref(conf);
   return 0;
 bail:
-  free(g_sensors);
   json_decref(conf);
-  g_sensors = NULL;
-  g_sensors_count = 0;
+  free_corrections();
   return -1;
 }
 
+int sensor_correction_init(const char *file)
+{
+  int ret;
+
+  pthread_mutex_lock(&g_lock);
+  free_corrections();
+  ret = load_corrections(file);
+  if (ret == 0 && index_corrections()) {
+    DEBUG("Allocation failure!\n");
+    free_corrections();
+    ret = -1;
+  }
+  pthread_mutex_unlock(&g_lock);
+  return ret;
+}
+
 int sensor_correction_apply(uint8_t fru, uint8_t sensor_id, float cond_value, float *sensor_reading)
 {
-  char value[MAX_VALUE_LEN] = {0};
-  size_t table_idx = 0;
-  correction_table_t *table;
-  size_t i;
+  sensor_correction_t *snr;
+  size_t table_idx;
   float correction;
-  unsigned int flags;
 
-  sensor_correction_t *snr = get_correction(fru, sensor_id);
+  pthread_mutex_lock(&g_lock);
+  snr = get_correction(fru, sensor_id);
   if (!snr) {
     /* No correction defined for this sensor. Return success without
      * manipulating it */
+    pthread_mutex_unlock(&g_lock);
     return 0;
   }
-  flags = snr->cond_key_type == KEY_PERSISTENT ? KV_FPERSIST : 0;
-  if (kv_get(snr->cond_key, value, NULL, flags) ||
-      get_table(snr->value_map, snr->value_map_size, value, &table_idx)) {
-    table_idx = snr->default_table;
-  }
-  table = &snr->tables[table_idx];
-  correction = table->corr_table[0].correction;
-  for (i = 0; i < table->num; i++) {
-    if (cond_value < table->corr_table[i].cond_value) {
-      break;
-    }
-    correction = table->corr_table[i].correction;
-  }
+  table_idx = cond_table(snr);
+  correction = get_table_correction(&snr->tables[table_idx], snr->interpolate,
+      cond_value);
+  pthread_mutex_unlock(&g_lock);
+
   *sensor_reading = *sensor_reading - correction;
   return 0;
 }
@@ -0,0 +1,203 @@
+/*
+ *
+ * Copyright 2017-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include "sensor-correction.h"
+#include <openbmc/kv.h>
+#include <openbmc/cmock.h>
+
+DECLARE_MOCK_FUNC(int, kv_get, const char *, char *, size_t *, unsigned int);
+
+/* Key locations of libkv, pointed at the test directories */
+extern const char *cache_store;
+extern const char *kv_store;
+
+/* Value of my_key returned by the kv_get mock, NULL if it does not exist */
+static const char *g_key_value = NULL;
+
+static int mocked_kv_get(const char *key, char *value, size_t *len,
+    unsigned int flags)
+{
+  ASSERT_EQ_STR(key, "my_key", "Condition key read");
+  if (!g_key_value) {
+    return -1;
+  }
+  strcpy(value, g_key_value);
+  if (len)
+    *len = strlen(g_key_value);
+  return 0;
+}
+
+/* Check the correction of a reading of 100.0 at cond_value */
+static void check_corrected(uint8_t id, float cond_value, float exp,
+    const char *txt)
+{
+  float val = 100.0;
+  int ret;
+
+  ret = sensor_correction_apply(1, id, cond_value, &val);
+  ASSERT_EQ(ret, 0, "Correction applied");
+  ASSERT_EQ_FLT(val, exp, txt);
+}
+
+DEFINE_TEST(test_bad_conf)
+{
+  ASSERT_NEQ(sensor_correction_init("./no_such_file.json"), 0,
+      "Fail loading non-existant conf.");
+  ASSERT_NEQ(sensor_correction_init("./test_bad_table.json"), 0,
+      "Fail loading a malformed table");
+}
+
+DEFINE_TEST(test_no_correction)
+{
+  float val = 100.0;
+  int ret;
+
+  ASSERT_EQ(sensor_correction_init("./test_tables.json"), 0, "Initialization");
+  MOCK(kv_get, mocked_kv_get);
+  ret = sensor_correction_apply(2, 1, 10.0, &val);
+  ASSERT_EQ(ret, 0, "Sensor without a correction succeeds");
+  ASSERT_EQ_FLT(val, 100.0, "Reading untouched");
+  ret = sensor_correction_apply(1, 3, 10.0, &val);
+  ASSERT_EQ(ret, 0, "Sensor without a correction succeeds");
+  ASSERT_EQ_FLT(val, 100.0, "Reading untouched");
+  ASSERT_CALL_COUNT(kv_get, 0, 0, "Key not read");
+  MOCK_END(kv_get);
+}
+
+DEFINE_TEST(test_lookup)
+{
+  ASSERT_EQ(sensor_correction_init("./test_tables.json"), 0, "Initialization");
+  g_key_value = "V0";
+  MOCK(kv_get, mocked_kv_get);
+  /* The table is listed unsorted: 10:7 14:5 20:3 41:0 */
+  check_corrected(1, 5.0, 93.0, "Below the table: first entry");
+  check_corrected(1, 10.0, 93.0, "Exact first entry");
+  check_corrected(1, 12.0, 93.0, "Between entries: lower entry");
+  check_corrected(1, 14.0, 95.0, "Exact inner entry");
+  check_corrected(1, 19.9, 95.0, "Just below an entry");
+  check_corrected(1, 20.0, 97.0, "Exact inner entry");
+  check_corrected(1, 30.0, 97.0, "Between entries: lower entry");
+  check_corrected(1, 41.0, 100.0, "Exact last entry");
+  check_corrected(1, 60.0, 100.0, "Above the table: last entry");
+  MOCK_END(kv_get);
+}
+
+DEFINE_TEST(test_interpolate)
+{
+  ASSERT_EQ(sensor_correction_init("./test_tables.json"), 0, "Initialization");
+  g_key_value = "V0";
+  MOCK(kv_get, mocked_kv_get);
+  check_corrected(2, 5.0, 93.0, "Below the table: first entry");
+  check_corrected(2, 10.0, 93.0, "Exact first entry");
+  check_corrected(2, 12.0, 94.0, "Halfway between 10:7 and 14:5");
+  check_corrected(2, 14.0, 95.0, "Exact inner entry");
+  check_corrected(2, 17.0, 96.0, "Halfway between 14:5 and 20:3");
+  check_corrected(2, 30.5, 98.5, "Halfway between 20:3 and 41:0");
+  check_corrected(2, 41.0, 100.0, "Exact last entry");
+  check_corrected(2, 60.0, 100.0, "Above the table: last entry");
+  MOCK_END(kv_get);
+}
+
+DEFINE_TEST(test_cond_table)
+{
+  ASSERT_EQ(sensor_correction_init("./test_tables.json"), 0, "Initialization");
+  MOCK(kv_get, mocked_kv_get);
+  g_key_value = "V1";
+  check_corrected(1, 15.0, 99.0, "Table of V1 used");
+  check_corrected(2, 15.0, 98.5, "Table of V1 interpolated");
+  g_key_value = "V0";
+  check_corrected(1, 15.0, 95.0, "Table of V0 used");
+  g_key_value = "V9";
+  check_corrected(1, 15.0, 95.0, "Unmapped value: default table");
+  g_key_value = NULL;
+  check_corrected(1, 15.0, 95.0, "Missing key: default table");
+  ASSERT_CALL_COUNT(kv_get, 5, 5, "Unwatched key read every time");
+  MOCK_END(kv_get);
+}
+
+static void write_key(const char *path, const char *value)
+{
+  FILE *fp = fopen(path, "w");
+  ASSERT(fp != NULL, "Key file created");
+  fputs(value, fp);
+  fclose(fp);
+}
+
+DEFINE_TEST(test_cond_cache)
+{
+  int mocked_file_kv_get(const char *key, char *value, size_t *len,
+      unsigned int flags)
+  {
+    FILE *fp = fopen("./test_kv/my_key", "r");
+    size_t n;
+    ASSERT(fp != NULL, "Key file exists");
+    n = fread(value, 1, MAX_VALUE_LEN - 1, fp);
+    value[n] = '\0';
+    fclose(fp);
+    if (len)
+      *len = n;
+    return 0;
+  }
+
+  mkdir("./test_kv", 0755);
+  write_key("./test_kv/my_key", "V1");
+  cache_store = "./test_kv/%s";
+  ASSERT_EQ(sensor_correction_init("./test_tables.json"), 0, "Initialization");
+
+  MOCK(kv_get, mocked_file_kv_get);
+  check_corrected(1, 15.0, 99.0, "Table of V1 used");
+  check_corrected(1, 15.0, 99.0, "Table of V1 used");
+  ASSERT_CALL_COUNT(kv_get, 1, 1, "Unchanged key read once");
+  MOCK_END(kv_get);
+
+  write_key("./test_kv/my_key", "V0");
+  MOCK(kv_get, mocked_file_kv_get);
+  check_corrected(1, 15.0, 95.0, "Table of V0 used");
+  ASSERT_CALL_COUNT(kv_get, 1, 1, "Changed key read again");
+  MOCK_END(kv_get);
+
+  cache_store = "./no_such_dir/%s";
+  unlink("./test_kv/my_key");
+  rmdir("./test_kv");
+}
+
+int main(int argc, char *argv[])
+{
+  chdir(dirname(argv[0]));
+
+  /* Condition keys are read every time unless their directory can be
+   * watched; only test_cond_cache sets up a directory */
+  cache_store = "./no_such_dir/%s";
+  kv_store = "./no_such_dir/%s";
+
+  CALL_TEST(test_bad_conf);
+  CALL_TEST(test_no_correction);
+  CALL_TEST(test_lookup);
+  CALL_TEST(test_interpolate);
+  CALL_TEST(test_cond_table);
+  CALL_TEST(test_cond_cache);
+  return 0;
+}
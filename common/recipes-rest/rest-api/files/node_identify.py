@@ -2,6 +2,7 @@
 
 from subprocess import *
 
+from kv import FPERSIST, KeyOperationFailure, kv_get
 from node import node
 from pal import *
 
@@ -21,11 +22,10 @@ class identifyNode(node):
 
     def getInformation(self, param={}):
         identify_status = ""
-        data = (
-            Popen("cat /mnt/data/kv_store/identify_slot1", shell=True, stdout=PIPE)
-            .stdout.read()
-            .decode()
-        )
+        try:
+            data = kv_get("identify_slot1", FPERSIST)
+        except KeyOperationFailure:
+            data = ""
         identify_status = data.strip("\n")
         info = {"Status of identify LED": identify_status}
 
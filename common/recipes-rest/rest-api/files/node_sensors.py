@@ -18,18 +18,80 @@
 # Boston, MA 02110-1301 USA
 #
 
+import asyncio
 import json
 import os
 import re
 import subprocess
 
+import pal
 from node import node
 
+
+try:
+    import sdr
+except (ImportError, OSError):
+    sdr = None
+
+
+def sensor_snapshot(fru):
+    """
+    Current readings of the sensors of a FRU from libsdr, without
+    running sensor-util. No sensors for a FRU which is not present or
+    not ready, None when the library cannot serve the FRU.
+    """
+    if sdr is None or fru in ("all", "aggregate"):
+        return None
+    fru_id = pal.pal_get_fru_id(fru)
+    if fru_id is None:
+        return None
+    try:
+        return sdr.sdr_get_fru_snapshot(fru_id)
+    except sdr.SnapshotFailure as e:
+        if e.ret in (sdr.SDR_ERR_NOT_PRESENT, sdr.SDR_ERR_NOT_READY):
+            return []
+        return None
+
+
+def sensor_snapshot_format(snr, display):
+    # Same strings as parsed from sensor-util output
+    if snr["value"] is None:
+        snr_out = {"value": "NA"}
+        units = "na"
+    elif isinstance(snr["value"], str):
+        snr_out = {"value": snr["value"]}
+        units = "na"
+    else:
+        snr_out = {"value": "%.2f" % snr["value"]}
+        units = snr["units"] if snr["units"].strip() != "" else "na"
+    if "units" in display:
+        snr_out["units"] = units
+    if "id" in display:
+        snr_out["id"] = "%X" % snr["id"]
+    if "status" in display:
+        snr_out["status"] = snr["status"]
+    if (
+        "thresholds" in display
+        and isinstance(snr["value"], float)
+        and len(snr["thresholds"]) > 0
+    ):
+        snr_out["thresholds"] = {
+            k: "%.2f" % v for k, v in snr["thresholds"].items()
+        }
+    return snr_out
+
 def sensor_util_history_clear(fru='all', sensor_id='', sensor_name=''):
     cmd = ['/usr/local/bin/sensor-util', fru, '--history-clear']
     if sensor_id != '':
         cmd += [sensor_id]
+    snapshot = None
     if sensor_name != '':
+        snapshot = sensor_snapshot(fru)
+    if snapshot is not None:
+        for snr in snapshot:
+            if sensor_name.lower() == snr["name"].lower():
+                cmd += ["0x%X" % snr["id"]]
+    elif sensor_name != '':
         cmd_util = ['/usr/local/bin/sensor-util', fru]
         sensors = []
         try:
@@ -87,6 +149,33 @@ def sensor_util(fru="all", sensor_name="", sensor_id="", period="60", display=[]
         sensor_id_val = int(sensor_id, base=16)
     else:
         sensor_id_val = 0
+    snapshot = None
+    if "history" not in display:
+        snapshot = sensor_snapshot(fru)
+    if snapshot is not None:
+        snapshot = [
+            snr
+            for snr in snapshot
+            if (sensor_id == "" and sensor_name == "")
+            or (sensor_name != "" and sensor_name.lower() == snr["name"].lower())
+            or (sensor_id != "" and sensor_id_val == snr["id"])
+        ]
+        # sensors sensord does not poll are read by sensor-util only
+        if not all(snr["cached"] for snr in snapshot):
+            snapshot = None
+    if snapshot is not None:
+        sensors = {}
+        for snr in snapshot:
+            snr_out = sensor_snapshot_format(snr, display)
+            s_name = snr["name"]
+            if s_name in sensors:
+                if isinstance(sensors[s_name], list):
+                    sensors[s_name].append(snr_out)
+                else:
+                    sensors[s_name] = [sensors[s_name], snr_out]
+            else:
+                sensors[s_name] = snr_out
+        return sensors
     try:
         output_handle = subprocess.Popen(
             cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE
@@ -214,6 +303,12 @@ class sensorsNode(node):
             period = param["history-period"]
         return sensor_util(self.name, snr_name, snr_id, period, display)
 
+    async def getInformationAsync(self, param={}):
+        # Readings may still come from a sensor-util process, keep them
+        # off the event loop either way.
+        loop = asyncio.get_event_loop()
+        return await loop.run_in_executor(None, self.getInformation, param)
+
     def doAction(self, info, param={}):
         snr_name = ''
         snr = ''
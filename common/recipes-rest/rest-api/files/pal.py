@@ -203,3 +203,13 @@ def pal_set_key_value(key, value):
         ret = lpal_hndl.pal_set_key_value(pkey, pvalue)
         if ret != 0:
             raise ValueError("failure")
+
+
+def pal_get_fru_id(fru_name):
+    if lpal_hndl is None:
+        return None
+    fru = c_ubyte()
+    ret = lpal_hndl.pal_get_fru_id(c_char_p(fru_name.encode()), pointer(fru))
+    if ret:
+        return None
+    return fru.value
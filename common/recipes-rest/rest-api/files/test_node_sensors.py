@@ -3,6 +3,7 @@ import subprocess
 import unittest
 from unittest.mock import patch
 
+import node_sensors
 from node_sensors import sensorsNode
 
 
@@ -157,3 +158,83 @@ class TestSensors(unittest.TestCase):
         mocked_check_call.assert_called_with(
             ["/usr/local/bin/sensor-util", "mb", "--history-clear", "0xA0"]
         )
+
+    @patch.object(subprocess, "Popen")
+    @patch.object(node_sensors, "sensor_snapshot")
+    def test_snapshot_call(self, mocked_snapshot, mocked_popen):
+        mocked_snapshot.return_value = [
+            {
+                "id": 0xA0,
+                "name": "MB_INLET_TEMP",
+                "value": 33.312,
+                "units": "C",
+                "status": "ok",
+                "time": 1000,
+                "cached": True,
+                "thresholds": {"UCR": 40.0},
+            },
+            {
+                "id": 0xA1,
+                "name": "MB_OUTLET_TEMP",
+                "value": None,
+                "units": "C",
+                "status": "na",
+                "time": 1000,
+                "cached": True,
+                "thresholds": {"UCR": 80.0},
+            },
+        ]
+        snr = sensorsNode("mb")
+        self.assertEqual(
+            snr.getInformation(),
+            {"MB_INLET_TEMP": {"value": "33.31"}, "MB_OUTLET_TEMP": {"value": "NA"}},
+        )
+        self.assertEqual(
+            snr.getInformation(param={"id": "0xA0", "display": "units,status,thresholds"}),
+            {
+                "MB_INLET_TEMP": {
+                    "value": "33.31",
+                    "units": "C",
+                    "status": "ok",
+                    "thresholds": {"UCR": "40.00"},
+                }
+            },
+        )
+        self.assertEqual(
+            snr.getInformation(param={"name": "MB_OUTLET_TEMP", "display": "units,status"}),
+            {"MB_OUTLET_TEMP": {"value": "NA", "units": "na", "status": "na"}},
+        )
+        # Served without running sensor-util
+        mocked_popen.assert_not_called()
+
+    @patch.object(subprocess, "Popen")
+    @patch.object(node_sensors, "sensor_snapshot")
+    def test_snapshot_not_present(self, mocked_snapshot, mocked_popen):
+        mocked_snapshot.return_value = []
+        snr = sensorsNode("mb")
+        self.assertEqual(snr.getInformation(), {})
+        mocked_popen.assert_not_called()
+
+    @patch.object(subprocess, "Popen")
+    @patch.object(node_sensors, "sensor_snapshot")
+    def test_snapshot_uncached(self, mocked_snapshot, mocked_popen):
+        mocked_snapshot.return_value = [
+            {
+                "id": 0xA0,
+                "name": "MB_INLET_TEMP",
+                "value": None,
+                "units": "C",
+                "status": "na",
+                "time": 0,
+                "cached": False,
+                "thresholds": {},
+            }
+        ]
+        mocked_popen.return_value.communicate.return_value = (
+            b"MB_INLET_TEMP                (0xA0) :   33.31 C     | (ok)",
+            b"",
+        )
+        snr = sensorsNode("mb")
+        # Sensors sensord does not poll are left to sensor-util
+        self.assertEqual(snr.getInformation(), {"MB_INLET_TEMP": {"value": "33.31"}})
+        mocked_popen.assert_called_once()
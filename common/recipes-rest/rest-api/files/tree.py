@@ -78,7 +78,10 @@ class tree:
 
     async def handleGet(self, request):
         param = dict(request.query)
-        info = self.data.getInformation(param)
+        if hasattr(self.data, "getInformationAsync"):
+            info = await self.data.getInformationAsync(param)
+        else:
+            info = self.data.getInformation(param)
         actions = self.data.getActions()
         resources = []
         ca = self.getChildren()
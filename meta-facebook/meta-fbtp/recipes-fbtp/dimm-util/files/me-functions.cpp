@@ -97,6 +97,15 @@ get_dimm_label(uint8_t cpu, uint8_t dimm)
   }
 }
 
+// each half of the DIMMs of a CPU sits on its own SPD bus (addr_msb),
+// with its own EE page
+int
+util_get_spd_bus(uint8_t cpu, uint8_t dimm)
+{
+  return dimm >= (MAX_DIMM_NUM_FBTP/2);
+}
+
+
 // send ME command to select page 0 or 1 on SPD
 int
 util_set_EE_page(uint8_t fru_id, uint8_t cpu, uint8_t dimm, uint8_t page_num)
@@ -3506,7 +3506,7 @@ check_frb3(uint8_t fru_id, uint8_t sensor_num, float *value) {
 
   if (frb3_fail) {
     // KCS transaction
-    if (stat("/tmp/kcs_touch", &file_stat) == 0 && file_stat.st_mtime > rst_time)
+    if (lib_ipmi_kcs_last_req() > rst_time)
       frb3_fail = 0;
 
     // Port 80 updated
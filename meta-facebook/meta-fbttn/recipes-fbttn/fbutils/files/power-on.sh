@@ -44,7 +44,7 @@ check_por_config()
   if [ ! -f "${KEYDIR}/slot${slot_num}_por_cfg" ]; then
     TO_PWR_ON=$DEF_PWR_ON
   else
-    PWR_POLICY=`cat ${KEYDIR}/slot${slot_num}_por_cfg`
+    PWR_POLICY=`/usr/bin/kv get slot${slot_num}_por_cfg persistent`
 
     # Case ON
     if [ "$PWR_POLICY" == "on" ]; then
@@ -61,7 +61,7 @@ check_por_config()
       if [ ! -f "${KEYDIR}/pwr_server${slot_num}_last_state" ]; then
         TO_PWR_ON=$DEF_PWR_ON
       else
-        LS=`cat ${KEYDIR}/pwr_server${slot_num}_last_state`
+        LS=`/usr/bin/kv get pwr_server${slot_num}_last_state persistent`
         if [ "$LS" == "on" ]; then
           TO_PWR_ON=1;
         elif [ "$LS" == "off" ]; then
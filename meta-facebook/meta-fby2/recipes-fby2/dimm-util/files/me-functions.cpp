@@ -89,6 +89,14 @@ get_dimm_label(uint8_t cpu, uint8_t dimm)
   }
 }
 
+// each half of the DIMMs of a CPU sits on its own SPD bus (addr_msb),
+// with its own EE page
+int
+util_get_spd_bus(uint8_t cpu, uint8_t dimm)
+{
+  return dimm >= (MAX_DIMM_NUM_FBY2/2);
+}
+
 
 // send ME command to select page 0 or 1 on SPD
 int
@@ -21,6 +21,7 @@ from ctypes import *
 from re import match
 from subprocess import PIPE, Popen
 
+import kv
 from fsc_util import Logger
 
 
@@ -205,52 +206,52 @@ def sensor_valid_check(board, sname, check_name, attribute):
                             server_type = lpal_hndl.pal_get_server_type(slot_id)
                             if int(server_type) == 1:  # RC Server
                                 # check DIMM present
-                                with open(
-                                    "/mnt/data/kv_store/sys_config/"
+                                dimm_sts = kv.kv_get(
+                                    "sys_config/"
                                     + fru_map[board]["name"]
                                     + loc_map_rc[sname[9:10]],
-                                    "rb",
-                                ) as f:
-                                    dimm_sts = f.read(1)
+                                    kv.FPERSIST,
+                                    binary=True,
+                                )
                                 if dimm_sts[0] != 1:
                                     return 0
                                 else:
                                     return 1
                             elif int(server_type) == 2:  # EP Server
                                 # check DIMM present
-                                with open(
-                                    "/mnt/data/kv_store/sys_config/"
+                                dimm_sts = kv.kv_get(
+                                    "sys_config/"
                                     + fru_map[board]["name"]
                                     + loc_map_ep[sname[8:9]],
-                                    "rb",
-                                ) as f:
-                                    dimm_sts = f.read(1)
+                                    kv.FPERSIST,
+                                    binary=True,
+                                )
                                 if dimm_sts[0] != 1:
                                     return 0
                                 else:
                                     return 1
                             elif int(server_type) == 4:  # ND Server
                                 # check DIMM present
-                                with open(
-                                    "/mnt/data/kv_store/sys_config/"
+                                dimm_sts = kv.kv_get(
+                                    "sys_config/"
                                     + fru_map[board]["name"]
                                     + loc_map_nd[sname[8:9]],
-                                    "rb",
-                                ) as f:
-                                    dimm_sts = f.read(1)
+                                    kv.FPERSIST,
+                                    binary=True,
+                                )
                                 if dimm_sts[0] != 1:
                                     return 0
                                 else:
                                     return 1
                             else:  # TL Server
                                 # check DIMM present
-                                with open(
-                                    "/mnt/data/kv_store/sys_config/"
+                                dimm_sts = kv.kv_get(
+                                    "sys_config/"
                                     + fru_map[board]["name"]
                                     + loc_map[sname[8:10]],
-                                    "rb",
-                                ) as f:
-                                    dimm_sts = f.read(1)
+                                    kv.FPERSIST,
+                                    binary=True,
+                                )
                                 if dimm_sts[0] != 1:
                                     return 0
                                 else:
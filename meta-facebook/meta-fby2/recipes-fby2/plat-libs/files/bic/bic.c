@@ -32,6 +32,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "bic.h"
+#include <openbmc/ipc.h>
 #include <openbmc/kv.h>
 #include <openbmc/obmc-i2c.h>
 #include <openbmc/misc-utils.h>
@@ -98,6 +99,14 @@
 #define PCIE_PHY_FW 0x00
 #define BOOT_ROM_PATCH_FW 0x01
 
+// How long a BIC ready GPIO reading is trusted
+#define BIC_READY_CACHE_MS 1000
+
+// Sensor reads kept in flight by bic_read_sensors()
+#define BIC_SENSOR_WINDOW 8
+// Rounds of bic_read_sensors(), as many as bic_ipmb_wrapper() tries
+#define BIC_SENSOR_TRIES 3
+
 #pragma pack(push, 1)
 typedef struct _sdr_rec_hdr_t {
   uint16_t rec_id;
@@ -111,6 +120,11 @@ const static uint8_t gpio_bic_ready[] = { 0, GPIO_I2C_SLOT1_ALERT_N, GPIO_I2C_SL
 const static uint8_t gpio_12v[] = { 0, GPIO_P12V_STBY_SLOT1_EN, GPIO_P12V_STBY_SLOT2_EN, GPIO_P12V_STBY_SLOT3_EN, GPIO_P12V_STBY_SLOT4_EN };
 const static uint8_t gpio_power_en[] = { 0, GPIO_SLOT1_POWER_EN, GPIO_SLOT2_POWER_EN, GPIO_SLOT3_POWER_EN, GPIO_SLOT4_POWER_EN };
 
+static struct {
+  uint64_t read_ms;
+  uint8_t ready;
+} bic_ready_cache[5];
+
 // Helper Functions
 static void
 msleep(int msec) {
@@ -236,10 +250,19 @@ read_device(const char *device, int *value) {
   }
 }
 
+static uint64_t
+mono_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 uint8_t
 is_bic_ready(uint8_t slot_id) {
   int val;
   char path[64] = {0};
+  uint8_t ready;
 
   if (slot_id < 1 || slot_id > 4) {
     return 0;
@@ -247,14 +270,28 @@ is_bic_ready(uint8_t slot_id) {
 
   sprintf(path, GPIO_VAL, gpio_bic_ready[slot_id]);
   if (read_device(path, &val)) {
-    return 0;
+    ready = 0;
+  } else {
+    ready = (val == 0x0) ? 1 : 0;
   }
 
-  if (val == 0x0) {
-    return 1;
-  } else {
+  bic_ready_cache[slot_id].ready = ready;
+  bic_ready_cache[slot_id].read_ms = mono_ms();
+  return ready;
+}
+
+// Same as is_bic_ready(), but only reads the GPIO if the last reading
+// is older than BIC_READY_CACHE_MS
+static uint8_t
+is_bic_ready_cached(uint8_t slot_id) {
+  if (slot_id < 1 || slot_id > 4) {
     return 0;
   }
+  if (bic_ready_cache[slot_id].read_ms &&
+      mono_ms() - bic_ready_cache[slot_id].read_ms < BIC_READY_CACHE_MS) {
+    return bic_ready_cache[slot_id].ready;
+  }
+  return is_bic_ready(slot_id);
 }
 
 int
@@ -342,37 +379,11 @@ get_ipmb_bus_id(uint8_t slot_id) {
   return bus_id;
 }
 
-int
-bic_ipmb_wrapper(uint8_t slot_id, uint8_t netfn, uint8_t cmd,
-                  uint8_t *txbuf, uint16_t txlen,
-                  uint8_t *rxbuf, uint8_t *rxlen) {
-  ipmb_req_t *req;
-  ipmb_res_t *res;
-  uint8_t rbuf[MAX_IPMB_RES_LEN] = {0};
-  uint8_t tbuf[MAX_IPMB_RES_LEN] = {0};
-  uint16_t tlen = 0;
-  uint8_t rlen = 0;
-  int i = 0;
-  int ret;
-  uint8_t bus_id;
-  uint8_t dataCksum;
-  int retry = 0;
-
-  if (!is_bic_ready(slot_id)) {
-    return -1;
-  }
-
-  ret = get_ipmb_bus_id(slot_id);
-  if (ret < 0) {
-#ifdef DEBUG
-    syslog(LOG_ERR, "bic_ipmb_wrapper: Wrong Slot ID %d\n", slot_id);
-#endif
-    return ret;
-  }
-
-  bus_id = (uint8_t) ret;
-
-  req = (ipmb_req_t*)tbuf;
+// Build an IPMB request to the BIC, ipmbd fills in seq# and checksums
+static uint16_t
+bic_ipmb_build_req(uint8_t netfn, uint8_t cmd, uint8_t *txbuf, uint16_t txlen,
+                   uint8_t *tbuf) {
+  ipmb_req_t *req = (ipmb_req_t*)tbuf;
 
   req->res_slave_addr = BRIDGE_SLAVE_ADDR << 1;
   req->netfn_lun = netfn << LUN_OFFSET;
@@ -389,34 +400,20 @@ bic_ipmb_wrapper(uint8_t slot_id, uint8_t netfn, uint8_t cmd,
     memcpy(req->data, txbuf, txlen);
   }
 
-  tlen = IPMB_HDR_SIZE + IPMI_REQ_HDR_SIZE + txlen;
-
-  while(retry < 3) {
-    // Invoke IPMB library handler
-    lib_ipmb_handle(bus_id, tbuf, tlen, rbuf, &rlen);
-
-    if (rlen == 0) {
-      if (!is_bic_ready(slot_id)) {
-        break;
-      }
+  return IPMB_HDR_SIZE + IPMI_REQ_HDR_SIZE + txlen;
+}
 
-      retry++;
-      msleep(20);
-    }
-    else
-      break;
-  }
+// Check an IPMB response from the BIC and copy its data to the caller
+static int
+bic_ipmb_parse_res(uint8_t *rbuf, uint8_t rlen, uint8_t *rxbuf, uint8_t *rxlen) {
+  ipmb_res_t *res = (ipmb_res_t*) rbuf;
+  uint8_t dataCksum;
+  int i;
 
-  if (rlen == 0) {
-#ifdef DEBUG
-    syslog(LOG_DEBUG, "bic_ipmb_wrapper: Zero bytes received, retry:%d\n", retry);
-#endif
+  if (rlen < IPMB_HDR_SIZE + IPMI_RESP_HDR_SIZE) {
     return -1;
   }
 
-  // Handle IPMB response
-  res  = (ipmb_res_t*) rbuf;
-
   if (res->cc) {
 #ifdef DEBUG
     syslog(LOG_ERR, "bic_ipmb_wrapper: Completion Code: 0x%X\n", res->cc);
@@ -448,6 +445,61 @@ bic_ipmb_wrapper(uint8_t slot_id, uint8_t netfn, uint8_t cmd,
   return 0;
 }
 
+int
+bic_ipmb_wrapper(uint8_t slot_id, uint8_t netfn, uint8_t cmd,
+                  uint8_t *txbuf, uint16_t txlen,
+                  uint8_t *rxbuf, uint8_t *rxlen) {
+  uint8_t rbuf[MAX_IPMB_RES_LEN] = {0};
+  uint8_t tbuf[MAX_IPMB_RES_LEN] = {0};
+  uint16_t tlen = 0;
+  uint8_t rlen = 0;
+  int ret;
+  uint8_t bus_id;
+  int retry = 0;
+
+  if (!is_bic_ready_cached(slot_id)) {
+    return -1;
+  }
+
+  ret = get_ipmb_bus_id(slot_id);
+  if (ret < 0) {
+#ifdef DEBUG
+    syslog(LOG_ERR, "bic_ipmb_wrapper: Wrong Slot ID %d\n", slot_id);
+#endif
+    return ret;
+  }
+
+  bus_id = (uint8_t) ret;
+
+  tlen = bic_ipmb_build_req(netfn, cmd, txbuf, txlen, tbuf);
+
+  while(retry < 3) {
+    // Invoke IPMB library handler
+    lib_ipmb_handle(bus_id, tbuf, tlen, rbuf, &rlen);
+
+    if (rlen == 0) {
+      if (!is_bic_ready(slot_id)) {
+        break;
+      }
+
+      retry++;
+      msleep(20);
+    }
+    else
+      break;
+  }
+
+  if (rlen == 0) {
+#ifdef DEBUG
+    syslog(LOG_DEBUG, "bic_ipmb_wrapper: Zero bytes received, retry:%d\n", retry);
+#endif
+    return -1;
+  }
+
+  // Handle IPMB response
+  return bic_ipmb_parse_res(rbuf, rlen, rxbuf, rxlen);
+}
+
 // Get Self-Test result
 int
 bic_get_self_test_result(uint8_t slot_id, uint8_t *self_test_result) {
@@ -2872,6 +2924,151 @@ bic_read_sensor(uint8_t slot_id, uint8_t sensor_num, ipmi_sensor_reading_t *sens
   return ret;
 }
 
+/*
+ * One round of bic_read_sensors(): the Get Sensor Reading requests of
+ * the todo[] sensors are pipelined to ipmbd over one connection,
+ * BIC_SENSOR_WINDOW at a time. A sensor left without an answer keeps
+ * status -2. Returns -1 if ipmbd can't be talked to that way.
+ */
+static int
+bic_read_sensors_round(const char *sock_path, const uint8_t *sensor_nums,
+                       const int *todo, int num,
+                       ipmi_sensor_reading_t *sensors, int *status) {
+  uint8_t rbuf[MAX_IPMB_RES_LEN] = {0};
+  uint8_t tbuf[MAX_IPMB_RES_LEN] = {0};
+  uint8_t data[MAX_IPMB_RES_LEN];
+  uint32_t ids[BIC_SENSOR_WINDOW];
+  int pending[BIC_SENSOR_WINDOW];
+  ipc_conn_t *conn;
+  uint16_t tlen;
+  uint8_t dlen;
+  size_t rlen;
+  uint32_t id;
+  int i, j;
+  int sent = 0, inflight = 0;
+
+  conn = ipc_conn_open(sock_path);
+  if (!conn) {
+    return -1;
+  }
+  while (sent < num || inflight) {
+    // Keep the window full
+    while (sent < num && inflight < BIC_SENSOR_WINDOW) {
+      i = todo[sent];
+      tlen = bic_ipmb_build_req(NETFN_SENSOR_REQ, CMD_SENSOR_GET_SENSOR_READING,
+                                (uint8_t *)&sensor_nums[i], 1, tbuf);
+      if (ipc_conn_send(conn, tbuf, tlen, &id)) {
+        ipc_conn_close(conn);
+        return -1;
+      }
+      ids[inflight] = id;
+      pending[inflight++] = i;
+      sent++;
+    }
+
+    rlen = sizeof(rbuf);
+    if (ipc_conn_recv(conn, &id, rbuf, &rlen, TIMEOUT_IPMB_CLIENT)) {
+      ipc_conn_close(conn);
+      return -1;
+    }
+    for (j = 0; j < inflight && ids[j] != id; j++)
+      ;
+    if (j == inflight) {
+      continue;
+    }
+    i = pending[j];
+    ids[j] = ids[--inflight];
+    pending[j] = pending[inflight];
+
+    // No answer from the BIC, leave it for the next round
+    if (rlen == 0) {
+      continue;
+    }
+    dlen = 0;
+    status[i] = bic_ipmb_parse_res(rbuf, (uint8_t)rlen, data, &dlen);
+    if (status[i] == 0) {
+      memset(&sensors[i], 0, sizeof(sensors[i]));
+      memcpy(&sensors[i], data, dlen < sizeof(sensors[i]) ? dlen : sizeof(sensors[i]));
+    }
+  }
+  ipc_conn_close(conn);
+  return 0;
+}
+
+/*
+ * Read several sensors of a slot, pipelined instead of paying a full
+ * round trip each. Only the sensors which got no answer (or a BIC retry
+ * completion code) are sent again, so the whole list shares the
+ * BIC_SENSOR_TRIES budget of a single bic_read_sensor(). If ipmbd does
+ * not talk framed, the remaining sensors are read one by one. status[i]
+ * is the result of reading sensor_nums[i] into sensors[i], as
+ * bic_read_sensor() would return it.
+ * Returns the number of sensors read, -1 if the BIC is not ready or
+ * the list is longer than the sensor number space.
+ */
+int
+bic_read_sensors(uint8_t slot_id, const uint8_t *sensor_nums, int num,
+                 ipmi_sensor_reading_t *sensors, int *status) {
+  int todo[256];  // sensor numbers are 8 bit
+  char sock_path[64];
+  int ret, i, try, ntodo;
+  int nread = 0;
+
+  if (num > (int)(sizeof(todo) / sizeof(todo[0]))) {
+    return -1;
+  }
+  if (!is_bic_ready_cached(slot_id)) {
+    return -1;
+  }
+  ret = get_ipmb_bus_id(slot_id);
+  if (ret < 0) {
+    return -1;
+  }
+  sprintf(sock_path, "%s_%d", SOCK_PATH_IPMB, ret);
+
+  for (i = 0; i < num; i++) {
+    status[i] = -2;
+  }
+
+  for (try = 0; try < BIC_SENSOR_TRIES; try++) {
+    ntodo = 0;
+    for (i = 0; i < num; i++) {
+      if (status[i] == -2 || status[i] == BIC_RETRY_ACTION) {
+        todo[ntodo++] = i;
+      }
+    }
+    if (ntodo == 0) {
+      break;
+    }
+    if (try > 0) {
+      if (!is_bic_ready(slot_id)) {
+        break;
+      }
+      msleep(20);
+    }
+    if (bic_read_sensors_round(sock_path, sensor_nums, todo, ntodo,
+                               sensors, status)) {
+      // ipmbd went away or does not talk framed, the rest goes one by one
+      for (i = 0; i < num; i++) {
+        if (status[i] == -2 || status[i] == BIC_RETRY_ACTION) {
+          status[i] = bic_read_sensor(slot_id, sensor_nums[i], &sensors[i]);
+        }
+      }
+      break;
+    }
+  }
+
+  for (i = 0; i < num; i++) {
+    if (status[i] == -2) {
+      status[i] = -1;
+    } else if (status[i] == 0) {
+      nread++;
+    }
+  }
+
+  return nread;
+}
+
 int
 bic_read_device_sensors(uint8_t slot_id, uint8_t dev_id, ipmi_device_sensor_reading_t *sensor, uint8_t *len) {
   uint8_t tbuf[4] = {0x15, 0xA0, 0x00, 0x00}; // IANA ID + Sensor Num
@@ -477,6 +477,7 @@ int bic_get_sdr_rsv(uint8_t slot_id, uint16_t *rsv);
 int bic_get_sdr(uint8_t slot_id, ipmi_sel_sdr_req_t *req, ipmi_sel_sdr_res_t *res, uint8_t *rlen);
 
 int bic_read_sensor(uint8_t slot_id, uint8_t sensor_num, ipmi_sensor_reading_t *sensor);
+int bic_read_sensors(uint8_t slot_id, const uint8_t *sensor_nums, int num, ipmi_sensor_reading_t *sensors, int *status);
 int bic_read_device_sensors(uint8_t slot_id, uint8_t dev_id, ipmi_device_sensor_reading_t *sensor, uint8_t *len);
 
 int bic_get_sys_guid(uint8_t slot_id, uint8_t *guid);
@@ -31,6 +31,7 @@
 #include <syslog.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 #include <openbmc/obmc-i2c.h>
 #include <openbmc/obmc_pal_sensors.h>
 #include "fby2_sensor.h"
@@ -85,6 +86,9 @@
 
 #define MAX_SENSOR_NUM 0xFF
 #define ALL_BYTES 0xFF
+
+// A batch of BIC sensor readings is used within this long
+#define BIC_BATCH_TTL_MS 1000
 #define LAST_REC_ID 0xFFFF
 
 #define FBY2_SDR_PATH "/tmp/sdr_%s.bin"
@@ -857,11 +861,11 @@ enum ina_register {
 };
 
 rc_dimm_location_info rc_dimm_location_list[] = {
-  // {dimm_location_file, dimm_sensor_number}
-  {SYS_CONFIG_PATH "fru%u_dimm0_location", BIC_RC_SENSOR_SOC_DIMMB_TEMP},
-  {SYS_CONFIG_PATH "fru%u_dimm1_location", BIC_RC_SENSOR_SOC_DIMMA_TEMP},
-  {SYS_CONFIG_PATH "fru%u_dimm2_location", BIC_RC_SENSOR_SOC_DIMMC_TEMP},
-  {SYS_CONFIG_PATH "fru%u_dimm3_location", BIC_RC_SENSOR_SOC_DIMMD_TEMP},
+  // {dimm_location_key, dimm_sensor_number}
+  {SYS_CONFIG_KEY "fru%u_dimm0_location", BIC_RC_SENSOR_SOC_DIMMB_TEMP},
+  {SYS_CONFIG_KEY "fru%u_dimm1_location", BIC_RC_SENSOR_SOC_DIMMA_TEMP},
+  {SYS_CONFIG_KEY "fru%u_dimm2_location", BIC_RC_SENSOR_SOC_DIMMC_TEMP},
+  {SYS_CONFIG_KEY "fru%u_dimm3_location", BIC_RC_SENSOR_SOC_DIMMD_TEMP},
 };
 
 #define GET_DEV_VALID_FALG(flag, dev_id) ((flag>>(dev_id-1)) & 1)
@@ -871,6 +875,31 @@ static sensor_info_t g_sinfo[MAX_NUM_FRUS][MAX_SENSOR_NUM] = {0};
 static ipmi_general_sensor_reading_t g_sread[MAX_NUM_FRUS][MAX_SENSOR_NUM] = {0};
 static uint16_t dev_valid_flag[MAX_NUM_FRUS] = {0};
 
+/*
+ * BIC sensors are fetched per slot in one batch. The batch holds the
+ * sensors which were asked for before; every reading in it is handed out
+ * once, a sensor asked for again is fetched with the next batch. Sensors
+ * whose reading was not used by then, or failed, drop out of the batch
+ * until they are asked for again. Sensors of a slot are read from several
+ * threads, lock protects the batch and is held across the fetch so
+ * concurrent readers use its result instead of fetching again.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  uint64_t fetched_ms;
+  uint8_t wanted[(MAX_SENSOR_NUM + 7) / 8];
+  uint8_t ready[(MAX_SENSOR_NUM + 7) / 8];
+  ipmi_sensor_reading_t reading[MAX_SENSOR_NUM];
+} bic_batch_t;
+
+static bic_batch_t g_sbatch[MAX_NUM_FRUS] = {
+  [0 ... MAX_NUM_FRUS-1] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+#define BATCH_TEST(map, n) ((map)[(n) / 8] & (1 << ((n) % 8)))
+#define BATCH_SET(map, n) ((map)[(n) / 8] |= (1 << ((n) % 8)))
+#define BATCH_CLR(map, n) ((map)[(n) / 8] &= ~(1 << ((n) % 8)))
+
 void
 msleep(int msec) {
   struct timespec req;
@@ -1499,36 +1528,102 @@ read_nic_temp(const char *device, uint8_t addr, float *value) {
 static int
 rc_dimm_present_check(uint8_t fru, int index, uint8_t sensor_num) {
 
-  int fd;
-  char path[64] = {0};
-  uint8_t dimm_present_status;
-  int dimm_present_data_size = 1;
+  char key[MAX_KEY_LEN] = {0};
+  char value[MAX_VALUE_LEN] = {0};
+  size_t len = 0;
 
-  sprintf(path, rc_dimm_location_list[index].dimm_location_file, fru);
+  sprintf(key, rc_dimm_location_list[index].dimm_location_key, fru);
 
-  fd = open(path, O_RDONLY);
-  if (fd < 0) {
-    return -1;     //DIMM location file doesn't exist
+  if (kv_get(key, value, &len, KV_FPERSIST) || len < 1) {
+    return -1;     //DIMM location key doesn't exist
   }
 
-  if (read(fd, &dimm_present_status, dimm_present_data_size) != dimm_present_data_size) {
-    close(fd);
-    return -1;
-  }
-
-  switch(dimm_present_status) {
+  switch((uint8_t)value[0]) {
     case 0x01:     //DIMM present
       break;
     case 0xFF:     //DIMM not present
     default:
-      close(fd);
       return -1;
   }
 
-  close(fd);
   return 0;
 }
 
+static uint64_t
+bic_batch_now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+bic_read_sensor_batched(uint8_t fru, uint8_t sensor_num, ipmi_sensor_reading_t *sensor) {
+  bic_batch_t *batch;
+  uint8_t nums[MAX_SENSOR_NUM];
+  ipmi_sensor_reading_t readings[MAX_SENSOR_NUM];
+  int status[MAX_SENSOR_NUM];
+  uint64_t now;
+  int i, num = 0, ret = -1;
+
+  if (fru < 1 || fru > MAX_NUM_FRUS || sensor_num >= MAX_SENSOR_NUM) {
+    return bic_read_sensor(fru, sensor_num, sensor);
+  }
+  batch = &g_sbatch[fru-1];
+  pthread_mutex_lock(&batch->lock);
+  now = bic_batch_now_ms();
+
+  if (BATCH_TEST(batch->ready, sensor_num)) {
+    BATCH_CLR(batch->ready, sensor_num);
+    if (now - batch->fetched_ms < BIC_BATCH_TTL_MS) {
+      *sensor = batch->reading[sensor_num];
+      pthread_mutex_unlock(&batch->lock);
+      return 0;
+    }
+  }
+
+  // First time asked for, read it alone and fetch it with the batch
+  // from now on
+  if (!BATCH_TEST(batch->wanted, sensor_num)) {
+    BATCH_SET(batch->wanted, sensor_num);
+    pthread_mutex_unlock(&batch->lock);
+    return bic_read_sensor(fru, sensor_num, sensor);
+  }
+
+  for (i = 0; i < MAX_SENSOR_NUM; i++) {
+    if (i != sensor_num && BATCH_TEST(batch->ready, i)) {
+      // Fetched last time but nobody wanted it
+      BATCH_CLR(batch->wanted, i);
+    }
+    if (BATCH_TEST(batch->wanted, i)) {
+      nums[num++] = i;
+    }
+  }
+  memset(batch->ready, 0, sizeof(batch->ready));
+
+  if (bic_read_sensors(fru, nums, num, readings, status) < 0) {
+    pthread_mutex_unlock(&batch->lock);
+    return -1;
+  }
+  batch->fetched_ms = bic_batch_now_ms();
+
+  for (i = 0; i < num; i++) {
+    if (nums[i] == sensor_num) {
+      ret = status[i];
+      if (ret == 0) {
+        *sensor = readings[i];
+      }
+    } else if (status[i] == 0) {
+      batch->reading[nums[i]] = readings[i];
+      BATCH_SET(batch->ready, nums[i]);
+    } else {
+      BATCH_CLR(batch->wanted, nums[i]);
+    }
+  }
+  pthread_mutex_unlock(&batch->lock);
+  return ret;
+}
+
 static int
 bic_read_sensor_wrapper(uint8_t fru, uint8_t sensor_num, bool discrete,
     void *value) {
@@ -1583,7 +1678,7 @@ bic_read_sensor_wrapper(uint8_t fru, uint8_t sensor_num, bool discrete,
       g_sread[fru-1][sensor_num].flags = acsensor.flags;
       g_sread[fru-1][sensor_num].is_accuracy = true;
     } else {
-      ret = bic_read_sensor(fru, sensor_num, &sensor);
+      ret = bic_read_sensor_batched(fru, sensor_num, &sensor);
       if (ret)
         return ret;
       g_sread[fru-1][sensor_num].int_value = sensor.value;
@@ -1626,7 +1721,7 @@ bic_read_sensor_wrapper(uint8_t fru, uint8_t sensor_num, bool discrete,
       case GPV2_SENSOR_0V92_VR_Temp:
       case GPV2_SENSOR_PCIE_SW_TEMP:
         dev_id = DEV_NONE;
-        ret = bic_read_sensor(fru, sensor_num, &sensor);
+        ret = bic_read_sensor_batched(fru, sensor_num, &sensor);
         if (ret)
           return ret;
         g_sread[fru-1][sensor_num].int_value = sensor.value;
@@ -44,10 +44,10 @@ extern "C" {
 
 #define PWM_UNIT_MAX 96
 
-#define SYS_CONFIG_PATH "/mnt/data/kv_store/sys_config/"
+#define SYS_CONFIG_KEY "sys_config/"
 
 typedef struct {
-  const char *dimm_location_file;
+  const char *dimm_location_key;
   uint8_t dimm_sensor_num;
 } rc_dimm_location_info;
 
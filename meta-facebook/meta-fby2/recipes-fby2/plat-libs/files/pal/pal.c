@@ -11225,11 +11225,9 @@ bool pal_is_m2_prsnt(char *slot_name, char *sensor_name)
   struct fsc_monitor *fsc_m2_list;
   int fsc_m2_list_size;
   int index;
-  int fd = -1;
   char path[64];
   char value[MAX_VALUE_LEN] = {0};
-  uint8_t m2_present_status;
-  uint8_t read_byte = 1;
+  size_t value_len = 0;
   int len;
 
   ret = pal_get_fru_id(slot_name, &slot_id);
@@ -11279,25 +11277,18 @@ bool pal_is_m2_prsnt(char *slot_name, char *sensor_name)
   if (index < 0)
     return true;
 
-  sprintf(path, SYS_CONFIG_PATH "fru%d_m2_%d_info", runoff_id, fsc_m2_list[index].offset);
-  fd = open(path, O_RDONLY);
-
-  if (fd < 0)
+  sprintf(path, SYS_CONFIG_KEY "fru%d_m2_%d_info", runoff_id, fsc_m2_list[index].offset);
+  if (kv_get(path, value, &value_len, KV_FPERSIST) || value_len < 1)
     return false;
 
-  if(read(fd, &m2_present_status, read_byte) != read_byte)
-    return false;
-
-  switch(m2_present_status) {
+  switch((uint8_t)value[0]) {
     case 0x01:     //M.2 is present
       break;
     case 0xFF:     //M.2 is not present
     default:
-      close(fd);
       return false;
   }
 
-  close(fd);
   return true;
 }
 
@@ -21,6 +21,7 @@ from ctypes import *
 from re import match
 from subprocess import PIPE, Popen
 
+import kv
 from fsc_util import Logger
 
 
@@ -92,13 +93,13 @@ def sensor_valid_check(board, sname, check_name, attribute):
             if pwr_sts[0] == "1":
                 if match(r"soc_dimm", sname) != None:
                     # check DIMM present
-                    with open(
-                        "/mnt/data/kv_store/sys_config/"
+                    dimm_sts = kv.kv_get(
+                        "sys_config/"
                         + fru_map[board]["name"]
                         + loc_map[sname[8:10]],
-                        "rb",
-                    ) as f:
-                        dimm_sts = f.read(1)
+                        kv.FPERSIST,
+                        binary=True,
+                    )
                     if dimm_sts[0] != 1:
                         return 0
                 return 1
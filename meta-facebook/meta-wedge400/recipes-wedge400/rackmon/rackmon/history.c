@@ -0,0 +1,187 @@
+/*
+ * Copyright 2019-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "history.h"
+#include <string.h>
+
+// time delta, bitmap of up to 125 registers, 3 bytes per value delta
+#define MAX_DELTA_LEN(len) (5 + ((len) + 7) / 8 + 3 * (len))
+
+static uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static size_t put_varint(uint8_t *dst, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    dst[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  dst[n++] = v;
+  return n;
+}
+
+static uint8_t ring_byte(const history *h, size_t *pos) {
+  uint8_t b = h->ring[*pos];
+  if (++(*pos) == h->size) {
+    *pos = 0;
+  }
+  return b;
+}
+
+static uint32_t ring_varint(const history *h, size_t *pos) {
+  uint32_t v = 0;
+  int shift = 0;
+  uint8_t b;
+  do {
+    b = ring_byte(h, pos);
+    v |= (uint32_t)(b & 0x7f) << shift;
+    shift += 7;
+  } while ((b & 0x80) && shift < 32);
+  return v;
+}
+
+// Apply the delta at *pos to time and regs, return its length
+static size_t apply_delta(const history *h, size_t *pos, uint32_t *time,
+                          uint16_t *regs) {
+  size_t start = *pos;
+  uint8_t mask[(h->len + 7) / 8];
+  int i;
+  *time += unzigzag(ring_varint(h, pos));
+  for (i = 0; i < (h->len + 7) / 8; i++) {
+    mask[i] = ring_byte(h, pos);
+  }
+  for (i = 0; i < h->len; i++) {
+    if (mask[i / 8] & (1 << (i % 8))) {
+      regs[i] += unzigzag(ring_varint(h, pos));
+    }
+  }
+  // A delta filling the whole ring ends where it started
+  return *pos > start ? *pos - start : *pos + h->size - start;
+}
+
+size_t history_mem_size(uint16_t len, size_t ring_size) {
+  return 2 * len * sizeof(uint16_t) + ring_size;
+}
+
+void history_init(history *h, uint16_t len, void *mem, size_t ring_size) {
+  memset(h, 0, sizeof(*h));
+  h->len = len;
+  h->first = mem;
+  h->last = h->first + len;
+  h->ring = (uint8_t *)(h->last + len);
+  h->size = ring_size;
+}
+
+// Drop the oldest sample, the next one becomes the first
+static void drop_first(history *h) {
+  size_t n = apply_delta(h, &h->head, &h->first_time, h->first);
+  h->used -= n;
+  h->count--;
+}
+
+void history_append(history *h, uint32_t time, const uint16_t *regs) {
+  uint8_t delta[MAX_DELTA_LEN(h->len)];
+  size_t n, pos;
+  int i;
+
+  if (h->count == 0) {
+    h->first_time = h->last_time = time;
+    memcpy(h->first, regs, h->len * sizeof(uint16_t));
+    memcpy(h->last, regs, h->len * sizeof(uint16_t));
+    h->count = 1;
+    return;
+  }
+
+  n = put_varint(delta, zigzag((int32_t)(time - h->last_time)));
+  pos = n;
+  n += (h->len + 7) / 8;
+  memset(delta + pos, 0, n - pos);
+  for (i = 0; i < h->len; i++) {
+    if (regs[i] != h->last[i]) {
+      delta[pos + i / 8] |= 1 << (i % 8);
+      n += put_varint(delta + n, zigzag((int16_t)(regs[i] - h->last[i])));
+    }
+  }
+
+  if (n > h->size) {
+    // Not even one delta fits: only the newest sample is kept
+    h->count = 0;
+    h->head = h->used = 0;
+    history_append(h, time, regs);
+    return;
+  }
+  while (h->size - h->used < n) {
+    drop_first(h);
+  }
+  pos = (h->head + h->used) % h->size;
+  for (i = 0; i < (int)n; i++) {
+    h->ring[pos] = delta[i];
+    if (++pos == h->size) {
+      pos = 0;
+    }
+  }
+  h->used += n;
+  h->count++;
+  h->last_time = time;
+  memcpy(h->last, regs, h->len * sizeof(uint16_t));
+}
+
+void history_iter_init(history_iter *it, const history *h, uint16_t *regs) {
+  it->h = h;
+  it->left = h->count;
+  it->pos = h->head;
+  it->time = h->first_time;
+  memcpy(regs, h->first, h->len * sizeof(uint16_t));
+}
+
+int history_next(history_iter *it, uint32_t *time, uint16_t *regs) {
+  if (it->left == 0) {
+    return 0;
+  }
+  if (it->left != it->h->count) {
+    apply_delta(it->h, &it->pos, &it->time, regs);
+  }
+  it->left--;
+  *time = it->time;
+  return 1;
+}
+
+void history_skip(history_iter *it, uint16_t *regs, uint32_t n) {
+  uint32_t time;
+  while (n-- > 0 && history_next(it, &time, regs))
+    ;
+}
+
+void history_deltas(const history *h, const uint8_t **p1, size_t *n1,
+                    const uint8_t **p2, size_t *n2) {
+  size_t tail = h->size - h->head;
+  *p1 = h->ring + h->head;
+  *p2 = h->ring;
+  if (h->used <= tail) {
+    *n1 = h->used;
+    *n2 = 0;
+  } else {
+    *n1 = tail;
+    *n2 = h->used - tail;
+  }
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2019-present Facebook. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * History of one register range. Only the oldest and the newest samples
+ * are kept as is; the ring holds every later sample as a delta against
+ * the one before it:
+ *
+ *   zigzag varint  time delta (seconds)
+ *   (len + 7) / 8  bitmap of the registers which changed
+ *   zigzag varint  value delta, for each register in the bitmap
+ *
+ * A sample of registers which did not change costs 2 bytes whatever
+ * the range length, instead of 4 + 2 * len. When the ring is full the
+ * oldest sample is folded into the next one and dropped.
+ */
+typedef struct history {
+  uint16_t len;         // registers per sample
+  uint32_t count;       // samples held
+  uint32_t first_time;  // time of the oldest sample
+  uint32_t last_time;   // time of the newest sample
+  uint16_t *first;      // registers of the oldest sample
+  uint16_t *last;       // registers of the newest sample
+  uint8_t *ring;
+  size_t size;          // bytes of ring
+  size_t head;          // offset of the delta of the second oldest sample
+  size_t used;          // bytes of deltas in the ring
+} history;
+
+typedef struct history_iter {
+  const history *h;
+  uint32_t left;        // samples not returned yet
+  size_t pos;           // offset of the next delta
+  uint32_t time;
+} history_iter;
+
+// Memory needed for a range of len registers with ring_size bytes of deltas
+size_t history_mem_size(uint16_t len, size_t ring_size);
+// Set up an empty history in mem, of history_mem_size(len, ring_size) bytes
+void history_init(history *h, uint16_t len, void *mem, size_t ring_size);
+void history_append(history *h, uint32_t time, const uint16_t *regs);
+
+// Iterate over the samples, oldest first. regs holds h->len registers
+// and is updated in place by each call of history_next.
+void history_iter_init(history_iter *it, const history *h, uint16_t *regs);
+// Skip n samples, the next one returned is sample n from the oldest
+void history_skip(history_iter *it, uint16_t *regs, uint32_t n);
+// 1 and the time and registers of the next sample, 0 at the end
+int history_next(history_iter *it, uint32_t *time, uint16_t *regs);
+
+// The deltas, oldest first, as the two pieces of the ring they sit in:
+// n1 bytes at p1 then n2 bytes at p2 (n2 is 0 unless they wrap)
+void history_deltas(const history *h, const uint8_t **p1, size_t *n1,
+                    const uint8_t **p2, size_t *n2);
+
+#endif
@@ -67,41 +67,63 @@ void print_hex(FILE* f, char* buf, size_t len) {
     fprintf(f, "%02x ", buf[i]);
 }
 
-size_t read_wait(int fd, char* dst, size_t maxlen, int mdelay_us) {
+// address, function | 0x80, exception code, crc
+#define MODBUS_EXCEPTION_LEN 5
+
+static size_t read_until(int fd, char* dst, size_t maxlen, int mdelay_us,
+                         int frame) {
   fd_set fdset;
   struct timeval timeout;
-  char read_buf[16];
-  size_t read_size = 0;
+  ssize_t read_size = 0;
   size_t pos = 0;
   memset(dst, 0, maxlen);
   while(pos < maxlen) {
     FD_ZERO(&fdset);
     FD_SET(fd, &fdset);
-    timeout.tv_sec = 0;
-    timeout.tv_usec = mdelay_us;
+    timeout.tv_sec = mdelay_us / 1000000;
+    timeout.tv_usec = mdelay_us % 1000000;
     int rv = select(fd + 1, &fdset, NULL, NULL, &timeout);
     if(rv == -1) {
+      if(errno == EINTR) continue;
       perror("select()");
+      break;
     } else if (rv == 0) {
       break;
     }
-    read_size = read(fd, read_buf, 16);
+    // Whatever the tty has buffered goes straight into the frame
+    read_size = read(fd, dst + pos, maxlen - pos);
     if(read_size < 0) {
-      if(errno == EAGAIN) continue;
+      if(errno == EAGAIN || errno == EINTR) continue;
       fprintf(stderr, "read error: %s\n", strerror(errno));
       exit(1);
     }
-    if((pos + read_size) <= maxlen) {
-      memcpy(dst + pos, read_buf, read_size);
-      pos += read_size;
-    } else {
-      return pos;
-      fprintf(stderr, "Response buffer overflowed!\n");
+    pos += read_size;
+    // An exception response is shorter than the one expected, no need
+    // to wait for the timeout to know it is complete
+    if(frame && pos >= MODBUS_EXCEPTION_LEN && (dst[1] & 0x80)) {
+      break;
     }
   }
   return pos;
 }
 
+size_t read_wait(int fd, char* dst, size_t maxlen, int mdelay_us) {
+  return read_until(fd, dst, maxlen, mdelay_us, 0);
+}
+
+size_t read_frame(int fd, char* dst, size_t maxlen, int mdelay_us) {
+  return read_until(fd, dst, maxlen, mdelay_us, 1);
+}
+
+int modbus_frame_gap_us(int baudrate) {
+  // start, 8 data bits, parity, stop
+  const int char_bits = 11;
+  if(baudrate <= 0 || baudrate > 19200) {
+    return 1750;
+  }
+  return (7 * char_bits * 1000000 + 2 * baudrate - 1) / (2 * baudrate);
+}
+
 /* From libmodbus, https://github.com/stephane/libmodbus
  * Under LGPL. */
 /* Table of CRC values for high-order byte */
@@ -256,7 +278,7 @@ int modbuscmd(modbus_req *req) {
     if(req->expected_len > req->dest_limit) {
       return -1;
     }
-    mb_pos = read_wait(req->tty_fd, req->dest_buf, req->expected_len, req->timeout);
+    mb_pos = read_frame(req->tty_fd, req->dest_buf, req->expected_len, req->timeout);
     clock_gettime(CLOCK_MONOTONIC_RAW, &read_end);
     req->dest_len = mb_pos;
     if(mb_pos >= 4) {
@@ -24,6 +24,7 @@
 uint16_t modbus_crc16(char* buffer, size_t length);
 
 #define DEFAULT_TTY "/dev/ttyUSB0"
+#define DEFAULT_BAUDRATE 19200
 
 extern int verbose;
 #define dbg(...) if(verbose) { fprintf(stderr, __VA_ARGS__); }
@@ -52,6 +53,12 @@ void print_hex(FILE* f, char* buf, size_t len);
 
 // Read until maxlen bytes or no bytes in mdelay_us microseconds
 size_t read_wait(int fd, char* dst, size_t maxlen, int mdelay_us);
+// Same, but also stop at the end of a complete modbus exception response
+size_t read_frame(int fd, char* dst, size_t maxlen, int mdelay_us);
+
+// Silent interval required between two frames (3.5 character times,
+// fixed at 1750us above 19200 baud as per the modbus RTU spec)
+int modbus_frame_gap_us(int baudrate);
 
 
 typedef struct _modbus_req {
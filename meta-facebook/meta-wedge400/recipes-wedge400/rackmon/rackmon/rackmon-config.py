@@ -25,15 +25,55 @@ from rackmond import configure_rackmond
 #  2'comp  0x4NXX
 #  decimal 0x20XX
 #  bitmap 1,2 0x10XX
+#
+# period: freshness target in seconds. Ranges without one are read as
+# often as the bus allows; identity data which does not change while
+# the PSU is present only needs an occasional refresh.
+IDENTITY_PERIOD = 300
 
 reglist = [
-    {"begin": 0x0, "length": 8, "flags": 0x8000},  # MFR_MODEL  # ascii
-    {"begin": 0x10, "length": 8, "flags": 0x8000},  # MFR_DATE  # ascii
-    {"begin": 0x20, "length": 8, "flags": 0x8000},  # FB Part #  # ascii
-    {"begin": 0x30, "length": 4, "flags": 0x8000},  # HW Revision  # ascii
-    {"begin": 0x38, "length": 4, "flags": 0x8000},  # FW Revision  # ascii
-    {"begin": 0x40, "length": 16, "flags": 0x8000},  # MFR Serial #  # ascii
-    {"begin": 0x60, "length": 4, "flags": 0x8000},  # Workorder #  # ascii
+    {
+        "begin": 0x0,  # MFR_MODEL
+        "length": 8,
+        "flags": 0x8000,  # ascii
+        "period": IDENTITY_PERIOD,
+    },
+    {
+        "begin": 0x10,  # MFR_DATE
+        "length": 8,
+        "flags": 0x8000,  # ascii
+        "period": IDENTITY_PERIOD,
+    },
+    {
+        "begin": 0x20,  # FB Part #
+        "length": 8,
+        "flags": 0x8000,  # ascii
+        "period": IDENTITY_PERIOD,
+    },
+    {
+        "begin": 0x30,  # HW Revision
+        "length": 4,
+        "flags": 0x8000,  # ascii
+        "period": IDENTITY_PERIOD,
+    },
+    {
+        "begin": 0x38,  # FW Revision
+        "length": 4,
+        "flags": 0x8000,  # ascii
+        "period": IDENTITY_PERIOD,
+    },
+    {
+        "begin": 0x40,  # MFR Serial #
+        "length": 16,
+        "flags": 0x8000,  # ascii
+        "period": IDENTITY_PERIOD,
+    },
+    {
+        "begin": 0x60,  # Workorder #
+        "length": 4,
+        "flags": 0x8000,  # ascii
+        "period": IDENTITY_PERIOD,
+    },
     {
         "begin": 0x68,  # PSU Status
         "length": 1,
@@ -212,13 +252,13 @@ reglist = [
         "flags": 0x1000,  # Bitmap
         "length": 1,
     },
-    {"begin": 0x106, "length": 1},  # BBU Specification Info
-    {"begin": 0x107, "length": 1},  # BBU Manufacturer Date
-    {"begin": 0x108, "length": 1},  # BBU Serial Number
-    {"begin": 0x109, "length": 2},  # BBU Device Chemistry
-    {"begin": 0x10B, "length": 2},  # BBU Manufacturer Data
-    {"begin": 0x10D, "length": 8},  # BBU Manufacturer Name
-    {"begin": 0x115, "length": 8},  # BBU Device Name
+    {"begin": 0x106, "length": 1, "period": IDENTITY_PERIOD},  # BBU Specification Info
+    {"begin": 0x107, "length": 1, "period": IDENTITY_PERIOD},  # BBU Manufacturer Date
+    {"begin": 0x108, "length": 1, "period": IDENTITY_PERIOD},  # BBU Serial Number
+    {"begin": 0x109, "length": 2, "period": IDENTITY_PERIOD},  # BBU Device Chemistry
+    {"begin": 0x10B, "length": 2, "period": IDENTITY_PERIOD},  # BBU Manufacturer Data
+    {"begin": 0x10D, "length": 8, "period": IDENTITY_PERIOD},  # BBU Manufacturer Name
+    {"begin": 0x115, "length": 8, "period": IDENTITY_PERIOD},  # BBU Device Name
     {"begin": 0x11D, "length": 4},  # FB Battery Status
     {"begin": 0x121, "length": 1},  # SoH results
 ]
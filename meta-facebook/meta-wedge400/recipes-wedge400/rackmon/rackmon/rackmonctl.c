@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -71,8 +72,19 @@ int main(int argc, char **argv) {
     if (argc > 1 && (strcmp("resume", argv[1]) == 0)) {
       cmd.type = COMMAND_TYPE_START_MONITORING;
     }
+    if (argc > 1 && (strcmp("dump", argv[1]) == 0)) {
+      cmd.type = COMMAND_TYPE_DUMP_DATA_BINARY;
+    }
+    if (argc > 3 && (strcmp("query", argv[1]) == 0)) {
+      cmd.type = COMMAND_TYPE_QUERY_DATA;
+      cmd.query_data.addr = strtoul(argv[2], NULL, 0);
+      cmd.query_data.reg = strtoul(argv[3], NULL, 0);
+      cmd.query_data.from = argc > 4 ? strtoul(argv[4], NULL, 0) : 0;
+      cmd.query_data.to = argc > 5 ? strtoul(argv[5], NULL, 0) : UINT32_MAX;
+    }
     if(cmd.type == 0) {
-      fprintf(stderr, "Usage: %s { status | data | info | force_scan | pause | resume }\n", callname);
+      fprintf(stderr, "Usage: %s { status | data | info | force_scan | pause | resume | dump"
+                      " | query ADDR REG [FROM [TO]] }\n", callname);
       exit(1);
     }
     clisock = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -85,6 +97,22 @@ int main(int argc, char **argv) {
     CHECKP(send, send(clisock, &cmd, wire_cmd_len, 0));
     char readbuf[1024];
     ssize_t n_read;
+    if (cmd.type == COMMAND_TYPE_QUERY_DATA) {
+      // records may straddle reads, keep the partial one at the front
+      size_t have = 0;
+      while((n_read = read(clisock, readbuf + have, sizeof(readbuf) - have)) > 0) {
+        query_data_record rec;
+        size_t pos;
+        have += n_read;
+        for (pos = 0; pos + sizeof(rec) <= have; pos += sizeof(rec)) {
+          memcpy(&rec, readbuf + pos, sizeof(rec));
+          printf("%u 0x%04x\n", rec.time, rec.value);
+        }
+        memmove(readbuf, readbuf + pos, have - pos);
+        have -= pos;
+      }
+      goto cleanup;
+    }
     while((n_read = read(clisock, readbuf, sizeof(readbuf))) > 0) {
       write(1, readbuf, n_read);
     }
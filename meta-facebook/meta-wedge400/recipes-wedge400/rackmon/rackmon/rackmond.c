@@ -18,6 +18,7 @@
 
 #include "modbus.h"
 #include "rackmond.h"
+#include "history.h"
 #include <string.h>
 #include <pthread.h>
 #include <stdio.h>
@@ -44,6 +45,10 @@
 
 #define READ_ERROR_RESPONSE -2
 
+// Longest the monitoring thread sleeps when no range is due, so scans,
+// pauses and commands are still picked up promptly
+#define MAX_IDLE_US 100000
+
 struct _lock_holder
 {
   pthread_mutex_t *lock;
@@ -77,6 +82,10 @@ typedef struct _rs485_dev
   // hold this for the duration of a command
   pthread_mutex_t lock;
   int tty_fd;
+  // silent interval between frames, derived from the baud rate
+  int frame_gap_us;
+  // monotonic time at which the bus is free for the next frame
+  uint64_t idle_at;
 } rs485_dev;
 
 typedef struct _register_req
@@ -88,8 +97,13 @@ typedef struct _register_req
 typedef struct register_range_data
 {
   monitor_interval *i;
-  void *mem_begin;
-  size_t mem_pos;
+  history hist;
+  // monotonic time (us) the range should be read again
+  uint64_t next_due;
+  // monotonic time (us) of the last successful read, 0 if none yet
+  uint64_t last_ok;
+  // read already in the current scan of the PSU
+  int scanned;
 } register_range_data;
 
 typedef struct monitoring_data
@@ -97,6 +111,13 @@ typedef struct monitoring_data
   uint8_t addr;
   uint32_t crc_errors;
   uint32_t timeout_errors;
+  // A scan is one read of every range with no period (read as often as
+  // possible); its duration is how stale the PSU's live data can get.
+  int num_fast;
+  int scan_left;
+  uint64_t scan_begin;
+  uint32_t scan_ms;
+  uint32_t scan_max_ms;
   register_range_data range_data[1];
 } monitoring_data;
 
@@ -118,7 +139,7 @@ typedef struct _rackmond_data
   // timeout in nanosecs
   int modbus_timeout;
 
-  // inter-command delay
+  // minimum inter-command delay, the frame gap applies if longer
   int min_delay;
 
   int paused;
@@ -232,6 +253,13 @@ cleanup:
 
 rackmond_data world;
 
+static uint64_t mono_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 char psu_address(int rack, int shelf, int psu)
 {
   int rack_a = ((rack & 3) << 3);
@@ -243,7 +271,9 @@ char psu_address(int rack, int shelf, int psu)
 int modbus_command(rs485_dev *dev, int timeout, char *command, size_t len, char *destbuf, size_t dest_limit, size_t expect)
 {
   int error = 0;
-  useconds_t delay = world.min_delay;
+  int gap = world.min_delay > dev->frame_gap_us ? world.min_delay
+                                                 : dev->frame_gap_us;
+  uint64_t now;
   lock_holder(devlock, &dev->lock);
   modbus_req req;
   req.tty_fd = dev->tty_fd;
@@ -255,11 +285,15 @@ int modbus_command(rs485_dev *dev, int timeout, char *command, size_t len, char
   req.expected_len = expect != 0 ? expect : dest_limit;
   req.scan = scanning;
   lock_take(devlock);
-  int cmd_error = modbuscmd(&req);
-  if (delay != 0)
+  // Only wait for what is left of the silent interval since the last
+  // frame; the time spent processing it usually already covers it.
+  now = mono_us();
+  if (dev->idle_at > now)
   {
-    usleep(delay);
+    usleep(dev->idle_at - now);
   }
+  int cmd_error = modbuscmd(&req);
+  dev->idle_at = mono_us() + gap;
   CHECK(cmd_error);
 cleanup:
   lock_release(devlock);
@@ -382,6 +416,15 @@ cleanup:
   return error;
 }
 
+// Bytes of deltas for a range: what keep raw samples used to take,
+// less the two samples the history keeps as is
+static size_t range_ring_size(monitor_interval *iv)
+{
+  int raw = (sizeof(uint32_t) + (sizeof(uint16_t) * iv->len)) * iv->keep;
+  int ring = raw - 2 * (sizeof(uint16_t) * iv->len);
+  return ring > 0 ? ring : 0;
+}
+
 monitoring_data *alloc_monitoring_data(uint8_t addr)
 {
   size_t size = sizeof(monitoring_data) +
@@ -389,9 +432,7 @@ monitoring_data *alloc_monitoring_data(uint8_t addr)
   for (int i = 0; i < world.config->num_intervals; i++)
   {
     monitor_interval *iv = &world.config->intervals[i];
-    int pitch = sizeof(uint32_t) + (sizeof(uint16_t) * iv->len);
-    int data_size = pitch * iv->keep;
-    size += data_size;
+    size += history_mem_size(iv->len, range_ring_size(iv));
   }
   monitoring_data *d = calloc(1, size);
   if (d == NULL)
@@ -402,18 +443,23 @@ monitoring_data *alloc_monitoring_data(uint8_t addr)
   d->addr = addr;
   d->crc_errors = 0;
   d->timeout_errors = 0;
+  d->num_fast = 0;
   void *mem = d;
   mem = mem + (sizeof(monitoring_data) +
                sizeof(register_range_data) * world.config->num_intervals);
   for (int i = 0; i < world.config->num_intervals; i++)
   {
     monitor_interval *iv = &world.config->intervals[i];
-    int pitch = sizeof(uint32_t) + (sizeof(uint16_t) * iv->len);
-    int data_size = pitch * iv->keep;
+    size_t ring_size = range_ring_size(iv);
     d->range_data[i].i = iv;
-    d->range_data[i].mem_begin = mem;
-    d->range_data[i].mem_pos = 0;
-    mem = mem + data_size;
+    history_init(&d->range_data[i].hist, iv->len, mem, ring_size);
+    // everything is due as soon as the PSU is found
+    d->range_data[i].next_due = 0;
+    if (iv->period == 0)
+    {
+      d->num_fast++;
+    }
+    mem = mem + history_mem_size(iv->len, ring_size);
   }
   return d;
 }
@@ -487,21 +533,131 @@ cleanup:
 
 void record_data(register_range_data *rd, uint32_t time, uint16_t *regs)
 {
-  int n_regs = (rd->i->len);
-  int pitch = sizeof(time) + (sizeof(uint16_t) * n_regs);
-  int mem_size = pitch * rd->i->keep;
-
-  memcpy(rd->mem_begin + rd->mem_pos, &time, sizeof(time));
-  rd->mem_pos += sizeof(time);
-  memcpy(rd->mem_begin + rd->mem_pos, regs, n_regs * sizeof(uint16_t));
-  rd->mem_pos += n_regs * sizeof(uint16_t);
-  rd->mem_pos = rd->mem_pos % mem_size;
+  history_append(&rd->hist, time, regs);
+}
+
+// Account for a read of a range in the current scan of its PSU
+void scan_progress(monitoring_data *md, register_range_data *rd,
+                   uint64_t begin, uint64_t end)
+{
+  if (rd->i->period != 0 || rd->scanned)
+  {
+    return;
+  }
+  if (md->scan_left == 0)
+  {
+    md->scan_left = md->num_fast;
+    md->scan_begin = begin;
+  }
+  rd->scanned = 1;
+  if (--md->scan_left > 0)
+  {
+    return;
+  }
+  md->scan_ms = (end - md->scan_begin) / 1000;
+  if (md->scan_ms > md->scan_max_ms)
+  {
+    md->scan_max_ms = md->scan_ms;
+  }
+  for (int r = 0; r < world.config->num_intervals; r++)
+  {
+    md->range_data[r].scanned = 0;
+  }
+}
+
+// Age in ms of the stalest data read as often as possible, 0 if none
+uint32_t oldest_data_ms(monitoring_data *md, uint64_t now)
+{
+  uint64_t oldest = now;
+  for (int r = 0; r < world.config->num_intervals; r++)
+  {
+    register_range_data *rd = &md->range_data[r];
+    if (rd->i->period == 0 && rd->last_ok != 0 && rd->last_ok < oldest)
+    {
+      oldest = rd->last_ok;
+    }
+  }
+  return (now - oldest) / 1000;
 }
 
+// Read one register range of a PSU and record the data
+void fetch_range(monitoring_data *md, register_range_data *rd)
+{
+  uint8_t addr = md->addr;
+  monitor_interval *i = rd->i;
+  uint16_t regs[i->len];
+  uint64_t begin, now;
+  lock_holder(worldlock, &world.lock);
+
+  begin = mono_us();
+  int err = read_registers(&world.rs485,
+                           world.modbus_timeout, addr, i->begin, i->len, regs);
+  now = mono_us();
+  lock_take(worldlock);
+  rd->next_due = now + (uint64_t)i->period * 1000000;
+  scan_progress(md, rd, begin, now);
+  lock_release(worldlock);
+  if (err)
+  {
+    if (err != READ_ERROR_RESPONSE)
+    {
+      log("Error %d reading %02x registers at %02x from %02x\n",
+          err, i->len, i->begin, addr);
+      if (err == MODBUS_BAD_CRC)
+      {
+        md->crc_errors++;
+      }
+      if (err == MODBUS_RESPONSE_TIMEOUT)
+      {
+        md->timeout_errors++;
+      }
+    }
+    return;
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint32_t timestamp = ts.tv_sec;
+  if (rd->i->flags & MONITOR_FLAG_ONLY_CHANGES)
+  {
+    if (rd->hist.count > 0 &&
+        !memcmp(rd->hist.last, regs, sizeof(uint16_t) * i->len))
+    {
+      rd->last_ok = now;
+      return;
+    }
+
+    if (world.status_log)
+    {
+      time_t rawt;
+      struct tm *ti;
+      time(&rawt);
+      ti = localtime(&rawt);
+      char timestr[80];
+      strftime(timestr, sizeof(timestr), "%b %e %T", ti);
+      fprintf(world.status_log,
+              "%s: Change to status register %02x on address %02x. New value: %02x\n",
+              timestr, i->begin, addr, regs[0]);
+      fflush(world.status_log);
+    }
+  }
+  lock_take(worldlock);
+  record_data(rd, timestamp, regs);
+  rd->last_ok = now;
+  lock_release(worldlock);
+}
+
+/*
+ * Read the one register range, of all PSUs, which is the most overdue.
+ * A range is due again its period after it was last read, so ranges
+ * without one are read round robin, least recently read first, while
+ * the others only take the bus when their freshness target requires.
+ */
 int fetch_monitored_data()
 {
   int error = 0;
-  int data_pos = 0;
+  monitoring_data *md = NULL;
+  register_range_data *rd = NULL;
+  uint64_t now;
   lock_holder(worldlock, &world.lock);
   lock_take(worldlock);
   if (world.paused == 1)
@@ -514,75 +670,29 @@ int fetch_monitored_data()
   {
     goto cleanup;
   }
-  lock_release(worldlock);
-
-  usleep(1000); // wait a sec btween PSUs to not overload RT scheduling
-                // threshold
-  while (world.stored_data[data_pos] != NULL && data_pos < MAX_ACTIVE_ADDRS)
+  for (int p = 0; p < MAX_ACTIVE_ADDRS && world.stored_data[p] != NULL; p++)
   {
-    uint8_t addr = world.stored_data[data_pos]->addr;
     for (int r = 0; r < world.config->num_intervals; r++)
     {
-      register_range_data *rd = &world.stored_data[data_pos]->range_data[r];
-      monitor_interval *i = rd->i;
-      uint16_t regs[i->len];
-      int err = read_registers(&world.rs485,
-                               world.modbus_timeout, addr, i->begin, i->len, regs);
-      if (err)
+      register_range_data *c = &world.stored_data[p]->range_data[r];
+      if (rd == NULL || c->next_due < rd->next_due)
       {
-        if (err != READ_ERROR_RESPONSE)
-        {
-          log("Error %d reading %02x registers at %02x from %02x\n",
-              err, i->len, i->begin, addr);
-          if (err == MODBUS_BAD_CRC)
-          {
-            world.stored_data[data_pos]->crc_errors++;
-          }
-          if (err == MODBUS_RESPONSE_TIMEOUT)
-          {
-            world.stored_data[data_pos]->timeout_errors++;
-          }
-        }
-        continue;
+        md = world.stored_data[p];
+        rd = c;
       }
-      struct timespec ts;
-      clock_gettime(CLOCK_REALTIME, &ts);
-      uint32_t timestamp = ts.tv_sec;
-      if (rd->i->flags & MONITOR_FLAG_ONLY_CHANGES)
-      {
-        int pitch = sizeof(timestamp) + (sizeof(uint16_t) * i->len);
-        int lastpos = rd->mem_pos - pitch;
-        if (lastpos < 0)
-        {
-          lastpos = (pitch * rd->i->keep) - pitch;
-        }
-        if (!memcmp(rd->mem_begin + lastpos + sizeof(timestamp),
-                    regs, sizeof(uint16_t) * i->len) &&
-            memcmp(rd->mem_begin, "\x00\x00\x00\x00", 4))
-        {
-          continue;
-        }
-
-        if (world.status_log)
-        {
-          time_t rawt;
-          struct tm *ti;
-          time(&rawt);
-          ti = localtime(&rawt);
-          char timestr[80];
-          strftime(timestr, sizeof(timestr), "%b %e %T", ti);
-          fprintf(world.status_log,
-                  "%s: Change to status register %02x on address %02x. New value: %02x\n",
-                  timestr, i->begin, addr, regs[0]);
-          fflush(world.status_log);
-        }
-      }
-      lock_take(worldlock);
-      record_data(rd, timestamp, regs);
-      lock_release(worldlock);
     }
-    data_pos++;
   }
+  lock_release(worldlock);
+
+  now = mono_us();
+  if (rd == NULL || rd->next_due > now)
+  {
+    uint64_t idle = rd == NULL ? MAX_IDLE_US : rd->next_due - now;
+    usleep(idle < MAX_IDLE_US ? idle : MAX_IDLE_US);
+    goto cleanup;
+  }
+
+  fetch_range(md, rd);
 cleanup:
   lock_release(worldlock);
   return error;
@@ -597,7 +707,9 @@ int rackmon_print_info(write_buffer *wb, monitoring_data *data)
     int value = 0, N = 0;
     float fvalue = 0.0;
     register_range_data *rd = &data->range_data[i];
-    char *mem_pos = rd->mem_begin;
+    uint16_t regs[rd->i->len];
+    history_iter it;
+    char *mem_pos;
 
 #define PRINTDESC(reg, desc)                       \
   case reg:                                        \
@@ -661,10 +773,15 @@ int rackmon_print_info(write_buffer *wb, monitoring_data *data)
       bprintf(wb, "  <0x%04X>                                  : ", rd->i->begin);
       break;
     }
-    memcpy(&time, mem_pos, sizeof(time));
-    for (int j = 0; j < rd->i->keep && time != 0; j++)
+    // the last keep samples, oldest first
+    history_iter_init(&it, &rd->hist, regs);
+    if (rd->hist.count > rd->i->keep)
+    {
+      history_skip(&it, regs, rd->hist.count - rd->i->keep);
+    }
+    while (history_next(&it, &time, regs))
     {
-      mem_pos += sizeof(time);
+      mem_pos = (char *)regs;
       switch (rd->i->flags & 0xF000)
       {
       case 0x8000: //Ascii
@@ -820,11 +937,6 @@ int rackmon_print_info(write_buffer *wb, monitoring_data *data)
         bprintf(wb, "  "); // End data
         break;
       }
-      memcpy(&time, mem_pos, sizeof(time));
-      if (time == 0)
-      {
-        break;
-      }
     }
     if ((rd->i->flags & 0xF000) != 0x1000)
     {
@@ -873,6 +985,8 @@ int open_rs485_dev(const char *tty_filename, rs485_dev *dev)
   dbg("[*] Putting TTY in RS485 mode\n");
 
   dev->tty_fd = tty_fd;
+  dev->frame_gap_us = modbus_frame_gap_us(DEFAULT_BAUDRATE);
+  dev->idle_at = 0;
   pthread_mutex_init(&dev->lock, NULL);
 cleanup:
   return error;
@@ -951,13 +1065,15 @@ int do_command(int sock, rackmond_command *cmd)
       clock_gettime(CLOCK_REALTIME, &ts);
       uint32_t now = ts.tv_sec;
       int data_pos = 0;
+      uint64_t mono_now = mono_us();
       bprintf(&wb, "Monitored PSUs:\n");
       while (world.stored_data[data_pos] != NULL && data_pos < MAX_ACTIVE_ADDRS)
       {
-        bprintf(&wb, "PSU addr %02x - crc errors: %d, timeouts: %d\n",
-                world.stored_data[data_pos]->addr,
-                world.stored_data[data_pos]->crc_errors,
-                world.stored_data[data_pos]->timeout_errors);
+        monitoring_data *md = world.stored_data[data_pos];
+        bprintf(&wb, "PSU addr %02x - crc errors: %d, timeouts: %d, "
+                     "scan: %u ms (max %u ms), oldest data: %u ms\n",
+                md->addr, md->crc_errors, md->timeout_errors,
+                md->scan_ms, md->scan_max_ms, oldest_data_ms(md, mono_now));
         data_pos++;
       }
       bprintf(&wb, "Active on last scan: ");
@@ -1001,27 +1117,40 @@ int do_command(int sock, rackmond_command *cmd)
       struct timespec ts;
       clock_gettime(CLOCK_REALTIME, &ts);
       uint32_t now = ts.tv_sec;
+      uint64_t mono_now = mono_us();
       buf_write(&wb, "[", 1);
       int data_pos = 0;
       while (world.stored_data[data_pos] != NULL && data_pos < MAX_ACTIVE_ADDRS)
       {
         bprintf(&wb, "{\"addr\":%d,\"crc_fails\":%d,\"timeouts\":%d,"
+                     "\"scan_ms\":%u,\"scan_max_ms\":%u,\"oldest_ms\":%u,"
                      "\"now\":%d,\"ranges\":[",
                 world.stored_data[data_pos]->addr,
                 world.stored_data[data_pos]->crc_errors,
-                world.stored_data[data_pos]->timeout_errors, now);
+                world.stored_data[data_pos]->timeout_errors,
+                world.stored_data[data_pos]->scan_ms,
+                world.stored_data[data_pos]->scan_max_ms,
+                oldest_data_ms(world.stored_data[data_pos], mono_now), now);
         for (int i = 0; i < world.config->num_intervals; i++)
         {
           uint32_t time;
           register_range_data *rd = &world.stored_data[data_pos]->range_data[i];
-          char *mem_pos = rd->mem_begin;
+          uint16_t regs[rd->i->len];
+          history_iter it;
           bprintf(&wb, "{\"begin\":%d,\"readings\":[", rd->i->begin);
-          // want to cut the list off early just before
-          // the first entry with time == 0
-          memcpy(&time, mem_pos, sizeof(time));
-          for (int j = 0; j < rd->i->keep && time != 0; j++)
+          // the last keep samples, oldest first
+          history_iter_init(&it, &rd->hist, regs);
+          if (rd->hist.count > rd->i->keep)
           {
-            mem_pos += sizeof(time);
+            history_skip(&it, regs, rd->hist.count - rd->i->keep);
+          }
+          for (int j = 0; history_next(&it, &time, regs); j++)
+          {
+            char *mem_pos = (char *)regs;
+            if (j > 0)
+            {
+              buf_write(&wb, ",", 1);
+            }
             bprintf(&wb, "{\"time\":%d,\"data\":\"", time);
             for (int c = 0; c < rd->i->len * 2; c++)
             {
@@ -1029,15 +1158,6 @@ int do_command(int sock, rackmond_command *cmd)
               mem_pos++;
             }
             buf_write(&wb, "\"}", 2);
-            memcpy(&time, mem_pos, sizeof(time));
-            if (time == 0)
-            {
-              break;
-            }
-            if ((j + 1) < rd->i->keep)
-            {
-              buf_write(&wb, ",", 1);
-            }
           }
           buf_write(&wb, "]}", 2);
           if ((i + 1) < world.config->num_intervals)
@@ -1082,6 +1202,90 @@ int do_command(int sock, rackmond_command *cmd)
     lock_release(worldlock);
     break;
   }
+  case COMMAND_TYPE_DUMP_DATA_BINARY:
+  {
+    lock_take(worldlock);
+    for (int data_pos = 0; world.config != NULL && data_pos < MAX_ACTIVE_ADDRS &&
+                           world.stored_data[data_pos] != NULL;
+         data_pos++)
+    {
+      monitoring_data *md = world.stored_data[data_pos];
+      binary_psu_header ph = {
+          .addr = md->addr,
+          .num_ranges = world.config->num_intervals,
+          .crc_errors = md->crc_errors,
+          .timeout_errors = md->timeout_errors,
+      };
+      buf_write(&wb, &ph, sizeof(ph));
+      for (int i = 0; i < world.config->num_intervals; i++)
+      {
+        register_range_data *rd = &md->range_data[i];
+        const uint8_t *p1, *p2;
+        size_t n1, n2;
+        history_deltas(&rd->hist, &p1, &n1, &p2, &n2);
+        binary_range_header rh = {
+            .begin = rd->i->begin,
+            .len = rd->i->len,
+            .count = rd->hist.count,
+            .first_time = rd->hist.first_time,
+            .nbytes = n1 + n2,
+        };
+        buf_write(&wb, &rh, sizeof(rh));
+        buf_write(&wb, rd->hist.first, sizeof(uint16_t) * rd->i->len);
+        buf_write(&wb, (void *)p1, n1);
+        buf_write(&wb, (void *)p2, n2);
+      }
+    }
+    lock_release(worldlock);
+    break;
+  }
+  case COMMAND_TYPE_QUERY_DATA:
+  {
+    query_data_command *q = &cmd->query_data;
+    register_range_data *rd = NULL;
+
+    lock_take(worldlock);
+    for (int data_pos = 0; world.config != NULL && rd == NULL &&
+                           data_pos < MAX_ACTIVE_ADDRS &&
+                           world.stored_data[data_pos] != NULL;
+         data_pos++)
+    {
+      monitoring_data *md = world.stored_data[data_pos];
+      if (md->addr != q->addr)
+      {
+        continue;
+      }
+      for (int i = 0; i < world.config->num_intervals; i++)
+      {
+        monitor_interval *iv = md->range_data[i].i;
+        if (q->reg >= iv->begin && q->reg < iv->begin + iv->len)
+        {
+          rd = &md->range_data[i];
+          break;
+        }
+      }
+    }
+    if (rd != NULL)
+    {
+      uint16_t regs[rd->i->len];
+      int reg = q->reg - rd->i->begin;
+      query_data_record rec = {0};
+      history_iter it;
+      history_iter_init(&it, &rd->hist, regs);
+      while (history_next(&it, &rec.time, regs))
+      {
+        if (rec.time < q->from || rec.time > q->to)
+        {
+          continue;
+        }
+        uint8_t *b = (uint8_t *)&regs[reg];
+        rec.value = (b[0] << 8) | b[1];
+        buf_write(&wb, &rec, sizeof(rec));
+      }
+    }
+    lock_release(worldlock);
+    break;
+  }
   case COMMAND_TYPE_PAUSE_MONITORING:
   {
     lock_take(worldlock);
@@ -38,6 +38,7 @@ typedef struct monitor_interval {
   uint16_t len;
   uint16_t keep; // How long of a history to keep?
   uint16_t flags;
+  uint16_t period; // Freshness target in seconds, 0 to read as often as possible
 } monitor_interval;
 
 typedef struct monitoring_config {
@@ -49,6 +50,14 @@ typedef struct set_config_command {
   monitoring_config config;
 } set_config_command;
 
+// Readings of one register of one PSU, between two timestamps (inclusive)
+typedef struct query_data_command {
+  uint8_t addr;
+  uint16_t reg;
+  uint32_t from;
+  uint32_t to;
+} query_data_command;
+
 #define COMMAND_TYPE_RAW_MODBUS         0x01
 #define COMMAND_TYPE_SET_CONFIG         0x02
 #define COMMAND_TYPE_DUMP_DATA_JSON     0x03
@@ -57,11 +66,41 @@ typedef struct set_config_command {
 #define COMMAND_TYPE_DUMP_STATUS        0x06
 #define COMMAND_TYPE_FORCE_SCAN         0x07
 #define COMMAND_TYPE_DUMP_DATA_INFO     0x08
+#define COMMAND_TYPE_DUMP_DATA_BINARY   0x09
+#define COMMAND_TYPE_QUERY_DATA         0x0A
+
+// COMMAND_TYPE_DUMP_DATA_BINARY response, until the connection closes:
+// for each PSU a binary_psu_header, then for each of its ranges a
+// binary_range_header, the len registers of the oldest sample and the
+// nbytes of deltas which rebuild the later ones (see history.h).
+// Registers are as read from the wire, high byte first.
+typedef struct binary_psu_header {
+  uint8_t addr;
+  uint16_t num_ranges;
+  uint32_t crc_errors;
+  uint32_t timeout_errors;
+} binary_psu_header;
+
+typedef struct binary_range_header {
+  uint16_t begin;
+  uint16_t len;
+  uint32_t count; // samples, 0 if the range was never read
+  uint32_t first_time;
+  uint32_t nbytes;
+} binary_range_header;
+
+// COMMAND_TYPE_QUERY_DATA response, until the connection closes,
+// oldest first
+typedef struct query_data_record {
+  uint32_t time;
+  uint16_t value;
+} query_data_record;
 
 typedef struct rackmond_command {
   uint16_t type;
   union {
     raw_modbus_command raw_modbus;
     set_config_command set_config;
+    query_data_command query_data;
   };
 } rackmond_command;
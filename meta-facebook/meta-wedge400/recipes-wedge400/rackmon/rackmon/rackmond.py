@@ -35,7 +35,12 @@ def configure_rackmond(reglist, verify_configure=False):
         flags = 0
         if "flags" in r:
             flags = r["flags"]
-        monitor_interval = struct.pack("@HHHH", r["begin"], r["length"], keep, flags)
+        period = 0
+        if "period" in r:
+            period = r["period"]
+        monitor_interval = struct.pack(
+            "@HHHHH", r["begin"], r["length"], keep, flags, period
+        )
         config_command += monitor_interval
 
     config_packet = struct.pack("H", len(config_command)) + config_command
@@ -42,7 +42,7 @@ check_por_config()
   if [ ! -f "${KEYDIR}/slot${1}_por_cfg" ]; then
     TO_PWR_ON=$DEF_PWR_ON
   else
-    POR=`cat ${KEYDIR}/slot${1}_por_cfg`
+    POR=`/usr/bin/kv get slot${1}_por_cfg persistent`
 
     # Case ON
     if [ $POR == "on" ]; then
@@ -59,7 +59,7 @@ check_por_config()
       if [ ! -f "${KEYDIR}/pwr_server${1}_last_state" ]; then
         TO_PWR_ON=$DEF_PWR_ON
       else
-        LS=`cat ${KEYDIR}/pwr_server${1}_last_state`
+        LS=`/usr/bin/kv get pwr_server${1}_last_state persistent`
         if [ $LS == "on" ]; then
           TO_PWR_ON=1;
         elif [ $LS == "off" ]; then
@@ -42,7 +42,7 @@ check_por_config()
   if [ ! -f "${KEYDIR}/server_por_cfg" ]; then
     TO_PWR_ON=$DEF_PWR_ON
   else
-    POR=`cat ${KEYDIR}/server_por_cfg`
+    POR=`/usr/bin/kv get server_por_cfg persistent`
 
     # Case ON
     if [ $POR == "on" ]; then
@@ -59,7 +59,7 @@ check_por_config()
       if [ ! -f "${KEYDIR}/pwr_server_last_state" ]; then
         TO_PWR_ON=$DEF_PWR_ON
       else
-        LS=`cat ${KEYDIR}/pwr_server_last_state`
+        LS=`/usr/bin/kv get pwr_server_last_state persistent`
         if [ $LS == "on" ]; then
           TO_PWR_ON=1;
         elif [ $LS == "off" ]; then